@@ -21,6 +21,14 @@ static NSString *const APP_USAGE_KEY = @"appUsageInfo";
 static NSString *const APP_USAGE_VERSION_KEY = @"appVersion";
 static NSString *const APP_USAGE_BUILD_KEY = @"appBuild";
 
+// An interrupted bundle zip download is resumed where its first incomplete entry starts
+static NSUInteger const MAX_DOWNLOAD_RESUMES_WITHOUT_PROGRESS = 3;
+// How far the download gets before its resume point is saved again, in case the app is killed
+static unsigned long long const DOWNLOAD_RESUME_STATE_INTERVAL = 512 * 1024;
+static NSString *const DOWNLOAD_RESUME_URL_KEY = @"url";
+static NSString *const DOWNLOAD_RESUME_OFFSET_KEY = @"offset";
+static NSString *const DOWNLOAD_RESUME_VALIDATOR_KEY = @"validator";
+
 static LKBundlesManager *_sharedInstance;
 
 NSString *const LKBundlesManagerDidFinishRetrievingBundlesManifest = @"LKBundlesManagerDidFinishRetrievingBundlesManifest";
@@ -32,7 +40,32 @@ NSString *const LKBundlesManagerDidFinishDownloadingRemoteBundles = @"LKBundlesM
 - (void) markResourceVersionAsNewest;
 @end
 
-@interface LKBundlesManager ()
+// A bundle zip being unzipped while it downloads
+@interface LKBundleStreamingDownload : NSObject
+
+@property (strong, nonatomic) LK_SSZipStreamUnarchiver *unarchiver;
+@property (strong, nonatomic) NSURL *remoteUrl;
+@property (strong, nonatomic) NSURL *directoryUrl;
+// Unzipped next to directoryUrl, and moved in place once complete
+@property (strong, nonatomic) NSURL *partialDirectoryUrl;
+// Where to resume from if the download is interrupted, kept next to partialDirectoryUrl
+@property (strong, nonatomic) NSURL *resumeStateUrl;
+// The offset the current request starts at, and the last one saved to resumeStateUrl
+@property (assign, nonatomic) unsigned long long requestOffset;
+@property (assign, nonatomic) unsigned long long savedResumeOffset;
+// ETag or Last-Modified of the zip, so that a resumed request gets the same zip
+@property (copy, nonatomic) NSString *validator;
+@property (assign, nonatomic) NSUInteger resumesWithoutProgress;
+@property (assign, nonatomic) unsigned long long downloadSize;
+@property (strong, nonatomic) NSError *unzipError;
+@property (copy, nonatomic) void (^completion)(NSURL *savedFileUrl, unsigned long long downloadSize, NSError *error);
+
+@end
+
+@implementation LKBundleStreamingDownload
+@end
+
+@interface LKBundlesManager () <NSURLSessionDataDelegate>
 
 @property (strong, nonatomic) NSMutableDictionary<NSString *, LKBundleInfo *> *remoteBundleMap;
 @property (strong, nonatomic) NSMutableDictionary<NSString *, LKBundleInfo *> *localBundleMap;
@@ -50,6 +83,7 @@ NSString *const LKBundlesManagerDidFinishDownloadingRemoteBundles = @"LKBundlesM
 
 @property (strong, nonatomic) NSDate *lastManifestRetrievalTime;
 @property (strong, nonatomic) NSURLSession *remoteUIDownloadSession;
+@property (strong, nonatomic) NSMutableDictionary<NSNumber *, LKBundleStreamingDownload *> *streamingDownloads;
 
 @property (strong, nonatomic) NSMutableDictionary *pendingRemoteBundleLoadHandlers;
 
@@ -68,6 +102,7 @@ NSString *const LKBundlesManagerDidFinishDownloadingRemoteBundles = @"LKBundlesM
         self.latestRemoteBundlesManifestRetrieved = NO;
         self.remoteBundlesDownloaded = NO;
         self.pendingRemoteBundleLoadHandlers = [NSMutableDictionary dictionaryWithCapacity:1];
+        self.streamingDownloads = [NSMutableDictionary dictionaryWithCapacity:1];
     }
     return self;
 }
@@ -872,6 +907,12 @@ NSString *const LKBundlesManagerDidFinishDownloadingRemoteBundles = @"LKBundlesM
 
 - (void)saveDataFromRemoteUrl:(NSURL *)remoteUrl toDirectoryUrl:(NSURL *)directoryUrl completion:(void (^)(NSURL *savedFileUrl, unsigned long long downloadSize, NSError *error))completion
 {
+    // Zipped bundles are unzipped as they download
+    if ([remoteUrl.lastPathComponent.pathExtension isEqualToString:@"zip"]) {
+        [self unzipDataFromRemoteUrl:remoteUrl toDirectoryUrl:directoryUrl completion:completion];
+        return;
+    }
+
     NSFileManager *fileManager = [NSFileManager defaultManager];
     NSURLRequest *request = [NSURLRequest requestWithURL:remoteUrl];
 
@@ -905,37 +946,10 @@ NSString *const LKBundlesManagerDidFinishDownloadingRemoteBundles = @"LKBundlesM
                 downloadSize = [fileAttributes[NSFileSize] unsignedLongLongValue];
             }
 
-            // Unzip if the saved file is zipped
-            if ([remoteUrl.lastPathComponent.pathExtension isEqualToString:@"zip"]) {
-                NSError *unzipError = nil;
-                // This will store the unzippedPath into .tempUnzippedPath.
-                // NOTE: This is clearly not thread-safe. Ideally Soffes' method should *return*
-                // the unzipped path, or nil if unsuccessful, rather than BOOL.
-                BOOL unzipped = [LK_SSZipArchive unzipFileAtPath:location.path toDestination:directoryUrl.path overwrite:YES password:nil error:&unzipError];
-
-                if (!unzipped || unzipError != nil) {
-                    if (completion) {
-                        completion(nil, downloadSize, unzipError);
-                    }
-                    return;
-                }
-
-                // Find the first file in the directory path we saved
-                NSError *directoryContentsError = nil;
-                NSArray *filesInDirectory = [fileManager contentsOfDirectoryAtURL:directoryUrl
-                                                       includingPropertiesForKeys:nil
-                                                                          options:NSDirectoryEnumerationSkipsHiddenFiles
-                                                                            error:&directoryContentsError];
-                if (filesInDirectory.count > 0) {
-                    savedUrl = filesInDirectory[0];
-                }
-
-            } else {
-                // Copy the file as-is from the NSURL location to our cached file area
-                NSError *copyError = nil;
-                [fileManager copyItemAtURL:location toURL:directoryUrl error:&copyError];
-                savedUrl = directoryUrl;
-            }
+            // Copy the file as-is from the NSURL location to our cached file area
+            NSError *copyError = nil;
+            [fileManager copyItemAtURL:location toURL:directoryUrl error:&copyError];
+            savedUrl = directoryUrl;
             if (completion) {
                 completion(savedUrl, downloadSize, nil);
             }
@@ -944,6 +958,258 @@ NSString *const LKBundlesManagerDidFinishDownloadingRemoteBundles = @"LKBundlesM
     [downloadTask resume];
 }
 
+- (void)unzipDataFromRemoteUrl:(NSURL *)remoteUrl toDirectoryUrl:(NSURL *)directoryUrl completion:(void (^)(NSURL *savedFileUrl, unsigned long long downloadSize, NSError *error))completion
+{
+    NSFileManager *fileManager = [NSFileManager defaultManager];
+    NSString *partialName = [NSString stringWithFormat:@".%@.partial", directoryUrl.lastPathComponent];
+    NSURL *partialDirectoryUrl = [[directoryUrl URLByDeletingLastPathComponent] URLByAppendingPathComponent:partialName];
+    NSURL *resumeStateUrl = [partialDirectoryUrl URLByAppendingPathExtension:@"plist"];
+
+    LKBundleStreamingDownload *download = [[LKBundleStreamingDownload alloc] init];
+    download.remoteUrl = remoteUrl;
+    download.directoryUrl = directoryUrl;
+    download.partialDirectoryUrl = partialDirectoryUrl;
+    download.resumeStateUrl = resumeStateUrl;
+    download.completion = completion;
+
+    // The entries extracted by an earlier, interrupted download of the same zip are kept
+    NSDictionary *resumeState = [NSDictionary dictionaryWithContentsOfURL:resumeStateUrl];
+    NSNumber *resumeOffset = resumeState[DOWNLOAD_RESUME_OFFSET_KEY];
+    NSString *validator = resumeState[DOWNLOAD_RESUME_VALIDATOR_KEY];
+    if ([resumeState[DOWNLOAD_RESUME_URL_KEY] isEqual:remoteUrl.absoluteString] &&
+        [resumeOffset isKindOfClass:[NSNumber class]] &&
+        [fileManager fileExistsAtPath:partialDirectoryUrl.path]) {
+        download.requestOffset = resumeOffset.unsignedLongLongValue;
+        download.savedResumeOffset = download.requestOffset;
+        download.validator = [validator isKindOfClass:[NSString class]] ? validator : nil;
+        if (self.debugMode && self.verboseLogging) {
+            LKLog(@"LKBundlesManager: Resuming download of %@ at %llu bytes", remoteUrl.lastPathComponent, download.requestOffset);
+        }
+    } else {
+        [fileManager removeItemAtURL:resumeStateUrl error:nil];
+        [fileManager removeItemAtURL:partialDirectoryUrl error:nil];
+    }
+
+    NSError *createError = nil;
+    if (![fileManager createDirectoryAtURL:partialDirectoryUrl withIntermediateDirectories:YES attributes:nil error:&createError]) {
+        if (completion) {
+            completion(nil, 0, createError);
+        }
+        return;
+    }
+
+    [self startStreamingDownload:download];
+}
+
+// Requests the zip from download.requestOffset on, and unzips it as it arrives
+- (void)startStreamingDownload:(LKBundleStreamingDownload *)download
+{
+    download.unarchiver = [[LK_SSZipStreamUnarchiver alloc] initWithDestination:download.partialDirectoryUrl.path
+                                                                      overwrite:YES
+                                                                   resumeOffset:download.requestOffset];
+
+    NSMutableURLRequest *request = [NSMutableURLRequest requestWithURL:download.remoteUrl];
+    if (download.requestOffset > 0) {
+        [request setValue:[NSString stringWithFormat:@"bytes=%llu-", download.requestOffset] forHTTPHeaderField:@"Range"];
+        // If the zip changed, the server sends all of the new one instead of a range of it
+        if (download.validator.length > 0) {
+            [request setValue:download.validator forHTTPHeaderField:@"If-Range"];
+        }
+    }
+
+    NSURLSessionDataTask *dataTask = nil;
+    @synchronized (self.streamingDownloads) {
+        if (self.remoteUIDownloadSession == nil) {
+            // Data arrives on a serial queue, so each zip is unzipped in order off the main thread.
+            // NOTE: The session keeps a strong reference to us, as its delegate
+            NSOperationQueue *queue = [[NSOperationQueue alloc] init];
+            queue.maxConcurrentOperationCount = 1;
+            self.remoteUIDownloadSession = [NSURLSession sessionWithConfiguration:[NSURLSessionConfiguration defaultSessionConfiguration]
+                                                                         delegate:self
+                                                                    delegateQueue:queue];
+        }
+        dataTask = [self.remoteUIDownloadSession dataTaskWithRequest:request];
+        self.streamingDownloads[@(dataTask.taskIdentifier)] = download;
+    }
+    [dataTask resume];
+}
+
+- (void)saveResumeStateOfStreamingDownload:(LKBundleStreamingDownload *)download
+{
+    unsigned long long resumeOffset = download.unarchiver.resumeOffset;
+    NSMutableDictionary *resumeState = [NSMutableDictionary dictionaryWithCapacity:3];
+    resumeState[DOWNLOAD_RESUME_URL_KEY] = download.remoteUrl.absoluteString;
+    resumeState[DOWNLOAD_RESUME_OFFSET_KEY] = @(resumeOffset);
+    if (download.validator != nil) {
+        resumeState[DOWNLOAD_RESUME_VALIDATOR_KEY] = download.validator;
+    }
+    if ([resumeState writeToURL:download.resumeStateUrl atomically:YES]) {
+        download.savedResumeOffset = resumeOffset;
+    }
+}
+
+// Header names are case-insensitive, but allHeaderFields is not
++ (NSString *)valueOfHeaderField:(NSString *)field inResponse:(NSHTTPURLResponse *)response
+{
+    for (NSString *name in response.allHeaderFields) {
+        if ([name caseInsensitiveCompare:field] == NSOrderedSame) {
+            return response.allHeaderFields[name];
+        }
+    }
+    return nil;
+}
+
+#pragma mark - NSURLSessionDataDelegate
+
+- (void)URLSession:(NSURLSession *)session dataTask:(NSURLSessionDataTask *)dataTask didReceiveResponse:(NSURLResponse *)response completionHandler:(void (^)(NSURLSessionResponseDisposition disposition))completionHandler
+{
+    LKBundleStreamingDownload *download = nil;
+    @synchronized (self.streamingDownloads) {
+        download = self.streamingDownloads[@(dataTask.taskIdentifier)];
+    }
+    if (download == nil || ![response isKindOfClass:[NSHTTPURLResponse class]]) {
+        completionHandler(NSURLSessionResponseAllow);
+        return;
+    }
+
+    NSHTTPURLResponse *httpResponse = (NSHTTPURLResponse *)response;
+    NSString *validator = [LKBundlesManager valueOfHeaderField:@"ETag" inResponse:httpResponse] ?:
+                          [LKBundlesManager valueOfHeaderField:@"Last-Modified" inResponse:httpResponse];
+    if (download.requestOffset > 0) {
+        NSString *expectedRange = [NSString stringWithFormat:@"bytes %llu-", download.requestOffset];
+        NSString *contentRange = [LKBundlesManager valueOfHeaderField:@"Content-Range" inResponse:httpResponse];
+        BOOL resumed = (httpResponse.statusCode == 206 && [contentRange hasPrefix:expectedRange]);
+        if (!resumed && httpResponse.statusCode == 200) {
+            // The server sent the whole zip (it changed, or ranges are not supported), so start over
+            NSFileManager *fileManager = [NSFileManager defaultManager];
+            [download.unarchiver finishWithError:nil];
+            [fileManager removeItemAtURL:download.partialDirectoryUrl error:nil];
+            [fileManager createDirectoryAtURL:download.partialDirectoryUrl withIntermediateDirectories:YES attributes:nil error:nil];
+            download.requestOffset = 0;
+            download.savedResumeOffset = 0;
+            download.unarchiver = [[LK_SSZipStreamUnarchiver alloc] initWithDestination:download.partialDirectoryUrl.path
+                                                                              overwrite:YES
+                                                                           resumeOffset:0];
+        } else if (!resumed) {
+            download.unzipError = [NSError errorWithDomain:@"LKBundlesManagerError"
+                                                      code:httpResponse.statusCode
+                                                  userInfo:@{NSLocalizedDescriptionKey: @"could not resume bundle download"}];
+            completionHandler(NSURLSessionResponseCancel);
+            return;
+        }
+    }
+    if (validator.length > 0) {
+        download.validator = validator;
+    }
+    completionHandler(NSURLSessionResponseAllow);
+}
+
+- (void)URLSession:(NSURLSession *)session dataTask:(NSURLSessionDataTask *)dataTask didReceiveData:(NSData *)data
+{
+    LKBundleStreamingDownload *download = nil;
+    @synchronized (self.streamingDownloads) {
+        download = self.streamingDownloads[@(dataTask.taskIdentifier)];
+    }
+    download.downloadSize += data.length;
+    if (download == nil || download.unzipError != nil) {
+        return;
+    }
+
+    NSError *unzipError = nil;
+    if (![download.unarchiver appendData:data error:&unzipError]) {
+        // No point downloading the rest of a broken zip
+        download.unzipError = unzipError;
+        [dataTask cancel];
+        return;
+    }
+    if (download.unarchiver.resumeOffset >= download.savedResumeOffset + DOWNLOAD_RESUME_STATE_INTERVAL) {
+        [self saveResumeStateOfStreamingDownload:download];
+    }
+}
+
+- (void)URLSession:(NSURLSession *)session task:(NSURLSessionTask *)task didCompleteWithError:(NSError *)error
+{
+    LKBundleStreamingDownload *download = nil;
+    @synchronized (self.streamingDownloads) {
+        download = self.streamingDownloads[@(task.taskIdentifier)];
+        [self.streamingDownloads removeObjectForKey:@(task.taskIdentifier)];
+    }
+    if (download == nil) {
+        return;
+    }
+
+    NSFileManager *fileManager = [NSFileManager defaultManager];
+    // Verifies the bundle before it is activated: every entry was checked against its CRC and sizes
+    // as it was extracted, and the central directory is checked against the entries
+    NSError *unzipError = nil;
+    BOOL unzipped = [download.unarchiver finishWithError:&unzipError];
+    if (!unzipped && download.unzipError == nil && [error.domain isEqualToString:NSURLErrorDomain]) {
+        // The connection dropped: the entries extracted so far are kept, and the zip is
+        // requested again from the first one that is missing
+        unsigned long long resumeOffset = download.unarchiver.resumeOffset;
+        if (resumeOffset > download.requestOffset) {
+            download.resumesWithoutProgress = 0;
+        } else {
+            download.resumesWithoutProgress++;
+        }
+        [self saveResumeStateOfStreamingDownload:download];
+        if (download.resumesWithoutProgress <= MAX_DOWNLOAD_RESUMES_WITHOUT_PROGRESS) {
+            if (self.debugMode && self.verboseLogging) {
+                LKLog(@"LKBundlesManager: Download of %@ interrupted (%@), resuming at %llu bytes", download.remoteUrl.lastPathComponent, error.localizedDescription, resumeOffset);
+            }
+            download.requestOffset = resumeOffset;
+            int64_t delay = (int64_t)(1 << download.resumesWithoutProgress) * (int64_t)NSEC_PER_SEC / 2;
+            dispatch_after(dispatch_time(DISPATCH_TIME_NOW, delay), dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+                [self startStreamingDownload:download];
+            });
+            return;
+        }
+        // Give up for now, a later download of this zip resumes from the saved state
+        if (download.completion) {
+            download.completion(nil, download.downloadSize, error);
+        }
+        return;
+    }
+    [fileManager removeItemAtURL:download.resumeStateUrl error:nil];
+
+    NSError *finalError = download.unzipError ?: (error ?: (unzipped ? nil : unzipError));
+    if ([finalError.domain isEqualToString:@"SSZipArchiveErrorDomain"]) {
+        LKLogError(@"Discarding bundle %@, its zip is not valid: %@", download.remoteUrl.lastPathComponent, finalError.localizedDescription);
+    }
+    if (finalError == nil && [fileManager fileExistsAtPath:download.directoryUrl.path]) {
+        NSError *deleteExistingFileError = nil;
+        [fileManager removeItemAtURL:download.directoryUrl error:&deleteExistingFileError];
+        if (deleteExistingFileError != nil) {
+            LKLogError(@"Couldn't delete existing item at %@ in order to download a new copy. Error: %@", download.directoryUrl, deleteExistingFileError);
+            finalError = deleteExistingFileError;
+        }
+    }
+    if (finalError == nil) {
+        [fileManager moveItemAtURL:download.partialDirectoryUrl toURL:download.directoryUrl error:&finalError];
+    }
+    if (finalError != nil) {
+        [fileManager removeItemAtURL:download.partialDirectoryUrl error:nil];
+        if (download.completion) {
+            download.completion(nil, download.downloadSize, finalError);
+        }
+        return;
+    }
+
+    // Find the first file in the directory path we saved
+    NSURL *savedUrl = nil;
+    NSError *directoryContentsError = nil;
+    NSArray *filesInDirectory = [fileManager contentsOfDirectoryAtURL:download.directoryUrl
+                                           includingPropertiesForKeys:nil
+                                                              options:NSDirectoryEnumerationSkipsHiddenFiles
+                                                                error:&directoryContentsError];
+    if (filesInDirectory.count > 0) {
+        savedUrl = filesInDirectory[0];
+    }
+    if (download.completion) {
+        download.completion(savedUrl, download.downloadSize, nil);
+    }
+}
+
 - (void) copyFromPath:(NSString *)sourcePath toPath:(NSString *)destinationPath
 {
     NSFileManager *fileManager = [NSFileManager defaultManager];
@@ -14,6 +14,9 @@
 
 @protocol LK_SSZipArchiveDelegate;
 
+// Names of the entries which failed verification, in the userInfo of the error
+extern NSString *const LK_SSZipArchiveCorruptEntriesKey;
+
 @interface LK_SSZipArchive : NSObject
 
 // Unzip
@@ -23,6 +26,11 @@
 + (BOOL)unzipFileAtPath:(NSString *)path toDestination:(NSString *)destination overwrite:(BOOL)overwrite password:(NSString *)password error:(NSError **)error;
 + (BOOL)unzipFileAtPath:(NSString *)path toDestination:(NSString *)destination overwrite:(BOOL)overwrite password:(NSString *)password error:(NSError **)error delegate:(id<LK_SSZipArchiveDelegate>)delegate;
 
+// Extracts the entries on a pool of worker threads, each reading the archive through its own handle.
+// Delegate and progress callbacks are still delivered on the calling thread, in archive order; will-unzip is sent
+// for every entry before the extraction starts, did-unzip as each entry completes.
++ (BOOL)unzipFileAtPath:(NSString *)path toDestination:(NSString *)destination overwrite:(BOOL)overwrite password:(NSString *)password concurrently:(BOOL)concurrently error:(NSError **)error delegate:(id<LK_SSZipArchiveDelegate>)delegate;
+
 + (BOOL)unzipFileAtPath:(NSString *)path
 		  toDestination:(NSString *)destination
 		progressHandler:(void (^)(NSString *entry, unz_file_info zipInfo, long entryNumber, long total))progressHandler
@@ -35,6 +43,10 @@
 		progressHandler:(void (^)(NSString *entry, unz_file_info zipInfo, long entryNumber, long total))progressHandler
 	  completionHandler:(void (^)(NSString *path, BOOL succeeded, NSError *error))completionHandler;
 
+// Checks the CRC and sizes of every entry against its local header and the central directory,
+// decompressing on all cores without writing anything. Nothing is extracted from a corrupt archive.
++ (BOOL)verifyZipFileAtPath:(NSString *)path password:(NSString *)password error:(NSError **)error;
+
 // Zip
 + (BOOL)createZipFileAtPath:(NSString *)path withFilesAtPaths:(NSArray *)filenames;
 + (BOOL)createZipFileAtPath:(NSString *)path withContentsOfDirectory:(NSString *)directoryPath;
@@ -50,6 +62,26 @@
 
 @end
 
+// Extracts a zip archive from its bytes as they arrive, e.g. from a download, so that
+// the extraction overlaps the transfer. Entries are written as soon as their data is in.
+@interface LK_SSZipStreamUnarchiver : NSObject
+
+- (instancetype)init NS_UNAVAILABLE;
+- (instancetype)initWithDestination:(NSString *)destination overwrite:(BOOL)overwrite;
+// Continues the extraction of an interrupted transfer, with the archive bytes from resumeOffset on
+- (instancetype)initWithDestination:(NSString *)destination overwrite:(BOOL)overwrite resumeOffset:(unsigned long long)resumeOffset NS_DESIGNATED_INITIALIZER;
+
+// Where the first entry not yet extracted starts in the archive. An interrupted transfer can resume
+// from there, e.g. with an HTTP Range request, in a new unarchiver.
+@property (NS_NONATOMIC_IOSONLY, readonly) unsigned long long resumeOffset;
+
+// Extracts what the next bytes of the archive complete. Returns NO once the archive is found to be invalid.
+- (BOOL)appendData:(NSData *)data error:(NSError **)error;
+// Returns NO if the archive was invalid or is incomplete. The unarchiver cannot be used afterwards.
+- (BOOL)finishWithError:(NSError **)error;
+
+@end
+
 @protocol LK_SSZipArchiveDelegate <NSObject>
 
 @optional
@@ -8,15 +8,72 @@
 
 #import "LK_SSZipArchive.h"
 #include "lk_zip.h"
+#include "lk_unzstream.h"
+#include "lk_crc32.h"
 #import "zlib.h"
 #import "zconf.h"
 
 #include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #define CHUNK 16384
+#define EXTRACT_BUFFER_SIZE (256 * 1024)
+// Files up to this size are compressed ahead by the zip pipeline, larger ones
+// are written in turn through the parallel deflate of the writer
+#define PIPELINE_MAX_ENTRY_SIZE (16 * 1024 * 1024)
+// Compressed buffers the zip pipeline keeps waiting for their turn, in bytes;
+// the buffer of the next entry to commit may go past it
+#define PIPELINE_MAX_PENDING_BYTES (32 * 1024 * 1024)
+
+NSString *const LK_SSZipArchiveCorruptEntriesKey = @"LK_SSZipArchiveCorruptEntries";
+
+static BOOL _LKWriteFully(int fd, const void *bytes, size_t length)
+{
+	const char *cursor = (const char *)bytes;
+	while (length > 0) {
+		ssize_t count = write(fd, cursor, length);
+		if (count < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return NO;
+		}
+		cursor += count;
+		length -= (size_t)count;
+	}
+	return YES;
+}
+
+static unz_file_info _LKFileInfoOfEntry(const unz_entry64 *entry)
+{
+	unz_file_info fileInfo;
+	fileInfo.version = entry->info.version;
+	fileInfo.version_needed = entry->info.version_needed;
+	fileInfo.flag = entry->info.flag;
+	fileInfo.compression_method = entry->info.compression_method;
+	fileInfo.dosDate = entry->info.dosDate;
+	fileInfo.crc = entry->info.crc;
+	fileInfo.compressed_size = (uLong)entry->info.compressed_size;
+	fileInfo.uncompressed_size = (uLong)entry->info.uncompressed_size;
+	fileInfo.size_filename = entry->info.size_filename;
+	fileInfo.size_file_extra = entry->info.size_file_extra;
+	fileInfo.size_file_comment = entry->info.size_file_comment;
+	fileInfo.disk_num_start = entry->info.disk_num_start;
+	fileInfo.internal_fa = entry->info.internal_fa;
+	fileInfo.external_fa = entry->info.external_fa;
+	fileInfo.tmu_date = entry->info.tmu_date;
+	return fileInfo;
+}
 
 @interface LK_SSZipArchive ()
++ (zipFile)_openZipAtPath:(NSString *)path;
++ (NSString *)_prepareEntry:(const unz_entry64 *)entry toDestination:(NSString *)destination directoriesModificationDates:(NSMutableSet *)directoriesModificationDates entryPath:(NSString **)entryPath isDirectory:(BOOL *)isDirectory symbolicLink:(BOOL *)symbolicLink;
++ (int)_extractCurrentFileOfZip:(zipFile)zip toPath:(NSString *)fullPath fileInfo:(unz_file_info)fileInfo symbolicLink:(BOOL)fileIsSymbolicLink overwrite:(BOOL)overwrite password:(NSString *)password;
++ (BOOL)_unzipEntriesConcurrentlyOfZip:(zipFile)zip atPath:(NSString *)path toDestination:(NSString *)destination overwrite:(BOOL)overwrite password:(NSString *)password globalInfo:(unz_global_info)globalInfo entries:(const unz_entry64 *)zipEntries count:(NSUInteger)count fileSize:(unsigned long long)fileSize directoriesModificationDates:(NSMutableSet *)directoriesModificationDates delegate:(id<LK_SSZipArchiveDelegate>)delegate progressHandler:(void (^)(NSString *entry, unz_file_info zipInfo, long entryNumber, long total))progressHandler canceled:(BOOL *)canceled error:(NSError **)error;
++ (NSError *)_errorOfEntry:(NSString *)entryPath result:(int)result;
 + (NSDate *)_dateWithMSDOSFormat:(UInt32)msdosDateTime;
+- (void)_writeFilesAtPaths:(NSArray *)paths withFileNames:(NSArray *)fileNames placeholders:(NSIndexSet *)placeholders;
 @end
 
 @implementation LK_SSZipArchive
@@ -74,9 +131,27 @@
 			   delegate:(id<LK_SSZipArchiveDelegate>)delegate
 		progressHandler:(void (^)(NSString *entry, unz_file_info zipInfo, long entryNumber, long total))progressHandler
 	  completionHandler:(void (^)(NSString *path, BOOL succeeded, NSError *error))completionHandler
+{
+	return [self unzipFileAtPath:path toDestination:destination overwrite:overwrite password:password concurrently:NO error:error delegate:delegate progressHandler:progressHandler completionHandler:completionHandler];
+}
+
++ (BOOL)unzipFileAtPath:(NSString *)path toDestination:(NSString *)destination overwrite:(BOOL)overwrite password:(NSString *)password concurrently:(BOOL)concurrently error:(NSError **)error delegate:(id<LK_SSZipArchiveDelegate>)delegate
+{
+	return [self unzipFileAtPath:path toDestination:destination overwrite:overwrite password:password concurrently:concurrently error:error delegate:delegate progressHandler:nil completionHandler:nil];
+}
+
++ (BOOL)unzipFileAtPath:(NSString *)path
+		  toDestination:(NSString *)destination
+			  overwrite:(BOOL)overwrite
+			   password:(NSString *)password
+		   concurrently:(BOOL)concurrently
+				  error:(NSError **)error
+			   delegate:(id<LK_SSZipArchiveDelegate>)delegate
+		progressHandler:(void (^)(NSString *entry, unz_file_info zipInfo, long entryNumber, long total))progressHandler
+	  completionHandler:(void (^)(NSString *path, BOOL succeeded, NSError *error))completionHandler
 {
 	// Begin opening
-	zipFile zip = unzOpen((const char*)[path UTF8String]);
+	zipFile zip = [self _openZipAtPath:path];
 	if (zip == NULL)
 	{
 		NSDictionary *userInfo = @{NSLocalizedDescriptionKey: @"failed to open zip file"};
@@ -115,11 +190,35 @@
 		return NO;
 	}
 
+	// Describe all the entries at once, without an allocation per entry
+	ZPOS64_T entryCount = 0;
+	ZPOS64_T arenaSize = 0;
+	unz_entry64 *entries = NULL;
+	void *entriesArena = NULL;
+	if (unzListEntries64(zip, NULL, 0, NULL, NULL, &arenaSize) == UNZ_OK) {
+		entriesArena = malloc((size_t)MAX(arenaSize, 1));
+	}
+	if (entriesArena == NULL || unzListEntries64(zip, entriesArena, arenaSize, &entries, &entryCount, NULL) != UNZ_OK)
+	{
+		free(entriesArena);
+		unzClose(zip);
+		NSDictionary *userInfo = @{NSLocalizedDescriptionKey: @"failed to read the central directory of zip file"};
+		NSError *err = [NSError errorWithDomain:@"SSZipArchiveErrorDomain" code:-2 userInfo:userInfo];
+		if (error)
+		{
+			*error = err;
+		}
+		if (completionHandler)
+		{
+			completionHandler(nil, NO, err);
+		}
+		return NO;
+	}
+
 	BOOL success = YES;
 	BOOL canceled = NO;
 	int ret = 0;
-	unsigned char buffer[4096] = {0};
-	NSFileManager *fileManager = [NSFileManager defaultManager];
+	NSError *unzipError = nil;
 	NSMutableSet *directoriesModificationDates = [[NSMutableSet alloc] init];
 
 	// Message delegate
@@ -130,213 +229,113 @@
 		[delegate zipArchiveProgressEvent:(NSInteger)currentPosition total:(NSInteger)fileSize];
 	}
 
-	NSInteger currentFileNumber = 0;
-	do {
-		@autoreleasepool {
-			if ([password length] == 0) {
-				ret = unzOpenCurrentFile(zip);
-			} else {
-				ret = unzOpenCurrentFilePassword(zip, [password cStringUsingEncoding:NSASCIIStringEncoding]);
-			}
-
-			if (ret != UNZ_OK) {
-				success = NO;
-				break;
-			}
-
-			// Reading data and write to file
-			unz_file_info fileInfo;
-			memset(&fileInfo, 0, sizeof(unz_file_info));
-
-			ret = unzGetCurrentFileInfo(zip, &fileInfo, NULL, 0, NULL, 0, NULL, 0);
-			if (ret != UNZ_OK) {
-				success = NO;
-				unzCloseCurrentFile(zip);
-				break;
-			}
-
-			currentPosition += fileInfo.compressed_size;
-
-			// Message delegate
-			if ([delegate respondsToSelector:@selector(zipArchiveShouldUnzipFileAtIndex:totalFiles:archivePath:fileInfo:)]) {
-				if (![delegate zipArchiveShouldUnzipFileAtIndex:currentFileNumber
-                                             totalFiles:(NSInteger)globalInfo.number_entry
-                                            archivePath:path fileInfo:fileInfo]) {
+	if (concurrently) {
+		success = [self _unzipEntriesConcurrentlyOfZip:zip
+												atPath:path
+										 toDestination:destination
+											 overwrite:overwrite
+											  password:password
+											globalInfo:globalInfo
+											   entries:entries
+												 count:(NSUInteger)entryCount
+											  fileSize:fileSize
+						   directoriesModificationDates:directoriesModificationDates
+											  delegate:delegate
+									   progressHandler:progressHandler
+											  canceled:&canceled
+												 error:&unzipError];
+	} else {
+		NSInteger currentFileNumber = 0;
+		for (ZPOS64_T entryIndex = 0; entryIndex < entryCount; entryIndex++) {
+			@autoreleasepool {
+				const unz_entry64 *entry = &entries[entryIndex];
+				if (unzGoToFilePos64(zip, &entry->pos) != UNZ_OK) {
 					success = NO;
-					canceled = YES;
 					break;
 				}
-			}
-			if ([delegate respondsToSelector:@selector(zipArchiveWillUnzipFileAtIndex:totalFiles:archivePath:fileInfo:)]) {
-				[delegate zipArchiveWillUnzipFileAtIndex:currentFileNumber totalFiles:(NSInteger)globalInfo.number_entry
-											 archivePath:path fileInfo:fileInfo];
-			}
-			if ([delegate respondsToSelector:@selector(zipArchiveProgressEvent:total:)]) {
-				[delegate zipArchiveProgressEvent:(NSInteger)currentPosition total:(NSInteger)fileSize];
-			}
-
-			char *filename = (char *)malloc(fileInfo.size_filename + 1);
-			unzGetCurrentFileInfo(zip, &fileInfo, filename, fileInfo.size_filename + 1, NULL, 0, NULL, 0);
-			filename[fileInfo.size_filename] = '\0';
-
-	        //
-	        // Determine whether this is a symbolic link:
-	        // - File is stored with 'version made by' value of UNIX (3),
-	        //   as per http://www.pkware.com/documents/casestudies/APPNOTE.TXT
-	        //   in the upper byte of the version field.
-	        // - BSD4.4 st_mode constants are stored in the high 16 bits of the
-	        //   external file attributes (defacto standard, verified against libarchive)
-	        //
-	        // The original constants can be found here:
-	        //    http://minnie.tuhs.org/cgi-bin/utree.pl?file=4.4BSD/usr/include/sys/stat.h
-	        //
-	        const uLong ZipUNIXVersion = 3;
-	        const uLong BSD_SFMT = 0170000;
-	        const uLong BSD_IFLNK = 0120000;
-            
-	        BOOL fileIsSymbolicLink = NO;
-	        if (((fileInfo.version >> 8) == ZipUNIXVersion) && BSD_IFLNK == (BSD_SFMT & (fileInfo.external_fa >> 16))) {
-	            fileIsSymbolicLink = NO;
-	        }
-
-			// Check if it contains directory
-			NSString *strPath = @(filename);
-			BOOL isDirectory = NO;
-			if (filename[fileInfo.size_filename-1] == '/' || filename[fileInfo.size_filename-1] == '\\') {
-				isDirectory = YES;
-			}
-			free(filename);
-
-			// Contains a path
-			if ([strPath rangeOfCharacterFromSet:[NSCharacterSet characterSetWithCharactersInString:@"/\\"]].location != NSNotFound) {
-				strPath = [strPath stringByReplacingOccurrencesOfString:@"\\" withString:@"/"];
-			}
 
-			NSString *fullPath = [destination stringByAppendingPathComponent:strPath];
-			NSError *err = nil;
-	        NSDate *modDate = [[self class] _dateWithMSDOSFormat:(UInt32)fileInfo.dosDate];
-	        NSDictionary *directoryAttr = @{NSFileCreationDate: modDate, NSFileModificationDate: modDate};
+				if ([password length] == 0) {
+					ret = unzOpenCurrentFile(zip);
+				} else {
+					ret = unzOpenCurrentFilePassword(zip, [password cStringUsingEncoding:NSASCIIStringEncoding]);
+				}
 
-			if (isDirectory) {
-				[fileManager createDirectoryAtPath:fullPath withIntermediateDirectories:YES attributes:directoryAttr  error:&err];
-			} else {
-				[fileManager createDirectoryAtPath:[fullPath stringByDeletingLastPathComponent] withIntermediateDirectories:YES attributes:directoryAttr error:&err];
-			}
-	        if (nil != err) {
-	            NSLog(@"[SSZipArchive] Error: %@", err.localizedDescription);
-	        }
+				if (ret != UNZ_OK) {
+					success = NO;
+					break;
+				}
 
-	        if(!fileIsSymbolicLink)
-	            [directoriesModificationDates addObject: @{@"path": fullPath, @"modDate": modDate}];
+				// Reading data and write to file
+				unz_file_info fileInfo = _LKFileInfoOfEntry(entry);
 
-	        if ([fileManager fileExistsAtPath:fullPath] && !isDirectory && !overwrite) {
-				unzCloseCurrentFile(zip);
-				ret = unzGoToNextFile(zip);
-				continue;
-			}
-
-			if (!fileIsSymbolicLink) {
-	            FILE *fp = fopen((const char*)[fullPath UTF8String], "wb");
-	            while (fp) {
-	                int readBytes = unzReadCurrentFile(zip, buffer, 4096);
-
-	                if (readBytes > 0) {
-	                    fwrite(buffer, readBytes, 1, fp );
-	                } else {
-	                    break;
-	                }
-	            }
-
-	            if (fp) {
-                    if ([[[fullPath pathExtension] lowercaseString] isEqualToString:@"zip"]) {
-                        NSLog(@"Unzipping nested .zip file:  %@", [fullPath lastPathComponent]);
-                        if ([self unzipFileAtPath:fullPath toDestination:[fullPath stringByDeletingLastPathComponent] overwrite:overwrite password:password error:nil delegate:nil]) {
-                            [[NSFileManager defaultManager] removeItemAtPath:fullPath error:nil];
-                        }
-                    }
-                    
-	                fclose(fp);
-
-	                // Set the original datetime property
-	                if (fileInfo.dosDate != 0) {
-	                    NSDate *orgDate = [[self class] _dateWithMSDOSFormat:(UInt32)fileInfo.dosDate];
-	                    NSDictionary *attr = @{NSFileModificationDate: orgDate};
-
-	                    if (attr) {
-	                        if ([fileManager setAttributes:attr ofItemAtPath:fullPath error:nil] == NO) {
-	                            // Can't set attributes
-	                            NSLog(@"[SSZipArchive] Failed to set attributes - whilst setting modification date");
-	                        }
-	                    }
-	                }
-
-                    // Set the original permissions on the file
-                    uLong permissions = fileInfo.external_fa >> 16;
-                    if (permissions != 0) {
-                        // Store it into a NSNumber
-                        NSNumber *permissionsValue = @(permissions);
-
-                        // Retrieve any existing attributes
-                        NSMutableDictionary *attrs = [[NSMutableDictionary alloc] initWithDictionary:[fileManager attributesOfItemAtPath:fullPath error:nil]];
-
-                        // Set the value in the attributes dict
-                        attrs[NSFilePosixPermissions] = permissionsValue;
-
-                        // Update attributes
-                        if ([fileManager setAttributes:attrs ofItemAtPath:fullPath error:nil] == NO) {
-                            // Unable to set the permissions attribute
-                            NSLog(@"[SSZipArchive] Failed to set attributes - whilst setting permissions");
-                        }
-                        
-#if !__has_feature(objc_arc)
-                        [attrs release];
-#endif
-                    }
-	            }
-	        }
-            else
-            {
-                // Assemble the path for the symbolic link
-                NSMutableString* destinationPath = [NSMutableString string];
-                int bytesRead = 0;
-                while((bytesRead = unzReadCurrentFile(zip, buffer, 4096)) > 0)
-                {
-                    buffer[bytesRead] = (int)0;
-                    [destinationPath appendString:@((const char*)buffer)];
-                }
+				currentPosition += fileInfo.compressed_size;
 
-                // Create the symbolic link (making sure it stays relative if it was relative before)
-                int symlinkError = symlink([destinationPath cStringUsingEncoding:NSUTF8StringEncoding],
-                                           [fullPath cStringUsingEncoding:NSUTF8StringEncoding]);
+				// Message delegate
+				if ([delegate respondsToSelector:@selector(zipArchiveShouldUnzipFileAtIndex:totalFiles:archivePath:fileInfo:)]) {
+					if (![delegate zipArchiveShouldUnzipFileAtIndex:currentFileNumber
+	                                             totalFiles:(NSInteger)globalInfo.number_entry
+	                                            archivePath:path fileInfo:fileInfo]) {
+						success = NO;
+						canceled = YES;
+						break;
+					}
+				}
+				if ([delegate respondsToSelector:@selector(zipArchiveWillUnzipFileAtIndex:totalFiles:archivePath:fileInfo:)]) {
+					[delegate zipArchiveWillUnzipFileAtIndex:currentFileNumber totalFiles:(NSInteger)globalInfo.number_entry
+												 archivePath:path fileInfo:fileInfo];
+				}
+				if ([delegate respondsToSelector:@selector(zipArchiveProgressEvent:total:)]) {
+					[delegate zipArchiveProgressEvent:(NSInteger)currentPosition total:(NSInteger)fileSize];
+				}
 
-                if(symlinkError != 0)
-                {
-                    NSLog(@"Failed to create symbolic link at \"%@\" to \"%@\". symlink() error code: %d", fullPath, destinationPath, errno);
-                }
-            }
+				NSString *strPath = nil;
+				BOOL isDirectory = NO;
+				BOOL fileIsSymbolicLink = NO;
+				NSString *fullPath = [self _prepareEntry:entry
+										   toDestination:destination
+							directoriesModificationDates:directoriesModificationDates
+											   entryPath:&strPath
+											 isDirectory:&isDirectory
+											symbolicLink:&fileIsSymbolicLink];
+
+		        if ([[NSFileManager defaultManager] fileExistsAtPath:fullPath] && !isDirectory && !overwrite) {
+					unzCloseCurrentFile(zip);
+					continue;
+				}
 
-			unzCloseCurrentFile( zip );
-			ret = unzGoToNextFile( zip );
+				ret = [self _extractCurrentFileOfZip:zip
+											  toPath:fullPath
+											fileInfo:fileInfo
+										symbolicLink:fileIsSymbolicLink
+										   overwrite:overwrite
+											password:password];
+				if (ret != UNZ_OK) {
+					unzipError = [self _errorOfEntry:strPath result:ret];
+					success = NO;
+					break;
+				}
 
-			// Message delegate
-			if ([delegate respondsToSelector:@selector(zipArchiveDidUnzipFileAtIndex:totalFiles:archivePath:fileInfo:)]) {
-				[delegate zipArchiveDidUnzipFileAtIndex:currentFileNumber totalFiles:(NSInteger)globalInfo.number_entry
-											 archivePath:path fileInfo:fileInfo];
-			} else if ([delegate respondsToSelector: @selector(zipArchiveDidUnzipFileAtIndex:totalFiles:archivePath:unzippedFilePath:)]) {
-				[delegate zipArchiveDidUnzipFileAtIndex: currentFileNumber totalFiles: (NSInteger)globalInfo.number_entry
-											archivePath:path unzippedFilePath: fullPath];
-			}
+				// Message delegate
+				if ([delegate respondsToSelector:@selector(zipArchiveDidUnzipFileAtIndex:totalFiles:archivePath:fileInfo:)]) {
+					[delegate zipArchiveDidUnzipFileAtIndex:currentFileNumber totalFiles:(NSInteger)globalInfo.number_entry
+												 archivePath:path fileInfo:fileInfo];
+				} else if ([delegate respondsToSelector: @selector(zipArchiveDidUnzipFileAtIndex:totalFiles:archivePath:unzippedFilePath:)]) {
+					[delegate zipArchiveDidUnzipFileAtIndex: currentFileNumber totalFiles: (NSInteger)globalInfo.number_entry
+												archivePath:path unzippedFilePath: fullPath];
+				}
 
-			currentFileNumber++;
-			if (progressHandler)
-			{
-				progressHandler(strPath, fileInfo, currentFileNumber, globalInfo.number_entry);
+				currentFileNumber++;
+				if (progressHandler)
+				{
+					progressHandler(strPath, fileInfo, currentFileNumber, globalInfo.number_entry);
+				}
 			}
 		}
-	} while(ret == UNZ_OK && ret != UNZ_END_OF_LIST_OF_FILE);
+	}
 
 	// Close
 	unzClose(zip);
+	free(entriesArena);
 
 	// The process of decompressing the .zip archive causes the modification times on the folders
     // to be set to the present time. So, when we are done, they need to be explicitly set.
@@ -364,13 +363,278 @@
 		[delegate zipArchiveProgressEvent:fileSize total:fileSize];
 	}
 
+	if (error && unzipError)
+	{
+		*error = unzipError;
+	}
 	if (completionHandler)
 	{
-		completionHandler(path, YES, nil);
+		completionHandler(path, success, unzipError);
 	}
 	return success;
 }
 
++ (NSError *)_errorOfEntry:(NSString *)entryPath result:(int)result
+{
+	NSString *description = (result == UNZ_CRCERROR) ?
+		[NSString stringWithFormat:@"data of %@ does not match its CRC", entryPath] :
+		[NSString stringWithFormat:@"failed to extract %@ (error %d)", entryPath, result];
+	NSDictionary *userInfo = @{NSLocalizedDescriptionKey: description};
+	return [NSError errorWithDomain:@"SSZipArchiveErrorDomain" code:-3 userInfo:userInfo];
+}
+
++ (BOOL)verifyZipFileAtPath:(NSString *)path password:(NSString *)password error:(NSError **)error
+{
+	zipFile zip = [self _openZipAtPath:path];
+	ZPOS64_T entryCount = 0;
+	ZPOS64_T arenaSize = 0;
+	unz_entry64 *entries = NULL;
+	void *entriesArena = NULL;
+	if (zip != NULL && unzListEntries64(zip, NULL, 0, NULL, NULL, &arenaSize) == UNZ_OK) {
+		entriesArena = malloc((size_t)MAX(arenaSize, 1));
+	}
+	if (entriesArena == NULL || unzListEntries64(zip, entriesArena, arenaSize, &entries, &entryCount, NULL) != UNZ_OK)
+	{
+		free(entriesArena);
+		if (zip != NULL) {
+			unzClose(zip);
+		}
+		if (error)
+		{
+			NSDictionary *userInfo = @{NSLocalizedDescriptionKey: @"failed to open zip file"};
+			*error = [NSError errorWithDomain:@"SSZipArchiveErrorDomain" code:-1 userInfo:userInfo];
+		}
+		return NO;
+	}
+	unzClose(zip);
+
+	// Every entry is decompressed and compared with both of its headers, on all the cores
+	zlib_filefunc64_ex_def mmapFileFunc;
+	fill_mmap_filefunc64(&mmapFileFunc);
+	unz_verify_entry *report = (unz_verify_entry *)calloc((size_t)MAX(entryCount, 1), sizeof(unz_verify_entry));
+	int threads = (int)[[NSProcessInfo processInfo] activeProcessorCount];
+	ZPOS64_T badCount = 0;
+	int ret = UNZ_INTERNALERROR;
+	if (report != NULL) {
+		ret = unzVerifyArchive([path UTF8String], &mmapFileFunc,
+							   ([password length] > 0) ? [password cStringUsingEncoding:NSASCIIStringEncoding] : NULL,
+							   threads, report, entryCount, &badCount);
+	}
+
+	if (ret != UNZ_OK && error)
+	{
+		NSMutableArray *badEntries = [NSMutableArray arrayWithCapacity:(NSUInteger)badCount];
+		for (ZPOS64_T i = 0; report != NULL && i < entryCount; i++) {
+			if (report[i].err != UNZ_OK) {
+				[badEntries addObject:@(entries[i].filename)];
+			}
+		}
+		NSString *description = (ret == UNZ_CRCERROR) ?
+			[NSString stringWithFormat:@"%llu entries of zip file are corrupt", (unsigned long long)badCount] :
+			[NSString stringWithFormat:@"failed to verify zip file (error %d)", ret];
+		NSDictionary *userInfo = @{NSLocalizedDescriptionKey: description, LK_SSZipArchiveCorruptEntriesKey: badEntries};
+		*error = [NSError errorWithDomain:@"SSZipArchiveErrorDomain" code:ret userInfo:userInfo];
+	}
+	free(report);
+	free(entriesArena);
+	return ret == UNZ_OK;
+}
+
+// Concurrent extraction: the central directory is walked once on `zip` to
+// create the directories and ask the delegate about every entry, then a pool
+// of workers, each with its own handle on the (mapped) archive, extracts the
+// entries largest first. Delegate and progress callbacks are still delivered
+// on the calling thread in archive order: will-unzip for every entry during
+// the walk, before any of them is handed to a worker, then progress and
+// did-unzip as each entry completes.
++ (BOOL)_unzipEntriesConcurrentlyOfZip:(zipFile)zip
+								atPath:(NSString *)path
+						 toDestination:(NSString *)destination
+							 overwrite:(BOOL)overwrite
+							  password:(NSString *)password
+							globalInfo:(unz_global_info)globalInfo
+							   entries:(const unz_entry64 *)zipEntries
+								 count:(NSUInteger)count
+							  fileSize:(unsigned long long)fileSize
+		   directoriesModificationDates:(NSMutableSet *)directoriesModificationDates
+							  delegate:(id<LK_SSZipArchiveDelegate>)delegate
+					   progressHandler:(void (^)(NSString *entry, unz_file_info zipInfo, long entryNumber, long total))progressHandler
+							  canceled:(BOOL *)canceled
+								 error:(NSError **)error
+{
+	typedef struct {
+		unz64_file_pos position;
+		unz_file_info fileInfo;
+		BOOL symbolicLink;
+		BOOL skip;
+		int result;
+		BOOL done;
+	} LKZipEntrySnapshot;
+
+	BOOL success = YES;
+	LKZipEntrySnapshot *entries = (LKZipEntrySnapshot *)calloc(MAX(count, 1), sizeof(LKZipEntrySnapshot));
+	NSMutableArray *entryPaths = [[NSMutableArray alloc] initWithCapacity:count];
+	NSMutableArray *fullPaths = [[NSMutableArray alloc] initWithCapacity:count];
+	NSUInteger snapshotCount = 0;
+
+	// Snapshot the central directory, in order
+	for (NSUInteger i = 0; i < count; i++) {
+		@autoreleasepool {
+			LKZipEntrySnapshot *entry = &entries[i];
+			entry->position = zipEntries[i].pos;
+			entry->fileInfo = _LKFileInfoOfEntry(&zipEntries[i]);
+
+			if ([delegate respondsToSelector:@selector(zipArchiveShouldUnzipFileAtIndex:totalFiles:archivePath:fileInfo:)]) {
+				if (![delegate zipArchiveShouldUnzipFileAtIndex:(NSInteger)i
+													 totalFiles:(NSInteger)globalInfo.number_entry
+													archivePath:path fileInfo:entry->fileInfo]) {
+					success = NO;
+					*canceled = YES;
+					break;
+				}
+			}
+			if ([delegate respondsToSelector:@selector(zipArchiveWillUnzipFileAtIndex:totalFiles:archivePath:fileInfo:)]) {
+				[delegate zipArchiveWillUnzipFileAtIndex:(NSInteger)i totalFiles:(NSInteger)globalInfo.number_entry
+											 archivePath:path fileInfo:entry->fileInfo];
+			}
+
+			NSString *strPath = nil;
+			BOOL isDirectory = NO;
+			BOOL fileIsSymbolicLink = NO;
+			NSString *fullPath = [self _prepareEntry:&zipEntries[i]
+									   toDestination:destination
+						directoriesModificationDates:directoriesModificationDates
+										   entryPath:&strPath
+										 isDirectory:&isDirectory
+										symbolicLink:&fileIsSymbolicLink];
+			entry->symbolicLink = fileIsSymbolicLink;
+			entry->skip = isDirectory || (!overwrite && [[NSFileManager defaultManager] fileExistsAtPath:fullPath]);
+			[entryPaths addObject:strPath];
+			[fullPaths addObject:fullPath];
+			snapshotCount++;
+		}
+	}
+	count = snapshotCount;
+
+	// Largest entries are handed out first, so the pool drains evenly
+	NSUInteger *order = (NSUInteger *)malloc(MAX(count, 1) * sizeof(NSUInteger));
+	for (NSUInteger i = 0; i < count; i++) {
+		order[i] = i;
+	}
+	qsort_b(order, count, sizeof(NSUInteger), ^int(const void *a, const void *b) {
+		uLong sizeA = entries[*(const NSUInteger *)a].fileInfo.compressed_size;
+		uLong sizeB = entries[*(const NSUInteger *)b].fileInfo.compressed_size;
+		return (sizeA < sizeB) ? 1 : ((sizeA > sizeB) ? -1 : 0);
+	});
+
+	NSCondition *condition = [[NSCondition alloc] init];
+	__block NSUInteger nextOrderIndex = 0;
+	__block BOOL aborted = NO;
+	NSUInteger workerCount = MIN([[NSProcessInfo processInfo] activeProcessorCount], MAX(count, 1));
+	dispatch_group_t group = dispatch_group_create();
+	dispatch_queue_t queue = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0);
+
+	for (NSUInteger w = 0; w < workerCount; w++) {
+		dispatch_group_async(group, queue, ^{
+			zipFile workerZip = [self _openZipAtPath:path];
+			while (YES) {
+				NSUInteger i;
+				[condition lock];
+				if (aborted || nextOrderIndex >= count) {
+					[condition unlock];
+					break;
+				}
+				i = order[nextOrderIndex++];
+				[condition unlock];
+
+				int result = UNZ_OK;
+				if (!entries[i].skip) {
+					@autoreleasepool {
+						result = (workerZip != NULL) ? unzGoToFilePos64(workerZip, &entries[i].position) : UNZ_ERRNO;
+						if (result == UNZ_OK) {
+							if ([password length] == 0) {
+								result = unzOpenCurrentFile(workerZip);
+							} else {
+								result = unzOpenCurrentFilePassword(workerZip, [password cStringUsingEncoding:NSASCIIStringEncoding]);
+							}
+						}
+						if (result == UNZ_OK) {
+							result = [self _extractCurrentFileOfZip:workerZip
+															 toPath:fullPaths[i]
+														   fileInfo:entries[i].fileInfo
+													   symbolicLink:entries[i].symbolicLink
+														  overwrite:overwrite
+														   password:password];
+						}
+					}
+				}
+
+				[condition lock];
+				entries[i].result = result;
+				entries[i].done = YES;
+				[condition broadcast];
+				[condition unlock];
+			}
+			if (workerZip != NULL) {
+				unzClose(workerZip);
+			}
+		});
+	}
+
+	// Report completed entries in archive order
+	unsigned long long currentPosition = 0;
+	for (NSUInteger i = 0; i < count; i++) {
+		@autoreleasepool {
+			[condition lock];
+			while (!entries[i].done) {
+				[condition wait];
+			}
+			[condition unlock];
+
+			if (entries[i].result != UNZ_OK) {
+				success = NO;
+				if (error) {
+					*error = [self _errorOfEntry:entryPaths[i] result:entries[i].result];
+				}
+				[condition lock];
+				aborted = YES;
+				[condition unlock];
+				break;
+			}
+
+			unz_file_info fileInfo = entries[i].fileInfo;
+			currentPosition += fileInfo.compressed_size;
+
+			if ([delegate respondsToSelector:@selector(zipArchiveProgressEvent:total:)]) {
+				[delegate zipArchiveProgressEvent:(NSInteger)currentPosition total:(NSInteger)fileSize];
+			}
+			if ([delegate respondsToSelector:@selector(zipArchiveDidUnzipFileAtIndex:totalFiles:archivePath:fileInfo:)]) {
+				[delegate zipArchiveDidUnzipFileAtIndex:(NSInteger)i totalFiles:(NSInteger)globalInfo.number_entry
+											 archivePath:path fileInfo:fileInfo];
+			} else if ([delegate respondsToSelector: @selector(zipArchiveDidUnzipFileAtIndex:totalFiles:archivePath:unzippedFilePath:)]) {
+				[delegate zipArchiveDidUnzipFileAtIndex:(NSInteger)i totalFiles:(NSInteger)globalInfo.number_entry
+											archivePath:path unzippedFilePath:fullPaths[i]];
+			}
+			if (progressHandler)
+			{
+				progressHandler(entryPaths[i], fileInfo, (long)i + 1, globalInfo.number_entry);
+			}
+		}
+	}
+
+	dispatch_group_wait(group, DISPATCH_TIME_FOREVER);
+
+#if !__has_feature(objc_arc)
+	dispatch_release(group);
+	[condition release];
+	[entryPaths release];
+	[fullPaths release];
+#endif
+	free(order);
+	free(entries);
+	return success;
+}
+
 #pragma mark - Zipping
 
 + (BOOL)createZipFileAtPath:(NSString *)path withFilesAtPaths:(NSArray *)paths
@@ -378,9 +642,11 @@
 	BOOL success = NO;
 	LK_SSZipArchive *zipArchive = [[LK_SSZipArchive alloc] initWithPath:path];
 	if ([zipArchive open]) {
+		NSMutableArray *fileNames = [NSMutableArray arrayWithCapacity:paths.count];
 		for (NSString *filePath in paths) {
-			[zipArchive writeFile:filePath];
+			[fileNames addObject:filePath.lastPathComponent];
 		}
+		[zipArchive _writeFilesAtPaths:paths withFileNames:fileNames placeholders:[NSIndexSet indexSet]];
 		success = [zipArchive close];
 	}
 
@@ -406,6 +672,9 @@
         // use a local filemanager (queue/thread compatibility)
         fileManager = [[NSFileManager alloc] init];
         NSDirectoryEnumerator *dirEnumerator = [fileManager enumeratorAtPath:directoryPath];
+        NSMutableArray *paths = [NSMutableArray array];
+        NSMutableArray *fileNames = [NSMutableArray array];
+        NSMutableIndexSet *placeholders = [NSMutableIndexSet indexSet];
         NSString *fileName;
         while ((fileName = [dirEnumerator nextObject])) {
             BOOL isDir;
@@ -416,19 +685,21 @@
                 {
                     fileName = [[directoryPath lastPathComponent] stringByAppendingPathComponent:fileName];
                 }
-                [zipArchive writeFileAtPath:fullFilePath withFileName:fileName];
+                [paths addObject:fullFilePath];
+                [fileNames addObject:fileName];
             }
             else
             {
                 if([[NSFileManager defaultManager] subpathsOfDirectoryAtPath:fullFilePath error:nil].count == 0)
                 {
-                    NSString *tempName = [fullFilePath stringByAppendingPathComponent:@".DS_Store"];
-                    [@"" writeToFile:tempName atomically:YES encoding:NSUTF8StringEncoding error:nil];
-                    [zipArchive writeFileAtPath:tempName withFileName:[fileName stringByAppendingPathComponent:@".DS_Store"]];
-                    [[NSFileManager defaultManager] removeItemAtPath:tempName error:nil];
+                    // An empty .DS_Store keeps the empty directory, it is created when its turn comes
+                    [placeholders addIndex:paths.count];
+                    [paths addObject:[fullFilePath stringByAppendingPathComponent:@".DS_Store"]];
+                    [fileNames addObject:[fileName stringByAppendingPathComponent:@".DS_Store"]];
                 }
             }
         }
+        [zipArchive _writeFilesAtPaths:paths withFileNames:fileNames placeholders:placeholders];
         success = [zipArchive close];
     }
     
@@ -463,6 +734,10 @@
 {
 	NSAssert((_zip == NULL), @"Attempting open an archive which is already open");
 	_zip = zipOpen([_path UTF8String], APPEND_STATUS_CREATE);
+    if (_zip) {
+        // Large files are deflated on every core; small ones stay on this thread
+        zipSetParallelDeflate(_zip, (int)[[NSProcessInfo processInfo] activeProcessorCount]);
+    }
 	return (NULL != _zip);
 }
 
@@ -484,6 +759,36 @@
     zipInfo->tmz_date.tm_year = (unsigned int)components.year;
 }
 
+- (void)zipInfo:(zip_fileinfo*)zipInfo setAttributesOfFileAtPath:(NSString*)path
+{
+    NSDictionary *attr = [[NSFileManager defaultManager] attributesOfItemAtPath:path error: nil];
+    if( attr )
+    {
+        NSDate *fileDate = (NSDate *)attr[NSFileModificationDate];
+        if( fileDate )
+        {
+            [self zipInfo:zipInfo setDate: fileDate ];
+        }
+
+        // Write permissions into the external attributes, for details on this see here: http://unix.stackexchange.com/a/14727
+        // Get the permissions value from the files attributes
+        NSNumber *permissionsValue = (NSNumber *)attr[NSFilePosixPermissions];
+        if (permissionsValue) {
+            // Get the short value for the permissions
+            short permissionsShort = permissionsValue.shortValue;
+
+            // Convert this into an octal by adding 010000, 010000 being the flag for a regular file
+            NSInteger permissionsOctal = 0100000 + permissionsShort;
+
+            // Convert this into a long value
+            uLong permissionsLong = @(permissionsOctal).unsignedLongValue;
+
+            // Store this into the external file attributes once it has been shifted 16 places left to form part of the second from last byte
+            zipInfo->external_fa = permissionsLong << 16L;
+        }
+    }
+}
+
 - (BOOL)writeFolderAtPath:(NSString *)path withFolderName:(NSString *)folderName
 {
     NSAssert((_zip != NULL), @"Attempting to write to an archive which was never opened");
@@ -550,33 +855,7 @@
     }
 
     zip_fileinfo zipInfo = {{0}};
-
-    NSDictionary *attr = [[NSFileManager defaultManager] attributesOfItemAtPath:path error: nil];
-    if( attr )
-    {
-        NSDate *fileDate = (NSDate *)attr[NSFileModificationDate];
-        if( fileDate )
-        {
-            [self zipInfo:&zipInfo setDate: fileDate ];
-        }
-
-        // Write permissions into the external attributes, for details on this see here: http://unix.stackexchange.com/a/14727
-        // Get the permissions value from the files attributes
-        NSNumber *permissionsValue = (NSNumber *)attr[NSFilePosixPermissions];
-        if (permissionsValue) {
-            // Get the short value for the permissions
-            short permissionsShort = permissionsValue.shortValue;
-
-            // Convert this into an octal by adding 010000, 010000 being the flag for a regular file
-            NSInteger permissionsOctal = 0100000 + permissionsShort;
-
-            // Convert this into a long value
-            uLong permissionsLong = @(permissionsOctal).unsignedLongValue;
-
-            // Store this into the external file attributes once it has been shifted 16 places left to form part of the second from last byte
-            zipInfo.external_fa = permissionsLong << 16L;
-        }
-    }
+    [self zipInfo:&zipInfo setAttributesOfFileAtPath:path];
 
     zipOpenNewFileInZip(_zip, afileName, &zipInfo, NULL, 0, NULL, 0, NULL, Z_DEFLATED, Z_DEFAULT_COMPRESSION);
 
@@ -614,6 +893,186 @@
 }
 
 
+// Zip pipeline: a pool of workers reads and deflates the files ahead, each
+// into its own buffer, while the calling thread commits the compressed
+// streams in order through the raw write path. The archive is laid out as if
+// the files were written one after the other with writeFileAtPath:.
+// Placeholders (empty .DS_Store files for empty directories) and files larger
+// than PIPELINE_MAX_ENTRY_SIZE are written in turn by the calling thread.
+- (void)_writeFilesAtPaths:(NSArray *)paths withFileNames:(NSArray *)fileNames placeholders:(NSIndexSet *)placeholders
+{
+	typedef struct {
+		uLong crc;
+		ZPOS64_T uncompressedSize;
+		size_t pendingBytes;
+		BOOL deferred;
+		BOOL failed;
+		BOOL done;
+	} LKZipPendingEntry;
+
+	NSAssert((_zip != NULL), @"Attempting to write to an archive which was never opened");
+
+	NSUInteger count = paths.count;
+	if (count == 0) {
+		return;
+	}
+
+	LKZipPendingEntry *entries = (LKZipPendingEntry *)calloc(count, sizeof(LKZipPendingEntry));
+	NSMutableArray *compressed = [[NSMutableArray alloc] initWithCapacity:count];
+	for (NSUInteger i = 0; i < count; i++) {
+		[compressed addObject:[NSNull null]];
+	}
+
+	NSCondition *condition = [[NSCondition alloc] init];
+	__block NSUInteger nextIndex = 0;
+	__block NSUInteger nextCommit = 0;
+	__block size_t pendingBytes = 0;
+	NSUInteger workerCount = MIN([[NSProcessInfo processInfo] activeProcessorCount], count);
+	// Bounds the compressed streams waiting for their turn, in number; their
+	// size is bounded by PIPELINE_MAX_PENDING_BYTES
+	NSUInteger window = workerCount * 4;
+	dispatch_group_t group = dispatch_group_create();
+	dispatch_queue_t queue = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0);
+
+	for (NSUInteger w = 0; w < workerCount; w++) {
+		dispatch_group_async(group, queue, ^{
+			z_stream stream;
+			memset(&stream, 0, sizeof(stream));
+			BOOL initialised = (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, DEF_MEM_LEVEL, Z_DEFAULT_STRATEGY) == Z_OK);
+
+			while (YES) {
+				NSUInteger i;
+				[condition lock];
+				while (nextIndex < count && nextIndex >= nextCommit + window) {
+					[condition wait];
+				}
+				if (nextIndex >= count) {
+					[condition unlock];
+					break;
+				}
+				i = nextIndex++;
+				[condition unlock];
+
+				@autoreleasepool {
+					LKZipPendingEntry entry = {0};
+					NSMutableData *deflated = nil;
+					struct stat fileStat;
+
+					entry.deferred = !initialised || [placeholders containsIndex:i];
+					if (!entry.deferred) {
+						if (stat([paths[i] fileSystemRepresentation], &fileStat) != 0) {
+							// skipped, as writeFileAtPath: does with a file it can not open
+							entry.failed = YES;
+						} else if (fileStat.st_size > PIPELINE_MAX_ENTRY_SIZE) {
+							entry.deferred = YES;
+						}
+					}
+					if (!entry.deferred && !entry.failed) {
+						NSData *data = [NSData dataWithContentsOfFile:paths[i] options:NSDataReadingMappedIfSafe error:nil];
+						if (data == nil || data.length > PIPELINE_MAX_ENTRY_SIZE) {
+							entry.failed = (data == nil);
+							entry.deferred = (data != nil);
+						} else {
+							// Waits for room in the buffers, unless the entry is the next to commit,
+							// as the buffers of the later ones are only freed after it
+							size_t bound = (size_t)deflateBound(&stream, data.length);
+							[condition lock];
+							while (pendingBytes > 0 && pendingBytes + bound > PIPELINE_MAX_PENDING_BYTES && i != nextCommit) {
+								[condition wait];
+							}
+							pendingBytes += bound;
+							[condition unlock];
+							entry.pendingBytes = bound;
+
+							deflateReset(&stream);
+							deflated = [NSMutableData dataWithLength:bound];
+							stream.next_in = (Bytef *)data.bytes;
+							stream.avail_in = (uInt)data.length;
+							stream.next_out = (Bytef *)deflated.mutableBytes;
+							stream.avail_out = (uInt)deflated.length;
+							if (deflate(&stream, Z_FINISH) == Z_STREAM_END) {
+								deflated.length = stream.total_out;
+								entry.crc = lk_crc32(0L, (const Bytef *)data.bytes, (uInt)data.length);
+								entry.uncompressedSize = data.length;
+							} else {
+								deflated = nil;
+								entry.deferred = YES;
+							}
+						}
+					}
+
+					[condition lock];
+					if (deflated == nil) {
+						pendingBytes -= entry.pendingBytes;
+						entry.pendingBytes = 0;
+					}
+					entry.done = YES;
+					entries[i] = entry;
+					if (deflated) {
+						compressed[i] = deflated;
+					}
+					[condition broadcast];
+					[condition unlock];
+				}
+			}
+
+			if (initialised) {
+				deflateEnd(&stream);
+			}
+		});
+	}
+
+	// Commit in order
+	for (NSUInteger i = 0; i < count; i++) {
+		@autoreleasepool {
+			NSData *deflated;
+			[condition lock];
+			while (!entries[i].done) {
+				[condition wait];
+			}
+			deflated = compressed[i];
+			compressed[i] = [NSNull null];
+			[condition unlock];
+
+			if ([placeholders containsIndex:i]) {
+				[@"" writeToFile:paths[i] atomically:YES encoding:NSUTF8StringEncoding error:nil];
+				[self writeFileAtPath:paths[i] withFileName:fileNames[i]];
+				[[NSFileManager defaultManager] removeItemAtPath:paths[i] error:nil];
+			} else if (entries[i].deferred) {
+				[self writeFileAtPath:paths[i] withFileName:fileNames[i]];
+			} else if (!entries[i].failed) {
+				zip_fileinfo zipInfo = {{0}};
+				[self zipInfo:&zipInfo setAttributesOfFileAtPath:paths[i]];
+
+				// Same header as zipOpenNewFileInZip, the deflated data is written as is
+				if (zipOpenNewFileInZip4_64(_zip, [fileNames[i] UTF8String], &zipInfo, NULL, 0, NULL, 0, NULL,
+											Z_DEFLATED, Z_DEFAULT_COMPRESSION, 1,
+											-MAX_WBITS, DEF_MEM_LEVEL, Z_DEFAULT_STRATEGY,
+											NULL, 0, 0, 0, 0) == ZIP_OK) {
+					zipWriteInFileInZip(_zip, deflated.bytes, (unsigned int)deflated.length);
+					zipCloseFileInZipRaw64(_zip, entries[i].uncompressedSize, entries[i].crc);
+				}
+			}
+			deflated = nil;
+
+			[condition lock];
+			pendingBytes -= entries[i].pendingBytes;
+			nextCommit = i + 1;
+			[condition broadcast];
+			[condition unlock];
+		}
+	}
+
+	dispatch_group_wait(group, DISPATCH_TIME_FOREVER);
+
+#if !__has_feature(objc_arc)
+	dispatch_release(group);
+	[condition release];
+	[compressed release];
+#endif
+	free(entries);
+}
+
 - (BOOL)close
 {
 	NSAssert((_zip != NULL), @"[SSZipArchive] Attempting to close an archive which was never opened");
@@ -623,6 +1082,245 @@
 
 #pragma mark - Private
 
++ (zipFile)_openZipAtPath:(NSString *)path
+{
+	// Map the archive in memory so it is read without copies, when possible
+	zlib_filefunc64_ex_def mmapFileFunc;
+	fill_mmap_filefunc64(&mmapFileFunc);
+	zipFile zip = unzOpen3_64((const char*)[path UTF8String], &mmapFileFunc);
+	if (zip == NULL)
+	{
+		zip = unzOpen((const char*)[path UTF8String]);
+	}
+	return zip;
+}
+
+// Resolves the destination of an entry listed by unzListEntries64 and creates
+// the directories leading to it. Returns the full path of the entry.
++ (NSString *)_prepareEntry:(const unz_entry64 *)entry
+			  toDestination:(NSString *)destination
+directoriesModificationDates:(NSMutableSet *)directoriesModificationDates
+				  entryPath:(NSString **)entryPath
+				isDirectory:(BOOL *)isDirectory
+			   symbolicLink:(BOOL *)symbolicLink
+{
+	NSFileManager *fileManager = [NSFileManager defaultManager];
+
+	unz_file_info fileInfo = _LKFileInfoOfEntry(entry);
+	const char *filename = entry->filename;
+
+    //
+    // Determine whether this is a symbolic link:
+    // - File is stored with 'version made by' value of UNIX (3),
+    //   as per http://www.pkware.com/documents/casestudies/APPNOTE.TXT
+    //   in the upper byte of the version field.
+    // - BSD4.4 st_mode constants are stored in the high 16 bits of the
+    //   external file attributes (defacto standard, verified against libarchive)
+    //
+    // The original constants can be found here:
+    //    http://minnie.tuhs.org/cgi-bin/utree.pl?file=4.4BSD/usr/include/sys/stat.h
+    //
+    const uLong ZipUNIXVersion = 3;
+    const uLong BSD_SFMT = 0170000;
+    const uLong BSD_IFLNK = 0120000;
+
+    BOOL fileIsSymbolicLink = NO;
+    if (((fileInfo.version >> 8) == ZipUNIXVersion) && BSD_IFLNK == (BSD_SFMT & (fileInfo.external_fa >> 16))) {
+        fileIsSymbolicLink = NO;
+    }
+
+	// Check if it contains directory
+	NSString *strPath = @(filename);
+	*isDirectory = NO;
+	if (fileInfo.size_filename > 0 && (filename[fileInfo.size_filename-1] == '/' || filename[fileInfo.size_filename-1] == '\\')) {
+		*isDirectory = YES;
+	}
+
+	// Contains a path
+	if ([strPath rangeOfCharacterFromSet:[NSCharacterSet characterSetWithCharactersInString:@"/\\"]].location != NSNotFound) {
+		strPath = [strPath stringByReplacingOccurrencesOfString:@"\\" withString:@"/"];
+	}
+
+	NSString *fullPath = [destination stringByAppendingPathComponent:strPath];
+	NSError *err = nil;
+    NSDate *modDate = [[self class] _dateWithMSDOSFormat:(UInt32)fileInfo.dosDate];
+    NSDictionary *directoryAttr = @{NSFileCreationDate: modDate, NSFileModificationDate: modDate};
+
+	if (*isDirectory) {
+		[fileManager createDirectoryAtPath:fullPath withIntermediateDirectories:YES attributes:directoryAttr  error:&err];
+	} else {
+		[fileManager createDirectoryAtPath:[fullPath stringByDeletingLastPathComponent] withIntermediateDirectories:YES attributes:directoryAttr error:&err];
+	}
+    if (nil != err) {
+        NSLog(@"[SSZipArchive] Error: %@", err.localizedDescription);
+    }
+
+	if (!fileIsSymbolicLink) {
+		[directoriesModificationDates addObject: @{@"path": fullPath, @"modDate": modDate}];
+	}
+
+	*symbolicLink = fileIsSymbolicLink;
+	*entryPath = strPath;
+	return fullPath;
+}
+
+// Writes the opened current entry of `zip` to `fullPath` and closes it. Safe to call from
+// several threads at once, as long as each uses its own handle. Returns UNZ_OK, or the
+// read or CRC error of the entry, in which case nothing is left at `fullPath`.
++ (int)_extractCurrentFileOfZip:(zipFile)zip
+						  toPath:(NSString *)fullPath
+						fileInfo:(unz_file_info)fileInfo
+					symbolicLink:(BOOL)fileIsSymbolicLink
+					   overwrite:(BOOL)overwrite
+						password:(NSString *)password
+{
+	NSFileManager *fileManager = [NSFileManager defaultManager];
+	int result = UNZ_OK;
+
+	if (!fileIsSymbolicLink) {
+        int fd = open((const char*)[fullPath UTF8String], O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if (fd != -1) {
+            // Reserve the space up front, so the file is not grown block by block
+            off_t fileSize = (off_t)fileInfo.uncompressed_size;
+            if (fileSize > 0) {
+#if defined(F_PREALLOCATE)
+                fstore_t store = {F_ALLOCATECONTIG, F_PEOFPOSMODE, 0, fileSize, 0};
+                if (fcntl(fd, F_PREALLOCATE, &store) == -1) {
+                    store.fst_flags = F_ALLOCATEALL;
+                    fcntl(fd, F_PREALLOCATE, &store);
+                }
+#elif defined(__linux__)
+                posix_fallocate(fd, 0, fileSize);
+#endif
+                ftruncate(fd, fileSize);
+            }
+
+            off_t written = 0;
+
+            // Stored entries are written straight from the mapped archive, or
+            // read straight into one buffer when it is not mapped
+            ZPOS64_T copied = 0;
+            int copyResult = unzCopyCurrentFileToFd(zip, fd, -1, &copied);
+            written = (off_t)copied;
+            if (copyResult != UNZ_PARAMERROR) {
+                result = copyResult;
+            }
+
+            if (copyResult == UNZ_PARAMERROR) {
+                // Large entries stream through a large block, small ones through one sized to fit
+                size_t bufferSize = EXTRACT_BUFFER_SIZE;
+                if (fileInfo.uncompressed_size < bufferSize) {
+                    bufferSize = MAX((size_t)fileInfo.uncompressed_size, (size_t)1);
+                }
+                void *buffer = malloc(bufferSize);
+                while (buffer) {
+                    int readBytes = unzReadCurrentFile(zip, buffer, (unsigned)bufferSize);
+
+                    if (readBytes > 0 && _LKWriteFully(fd, buffer, readBytes)) {
+                        written += readBytes;
+                    } else {
+                        if (readBytes < 0) {
+                            result = readBytes;
+                        }
+                        break;
+                    }
+                }
+                free(buffer);
+            }
+
+            // Don't leave the reserved size behind a short or failed read
+            if (written != fileSize) {
+                ftruncate(fd, written);
+            }
+            close(fd);
+
+            // A file whose data does not match its CRC is not kept
+            int closeResult = unzCloseCurrentFile(zip);
+            if (result == UNZ_OK) {
+                result = closeResult;
+            }
+            if (result != UNZ_OK) {
+                [fileManager removeItemAtPath:fullPath error:nil];
+                return result;
+            }
+
+            if ([[[fullPath pathExtension] lowercaseString] isEqualToString:@"zip"]) {
+                NSLog(@"Unzipping nested .zip file:  %@", [fullPath lastPathComponent]);
+                if ([self unzipFileAtPath:fullPath toDestination:[fullPath stringByDeletingLastPathComponent] overwrite:overwrite password:password error:nil delegate:nil]) {
+                    [[NSFileManager defaultManager] removeItemAtPath:fullPath error:nil];
+                }
+            }
+
+            // Set the original datetime property
+            if (fileInfo.dosDate != 0) {
+                NSDate *orgDate = [[self class] _dateWithMSDOSFormat:(UInt32)fileInfo.dosDate];
+                NSDictionary *attr = @{NSFileModificationDate: orgDate};
+
+                if (attr) {
+                    if ([fileManager setAttributes:attr ofItemAtPath:fullPath error:nil] == NO) {
+                        // Can't set attributes
+                        NSLog(@"[SSZipArchive] Failed to set attributes - whilst setting modification date");
+                    }
+                }
+            }
+
+            // Set the original permissions on the file
+            uLong permissions = fileInfo.external_fa >> 16;
+            if (permissions != 0) {
+                // Store it into a NSNumber
+                NSNumber *permissionsValue = @(permissions);
+
+                // Retrieve any existing attributes
+                NSMutableDictionary *attrs = [[NSMutableDictionary alloc] initWithDictionary:[fileManager attributesOfItemAtPath:fullPath error:nil]];
+
+                // Set the value in the attributes dict
+                attrs[NSFilePosixPermissions] = permissionsValue;
+
+                // Update attributes
+                if ([fileManager setAttributes:attrs ofItemAtPath:fullPath error:nil] == NO) {
+                    // Unable to set the permissions attribute
+                    NSLog(@"[SSZipArchive] Failed to set attributes - whilst setting permissions");
+                }
+
+#if !__has_feature(objc_arc)
+                [attrs release];
+#endif
+            }
+        } else {
+            result = unzCloseCurrentFile(zip);
+        }
+    }
+    else
+    {
+        // Assemble the path for the symbolic link
+        unsigned char buffer[4096] = {0};
+        NSMutableString* destinationPath = [NSMutableString string];
+        int bytesRead = 0;
+        while((bytesRead = unzReadCurrentFile(zip, buffer, sizeof(buffer) - 1)) > 0)
+        {
+            buffer[bytesRead] = (int)0;
+            [destinationPath appendString:@((const char*)buffer)];
+        }
+        result = unzCloseCurrentFile(zip);
+        if (bytesRead < 0) {
+            result = bytesRead;
+        }
+        if (result != UNZ_OK) {
+            return result;
+        }
+
+        // Create the symbolic link (making sure it stays relative if it was relative before)
+        int symlinkError = symlink([destinationPath cStringUsingEncoding:NSUTF8StringEncoding],
+                                   [fullPath cStringUsingEncoding:NSUTF8StringEncoding]);
+
+        if(symlinkError != 0)
+        {
+            NSLog(@"Failed to create symbolic link at \"%@\" to \"%@\". symlink() error code: %d", fullPath, destinationPath, errno);
+        }
+    }
+    return result;
+}
+
 // Format from http://newsgroups.derkeiler.com/Archive/Comp/comp.os.msdos.programmer/2009-04/msg00060.html
 // Two consecutive words, or a longword, YYYYYYYMMMMDDDDD hhhhhmmmmmmsssss
 // YYYYYYY is years from 1980 = 0
@@ -670,3 +1368,211 @@
 }
 
 @end
+
+
+#pragma mark - Streaming unzip
+
+@interface LK_SSZipStreamUnarchiver ()
+- (voidpf)_openEntry:(const unz_stream_entry *)entry;
+- (int)_writeBytes:(const void *)bytes length:(uLong)length;
+- (void)_closeEntry:(const unz_stream_entry *)entry error:(int)err;
+- (NSError *)_errorWithCode:(int)code;
+@end
+
+static voidpf _LKStreamOpenEntry(voidpf opaque, const unz_stream_entry *entry)
+{
+	return [(__bridge LK_SSZipStreamUnarchiver *)opaque _openEntry:entry];
+}
+
+static int _LKStreamWriteEntry(voidpf opaque, voidpf handle, const void *buf, uLong size)
+{
+	return [(__bridge LK_SSZipStreamUnarchiver *)opaque _writeBytes:buf length:size];
+}
+
+static void _LKStreamCloseEntry(voidpf opaque, voidpf handle, const unz_stream_entry *entry, int err)
+{
+	[(__bridge LK_SSZipStreamUnarchiver *)opaque _closeEntry:entry error:err];
+}
+
+@implementation LK_SSZipStreamUnarchiver
+{
+	NSString *_destination;
+	BOOL _overwrite;
+	unzStream _stream;
+	NSMutableSet *_directoriesModificationDates;
+	// The entry being written, entries come one after the other
+	int _fd;
+	NSString *_fullPath;
+	unsigned long long _resumeOffset;
+	// The first entry which did not match its CRC or sizes fails the whole archive
+	int _entryError;
+}
+
+- (instancetype)initWithDestination:(NSString *)destination overwrite:(BOOL)overwrite
+{
+	return [self initWithDestination:destination overwrite:overwrite resumeOffset:0];
+}
+
+- (instancetype)initWithDestination:(NSString *)destination overwrite:(BOOL)overwrite resumeOffset:(unsigned long long)resumeOffset
+{
+	if ((self = [super init])) {
+		_destination = [destination copy];
+		_overwrite = overwrite;
+		_directoriesModificationDates = [[NSMutableSet alloc] init];
+		_fd = -1;
+
+		unz_stream_callbacks callbacks;
+		callbacks.open_entry = _LKStreamOpenEntry;
+		callbacks.write_entry = _LKStreamWriteEntry;
+		callbacks.close_entry = _LKStreamCloseEntry;
+		callbacks.opaque = (__bridge voidpf)self;
+		_stream = unzStreamOpenAt(&callbacks, resumeOffset);
+		_resumeOffset = resumeOffset;
+	}
+	return self;
+}
+
+- (unsigned long long)resumeOffset
+{
+	if (_stream != NULL) {
+		_resumeOffset = unzStreamResumeOffset(_stream);
+	}
+	return _resumeOffset;
+}
+
+- (void)dealloc
+{
+	if (_stream != NULL) {
+		unzStreamClose(_stream);
+	}
+#if !__has_feature(objc_arc)
+	[_destination release];
+	[_directoriesModificationDates release];
+	[_fullPath release];
+	[super dealloc];
+#endif
+}
+
+- (BOOL)appendData:(NSData *)data error:(NSError **)error
+{
+	__block int ret = UNZ_BADZIPFILE;
+	if (_stream != NULL) {
+		ret = UNZ_OK;
+		// Data received from the network is often made of several buffers, push them as they are
+		[data enumerateByteRangesUsingBlock:^(const void *bytes, NSRange byteRange, BOOL *stop) {
+			ret = unzStreamWrite(_stream, bytes, (uLong)byteRange.length);
+			*stop = (ret != UNZ_OK);
+		}];
+	}
+	if (ret == UNZ_OK) {
+		ret = _entryError;
+	}
+	if (ret != UNZ_OK) {
+		if (error) {
+			*error = [self _errorWithCode:ret];
+		}
+		return NO;
+	}
+	return YES;
+}
+
+- (BOOL)finishWithError:(NSError **)error
+{
+	int ret = UNZ_BADZIPFILE;
+	if (_stream != NULL) {
+		_resumeOffset = unzStreamResumeOffset(_stream);
+		ret = unzStreamClose(_stream);
+		_stream = NULL;
+	}
+	if (ret == UNZ_OK) {
+		ret = _entryError;
+	}
+
+	// Creating the files inside the folders set their modification times to the present time
+	for (NSDictionary *d in _directoriesModificationDates) {
+		if (![[NSFileManager defaultManager] setAttributes:@{NSFileModificationDate: d[@"modDate"]} ofItemAtPath:d[@"path"] error:nil]) {
+			NSLog(@"[SSZipArchive] Set attributes failed for directory: %@.", d[@"path"]);
+		}
+	}
+
+	if (ret != UNZ_OK) {
+		if (error) {
+			*error = [self _errorWithCode:ret];
+		}
+		return NO;
+	}
+	return YES;
+}
+
+- (NSError *)_errorWithCode:(int)code
+{
+	NSString *description = (code == UNZ_ERRNO) ? @"failed to write unzipped file" :
+		(code == UNZ_CRCERROR) ? @"streamed zip file does not match its CRCs" : @"failed to unzip streamed zip file";
+	NSDictionary *userInfo = @{NSLocalizedDescriptionKey: description};
+	return [NSError errorWithDomain:@"SSZipArchiveErrorDomain" code:code userInfo:userInfo];
+}
+
+- (voidpf)_openEntry:(const unz_stream_entry *)entry
+{
+	NSFileManager *fileManager = [NSFileManager defaultManager];
+
+	NSString *strPath = [@(entry->filename) stringByReplacingOccurrencesOfString:@"\\" withString:@"/"];
+	BOOL isDirectory = [strPath hasSuffix:@"/"];
+	NSString *fullPath = [_destination stringByAppendingPathComponent:strPath];
+
+	NSDate *modDate = [LK_SSZipArchive _dateWithMSDOSFormat:(UInt32)entry->dosDate];
+	NSDictionary *directoryAttr = @{NSFileCreationDate: modDate, NSFileModificationDate: modDate};
+	NSString *directory = isDirectory ? fullPath : [fullPath stringByDeletingLastPathComponent];
+	NSError *err = nil;
+	[fileManager createDirectoryAtPath:directory withIntermediateDirectories:YES attributes:directoryAttr error:&err];
+	if (nil != err) {
+		NSLog(@"[SSZipArchive] Error: %@", err.localizedDescription);
+	}
+	[_directoriesModificationDates addObject:@{@"path": fullPath, @"modDate": modDate}];
+
+	// Directories have no data, and existing files are kept unless overwriting
+	if (isDirectory || (!_overwrite && [fileManager fileExistsAtPath:fullPath])) {
+		return NULL;
+	}
+
+	_fd = open((const char*)[fullPath UTF8String], O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (_fd == -1) {
+		NSLog(@"[SSZipArchive] Failed to create file at %@", fullPath);
+		return NULL;
+	}
+#if !__has_feature(objc_arc)
+	[_fullPath release];
+#endif
+	_fullPath = [fullPath copy];
+	return (__bridge voidpf)self;
+}
+
+- (int)_writeBytes:(const void *)bytes length:(uLong)length
+{
+	return _LKWriteFully(_fd, bytes, length) ? UNZ_OK : UNZ_ERRNO;
+}
+
+- (void)_closeEntry:(const unz_stream_entry *)entry error:(int)err
+{
+	close(_fd);
+	_fd = -1;
+
+	if (err != UNZ_OK) {
+		// Don't leave a partial file behind
+		[[NSFileManager defaultManager] removeItemAtPath:_fullPath error:nil];
+		if (_entryError == UNZ_OK) {
+			_entryError = err;
+		}
+		return;
+	}
+
+	// Set the original datetime property
+	if (entry->dosDate != 0) {
+		NSDate *orgDate = [LK_SSZipArchive _dateWithMSDOSFormat:(UInt32)entry->dosDate];
+		if ([[NSFileManager defaultManager] setAttributes:@{NSFileModificationDate: orgDate} ofItemAtPath:_fullPath error:nil] == NO) {
+			NSLog(@"[SSZipArchive] Failed to set attributes - whilst setting modification date");
+		}
+	}
+}
+
+@end
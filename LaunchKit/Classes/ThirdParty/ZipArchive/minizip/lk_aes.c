@@ -0,0 +1,775 @@
+/* lk_aes.c -- WinZip AES encryption for the Minizip zip and unzip code
+
+   The data is encrypted with AES in counter mode, the counter being a
+   little endian 64-bit number in the first 8 bytes of the block, starting
+   at 1 (Brian Gladman's fcrypt, which WinZip uses). Counter mode only
+   needs the encryption of the counter blocks, which are independent: the
+   x86 and ARMv8 kernels encrypt several at once to hide the latency of
+   the AES instructions. The table kernel follows "The Design of Rijndael"
+   (Daemen and Rijmen), with tables built at the first call.
+
+   License: Same as ZLIB (www.gzip.org)
+*/
+
+#if defined(_WIN32) || defined(WIN32)
+#define _CRT_RAND_S     /* rand_s, from the random generator of the system */
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "zlib.h"
+#include "lk_aes.h"
+
+#if (!defined(_WIN32)) && (!defined(WIN32))
+#include <pthread.h>
+#endif
+
+#if defined(__APPLE__)
+#include <sys/types.h>
+#include <sys/sysctl.h>
+#endif
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define LK_AES_AESNI
+#include <cpuid.h>
+#include <emmintrin.h>
+#include <wmmintrin.h>
+#endif
+
+/* LK_AES_ARMV8 can also be defined to build the ARMv8 kernel elsewhere, on
+   stand-ins of its intrinsics */
+#if defined(__aarch64__) && (defined(__GNUC__) || defined(__clang__)) && !defined(LK_AES_ARMV8)
+#define LK_AES_ARMV8
+#endif
+
+#ifdef LK_AES_ARMV8
+#include <arm_neon.h>
+#if defined(__linux__)
+#include <sys/auxv.h>
+#ifndef HWCAP_AES
+#define HWCAP_AES (1 << 3)
+#endif
+#endif
+#endif
+
+#ifndef local
+#  define local static
+#endif
+
+/* PBKDF2 iterations of WinZip AES */
+#define LK_AES_KEYING_ITERATIONS 1000
+
+#define GETU32(p) (((uint32_t)(p)[0] << 24) | ((uint32_t)(p)[1] << 16) | \
+                   ((uint32_t)(p)[2] << 8) | (uint32_t)(p)[3])
+#define PUTU32(p, v) { (p)[0] = (unsigned char)((v) >> 24); (p)[1] = (unsigned char)((v) >> 16); \
+                       (p)[2] = (unsigned char)((v) >> 8); (p)[3] = (unsigned char)(v); }
+
+/* encrypt the counter blocks following *counter, xor them into the
+   first blocks*16 bytes of buf and advance *counter past them */
+typedef void (*lk_aes_ctr_func) OF((const unsigned char* round_keys, int rounds,
+                                    uint64_t* counter, unsigned char* buf, size_t blocks));
+
+/* memset that is not optimized away, for the keys */
+local void lk_aes_wipe OF((void* p, size_t len));
+local void lk_aes_wipe (void* p, size_t len)
+{
+    volatile unsigned char* v = (volatile unsigned char*)p;
+    while (len--)
+        *v++ = 0;
+}
+
+/* ===========================================================================
+   AES with lookup tables
+*/
+
+local unsigned char aes_sbox[256];
+local uint32_t aes_te[4][256];
+
+#define ROTL8(x, shift) ((unsigned char)(((x) << (shift)) | ((x) >> (8 - (shift)))))
+#define XTIME(x) ((unsigned char)(((x) << 1) ^ (((x) & 0x80) ? 0x1b : 0)))
+
+local void lk_aes_make_tables OF((void));
+local void lk_aes_make_tables ()
+{
+    unsigned char p = 1, q = 1;
+    int i;
+
+    /* p runs through the multiplicative group by powers of 3, q = 1/p */
+    do
+    {
+        unsigned char x;
+        p = (unsigned char)(p ^ (p << 1) ^ ((p & 0x80) ? 0x1b : 0));
+        q ^= (unsigned char)(q << 1);
+        q ^= (unsigned char)(q << 2);
+        q ^= (unsigned char)(q << 4);
+        if (q & 0x80)
+            q ^= 0x09;
+        x = (unsigned char)(q ^ ROTL8(q, 1) ^ ROTL8(q, 2) ^ ROTL8(q, 3) ^ ROTL8(q, 4));
+        aes_sbox[p] = (unsigned char)(x ^ 0x63);
+    } while (p != 1);
+    aes_sbox[0] = 0x63;
+
+    for (i = 0; i < 256; i++)
+    {
+        uint32_t s = aes_sbox[i];
+        uint32_t s2 = XTIME(aes_sbox[i]);
+        uint32_t t = (s2 << 24) | (s << 16) | (s << 8) | (s2 ^ s);
+        aes_te[0][i] = t;
+        aes_te[1][i] = (t >> 8) | (t << 24);
+        aes_te[2][i] = (t >> 16) | (t << 16);
+        aes_te[3][i] = (t >> 24) | (t << 8);
+    }
+}
+
+local uint32_t lk_aes_sub_word OF((uint32_t w));
+local uint32_t lk_aes_sub_word (uint32_t w)
+{
+    return ((uint32_t)aes_sbox[w >> 24] << 24) | ((uint32_t)aes_sbox[(w >> 16) & 0xff] << 16) |
+           ((uint32_t)aes_sbox[(w >> 8) & 0xff] << 8) | (uint32_t)aes_sbox[w & 0xff];
+}
+
+/* FIPS-197 key expansion, the round keys are stored in the byte order the
+   AES instructions use */
+local void lk_aes_expand_key OF((const unsigned char* key, int key_words,
+                                 unsigned char* round_keys, int rounds));
+local void lk_aes_expand_key (const unsigned char* key, int key_words,
+                              unsigned char* round_keys, int rounds)
+{
+    uint32_t w[4*15];
+    unsigned char rcon = 1;
+    int i;
+
+    for (i = 0; i < key_words; i++)
+        w[i] = GETU32(key + 4*i);
+    for (i = key_words; i < 4*(rounds+1); i++)
+    {
+        uint32_t t = w[i-1];
+        if ((i % key_words) == 0)
+        {
+            t = lk_aes_sub_word((t << 8) | (t >> 24)) ^ ((uint32_t)rcon << 24);
+            rcon = XTIME(rcon);
+        }
+        else if ((key_words > 6) && ((i % key_words) == 4))
+            t = lk_aes_sub_word(t);
+        w[i] = w[i-key_words] ^ t;
+    }
+    for (i = 0; i < 4*(rounds+1); i++)
+        PUTU32(round_keys + 4*i, w[i]);
+    lk_aes_wipe(w, sizeof(w));
+}
+
+local void lk_aes_encrypt_block OF((const unsigned char* rk, int rounds,
+                                    const unsigned char* in, unsigned char* out));
+local void lk_aes_encrypt_block (const unsigned char* rk, int rounds,
+                                 const unsigned char* in, unsigned char* out)
+{
+    uint32_t s0, s1, s2, s3, t0, t1, t2, t3;
+    int r;
+
+    s0 = GETU32(in) ^ GETU32(rk);
+    s1 = GETU32(in + 4) ^ GETU32(rk + 4);
+    s2 = GETU32(in + 8) ^ GETU32(rk + 8);
+    s3 = GETU32(in + 12) ^ GETU32(rk + 12);
+
+    for (r = 1; r < rounds; r++)
+    {
+        rk += 16;
+        t0 = aes_te[0][s0 >> 24] ^ aes_te[1][(s1 >> 16) & 0xff] ^
+             aes_te[2][(s2 >> 8) & 0xff] ^ aes_te[3][s3 & 0xff] ^ GETU32(rk);
+        t1 = aes_te[0][s1 >> 24] ^ aes_te[1][(s2 >> 16) & 0xff] ^
+             aes_te[2][(s3 >> 8) & 0xff] ^ aes_te[3][s0 & 0xff] ^ GETU32(rk + 4);
+        t2 = aes_te[0][s2 >> 24] ^ aes_te[1][(s3 >> 16) & 0xff] ^
+             aes_te[2][(s0 >> 8) & 0xff] ^ aes_te[3][s1 & 0xff] ^ GETU32(rk + 8);
+        t3 = aes_te[0][s3 >> 24] ^ aes_te[1][(s0 >> 16) & 0xff] ^
+             aes_te[2][(s1 >> 8) & 0xff] ^ aes_te[3][s2 & 0xff] ^ GETU32(rk + 12);
+        s0 = t0; s1 = t1; s2 = t2; s3 = t3;
+    }
+
+    rk += 16;
+    t0 = ((uint32_t)aes_sbox[s0 >> 24] << 24) ^ ((uint32_t)aes_sbox[(s1 >> 16) & 0xff] << 16) ^
+         ((uint32_t)aes_sbox[(s2 >> 8) & 0xff] << 8) ^ (uint32_t)aes_sbox[s3 & 0xff] ^ GETU32(rk);
+    t1 = ((uint32_t)aes_sbox[s1 >> 24] << 24) ^ ((uint32_t)aes_sbox[(s2 >> 16) & 0xff] << 16) ^
+         ((uint32_t)aes_sbox[(s3 >> 8) & 0xff] << 8) ^ (uint32_t)aes_sbox[s0 & 0xff] ^ GETU32(rk + 4);
+    t2 = ((uint32_t)aes_sbox[s2 >> 24] << 24) ^ ((uint32_t)aes_sbox[(s3 >> 16) & 0xff] << 16) ^
+         ((uint32_t)aes_sbox[(s0 >> 8) & 0xff] << 8) ^ (uint32_t)aes_sbox[s1 & 0xff] ^ GETU32(rk + 8);
+    t3 = ((uint32_t)aes_sbox[s3 >> 24] << 24) ^ ((uint32_t)aes_sbox[(s0 >> 16) & 0xff] << 16) ^
+         ((uint32_t)aes_sbox[(s1 >> 8) & 0xff] << 8) ^ (uint32_t)aes_sbox[s2 & 0xff] ^ GETU32(rk + 12);
+    PUTU32(out, t0);
+    PUTU32(out + 4, t1);
+    PUTU32(out + 8, t2);
+    PUTU32(out + 12, t3);
+}
+
+local void lk_aes_ctr_tables OF((const unsigned char* round_keys, int rounds,
+                                 uint64_t* counter, unsigned char* buf, size_t blocks));
+local void lk_aes_ctr_tables (const unsigned char* round_keys, int rounds,
+                              uint64_t* counter, unsigned char* buf, size_t blocks)
+{
+    unsigned char block[16];
+    uint64_t c = *counter;
+    int i;
+
+    while (blocks-- > 0)
+    {
+        c++;
+        for (i = 0; i < 8; i++)
+            block[i] = (unsigned char)(c >> (8*i));
+        memset(block + 8, 0, 8);
+        lk_aes_encrypt_block(round_keys, rounds, block, block);
+        for (i = 0; i < 16; i++)
+            buf[i] ^= block[i];
+        buf += 16;
+    }
+    *counter = c;
+}
+
+/* ===========================================================================
+   AES with x86 AES-NI, 8 blocks at a time
+*/
+
+#ifdef LK_AES_AESNI
+
+#define LK_AES_NI_ROUND(i) \
+    { b0 = _mm_aesenc_si128(b0, rk[i]); b1 = _mm_aesenc_si128(b1, rk[i]); \
+      b2 = _mm_aesenc_si128(b2, rk[i]); b3 = _mm_aesenc_si128(b3, rk[i]); \
+      b4 = _mm_aesenc_si128(b4, rk[i]); b5 = _mm_aesenc_si128(b5, rk[i]); \
+      b6 = _mm_aesenc_si128(b6, rk[i]); b7 = _mm_aesenc_si128(b7, rk[i]); }
+
+#define LK_AES_NI_XOR(i, b) \
+    _mm_storeu_si128((__m128i*)(buf + 16*(i)), \
+                     _mm_xor_si128(_mm_loadu_si128((const __m128i*)(buf + 16*(i))), b))
+
+local void lk_aes_ctr_aesni OF((const unsigned char* round_keys, int rounds,
+                                uint64_t* counter, unsigned char* buf, size_t blocks));
+__attribute__((target("aes,sse2")))
+local void lk_aes_ctr_aesni (const unsigned char* round_keys, int rounds,
+                             uint64_t* counter, unsigned char* buf, size_t blocks)
+{
+    __m128i rk[15];
+    uint64_t c = *counter;
+    int r;
+
+    for (r = 0; r <= rounds; r++)
+        rk[r] = _mm_loadu_si128((const __m128i*)(round_keys + 16*r));
+
+    while (blocks >= 8)
+    {
+        __m128i b0 = _mm_xor_si128(_mm_set_epi64x(0, (long long)(c + 1)), rk[0]);
+        __m128i b1 = _mm_xor_si128(_mm_set_epi64x(0, (long long)(c + 2)), rk[0]);
+        __m128i b2 = _mm_xor_si128(_mm_set_epi64x(0, (long long)(c + 3)), rk[0]);
+        __m128i b3 = _mm_xor_si128(_mm_set_epi64x(0, (long long)(c + 4)), rk[0]);
+        __m128i b4 = _mm_xor_si128(_mm_set_epi64x(0, (long long)(c + 5)), rk[0]);
+        __m128i b5 = _mm_xor_si128(_mm_set_epi64x(0, (long long)(c + 6)), rk[0]);
+        __m128i b6 = _mm_xor_si128(_mm_set_epi64x(0, (long long)(c + 7)), rk[0]);
+        __m128i b7 = _mm_xor_si128(_mm_set_epi64x(0, (long long)(c + 8)), rk[0]);
+
+        for (r = 1; r < rounds; r++)
+            LK_AES_NI_ROUND(r);
+
+        b0 = _mm_aesenclast_si128(b0, rk[rounds]);
+        b1 = _mm_aesenclast_si128(b1, rk[rounds]);
+        b2 = _mm_aesenclast_si128(b2, rk[rounds]);
+        b3 = _mm_aesenclast_si128(b3, rk[rounds]);
+        b4 = _mm_aesenclast_si128(b4, rk[rounds]);
+        b5 = _mm_aesenclast_si128(b5, rk[rounds]);
+        b6 = _mm_aesenclast_si128(b6, rk[rounds]);
+        b7 = _mm_aesenclast_si128(b7, rk[rounds]);
+
+        LK_AES_NI_XOR(0, b0); LK_AES_NI_XOR(1, b1);
+        LK_AES_NI_XOR(2, b2); LK_AES_NI_XOR(3, b3);
+        LK_AES_NI_XOR(4, b4); LK_AES_NI_XOR(5, b5);
+        LK_AES_NI_XOR(6, b6); LK_AES_NI_XOR(7, b7);
+
+        c += 8;
+        buf += 8*16;
+        blocks -= 8;
+    }
+
+    while (blocks > 0)
+    {
+        __m128i b0 = _mm_xor_si128(_mm_set_epi64x(0, (long long)(c + 1)), rk[0]);
+        for (r = 1; r < rounds; r++)
+            b0 = _mm_aesenc_si128(b0, rk[r]);
+        b0 = _mm_aesenclast_si128(b0, rk[rounds]);
+        LK_AES_NI_XOR(0, b0);
+
+        c++;
+        buf += 16;
+        blocks--;
+    }
+
+    *counter = c;
+}
+
+local int lk_aes_has_aesni OF((void));
+local int lk_aes_has_aesni ()
+{
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        return 0;
+    return (ecx & bit_AES) && (edx & bit_SSE2);
+}
+
+#endif /* LK_AES_AESNI */
+
+/* ===========================================================================
+   AES with the ARMv8 crypto extensions, 4 blocks at a time
+*/
+
+#ifdef LK_AES_ARMV8
+
+#ifndef LK_AES_TARGET_CRYPTO
+#if defined(__clang__)
+#define LK_AES_TARGET_CRYPTO __attribute__((target("crypto")))
+#else
+#define LK_AES_TARGET_CRYPTO __attribute__((target("+crypto")))
+#endif
+#endif
+
+local void lk_aes_ctr_armv8 OF((const unsigned char* round_keys, int rounds,
+                                uint64_t* counter, unsigned char* buf, size_t blocks));
+LK_AES_TARGET_CRYPTO
+local void lk_aes_ctr_armv8 (const unsigned char* round_keys, int rounds,
+                             uint64_t* counter, unsigned char* buf, size_t blocks)
+{
+    uint8x16_t rk[15];
+    uint64_t c = *counter;
+    int r;
+
+    for (r = 0; r <= rounds; r++)
+        rk[r] = vld1q_u8(round_keys + 16*r);
+
+    /* vaeseq_u8 adds the round key before the substitution, so the last
+       round key is added on its own */
+    while (blocks >= 4)
+    {
+        uint8x16_t b0 = vreinterpretq_u8_u64(vcombine_u64(vcreate_u64(c + 1), vcreate_u64(0)));
+        uint8x16_t b1 = vreinterpretq_u8_u64(vcombine_u64(vcreate_u64(c + 2), vcreate_u64(0)));
+        uint8x16_t b2 = vreinterpretq_u8_u64(vcombine_u64(vcreate_u64(c + 3), vcreate_u64(0)));
+        uint8x16_t b3 = vreinterpretq_u8_u64(vcombine_u64(vcreate_u64(c + 4), vcreate_u64(0)));
+
+        for (r = 0; r < rounds - 1; r++)
+        {
+            b0 = vaesmcq_u8(vaeseq_u8(b0, rk[r]));
+            b1 = vaesmcq_u8(vaeseq_u8(b1, rk[r]));
+            b2 = vaesmcq_u8(vaeseq_u8(b2, rk[r]));
+            b3 = vaesmcq_u8(vaeseq_u8(b3, rk[r]));
+        }
+        b0 = veorq_u8(vaeseq_u8(b0, rk[rounds-1]), rk[rounds]);
+        b1 = veorq_u8(vaeseq_u8(b1, rk[rounds-1]), rk[rounds]);
+        b2 = veorq_u8(vaeseq_u8(b2, rk[rounds-1]), rk[rounds]);
+        b3 = veorq_u8(vaeseq_u8(b3, rk[rounds-1]), rk[rounds]);
+
+        vst1q_u8(buf, veorq_u8(vld1q_u8(buf), b0));
+        vst1q_u8(buf + 16, veorq_u8(vld1q_u8(buf + 16), b1));
+        vst1q_u8(buf + 32, veorq_u8(vld1q_u8(buf + 32), b2));
+        vst1q_u8(buf + 48, veorq_u8(vld1q_u8(buf + 48), b3));
+
+        c += 4;
+        buf += 4*16;
+        blocks -= 4;
+    }
+
+    while (blocks > 0)
+    {
+        uint8x16_t b0 = vreinterpretq_u8_u64(vcombine_u64(vcreate_u64(c + 1), vcreate_u64(0)));
+        for (r = 0; r < rounds - 1; r++)
+            b0 = vaesmcq_u8(vaeseq_u8(b0, rk[r]));
+        b0 = veorq_u8(vaeseq_u8(b0, rk[rounds-1]), rk[rounds]);
+        vst1q_u8(buf, veorq_u8(vld1q_u8(buf), b0));
+
+        c++;
+        buf += 16;
+        blocks--;
+    }
+
+    *counter = c;
+}
+
+local int lk_aes_has_armv8 OF((void));
+local int lk_aes_has_armv8 ()
+{
+#if defined(__ARM_FEATURE_CRYPTO) || defined(__ARM_FEATURE_AES)
+    return 1;
+#elif defined(__APPLE__)
+    int has_aes = 0;
+    size_t size = sizeof(has_aes);
+    if (sysctlbyname("hw.optional.arm.FEAT_AES", &has_aes, &size, NULL, 0) != 0)
+        return 0;
+    return has_aes;
+#elif defined(__linux__) && defined(__aarch64__)
+    return (getauxval(AT_HWCAP) & HWCAP_AES) != 0;
+#else
+    return 0;
+#endif
+}
+
+#endif /* LK_AES_ARMV8 */
+
+local lk_aes_ctr_func aes_ctr_impl = lk_aes_ctr_tables;
+local const char* aes_impl_name = "tables";
+
+local void lk_aes_init_impl OF((void));
+local void lk_aes_init_impl ()
+{
+    lk_aes_make_tables();
+#ifdef LK_AES_AESNI
+    if (lk_aes_has_aesni())
+    {
+        aes_ctr_impl = lk_aes_ctr_aesni;
+        aes_impl_name = "aesni";
+    }
+#endif
+#ifdef LK_AES_ARMV8
+    if (lk_aes_has_armv8())
+    {
+        aes_ctr_impl = lk_aes_ctr_armv8;
+        aes_impl_name = "armv8";
+    }
+#endif
+}
+
+#if (!defined(_WIN32)) && (!defined(WIN32))
+local pthread_once_t aes_once = PTHREAD_ONCE_INIT;
+#define LK_AES_INIT() pthread_once(&aes_once, lk_aes_init_impl)
+#else
+local volatile int aes_ready = 0;
+#define LK_AES_INIT() do { if (!aes_ready) { lk_aes_init_impl(); aes_ready = 1; } } while (0)
+#endif
+
+/* ===========================================================================
+   SHA-1 (FIPS 180-4), HMAC-SHA1 (RFC 2104) and PBKDF2 (RFC 8018)
+*/
+
+#define ROTL32(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+/* the rounds are unrolled and the message schedule kept in 16 words, the
+   HMAC of the data costs more than its AES-NI encryption otherwise */
+#define SHA1_W(i) (w[(i) & 15] = ROTL32(w[((i)-3) & 15] ^ w[((i)-8) & 15] ^ \
+                                         w[((i)-14) & 15] ^ w[(i) & 15], 1))
+#define SHA1_F1(b, c, d) ((d) ^ ((b) & ((c) ^ (d))))
+#define SHA1_F2(b, c, d) ((b) ^ (c) ^ (d))
+#define SHA1_F3(b, c, d) (((b) & (c)) | ((d) & ((b) | (c))))
+#define SHA1_ROUND(a, b, c, d, e, f, k, wi) \
+    do { (e) += ROTL32(a, 5) + f(b, c, d) + (k) + (wi); (b) = ROTL32(b, 30); } while (0)
+#define SHA1_ROUND5(i, f, k, wi) \
+    do { SHA1_ROUND(a, b, c, d, e, f, k, wi(i));   \
+         SHA1_ROUND(e, a, b, c, d, f, k, wi(i+1)); \
+         SHA1_ROUND(d, e, a, b, c, f, k, wi(i+2)); \
+         SHA1_ROUND(c, d, e, a, b, f, k, wi(i+3)); \
+         SHA1_ROUND(b, c, d, e, a, f, k, wi(i+4)); } while (0)
+#define SHA1_W0(i) (w[i])
+
+local void lk_sha1_compress OF((uint32_t* h, const unsigned char* block));
+local void lk_sha1_compress (uint32_t* h, const unsigned char* block)
+{
+    uint32_t w[16];
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+    int i;
+
+    for (i = 0; i < 16; i++)
+        w[i] = GETU32(block + 4*i);
+
+    SHA1_ROUND5(0, SHA1_F1, 0x5a827999UL, SHA1_W0);
+    SHA1_ROUND5(5, SHA1_F1, 0x5a827999UL, SHA1_W0);
+    SHA1_ROUND5(10, SHA1_F1, 0x5a827999UL, SHA1_W0);
+    SHA1_ROUND(a, b, c, d, e, SHA1_F1, 0x5a827999UL, w[15]);
+    SHA1_ROUND(e, a, b, c, d, SHA1_F1, 0x5a827999UL, SHA1_W(16));
+    SHA1_ROUND(d, e, a, b, c, SHA1_F1, 0x5a827999UL, SHA1_W(17));
+    SHA1_ROUND(c, d, e, a, b, SHA1_F1, 0x5a827999UL, SHA1_W(18));
+    SHA1_ROUND(b, c, d, e, a, SHA1_F1, 0x5a827999UL, SHA1_W(19));
+
+    SHA1_ROUND5(20, SHA1_F2, 0x6ed9eba1UL, SHA1_W);
+    SHA1_ROUND5(25, SHA1_F2, 0x6ed9eba1UL, SHA1_W);
+    SHA1_ROUND5(30, SHA1_F2, 0x6ed9eba1UL, SHA1_W);
+    SHA1_ROUND5(35, SHA1_F2, 0x6ed9eba1UL, SHA1_W);
+
+    SHA1_ROUND5(40, SHA1_F3, 0x8f1bbcdcUL, SHA1_W);
+    SHA1_ROUND5(45, SHA1_F3, 0x8f1bbcdcUL, SHA1_W);
+    SHA1_ROUND5(50, SHA1_F3, 0x8f1bbcdcUL, SHA1_W);
+    SHA1_ROUND5(55, SHA1_F3, 0x8f1bbcdcUL, SHA1_W);
+
+    SHA1_ROUND5(60, SHA1_F2, 0xca62c1d6UL, SHA1_W);
+    SHA1_ROUND5(65, SHA1_F2, 0xca62c1d6UL, SHA1_W);
+    SHA1_ROUND5(70, SHA1_F2, 0xca62c1d6UL, SHA1_W);
+    SHA1_ROUND5(75, SHA1_F2, 0xca62c1d6UL, SHA1_W);
+
+    h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+}
+
+local void lk_sha1_init OF((lk_sha1_ctx* ctx));
+local void lk_sha1_init (lk_sha1_ctx* ctx)
+{
+    ctx->h[0] = 0x67452301UL;
+    ctx->h[1] = 0xefcdab89UL;
+    ctx->h[2] = 0x98badcfeUL;
+    ctx->h[3] = 0x10325476UL;
+    ctx->h[4] = 0xc3d2e1f0UL;
+    ctx->used = 0;
+    ctx->length = 0;
+}
+
+local void lk_sha1_update OF((lk_sha1_ctx* ctx, const unsigned char* buf, size_t len));
+local void lk_sha1_update (lk_sha1_ctx* ctx, const unsigned char* buf, size_t len)
+{
+    ctx->length += len;
+    if (ctx->used > 0)
+    {
+        size_t n = 64 - ctx->used;
+        if (n > len)
+            n = len;
+        memcpy(ctx->block + ctx->used, buf, n);
+        ctx->used += (uInt)n;
+        buf += n;
+        len -= n;
+        if (ctx->used < 64)
+            return;
+        lk_sha1_compress(ctx->h, ctx->block);
+        ctx->used = 0;
+    }
+    while (len >= 64)
+    {
+        lk_sha1_compress(ctx->h, buf);
+        buf += 64;
+        len -= 64;
+    }
+    if (len > 0)
+    {
+        memcpy(ctx->block, buf, len);
+        ctx->used = (uInt)len;
+    }
+}
+
+local void lk_sha1_final OF((lk_sha1_ctx* ctx, unsigned char* digest));
+local void lk_sha1_final (lk_sha1_ctx* ctx, unsigned char* digest)
+{
+    uint64_t bits = ctx->length * 8;
+    int i;
+
+    ctx->block[ctx->used++] = 0x80;
+    if (ctx->used > 56)
+    {
+        memset(ctx->block + ctx->used, 0, 64 - ctx->used);
+        lk_sha1_compress(ctx->h, ctx->block);
+        ctx->used = 0;
+    }
+    memset(ctx->block + ctx->used, 0, 56 - ctx->used);
+    for (i = 0; i < 8; i++)
+        ctx->block[56 + i] = (unsigned char)(bits >> (56 - 8*i));
+    lk_sha1_compress(ctx->h, ctx->block);
+
+    for (i = 0; i < 5; i++)
+        PUTU32(digest + 4*i, ctx->h[i]);
+}
+
+/* inner and outer are the states after the key xored with the pads, which
+   every HMAC with this key starts from */
+local void lk_hmac_sha1_init OF((lk_sha1_ctx* inner, lk_sha1_ctx* outer,
+                                 const unsigned char* key, size_t key_len));
+local void lk_hmac_sha1_init (lk_sha1_ctx* inner, lk_sha1_ctx* outer,
+                              const unsigned char* key, size_t key_len)
+{
+    unsigned char pad[64];
+    unsigned char key_digest[20];
+    size_t i;
+
+    if (key_len > 64)
+    {
+        lk_sha1_init(inner);
+        lk_sha1_update(inner, key, key_len);
+        lk_sha1_final(inner, key_digest);
+        key = key_digest;
+        key_len = 20;
+    }
+
+    memset(pad, 0x36, 64);
+    for (i = 0; i < key_len; i++)
+        pad[i] ^= key[i];
+    lk_sha1_init(inner);
+    lk_sha1_update(inner, pad, 64);
+
+    for (i = 0; i < 64; i++)
+        pad[i] ^= 0x36 ^ 0x5c;
+    lk_sha1_init(outer);
+    lk_sha1_update(outer, pad, 64);
+
+    lk_aes_wipe(pad, sizeof(pad));
+    lk_aes_wipe(key_digest, sizeof(key_digest));
+}
+
+local void lk_hmac_sha1_final OF((lk_sha1_ctx* inner, const lk_sha1_ctx* outer, unsigned char* mac));
+local void lk_hmac_sha1_final (lk_sha1_ctx* inner, const lk_sha1_ctx* outer, unsigned char* mac)
+{
+    unsigned char digest[20];
+    lk_sha1_ctx o = *outer;
+
+    lk_sha1_final(inner, digest);
+    lk_sha1_update(&o, digest, 20);
+    lk_sha1_final(&o, mac);
+}
+
+local void lk_pbkdf2_sha1 OF((const unsigned char* password, size_t password_len,
+                              const unsigned char* salt, size_t salt_len,
+                              unsigned char* out, size_t out_len));
+local void lk_pbkdf2_sha1 (const unsigned char* password, size_t password_len,
+                           const unsigned char* salt, size_t salt_len,
+                           unsigned char* out, size_t out_len)
+{
+    lk_sha1_ctx inner, outer, c;
+    unsigned char u[20], t[20], index[4];
+    uint32_t block;
+    int i, j;
+
+    lk_hmac_sha1_init(&inner, &outer, password, password_len);
+    for (block = 1; out_len > 0; block++)
+    {
+        size_t n = (out_len < 20) ? out_len : 20;
+
+        c = inner;
+        lk_sha1_update(&c, salt, salt_len);
+        PUTU32(index, block);
+        lk_sha1_update(&c, index, 4);
+        lk_hmac_sha1_final(&c, &outer, u);
+        memcpy(t, u, 20);
+
+        for (i = 1; i < LK_AES_KEYING_ITERATIONS; i++)
+        {
+            c = inner;
+            lk_sha1_update(&c, u, 20);
+            lk_hmac_sha1_final(&c, &outer, u);
+            for (j = 0; j < 20; j++)
+                t[j] ^= u[j];
+        }
+
+        memcpy(out, t, n);
+        out += n;
+        out_len -= n;
+    }
+
+    lk_aes_wipe(&inner, sizeof(inner));
+    lk_aes_wipe(&outer, sizeof(outer));
+    lk_aes_wipe(&c, sizeof(c));
+    lk_aes_wipe(u, sizeof(u));
+    lk_aes_wipe(t, sizeof(t));
+}
+
+/* ===========================================================================
+   WinZip AES
+*/
+
+extern int ZEXPORT lk_aes_init (lk_aes_ctx* ctx, const char* password, int strength,
+                                const unsigned char* salt, unsigned char* pwverify)
+{
+    unsigned char derived[2*32 + LK_AES_PWVERIFY_SIZE];
+    int key_size;
+
+    if ((ctx == NULL) || (password == NULL) || (strength < LK_AES_STRENGTH_128) ||
+        (strength > LK_AES_STRENGTH_256))
+        return Z_STREAM_ERROR;
+    LK_AES_INIT();
+
+    /* the AES key, the HMAC key and the password verifier */
+    key_size = 8 + 8*strength;
+    lk_pbkdf2_sha1((const unsigned char*)password, strlen(password),
+                   salt, LK_AES_SALT_SIZE(strength),
+                   derived, 2*key_size + LK_AES_PWVERIFY_SIZE);
+
+    ctx->rounds = 6 + key_size/4;
+    lk_aes_expand_key(derived, key_size/4, ctx->round_keys, ctx->rounds);
+    lk_hmac_sha1_init(&ctx->hmac_inner, &ctx->hmac_outer, derived + key_size, key_size);
+    memcpy(pwverify, derived + 2*key_size, LK_AES_PWVERIFY_SIZE);
+    ctx->counter = 0;
+    ctx->key_stream_pos = 16;
+
+    lk_aes_wipe(derived, sizeof(derived));
+    return Z_OK;
+}
+
+local void lk_aes_crypt OF((lk_aes_ctx* ctx, unsigned char* buf, size_t len));
+local void lk_aes_crypt (lk_aes_ctx* ctx, unsigned char* buf, size_t len)
+{
+    size_t blocks;
+
+    /* the end of the key stream block started by the previous call */
+    while ((len > 0) && (ctx->key_stream_pos < 16))
+    {
+        *buf++ ^= ctx->key_stream[ctx->key_stream_pos++];
+        len--;
+    }
+
+    blocks = len / 16;
+    if (blocks > 0)
+    {
+        (*aes_ctr_impl)(ctx->round_keys, ctx->rounds, &ctx->counter, buf, blocks);
+        buf += 16*blocks;
+        len -= 16*blocks;
+    }
+
+    if (len > 0)
+    {
+        memset(ctx->key_stream, 0, 16);
+        (*aes_ctr_impl)(ctx->round_keys, ctx->rounds, &ctx->counter, ctx->key_stream, 1);
+        for (ctx->key_stream_pos = 0; ctx->key_stream_pos < len; ctx->key_stream_pos++)
+            buf[ctx->key_stream_pos] ^= ctx->key_stream[ctx->key_stream_pos];
+    }
+}
+
+extern void ZEXPORT lk_aes_encrypt (lk_aes_ctx* ctx, unsigned char* buf, uLong len)
+{
+    lk_aes_crypt(ctx, buf, (size_t)len);
+    lk_sha1_update(&ctx->hmac_inner, buf, (size_t)len);
+}
+
+extern void ZEXPORT lk_aes_decrypt (lk_aes_ctx* ctx, unsigned char* buf, uLong len)
+{
+    lk_sha1_update(&ctx->hmac_inner, buf, (size_t)len);
+    lk_aes_crypt(ctx, buf, (size_t)len);
+}
+
+extern void ZEXPORT lk_aes_finish (lk_aes_ctx* ctx, unsigned char* authcode)
+{
+    unsigned char mac[20];
+
+    lk_hmac_sha1_final(&ctx->hmac_inner, &ctx->hmac_outer, mac);
+    memcpy(authcode, mac, LK_AES_AUTHCODE_SIZE);
+
+    lk_aes_wipe(mac, sizeof(mac));
+    lk_aes_wipe(ctx, sizeof(lk_aes_ctx));
+}
+
+extern int ZEXPORT lk_aes_random (unsigned char* buf, uLong len)
+{
+#if defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__)
+    arc4random_buf(buf, (size_t)len);
+    return Z_OK;
+#elif defined(_WIN32) || defined(WIN32)
+    while (len > 0)
+    {
+        unsigned int r;
+        uLong n = (len < sizeof(r)) ? len : sizeof(r);
+        if (rand_s(&r) != 0)
+            return Z_ERRNO;
+        memcpy(buf, &r, n);
+        buf += n;
+        len -= n;
+    }
+    return Z_OK;
+#else
+    FILE* f = fopen("/dev/urandom", "rb");
+    size_t got;
+    if (f == NULL)
+        return Z_ERRNO;
+    got = fread(buf, 1, (size_t)len, f);
+    fclose(f);
+    return (got == (size_t)len) ? Z_OK : Z_ERRNO;
+#endif
+}
+
+extern const char* ZEXPORT lk_aes_implementation ()
+{
+    LK_AES_INIT();
+    return aes_impl_name;
+}
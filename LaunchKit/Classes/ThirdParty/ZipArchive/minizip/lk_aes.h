@@ -0,0 +1,103 @@
+/* lk_aes.h -- WinZip AES encryption for the Minizip zip and unzip code
+
+   Entries encrypted as described in http://www.winzip.com/aes_info.htm
+   (AE-1 and AE-2): their compression method is 99, an extra field 0x9901
+   gives the AES key size and the real compression method, and the data is
+
+     salt | password verifier (2 bytes) | AES-CTR data | HMAC-SHA1 (10 bytes)
+
+   The AES and HMAC keys and the verifier come from the password and the
+   salt with PBKDF2-HMAC-SHA1 (1000 iterations). AES uses the AES
+   instructions of the processor when it has them (x86 AES-NI, ARMv8
+   crypto extensions), and lookup tables otherwise. The implementation is
+   chosen once, at the first call.
+
+   License: Same as ZLIB (www.gzip.org)
+*/
+
+#ifndef _LK_AES_H
+#define _LK_AES_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#ifndef _ZLIB_H
+#include "zlib.h"
+#endif
+
+#define LK_AES_METHOD           (99)      /* compression method of AES entries */
+#define LK_AES_EXTRAFIELD_ID    (0x9901)
+#define LK_AES_EXTRAFIELD_SIZE  (7)       /* data size of the extra field */
+#define LK_AES_VERSION_AE1      (1)       /* the crc of the data is stored */
+#define LK_AES_VERSION_AE2      (2)       /* the crc is 0, only the HMAC checks the data */
+
+#define LK_AES_STRENGTH_128     (1)       /* key size, as in the extra field */
+#define LK_AES_STRENGTH_192     (2)
+#define LK_AES_STRENGTH_256     (3)
+
+#define LK_AES_SALT_SIZE(strength) (4 + 4 * (strength))
+#define LK_AES_PWVERIFY_SIZE    (2)
+#define LK_AES_AUTHCODE_SIZE    (10)
+
+typedef struct lk_sha1_ctx_s
+{
+    uint32_t h[5];
+    unsigned char block[64];
+    uInt used;                  /* bytes in block */
+    uint64_t length;            /* bytes hashed */
+} lk_sha1_ctx;
+
+typedef struct lk_aes_ctx_s
+{
+    unsigned char round_keys[15*16];
+    int rounds;
+    uint64_t counter;           /* of the last block of key stream */
+    unsigned char key_stream[16];
+    uInt key_stream_pos;        /* 16 when key_stream is used up */
+    lk_sha1_ctx hmac_inner;     /* HMAC-SHA1 of the encrypted data */
+    lk_sha1_ctx hmac_outer;
+} lk_aes_ctx;
+
+extern int ZEXPORT lk_aes_init OF((lk_aes_ctx* ctx, const char* password, int strength,
+                                   const unsigned char* salt, unsigned char* pwverify));
+/*
+  Derive the keys of an entry from its password and salt
+  (LK_AES_SALT_SIZE(strength) bytes). Set the LK_AES_PWVERIFY_SIZE bytes
+  of pwverify, which a reader compares with the ones of the entry and a
+  writer writes after the salt.
+  Return Z_OK, or Z_STREAM_ERROR if strength is not valid.
+*/
+
+extern void ZEXPORT lk_aes_encrypt OF((lk_aes_ctx* ctx, unsigned char* buf, uLong len));
+extern void ZEXPORT lk_aes_decrypt OF((lk_aes_ctx* ctx, unsigned char* buf, uLong len));
+/*
+  Encrypt or decrypt the next len bytes of the entry in place, and add the
+  encrypted bytes to the HMAC. Any len can be given.
+*/
+
+extern void ZEXPORT lk_aes_finish OF((lk_aes_ctx* ctx, unsigned char* authcode));
+/*
+  Set the LK_AES_AUTHCODE_SIZE bytes of authcode, which follow the data of
+  the entry, and erase the keys from ctx.
+*/
+
+extern int ZEXPORT lk_aes_random OF((unsigned char* buf, uLong len));
+/*
+  Fill buf with len bytes from the random generator of the system, for
+  salts. Return Z_OK, or Z_ERRNO if no random bytes could be read.
+*/
+
+extern const char* ZEXPORT lk_aes_implementation OF((void));
+/*
+  Return the name of the AES implementation used on this processor
+  ("armv8", "aesni" or "tables").
+*/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _LK_AES_H */
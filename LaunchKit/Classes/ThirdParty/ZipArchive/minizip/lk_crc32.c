@@ -0,0 +1,344 @@
+/* lk_crc32.c -- CRC-32 engine for the Minizip zip and unzip code
+
+   The x86 kernel folds 64 bytes at a time with carry-less multiplication,
+   following "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ
+   Instruction" (Gopal et al., Intel, 2009). The ARMv8 kernel uses the
+   CRC32 instructions, which implement the zip polynomial directly. Both
+   fall back on slice-by-8 for what they do not handle.
+
+   License: Same as ZLIB (www.gzip.org)
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "zlib.h"
+#include "lk_crc32.h"
+
+#if (!defined(_WIN32)) && (!defined(WIN32))
+#include <pthread.h>
+#endif
+
+#if defined(__APPLE__)
+#include <sys/types.h>
+#include <sys/sysctl.h>
+#endif
+
+/* the kernels are chosen by the target; LK_CRC32_ARMV8 can also be defined
+   to build the ARMv8 one elsewhere, on stand-ins of its intrinsics */
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define LK_CRC32_PCLMUL
+#include <cpuid.h>
+#include <emmintrin.h>
+#include <smmintrin.h>
+#include <wmmintrin.h>
+#endif
+
+#if defined(__aarch64__) && (defined(__GNUC__) || defined(__clang__)) && !defined(LK_CRC32_ARMV8)
+#define LK_CRC32_ARMV8
+#endif
+
+#ifdef LK_CRC32_ARMV8
+#include <arm_acle.h>
+#if defined(__linux__)
+#include <sys/auxv.h>
+#ifndef HWCAP_CRC32
+#define HWCAP_CRC32 (1 << 7)
+#endif
+#endif
+#endif
+
+#ifndef local
+#  define local static
+#endif
+
+typedef uint32_t (*lk_crc32_func) OF((uint32_t crc, const unsigned char *buf, size_t len));
+
+/* CRC-32 of zip, reflected */
+#define LK_CRC32_POLY 0xedb88320UL
+
+local uint32_t crc_table[8][256];
+
+local void lk_crc32_make_table OF((void));
+local void lk_crc32_make_table ()
+{
+    uint32_t c;
+    int n, k;
+
+    for (n = 0; n < 256; n++)
+    {
+        c = (uint32_t)n;
+        for (k = 0; k < 8; k++)
+            c = (c & 1) ? (LK_CRC32_POLY ^ (c >> 1)) : (c >> 1);
+        crc_table[0][n] = c;
+    }
+    for (n = 0; n < 256; n++)
+    {
+        c = crc_table[0][n];
+        for (k = 1; k < 8; k++)
+        {
+            c = crc_table[0][c & 0xff] ^ (c >> 8);
+            crc_table[k][n] = c;
+        }
+    }
+}
+
+/* slice-by-8: eight table lookups per eight bytes, independent of endianness */
+local uint32_t lk_crc32_slice8 OF((uint32_t crc, const unsigned char *buf, size_t len));
+local uint32_t lk_crc32_slice8 (uint32_t crc, const unsigned char *buf, size_t len)
+{
+    while (len >= 8)
+    {
+        crc ^= (uint32_t)buf[0] | ((uint32_t)buf[1] << 8) |
+               ((uint32_t)buf[2] << 16) | ((uint32_t)buf[3] << 24);
+        crc = crc_table[7][crc & 0xff] ^
+              crc_table[6][(crc >> 8) & 0xff] ^
+              crc_table[5][(crc >> 16) & 0xff] ^
+              crc_table[4][crc >> 24] ^
+              crc_table[3][buf[4]] ^
+              crc_table[2][buf[5]] ^
+              crc_table[1][buf[6]] ^
+              crc_table[0][buf[7]];
+        buf += 8;
+        len -= 8;
+    }
+    while (len--)
+        crc = crc_table[0][(crc ^ *buf++) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+#ifdef LK_CRC32_PCLMUL
+
+/* the kernel needs at least 64 bytes, and consumes multiples of 16 */
+#define LK_CRC32_PCLMUL_MIN 64
+
+local uint32_t lk_crc32_pclmul OF((uint32_t crc, const unsigned char *buf, size_t len));
+__attribute__((target("pclmul,sse4.1")))
+local uint32_t lk_crc32_pclmul (uint32_t crc, const unsigned char *buf, size_t len)
+{
+    /* folding constants x^(4*128+32) mod P, x^(4*128-32) mod P, etc,
+       and the Barrett constants, bit reflected (from the paper) */
+    static const uint64_t k1k2[2] __attribute__((aligned(16))) = { 0x0154442bd4ULL, 0x01c6e41596ULL };
+    static const uint64_t k3k4[2] __attribute__((aligned(16))) = { 0x01751997d0ULL, 0x00ccaa009eULL };
+    static const uint64_t k5k0[2] __attribute__((aligned(16))) = { 0x0163cd6124ULL, 0x0000000000ULL };
+    static const uint64_t poly[2] __attribute__((aligned(16))) = { 0x01db710641ULL, 0x01f7011641ULL };
+    size_t tail;
+    __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+    if (len < LK_CRC32_PCLMUL_MIN)
+        return lk_crc32_slice8(crc, buf, len);
+
+    tail = len & 15;
+    len -= tail;
+
+    x1 = _mm_loadu_si128((const __m128i *)(buf + 0x00));
+    x2 = _mm_loadu_si128((const __m128i *)(buf + 0x10));
+    x3 = _mm_loadu_si128((const __m128i *)(buf + 0x20));
+    x4 = _mm_loadu_si128((const __m128i *)(buf + 0x30));
+
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)crc));
+
+    x0 = _mm_load_si128((const __m128i *)k1k2);
+
+    buf += 64;
+    len -= 64;
+
+    /* fold four blocks of 16 in parallel */
+    while (len >= 64)
+    {
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+        x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+        x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+
+        y5 = _mm_loadu_si128((const __m128i *)(buf + 0x00));
+        y6 = _mm_loadu_si128((const __m128i *)(buf + 0x10));
+        y7 = _mm_loadu_si128((const __m128i *)(buf + 0x20));
+        y8 = _mm_loadu_si128((const __m128i *)(buf + 0x30));
+
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+
+        buf += 64;
+        len -= 64;
+    }
+
+    /* fold the four lanes into one */
+    x0 = _mm_load_si128((const __m128i *)k3k4);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+    /* remaining blocks of 16 */
+    while (len >= 16)
+    {
+        x2 = _mm_loadu_si128((const __m128i *)buf);
+
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+        buf += 16;
+        len -= 16;
+    }
+
+    /* fold 128 bits to 64 bits */
+    x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+    x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+    x1 = _mm_srli_si128(x1, 8);
+    x1 = _mm_xor_si128(x1, x2);
+
+    x0 = _mm_loadl_epi64((const __m128i *)k5k0);
+
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, x3);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    /* Barrett reduction to 32 bits */
+    x0 = _mm_load_si128((const __m128i *)poly);
+
+    x2 = _mm_and_si128(x1, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+    x2 = _mm_and_si128(x2, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    crc = (uint32_t)_mm_extract_epi32(x1, 1);
+
+    return lk_crc32_slice8(crc, buf, tail);
+}
+
+local int lk_crc32_has_pclmul OF((void));
+local int lk_crc32_has_pclmul ()
+{
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        return 0;
+    return (ecx & bit_PCLMUL) && (ecx & bit_SSE4_1);
+}
+
+#endif /* LK_CRC32_PCLMUL */
+
+#ifdef LK_CRC32_ARMV8
+
+#ifndef LK_CRC32_TARGET_CRC
+#if defined(__clang__)
+#define LK_CRC32_TARGET_CRC __attribute__((target("crc")))
+#else
+#define LK_CRC32_TARGET_CRC __attribute__((target("+crc")))
+#endif
+#endif
+
+local uint32_t lk_crc32_armv8 OF((uint32_t crc, const unsigned char *buf, size_t len));
+LK_CRC32_TARGET_CRC
+local uint32_t lk_crc32_armv8 (uint32_t crc, const unsigned char *buf, size_t len)
+{
+    uint64_t v;
+
+    while ((len > 0) && (((uintptr_t)buf & 7) != 0))
+    {
+        crc = __crc32b(crc, *buf++);
+        len--;
+    }
+    while (len >= 32)
+    {
+        memcpy(&v, buf, 8);      crc = __crc32d(crc, v);
+        memcpy(&v, buf + 8, 8);  crc = __crc32d(crc, v);
+        memcpy(&v, buf + 16, 8); crc = __crc32d(crc, v);
+        memcpy(&v, buf + 24, 8); crc = __crc32d(crc, v);
+        buf += 32;
+        len -= 32;
+    }
+    while (len >= 8)
+    {
+        memcpy(&v, buf, 8);
+        crc = __crc32d(crc, v);
+        buf += 8;
+        len -= 8;
+    }
+    while (len--)
+        crc = __crc32b(crc, *buf++);
+    return crc;
+}
+
+local int lk_crc32_has_armv8 OF((void));
+local int lk_crc32_has_armv8 ()
+{
+#if defined(__ARM_FEATURE_CRC32)
+    return 1;
+#elif defined(__APPLE__)
+    int has_crc32 = 0;
+    size_t size = sizeof(has_crc32);
+    if (sysctlbyname("hw.optional.armv8_crc32", &has_crc32, &size, NULL, 0) != 0)
+        return 0;
+    return has_crc32;
+#elif defined(__linux__) && defined(__aarch64__)
+    return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+#else
+    return 0;
+#endif
+}
+
+#endif /* LK_CRC32_ARMV8 */
+
+local lk_crc32_func crc32_impl = lk_crc32_slice8;
+local const char* crc32_impl_name = "slice8";
+
+local void lk_crc32_init OF((void));
+local void lk_crc32_init ()
+{
+    lk_crc32_make_table();
+#ifdef LK_CRC32_PCLMUL
+    if (lk_crc32_has_pclmul())
+    {
+        crc32_impl = lk_crc32_pclmul;
+        crc32_impl_name = "pclmul";
+    }
+#endif
+#ifdef LK_CRC32_ARMV8
+    if (lk_crc32_has_armv8())
+    {
+        crc32_impl = lk_crc32_armv8;
+        crc32_impl_name = "armv8";
+    }
+#endif
+}
+
+#if (!defined(_WIN32)) && (!defined(WIN32))
+local pthread_once_t crc32_once = PTHREAD_ONCE_INIT;
+#define LK_CRC32_INIT() pthread_once(&crc32_once, lk_crc32_init)
+#else
+local volatile int crc32_ready = 0;
+#define LK_CRC32_INIT() do { if (!crc32_ready) { lk_crc32_init(); crc32_ready = 1; } } while (0)
+#endif
+
+extern uLong ZEXPORT lk_crc32 (uLong crc, const Bytef *buf, uInt len)
+{
+    if (buf == Z_NULL)
+        return 0;
+    LK_CRC32_INIT();
+    return (uLong)~(*crc32_impl)(~(uint32_t)crc, (const unsigned char*)buf, (size_t)len);
+}
+
+extern const char* ZEXPORT lk_crc32_implementation ()
+{
+    LK_CRC32_INIT();
+    return crc32_impl_name;
+}
@@ -0,0 +1,39 @@
+/* lk_crc32.h -- CRC-32 engine for the Minizip zip and unzip code
+
+   Same result as zlib's crc32(), computed with the CRC instructions of
+   the processor when it has them (ARMv8 CRC32, x86 PCLMULQDQ folding),
+   and with a slice-by-8 table otherwise. The implementation is chosen
+   once, at the first call.
+
+   License: Same as ZLIB (www.gzip.org)
+*/
+
+#ifndef _LK_CRC32_H
+#define _LK_CRC32_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef _ZLIB_H
+#include "zlib.h"
+#endif
+
+extern uLong ZEXPORT lk_crc32 OF((uLong crc, const Bytef *buf, uInt len));
+/*
+  Update a running CRC-32 with the bytes buf[0..len-1] and return the
+  updated CRC-32, exactly as crc32() from zlib. If buf is Z_NULL, this
+  function returns the required initial value for the crc.
+*/
+
+extern const char* ZEXPORT lk_crc32_implementation OF((void));
+/*
+  Return the name of the implementation lk_crc32 uses on this processor
+  ("armv8", "pclmul" or "slice8").
+*/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _LK_CRC32_H */
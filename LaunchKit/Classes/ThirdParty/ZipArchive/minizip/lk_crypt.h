@@ -23,8 +23,12 @@
    This code support the "Traditional PKWARE Encryption".
 
    The new AES encryption added on Zip format by Winzip (see the page
-   http://www.winzip.com/aes_info.htm ) and PKWare PKZip 5.x Strong
-   Encryption is not supported.
+   http://www.winzip.com/aes_info.htm ) is in lk_aes.c. PKWare PKZip 5.x
+   Strong Encryption is not supported.
+
+   pcrc_32_tab is the table of get_crc_table(), whose entries are z_crc_t
+   (32 bits); reading them as unsigned long gave wrong keys on 64-bit
+   systems, which could not decrypt the files of other zip tools.
 */
 
 #define CRC32(c, b) ((*(pcrc_32_tab+(((int)(c) ^ (b)) & 0xff))) ^ ((c) >> 8))
@@ -32,7 +36,7 @@
 /***********************************************************************
  * Return the next byte in the pseudo-random sequence
  */
-static int decrypt_byte(unsigned long* pkeys, const unsigned long* pcrc_32_tab)
+static inline int decrypt_byte(unsigned long* pkeys, const z_crc_t* pcrc_32_tab)
 {
     unsigned temp;  /* POTENTIAL BUG:  temp*(temp^1) may overflow in an
                      * unpredictable manner on 16-bit systems; not a problem
@@ -45,7 +49,7 @@ static int decrypt_byte(unsigned long* pkeys, const unsigned long* pcrc_32_tab)
 /***********************************************************************
  * Update the encryption keys with the next byte of plain text
  */
-static int update_keys(unsigned long* pkeys,const unsigned long* pcrc_32_tab,int c)
+static int update_keys(unsigned long* pkeys,const z_crc_t* pcrc_32_tab,int c)
 {
     (*(pkeys+0)) = CRC32((*(pkeys+0)), c);
     (*(pkeys+1)) += (*(pkeys+0)) & 0xff;
@@ -62,7 +66,7 @@ static int update_keys(unsigned long* pkeys,const unsigned long* pcrc_32_tab,int
  * Initialize the encryption keys and the random header according to
  * the given password.
  */
-static void init_keys(const char* passwd,unsigned long* pkeys,const unsigned long* pcrc_32_tab)
+static void init_keys(const char* passwd,unsigned long* pkeys,const z_crc_t* pcrc_32_tab)
 {
     *(pkeys+0) = 305419896L;
     *(pkeys+1) = 591751049L;
@@ -79,8 +83,60 @@ static void init_keys(const char* passwd,unsigned long* pkeys,const unsigned lon
 #define zencode(pkeys,pcrc_32_tab,c,t) \
     (t=decrypt_byte(pkeys,pcrc_32_tab), update_keys(pkeys,pcrc_32_tab,c), t^(c))
 
+/***********************************************************************
+ * Decrypt or encrypt len bytes of buf in place. Same as zdecode and
+ * zencode on each byte, but the keys stay in local variables for the whole
+ * buffer: through pkeys the compiler has to store and load them again for
+ * every byte, as the bytes of buf may alias them. The keys are computed on
+ * 32 bits, which gives the low 32 bits of the unsigned long ones.
+ */
+#define CRYPT_BLOCK_UPDATE_KEYS(c) \
+    { \
+      k0 = (uInt)pcrc_32_tab[(k0 ^ (c)) & 0xff] ^ (k0 >> 8); \
+      k1 = (k1 + (k0 & 0xff)) * 134775813U + 1; \
+      k2 = (uInt)pcrc_32_tab[(k2 ^ (k1 >> 24)) & 0xff] ^ (k2 >> 8); \
+    }
+
+static inline void decrypt_block(unsigned long* pkeys, const z_crc_t* pcrc_32_tab,
+                                 unsigned char* buf, uLong len)
+{
+    uInt k0 = (uInt)pkeys[0], k1 = (uInt)pkeys[1], k2 = (uInt)pkeys[2];
+    uLong i;
+
+    for (i = 0; i < len; i++)
+    {
+        uInt temp = (k2 & 0xffff) | 2;
+        uInt c = buf[i] ^ (((temp * (temp ^ 1)) >> 8) & 0xff);
+        buf[i] = (unsigned char)c;
+        CRYPT_BLOCK_UPDATE_KEYS(c)
+    }
+    pkeys[0] = k0;
+    pkeys[1] = k1;
+    pkeys[2] = k2;
+}
+
+static inline void encrypt_block(unsigned long* pkeys, const z_crc_t* pcrc_32_tab,
+                                 unsigned char* buf, uLong len)
+{
+    uInt k0 = (uInt)pkeys[0], k1 = (uInt)pkeys[1], k2 = (uInt)pkeys[2];
+    uLong i;
+
+    for (i = 0; i < len; i++)
+    {
+        uInt temp = (k2 & 0xffff) | 2;
+        uInt c = buf[i];
+        buf[i] = (unsigned char)(c ^ (((temp * (temp ^ 1)) >> 8) & 0xff));
+        CRYPT_BLOCK_UPDATE_KEYS(c)
+    }
+    pkeys[0] = k0;
+    pkeys[1] = k1;
+    pkeys[2] = k2;
+}
+
 #ifdef INCLUDECRYPTINGCODE_IFCRYPTALLOWED
 
+#include "lk_aes.h"
+
 #define RAND_HEAD_LEN  12
    /* "last resort" source for second part of crypt seed pattern */
 #  ifndef ZCR_SEED2
@@ -91,7 +147,7 @@ static int crypthead(const char* passwd,      /* password string */
                      unsigned char* buf,      /* where to write header */
                      int bufSize,
                      unsigned long* pkeys,
-                     const unsigned long* pcrc_32_tab,
+                     const z_crc_t* pcrc_32_tab,
                      unsigned long crcForCrypting)
 {
     int n;                       /* index in random header */
@@ -103,19 +159,22 @@ static int crypthead(const char* passwd,      /* password string */
     if (bufSize<RAND_HEAD_LEN)
       return 0;
 
-    /* First generate RAND_HEAD_LEN-2 random bytes. We encrypt the
-     * output of rand() to get less predictability, since rand() is
-     * often poorly implemented.
+    /* First generate RAND_HEAD_LEN-2 random bytes, from the random generator
+     * of the system. If it can not be read, we encrypt the output of rand()
+     * to get less predictability, since rand() is often poorly implemented.
      */
-    if (++calls == 1)
-    {
-        srand((unsigned)(time(NULL) ^ ZCR_SEED2));
-    }
-    init_keys(passwd, pkeys, pcrc_32_tab);
-    for (n = 0; n < RAND_HEAD_LEN-2; n++)
+    if (lk_aes_random(header, RAND_HEAD_LEN-2) != Z_OK)
     {
-        c = (rand() >> 7) & 0xff;
-        header[n] = (unsigned char)zencode(pkeys, pcrc_32_tab, c, t);
+      if (++calls == 1)
+      {
+          srand((unsigned)(time(NULL) ^ ZCR_SEED2));
+      }
+      init_keys(passwd, pkeys, pcrc_32_tab);
+      for (n = 0; n < RAND_HEAD_LEN-2; n++)
+      {
+          c = (rand() >> 7) & 0xff;
+          header[n] = (unsigned char)zencode(pkeys, pcrc_32_tab, c, t);
+      }
     }
     /* Encrypt random header (last two bytes is high word of crc) */
     init_keys(passwd, pkeys, pcrc_32_tab);
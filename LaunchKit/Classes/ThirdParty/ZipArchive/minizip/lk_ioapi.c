@@ -16,6 +16,21 @@
 
 #include "lk_ioapi.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+#if (!defined(_WIN32)) && (!defined(WIN32))
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
 voidpf call_zopen64 (const zlib_filefunc64_32_def* pfilefunc,const void*filename,int mode)
 {
     if (pfilefunc->zfile_func64.zopen64_file != NULL)
@@ -54,6 +69,111 @@ ZPOS64_T call_ztell64 (const zlib_filefunc64_32_def* pfilefunc,voidpf filestream
     }
 }
 
+const void* call_zmap64 (const zlib_filefunc64_32_def* pfilefunc,voidpf filestream, ZPOS64_T* psize)
+{
+    *psize = 0;
+    if (pfilefunc->zmap64_file == NULL)
+        return NULL;
+    return (*(pfilefunc->zmap64_file)) (pfilefunc->zfile_func64.opaque,filestream,psize);
+}
+
+uLong call_zpread64 (const zlib_filefunc64_32_def* pfilefunc,voidpf filestream, void* buf, uLong size, ZPOS64_T offset)
+{
+    if (pfilefunc->zpread64_file != NULL)
+        return (*(pfilefunc->zpread64_file)) (pfilefunc->zfile_func64.opaque,filestream,buf,size,offset);
+    if (call_zseek64(pfilefunc,filestream,offset,ZLIB_FILEFUNC_SEEK_SET) != 0)
+        return 0;
+    return ZREAD64(*pfilefunc,filestream,buf,size);
+}
+
+/* the end of central directory record is followed by a comment of at most
+   0xffff bytes, and preceded by the 20 bytes of the zip64 locator */
+#define SIZE_TRAILER_SEARCH (0xffff + 22 + 20)
+
+/* Return the offset of the last "PK" c2 c3 signature in buf[0..len-1],
+   or -1. Sixteen candidates are tested at once where SIMD is available. */
+static long search_signature_backward (const unsigned char* buf, long len, unsigned char c2, unsigned char c3)
+{
+    long i = len - 4;   /* last position where a signature fits */
+#if defined(__SSE2__) || defined(__ARM_NEON) || defined(__ARM_NEON__)
+    while (i >= 15)
+    {
+        long block = i - 15;
+        int bit;
+#if defined(__SSE2__)
+        __m128i first = _mm_loadu_si128((const __m128i*)(buf + block));
+        __m128i second = _mm_loadu_si128((const __m128i*)(buf + block + 1));
+        int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(first, _mm_set1_epi8(0x50)),
+                                                   _mm_cmpeq_epi8(second, _mm_set1_epi8(0x4b))));
+        if (mask != 0)
+#else
+        uint8x16_t first = vld1q_u8(buf + block);
+        uint8x16_t second = vld1q_u8(buf + block + 1);
+        uint8x16_t match = vandq_u8(vceqq_u8(first, vdupq_n_u8(0x50)), vceqq_u8(second, vdupq_n_u8(0x4b)));
+        uint64x2_t halves = vreinterpretq_u64_u8(match);
+        if ((vgetq_lane_u64(halves, 0) | vgetq_lane_u64(halves, 1)) != 0)
+#endif
+        {
+            for (bit = 15; bit >= 0; bit--)
+                if ((buf[block+bit] == 0x50) && (buf[block+bit+1] == 0x4b) &&
+                    (buf[block+bit+2] == c2) && (buf[block+bit+3] == c3))
+                    return block + bit;
+        }
+        i -= 16;
+    }
+#endif
+    for (; i >= 0; i--)
+        if ((buf[i] == 0x50) && (buf[i+1] == 0x4b) &&
+            (buf[i+2] == c2) && (buf[i+3] == c3))
+            return i;
+    return -1;
+}
+
+int call_zsearch_central_dir (const zlib_filefunc64_32_def* pfilefunc,voidpf filestream, ZPOS64_T* pos_end_central_dir, ZPOS64_T* pos_zip64_locator)
+{
+    unsigned char* buf;
+    ZPOS64_T uSizeFile;
+    ZPOS64_T uReadPos;
+    uLong uReadSize;
+    long found;
+
+    *pos_end_central_dir = 0;
+    *pos_zip64_locator = 0;
+
+    if (ZSEEK64(*pfilefunc,filestream,0,ZLIB_FILEFUNC_SEEK_END) != 0)
+        return -1;
+
+    uSizeFile = ZTELL64(*pfilefunc,filestream);
+    if (uSizeFile == (ZPOS64_T)-1)
+        return -1;
+
+    uReadSize = (uSizeFile < SIZE_TRAILER_SEARCH) ? (uLong)uSizeFile : SIZE_TRAILER_SEARCH;
+    uReadPos = uSizeFile - uReadSize;
+
+    buf = (unsigned char*)malloc(uReadSize + 1);
+    if (buf == NULL)
+        return -1;
+
+    if ((ZSEEK64(*pfilefunc,filestream,uReadPos,ZLIB_FILEFUNC_SEEK_SET) != 0) ||
+        (ZREAD64(*pfilefunc,filestream,buf,uReadSize) != uReadSize))
+    {
+        free(buf);
+        return -1;
+    }
+
+    /* a position of 0 means not found, as in the callers */
+    found = search_signature_backward(buf, (long)uReadSize, 0x05, 0x06);
+    if ((found >= 0) && (uReadPos + found > 0))
+        *pos_end_central_dir = uReadPos + found;
+
+    found = search_signature_backward(buf, (long)uReadSize, 0x06, 0x07);
+    if ((found >= 0) && (uReadPos + found > 0))
+        *pos_zip64_locator = uReadPos + found;
+
+    free(buf);
+    return 0;
+}
+
 void fill_zlib_filefunc64_32_def_from_filefunc32(zlib_filefunc64_32_def* p_filefunc64_32,const zlib_filefunc_def* p_filefunc32)
 {
     p_filefunc64_32->zfile_func64.zopen64_file = NULL;
@@ -64,6 +184,8 @@ void fill_zlib_filefunc64_32_def_from_filefunc32(zlib_filefunc64_32_def* p_filef
     p_filefunc64_32->zfile_func64.ztell64_file = NULL;
     p_filefunc64_32->zfile_func64.zseek64_file = NULL;
     p_filefunc64_32->zfile_func64.zclose_file = p_filefunc32->zclose_file;
+    p_filefunc64_32->zmap64_file = NULL;
+    p_filefunc64_32->zpread64_file = NULL;
 
 #ifndef __clang_analyzer__
     p_filefunc64_32->zfile_func64.zerror_file = p_filefunc32->zerror_file;
@@ -128,6 +250,31 @@ static uLong ZCALLBACK fread_file_func (voidpf opaque, voidpf stream, void* buf,
     return ret;
 }
 
+#if (!defined(_WIN32)) && (!defined(WIN32))
+/* pread on the descriptor of the FILE, which leaves its buffer and its
+   position alone; only unzip reads this way, and it never writes, so the
+   buffer holds no data that pread would miss */
+static uLong ZCALLBACK fpread64_file_func (voidpf opaque, voidpf stream, void* buf, uLong size, ZPOS64_T offset)
+{
+    int fd = fileno((FILE *)stream);
+    uLong ret = 0;
+    while (ret < size)
+    {
+        ssize_t n = pread(fd, (char*)buf + ret, (size_t)(size - ret), (off_t)(offset + ret));
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        if (n == 0)
+            break;
+        ret += (uLong)n;
+    }
+    return ret;
+}
+#endif
+
 static uLong ZCALLBACK fwrite_file_func (voidpf opaque, voidpf stream, const void* buf, uLong size)
 {
     uLong ret;
@@ -192,7 +339,7 @@ static long ZCALLBACK fseek64_file_func (voidpf  opaque, voidpf stream, ZPOS64_T
     }
     ret = 0;
 
-    if(fseeko64((FILE *)stream, (long)offset, fseek_origin) != 0)
+    if(fseeko64((FILE *)stream, offset, fseek_origin) != 0)
                         ret = -1;
     return ret;
 }
@@ -236,3 +383,173 @@ void fill_fopen64_filefunc (zlib_filefunc64_def*  pzlib_filefunc_def)
     pzlib_filefunc_def->zerror_file = ferror_file_func;
     pzlib_filefunc_def->opaque = NULL;
 }
+
+void fill_fopen64_filefunc_ex (zlib_filefunc64_ex_def*  pzlib_filefunc_def)
+{
+    fill_fopen64_filefunc(&pzlib_filefunc_def->zfile_func64);
+    pzlib_filefunc_def->zmap64_file = NULL;
+#if (!defined(_WIN32)) && (!defined(WIN32))
+    pzlib_filefunc_def->zpread64_file = fpread64_file_func;
+#else
+    pzlib_filefunc_def->zpread64_file = NULL;
+#endif
+}
+
+#if (!defined(_WIN32)) && (!defined(WIN32))
+
+/* stream of the mmap file functions */
+typedef struct mmap_file_s
+{
+    unsigned char* base;        /* start of the mapping, NULL for an empty file */
+    ZPOS64_T size;              /* size of the file */
+    ZPOS64_T pos;               /* current position */
+    int error;
+} mmap_file;
+
+static voidpf ZCALLBACK mmap_open64_file_func (voidpf opaque, const void* filename, int mode)
+{
+    mmap_file* mf;
+    struct stat st;
+    int fd;
+
+    /* the mapping is read only */
+    if ((filename==NULL) || ((mode & ZLIB_FILEFUNC_MODE_READWRITEFILTER)!=ZLIB_FILEFUNC_MODE_READ))
+        return NULL;
+
+    fd = open((const char*)filename, O_RDONLY);
+    if (fd == -1)
+        return NULL;
+
+    if ((fstat(fd, &st) != 0) || ((ZPOS64_T)(size_t)st.st_size != (ZPOS64_T)st.st_size))
+    {
+        close(fd);
+        return NULL;
+    }
+
+    mf = (mmap_file*)malloc(sizeof(mmap_file));
+    if (mf == NULL)
+    {
+        close(fd);
+        return NULL;
+    }
+    mf->base = NULL;
+    mf->size = (ZPOS64_T)st.st_size;
+    mf->pos = 0;
+    mf->error = 0;
+
+    if (mf->size > 0)
+    {
+        void* base = mmap(NULL, (size_t)mf->size, PROT_READ, MAP_SHARED, fd, 0);
+        if (base == MAP_FAILED)
+        {
+            close(fd);
+            free(mf);
+            return NULL;
+        }
+        mf->base = (unsigned char*)base;
+    }
+
+    /* the mapping stays valid once the descriptor is closed */
+    close(fd);
+    return mf;
+}
+
+static uLong ZCALLBACK mmap_read_file_func (voidpf opaque, voidpf stream, void* buf, uLong size)
+{
+    mmap_file* mf = (mmap_file*)stream;
+    uLong ret = 0;
+    if (mf->pos < mf->size)
+    {
+        ret = size;
+        if (mf->size - mf->pos < ret)
+            ret = (uLong)(mf->size - mf->pos);
+        memcpy(buf, mf->base + mf->pos, ret);
+        mf->pos += ret;
+    }
+    return ret;
+}
+
+static uLong ZCALLBACK mmap_pread64_file_func (voidpf opaque, voidpf stream, void* buf, uLong size, ZPOS64_T offset)
+{
+    mmap_file* mf = (mmap_file*)stream;
+    uLong ret = 0;
+    if (offset < mf->size)
+    {
+        ret = size;
+        if (mf->size - offset < ret)
+            ret = (uLong)(mf->size - offset);
+        memcpy(buf, mf->base + offset, ret);
+    }
+    return ret;
+}
+
+static uLong ZCALLBACK mmap_write_file_func (voidpf opaque, voidpf stream, const void* buf, uLong size)
+{
+    mmap_file* mf = (mmap_file*)stream;
+    mf->error = 1;
+    return 0;
+}
+
+static ZPOS64_T ZCALLBACK mmap_tell64_file_func (voidpf opaque, voidpf stream)
+{
+    mmap_file* mf = (mmap_file*)stream;
+    return mf->pos;
+}
+
+static long ZCALLBACK mmap_seek64_file_func (voidpf  opaque, voidpf stream, ZPOS64_T offset, int origin)
+{
+    mmap_file* mf = (mmap_file*)stream;
+    switch (origin)
+    {
+    case ZLIB_FILEFUNC_SEEK_CUR :
+        mf->pos += offset;
+        break;
+    case ZLIB_FILEFUNC_SEEK_END :
+        mf->pos = mf->size + offset;
+        break;
+    case ZLIB_FILEFUNC_SEEK_SET :
+        mf->pos = offset;
+        break;
+    default: return -1;
+    }
+    return 0;
+}
+
+static int ZCALLBACK mmap_close_file_func (voidpf opaque, voidpf stream)
+{
+    mmap_file* mf = (mmap_file*)stream;
+    int ret = 0;
+    if (mf->base != NULL)
+        ret = munmap(mf->base, (size_t)mf->size);
+    free(mf);
+    return ret;
+}
+
+static int ZCALLBACK mmap_error_file_func (voidpf opaque, voidpf stream)
+{
+    mmap_file* mf = (mmap_file*)stream;
+    return mf->error;
+}
+
+static const void* ZCALLBACK mmap_map64_file_func (voidpf opaque, voidpf stream, ZPOS64_T* psize)
+{
+    mmap_file* mf = (mmap_file*)stream;
+    *psize = mf->size;
+    return mf->base;
+}
+
+void fill_mmap_filefunc64 (zlib_filefunc64_ex_def*  pzlib_filefunc_def)
+{
+    pzlib_filefunc_def->zfile_func64.zopen64_file = mmap_open64_file_func;
+    pzlib_filefunc_def->zfile_func64.zread_file = mmap_read_file_func;
+    pzlib_filefunc_def->zfile_func64.zwrite_file = mmap_write_file_func;
+    pzlib_filefunc_def->zfile_func64.ztell64_file = mmap_tell64_file_func;
+    pzlib_filefunc_def->zfile_func64.zseek64_file = mmap_seek64_file_func;
+    pzlib_filefunc_def->zfile_func64.zclose_file = mmap_close_file_func;
+    pzlib_filefunc_def->zfile_func64.zerror_file = mmap_error_file_func;
+    pzlib_filefunc_def->zfile_func64.opaque = NULL;
+    pzlib_filefunc_def->zmap64_file = mmap_map64_file_func;
+    pzlib_filefunc_def->zpread64_file = mmap_pread64_file_func;
+}
+
+#endif
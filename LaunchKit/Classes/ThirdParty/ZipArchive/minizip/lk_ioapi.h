@@ -35,8 +35,8 @@
         #ifndef _LARGEFILE64_SOURCE
                 #define _LARGEFILE64_SOURCE
         #endif
-        #ifndef _FILE_OFFSET_BIT
-                #define _FILE_OFFSET_BIT 64
+        #ifndef _FILE_OFFSET_BITS
+                #define _FILE_OFFSET_BITS 64
         #endif
 #endif
 
@@ -44,11 +44,15 @@
 #include <stdlib.h>
 #include "zlib.h"
 
-#define USE_FILE32API
 #if defined(USE_FILE32API)
 #define fopen64 fopen
 #define ftello64 ftell
 #define fseeko64 fseek
+#elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__) || defined(IOAPI_NO_64)
+// off_t is always 64 bit on Darwin and the BSDs, so there are no specific 64 bit functions
+#define fopen64 fopen
+#define ftello64 ftello
+#define fseeko64 fseeko
 #else
 #ifdef _MSC_VER
  #define fopen64 fopen
@@ -152,6 +156,15 @@ typedef ZPOS64_T (ZCALLBACK *tell64_file_func)    OF((voidpf opaque, voidpf stre
 typedef long     (ZCALLBACK *seek64_file_func)    OF((voidpf opaque, voidpf stream, ZPOS64_T offset, int origin));
 typedef voidpf   (ZCALLBACK *open64_file_func)    OF((voidpf opaque, const void* filename, int mode));
 
+/* return the address of a read only mapping of the whole file and its size in
+   *psize, or NULL if the stream is not mapped in memory */
+typedef const void* (ZCALLBACK *map64_file_func)  OF((voidpf opaque, voidpf stream, ZPOS64_T* psize));
+
+/* read size bytes at offset in buf without moving the position of the stream,
+   and return the number of bytes read. Several readers can share one stream
+   this way, as with pread() */
+typedef uLong    (ZCALLBACK *pread64_file_func)   OF((voidpf opaque, voidpf stream, void* buf, uLong size, ZPOS64_T offset));
+
 typedef struct zlib_filefunc64_def_s
 {
     open64_file_func    zopen64_file;
@@ -164,7 +177,27 @@ typedef struct zlib_filefunc64_def_s
     voidpf              opaque;
 } zlib_filefunc64_def;
 
+/* zlib_filefunc64_def and the optional functions which unzOpen3_64 uses
+   when they are not NULL. They are kept out of zlib_filefunc64_def, which
+   callers fill field by field, so that its layout stays the same */
+typedef struct zlib_filefunc64_ex_def_s
+{
+    zlib_filefunc64_def zfile_func64;
+    map64_file_func     zmap64_file;
+    pread64_file_func   zpread64_file;
+} zlib_filefunc64_ex_def;
+
 void fill_fopen64_filefunc OF((zlib_filefunc64_def* pzlib_filefunc_def));
+
+/* the stdio file functions, reading with pread where it exists; unzOpen64
+   uses them */
+void fill_fopen64_filefunc_ex OF((zlib_filefunc64_ex_def* pzlib_filefunc_def));
+
+/* read only file functions which map the whole file in memory with mmap, so
+   unzip can read the compressed data without copying it (not on Windows) */
+#if (!defined(_WIN32)) && (!defined(WIN32))
+void fill_mmap_filefunc64 OF((zlib_filefunc64_ex_def* pzlib_filefunc_def));
+#endif
 void fill_fopen_filefunc OF((zlib_filefunc_def* pzlib_filefunc_def));
 
 /* now internal definition, only for zip.c and unzip.h */
@@ -174,6 +207,8 @@ typedef struct zlib_filefunc64_32_def_s
     open_file_func      zopen32_file;
     tell_file_func      ztell32_file;
     seek_file_func      zseek32_file;
+    map64_file_func     zmap64_file;
+    pread64_file_func   zpread64_file;
 } zlib_filefunc64_32_def;
 
 
@@ -187,12 +222,22 @@ typedef struct zlib_filefunc64_32_def_s
 voidpf call_zopen64 OF((const zlib_filefunc64_32_def* pfilefunc,const void*filename,int mode));
 long    call_zseek64 OF((const zlib_filefunc64_32_def* pfilefunc,voidpf filestream, ZPOS64_T offset, int origin));
 ZPOS64_T call_ztell64 OF((const zlib_filefunc64_32_def* pfilefunc,voidpf filestream));
+const void* call_zmap64 OF((const zlib_filefunc64_32_def* pfilefunc,voidpf filestream, ZPOS64_T* psize));
+/* positional read, or seek and read when the file functions have no zpread64_file */
+uLong   call_zpread64 OF((const zlib_filefunc64_32_def* pfilefunc,voidpf filestream, void* buf, uLong size, ZPOS64_T offset));
+
+/* read the end of the file once, and return the position of the last end of
+   central directory record and of the last zip64 end of central directory
+   locator found there (0 when not found). return 0, or -1 on io error */
+int call_zsearch_central_dir OF((const zlib_filefunc64_32_def* pfilefunc,voidpf filestream, ZPOS64_T* pos_end_central_dir, ZPOS64_T* pos_zip64_locator));
 
 void    fill_zlib_filefunc64_32_def_from_filefunc32(zlib_filefunc64_32_def* p_filefunc64_32,const zlib_filefunc_def* p_filefunc32);
 
 #define ZOPEN64(filefunc,filename,mode)         (call_zopen64((&(filefunc)),(filename),(mode)))
 #define ZTELL64(filefunc,filestream)            (call_ztell64((&(filefunc)),(filestream)))
 #define ZSEEK64(filefunc,filestream,pos,mode)   (call_zseek64((&(filefunc)),(filestream),(pos),(mode)))
+#define ZMAP64(filefunc,filestream,psize)       (call_zmap64((&(filefunc)),(filestream),(psize)))
+#define ZPREAD64(filefunc,filestream,buf,size,pos) (call_zpread64((&(filefunc)),(filestream),(buf),(size),(pos)))
 
 #ifdef __cplusplus
 }
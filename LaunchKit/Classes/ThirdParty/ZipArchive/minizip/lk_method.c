@@ -0,0 +1,417 @@
+/* lk_method.c -- compression methods of the Minizip zip and unzip code
+
+   Adapters from the bzip2, Zstandard and LZ4 frame streaming interfaces
+   to the z_stream convention of lk_method.h, and the table zip.c and
+   unzip.c look the methods up in.
+
+   License: Same as ZLIB (www.gzip.org)
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "zlib.h"
+#include "lk_zip.h"
+#include "lk_method.h"
+
+#ifdef HAVE_ZSTD
+#include "zstd.h"
+#endif
+
+#ifdef HAVE_LZ4
+#include "lz4frame.h"
+#endif
+
+#ifndef local
+#  define local static
+#endif
+
+#define LK_METHOD_MAXREGISTERED 8
+
+#if defined(HAVE_BZIP2) || defined(HAVE_ZSTD) || defined(HAVE_LZ4)
+/* account for what a codec consumed and produced */
+local void lk_method_advance OF((z_streamp strm, size_t used_in, size_t produced));
+local void lk_method_advance (z_streamp strm, size_t used_in, size_t produced)
+{
+    strm->next_in += used_in;
+    strm->avail_in -= (uInt)used_in;
+    strm->total_in += (uLong)used_in;
+    strm->next_out += produced;
+    strm->avail_out -= (uInt)produced;
+    strm->total_out += (uLong)produced;
+}
+#endif
+
+/* ===========================================================================
+   bzip2
+*/
+#ifdef HAVE_BZIP2
+
+local voidpf bzip2_compress_init (int level)
+{
+    bz_stream* bz = (bz_stream*)calloc(1, sizeof(bz_stream));
+    if (bz == NULL)
+        return NULL;
+    if ((level < 1) || (level > 9))
+        level = 9;
+    if (BZ2_bzCompressInit(bz, level, 0, 35) != BZ_OK)
+    {
+        free(bz);
+        return NULL;
+    }
+    return bz;
+}
+
+local int bzip2_compress (voidpf state, z_streamp strm, int flush)
+{
+    bz_stream* bz = (bz_stream*)state;
+    int err;
+
+    bz->next_in = (char*)strm->next_in;
+    bz->avail_in = strm->avail_in;
+    bz->next_out = (char*)strm->next_out;
+    bz->avail_out = strm->avail_out;
+    err = BZ2_bzCompress(bz, (flush == Z_FINISH) ? BZ_FINISH : BZ_RUN);
+    lk_method_advance(strm, strm->avail_in - bz->avail_in, strm->avail_out - bz->avail_out);
+
+    if (err == BZ_STREAM_END)
+        return Z_STREAM_END;
+    if ((err == BZ_RUN_OK) || (err == BZ_FINISH_OK))
+        return Z_OK;
+    return Z_STREAM_ERROR;
+}
+
+local void bzip2_compress_end (voidpf state)
+{
+    BZ2_bzCompressEnd((bz_stream*)state);
+    free(state);
+}
+
+local voidpf bzip2_decompress_init (void)
+{
+    bz_stream* bz = (bz_stream*)calloc(1, sizeof(bz_stream));
+    if (bz == NULL)
+        return NULL;
+    if (BZ2_bzDecompressInit(bz, 0, 0) != BZ_OK)
+    {
+        free(bz);
+        return NULL;
+    }
+    return bz;
+}
+
+local int bzip2_decompress (voidpf state, z_streamp strm)
+{
+    bz_stream* bz = (bz_stream*)state;
+    size_t used_in, produced;
+    int err;
+
+    bz->next_in = (char*)strm->next_in;
+    bz->avail_in = strm->avail_in;
+    bz->next_out = (char*)strm->next_out;
+    bz->avail_out = strm->avail_out;
+    err = BZ2_bzDecompress(bz);
+    used_in = strm->avail_in - bz->avail_in;
+    produced = strm->avail_out - bz->avail_out;
+    lk_method_advance(strm, used_in, produced);
+
+    if (err == BZ_STREAM_END)
+        return Z_STREAM_END;
+    if (err != BZ_OK)
+        return Z_DATA_ERROR;
+    return ((used_in == 0) && (produced == 0)) ? Z_BUF_ERROR : Z_OK;
+}
+
+local void bzip2_decompress_end (voidpf state)
+{
+    BZ2_bzDecompressEnd((bz_stream*)state);
+    free(state);
+}
+
+local const lk_method bzip2_method =
+{
+    Z_BZIP2ED, "bzip2", 46,
+    bzip2_compress_init, bzip2_compress, bzip2_compress_end,
+    bzip2_decompress_init, bzip2_decompress, bzip2_decompress_end
+};
+
+#endif /* HAVE_BZIP2 */
+
+/* ===========================================================================
+   Zstandard, one frame per entry; the zip CRC makes the frame checksum
+   useless, so it is not written
+*/
+#ifdef HAVE_ZSTD
+
+local voidpf zstd_compress_init (int level)
+{
+    ZSTD_CCtx* cctx = ZSTD_createCCtx();
+    if (cctx == NULL)
+        return NULL;
+    if (level == Z_DEFAULT_COMPRESSION)
+        level = ZSTD_CLEVEL_DEFAULT;
+    if (ZSTD_isError(ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, level)))
+    {
+        ZSTD_freeCCtx(cctx);
+        return NULL;
+    }
+    return cctx;
+}
+
+local int zstd_compress (voidpf state, z_streamp strm, int flush)
+{
+    ZSTD_inBuffer in;
+    ZSTD_outBuffer out;
+    size_t ret;
+
+    in.src = strm->next_in;
+    in.size = strm->avail_in;
+    in.pos = 0;
+    out.dst = strm->next_out;
+    out.size = strm->avail_out;
+    out.pos = 0;
+    ret = ZSTD_compressStream2((ZSTD_CCtx*)state, &out, &in,
+                               (flush == Z_FINISH) ? ZSTD_e_end : ZSTD_e_continue);
+    lk_method_advance(strm, in.pos, out.pos);
+
+    if (ZSTD_isError(ret))
+        return Z_STREAM_ERROR;
+    if ((flush == Z_FINISH) && (ret == 0))
+        return Z_STREAM_END;
+    return Z_OK;
+}
+
+local void zstd_compress_end (voidpf state)
+{
+    ZSTD_freeCCtx((ZSTD_CCtx*)state);
+}
+
+local voidpf zstd_decompress_init (void)
+{
+    return ZSTD_createDCtx();
+}
+
+local int zstd_decompress (voidpf state, z_streamp strm)
+{
+    ZSTD_inBuffer in;
+    ZSTD_outBuffer out;
+    size_t ret;
+
+    in.src = strm->next_in;
+    in.size = strm->avail_in;
+    in.pos = 0;
+    out.dst = strm->next_out;
+    out.size = strm->avail_out;
+    out.pos = 0;
+    ret = ZSTD_decompressStream((ZSTD_DCtx*)state, &out, &in);
+    lk_method_advance(strm, in.pos, out.pos);
+
+    if (ZSTD_isError(ret))
+        return Z_DATA_ERROR;
+    /* a frame ended and no other one follows in what we were given */
+    if ((ret == 0) && (strm->avail_in == 0))
+        return Z_STREAM_END;
+    return ((in.pos == 0) && (out.pos == 0)) ? Z_BUF_ERROR : Z_OK;
+}
+
+local void zstd_decompress_end (voidpf state)
+{
+    ZSTD_freeDCtx((ZSTD_DCtx*)state);
+}
+
+local const lk_method zstd_method =
+{
+    Z_ZSTD, "zstd", 63,
+    zstd_compress_init, zstd_compress, zstd_compress_end,
+    zstd_decompress_init, zstd_decompress, zstd_decompress_end
+};
+
+#endif /* HAVE_ZSTD */
+
+/* ===========================================================================
+   LZ4 frames. The LZ4F compressor writes whole blocks and needs room for
+   the worst case, so its output goes through a buffer of its own.
+*/
+#ifdef HAVE_LZ4
+
+#define LZ4_CHUNK (64 * 1024)
+
+typedef struct lz4_compress_state_s
+{
+    LZ4F_cctx* cctx;
+    LZ4F_preferences_t prefs;
+    unsigned char* pending;     /* compressed data not yet given out */
+    size_t pending_size;        /* allocated size of pending */
+    size_t pending_pos;
+    size_t pending_len;
+    int started;                /* the frame header was written */
+    int ended;                  /* the frame footer was written */
+} lz4_compress_state;
+
+local voidpf lz4_compress_init (int level)
+{
+    lz4_compress_state* st = (lz4_compress_state*)calloc(1, sizeof(lz4_compress_state));
+    if (st == NULL)
+        return NULL;
+    if (LZ4F_isError(LZ4F_createCompressionContext(&st->cctx, LZ4F_VERSION)))
+    {
+        free(st);
+        return NULL;
+    }
+    memset(&st->prefs, 0, sizeof(st->prefs));
+    st->prefs.frameInfo.blockSizeID = LZ4F_max64KB;
+    /* levels up to 2 are the fast compressor, above it is LZ4_HC */
+    st->prefs.compressionLevel = (level == Z_DEFAULT_COMPRESSION) ? 0 : level;
+    st->pending_size = LZ4F_compressBound(LZ4_CHUNK, &st->prefs) + LZ4F_HEADER_SIZE_MAX;
+    st->pending = (unsigned char*)malloc(st->pending_size);
+    if (st->pending == NULL)
+    {
+        LZ4F_freeCompressionContext(st->cctx);
+        free(st);
+        return NULL;
+    }
+    return st;
+}
+
+local int lz4_compress (voidpf state, z_streamp strm, int flush)
+{
+    lz4_compress_state* st = (lz4_compress_state*)state;
+
+    while (strm->avail_out > 0)
+    {
+        size_t ret;
+
+        if (st->pending_pos < st->pending_len)
+        {
+            size_t n = st->pending_len - st->pending_pos;
+            if (n > strm->avail_out)
+                n = strm->avail_out;
+            memcpy(strm->next_out, st->pending + st->pending_pos, n);
+            st->pending_pos += n;
+            lk_method_advance(strm, 0, n);
+            continue;
+        }
+        st->pending_pos = st->pending_len = 0;
+
+        if (!st->started)
+        {
+            ret = LZ4F_compressBegin(st->cctx, st->pending, st->pending_size, &st->prefs);
+            st->started = 1;
+        }
+        else if (strm->avail_in > 0)
+        {
+            size_t n = strm->avail_in;
+            if (n > LZ4_CHUNK)
+                n = LZ4_CHUNK;
+            ret = LZ4F_compressUpdate(st->cctx, st->pending, st->pending_size, strm->next_in, n, NULL);
+            if (!LZ4F_isError(ret))
+                lk_method_advance(strm, n, 0);
+        }
+        else if ((flush == Z_FINISH) && (!st->ended))
+        {
+            ret = LZ4F_compressEnd(st->cctx, st->pending, st->pending_size, NULL);
+            st->ended = 1;
+        }
+        else
+            break;
+
+        if (LZ4F_isError(ret))
+            return Z_STREAM_ERROR;
+        st->pending_len = ret;
+    }
+
+    if ((st->ended) && (st->pending_pos == st->pending_len))
+        return Z_STREAM_END;
+    return Z_OK;
+}
+
+local void lz4_compress_end (voidpf state)
+{
+    lz4_compress_state* st = (lz4_compress_state*)state;
+    LZ4F_freeCompressionContext(st->cctx);
+    free(st->pending);
+    free(st);
+}
+
+local voidpf lz4_decompress_init (void)
+{
+    LZ4F_dctx* dctx;
+    if (LZ4F_isError(LZ4F_createDecompressionContext(&dctx, LZ4F_VERSION)))
+        return NULL;
+    return dctx;
+}
+
+local int lz4_decompress (voidpf state, z_streamp strm)
+{
+    size_t used_in = strm->avail_in;
+    size_t produced = strm->avail_out;
+    size_t ret = LZ4F_decompress((LZ4F_dctx*)state, strm->next_out, &produced,
+                                 strm->next_in, &used_in, NULL);
+    lk_method_advance(strm, used_in, produced);
+
+    if (LZ4F_isError(ret))
+        return Z_DATA_ERROR;
+    if ((ret == 0) && (strm->avail_in == 0))
+        return Z_STREAM_END;
+    return ((used_in == 0) && (produced == 0)) ? Z_BUF_ERROR : Z_OK;
+}
+
+local void lz4_decompress_end (voidpf state)
+{
+    LZ4F_freeDecompressionContext((LZ4F_dctx*)state);
+}
+
+local const lk_method lz4_method =
+{
+    Z_LK_LZ4, "lz4", 63,
+    lz4_compress_init, lz4_compress, lz4_compress_end,
+    lz4_decompress_init, lz4_decompress, lz4_decompress_end
+};
+
+#endif /* HAVE_LZ4 */
+
+/* ===========================================================================
+   The table
+*/
+
+local const lk_method* builtin_methods[] =
+{
+#ifdef HAVE_BZIP2
+    &bzip2_method,
+#endif
+#ifdef HAVE_ZSTD
+    &zstd_method,
+#endif
+#ifdef HAVE_LZ4
+    &lz4_method,
+#endif
+    NULL
+};
+
+local const lk_method* registered_methods[LK_METHOD_MAXREGISTERED];
+local int registered_count = 0;
+
+extern const lk_method* ZEXPORT lk_method_find (uLong method)
+{
+    int i;
+
+    /* registered methods come first, so they can replace a built in one */
+    for (i = registered_count - 1; i >= 0; i--)
+        if (registered_methods[i]->method == method)
+            return registered_methods[i];
+    for (i = 0; builtin_methods[i] != NULL; i++)
+        if (builtin_methods[i]->method == method)
+            return builtin_methods[i];
+    return NULL;
+}
+
+extern int ZEXPORT lk_method_register (const lk_method* m)
+{
+    if ((m == NULL) || (m->method == 0) || (m->method == Z_DEFLATED) ||
+        (m->decompress_init == NULL) || (m->decompress == NULL) || (m->decompress_end == NULL) ||
+        ((m->compress_init != NULL) && ((m->compress == NULL) || (m->compress_end == NULL))))
+        return -1;
+    if (registered_count == LK_METHOD_MAXREGISTERED)
+        return -1;
+    registered_methods[registered_count++] = m;
+    return 0;
+}
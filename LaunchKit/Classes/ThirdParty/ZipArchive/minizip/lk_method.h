@@ -0,0 +1,73 @@
+/* lk_method.h -- compression methods of the Minizip zip and unzip code
+
+   Stored and deflated entries are handled by zip.c and unzip.c themselves.
+   Every other compression method is a table of streaming functions, found
+   by its method number: bzip2, Zstandard and LZ4 are built in when their
+   library is (HAVE_BZIP2, HAVE_ZSTD, HAVE_LZ4), and an application can
+   register more with lk_method_register.
+
+   License: Same as ZLIB (www.gzip.org)
+*/
+
+#ifndef _LK_METHOD_H
+#define _LK_METHOD_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//#define HAVE_ZSTD
+//#define HAVE_LZ4
+
+#ifndef _ZLIB_H
+#include "zlib.h"
+#endif
+
+#define Z_ZSTD   93         /* Zstandard (APPNOTE 4.4.5) */
+#define Z_LK_LZ4 0x4c34     /* LZ4 frames, a LaunchKit vendor method ("4L") */
+
+/*
+  The functions work on the next_in, avail_in, next_out and avail_out
+  fields of a z_stream as deflate() and inflate() do, and add the bytes
+  they consumed and produced to total_in and total_out. They return Z_OK
+  while there is work left, Z_STREAM_END once the stream is complete,
+  Z_BUF_ERROR if no progress was possible, or another zlib error code.
+*/
+typedef struct lk_method_s
+{
+    uLong method;               /* compression method number in the zipfile */
+    const char* name;
+    uLong version_needed;       /* version needed to extract, as 10*major+minor */
+
+    /* compression, NULL if entries of this method can only be read.
+       level is the one given to zipOpenNewFileInZip, which can be
+       Z_DEFAULT_COMPRESSION. flush is Z_NO_FLUSH or Z_FINISH. */
+    voidpf (*compress_init)   OF((int level));
+    int    (*compress)        OF((voidpf state, z_streamp strm, int flush));
+    void   (*compress_end)    OF((voidpf state));
+
+    /* decompression of one entry */
+    voidpf (*decompress_init) OF((void));
+    int    (*decompress)      OF((voidpf state, z_streamp strm));
+    void   (*decompress_end)  OF((voidpf state));
+} lk_method;
+
+extern const lk_method* ZEXPORT lk_method_find OF((uLong method));
+/*
+  Return the functions of a compression method, or NULL if it is not
+  supported. Stored (0) and deflated (8) entries have no table.
+*/
+
+extern int ZEXPORT lk_method_register OF((const lk_method* m));
+/*
+  Add a compression method, or replace a built in one with the same number.
+  *m must stay valid until the program exits. Register methods before
+  opening any zipfile; the table is not protected against concurrent use.
+  Return 0, or -1 when the table is full or m is not usable.
+*/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _LK_METHOD_H */
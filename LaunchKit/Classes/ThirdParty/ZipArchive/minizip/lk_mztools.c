@@ -5,6 +5,7 @@
 */
 
 /* Code */
+#include "lk_ioapi.h"   /* first: it selects the 64-bit file functions */
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -12,9 +13,16 @@
 #include "lk_unzip.h"
 #include "lk_mztools.h"
 
+#if defined(_WIN32) || defined(WIN32)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
 #define READ_8(adr)  ((unsigned char)*(adr))
 #define READ_16(adr) ( READ_8(adr) | (READ_8(adr+1) << 8) )
-#define READ_32(adr) ( READ_16(adr) | (READ_16((adr)+2) << 16) )
+#define READ_32(adr) ( (uLong)READ_16(adr) | ((uLong)READ_16((adr)+2) << 16) )
+#define READ_64(adr) ( (ZPOS64_T)READ_32(adr) | ((ZPOS64_T)READ_32((adr)+4) << 32) )
 
 #define WRITE_8(buff, n) do { \
   *((unsigned char*)(buff)) = (unsigned char) ((n) & 0xff); \
@@ -27,258 +35,488 @@
   WRITE_16((unsigned char*)(buff), (n) & 0xffff); \
   WRITE_16((unsigned char*)(buff) + 2, (n) >> 16); \
 } while(0)
+#define WRITE_64(buff, n) do { \
+  WRITE_32((unsigned char*)(buff), (uLong)((n) & 0xffffffff)); \
+  WRITE_32((unsigned char*)(buff) + 4, (uLong)((n) >> 32)); \
+} while(0)
 
-extern int ZEXPORT lk_unzRepair(file, fileOut, fileOutTmp, nRecovered, bytesRecovered)
+#define LOCALHEADERMAGIC      (0x04034b50)
+#define CENTRALHEADERMAGIC    (0x02014b50)
+#define ENDHEADERMAGIC        (0x06054b50)
+#define ZIP64ENDHEADERMAGIC   (0x06064b50)
+#define ZIP64ENDLOCHEADERMAGIC (0x07064b50)
+#define DESCRIPTORMAGIC       (0x08074b50)
+
+/* The damaged zipfile is read through a window of REPAIR_BUFSIZE bytes,
+   large enough for a local header with the longest filename and extra
+   field. Entry data is copied a window at a time, whatever its size. */
+#define REPAIR_BUFSIZE (256 * 1024)
+
+/* bytes needed after the start of a data descriptor candidate: the largest
+   descriptor (signature, crc and 64-bit sizes) and the next signature */
+#define REPAIR_DESCRIPTOR_LOOKAHEAD (24 + 4)
+
+/* a central directory entry: header, filename, extra fields (the ones of
+   the local header and a Zip64 one) */
+#define REPAIR_CENTRAL_MAXSIZE (46 + 0xffff + 0xffff)
+
+typedef struct {
+  FILE* fp;
+  unsigned char* buf;
+  uLong pos;                /* the unread bytes are buf[pos..len) */
+  uLong len;
+  int eof;
+  ZPOS64_T scanned;         /* bytes read from the file */
+} repair_reader;
+
+/* Make at least need bytes readable at buf+pos if the file has them, and
+   return how many are. */
+static uLong repair_fill(repair_reader* r, uLong need) {
+  if (r->len - r->pos >= need || r->eof) {
+    return r->len - r->pos;
+  }
+  if (r->pos > 0) {
+    memmove(r->buf, r->buf + r->pos, r->len - r->pos);
+    r->len -= r->pos;
+    r->pos = 0;
+  }
+  while (r->len < need && !r->eof) {
+    size_t n = fread(r->buf + r->len, 1, REPAIR_BUFSIZE - r->len, r->fp);
+    if (n == 0) {
+      r->eof = 1;
+    }
+    r->len += (uLong)n;
+    r->scanned += n;
+  }
+  return r->len - r->pos;
+}
+
+static int repair_write(FILE* fp, const void* buf, uLong size, ZPOS64_T* offset) {
+  if (size > 0 && fwrite(buf, 1, size, fp) != size) {
+    return Z_ERRNO;
+  }
+  *offset += size;
+  return Z_OK;
+}
+
+/* Is p the signature of a record which may follow entry data? */
+static int repair_is_next_record(const unsigned char* p) {
+  uLong magic = READ_32(p);
+  return magic == LOCALHEADERMAGIC || magic == CENTRALHEADERMAGIC ||
+         magic == ENDHEADERMAGIC || magic == ZIP64ENDHEADERMAGIC;
+}
+
+/*
+  Look for the data descriptor of an entry at p, dataSize bytes after the
+  start of its data (avail bytes are readable at p, and atEof tells if
+  they are the last ones of the file). A descriptor, with or without its
+  signature, is taken if its compressed size is dataSize and it is followed
+  by another record or by the end of the file; if loose is set, one with a
+  signature is taken whatever follows it (garbage). Its sizes have 64 bits
+  if zip64 is set (the local header has a Zip64 extra field), but the other
+  size is tried too. Return its size, or 0.
+*/
+static uLong repair_match_descriptor(const unsigned char* p, uLong avail, ZPOS64_T dataSize,
+                                     int atEof, int zip64, int loose,
+                                     uLong* crc, ZPOS64_T* cpsize, ZPOS64_T* uncpsize) {
+  int i;
+  for (i = 0; i < 4; i++) {
+    int withMagic = (i < 2);
+    int sizes64 = ((i & 1) == 0) == (zip64 != 0);
+    uLong size = (withMagic ? 4 : 0) + (sizes64 ? 20 : 12);
+    const unsigned char* q = withMagic ? p + 4 : p;
+    if (avail < size) {
+      continue;
+    }
+    if (withMagic && READ_32(p) != DESCRIPTORMAGIC) {
+      continue;
+    }
+    if (!withMagic && loose) {
+      continue;
+    }
+    if ((sizes64 ? READ_64(q + 4) : (ZPOS64_T)READ_32(q + 4)) != dataSize) {
+      continue;
+    }
+    if (!loose &&
+        (avail >= size + 4 ? !repair_is_next_record(p + size) : !(atEof && avail == size))) {
+      continue;
+    }
+    *crc = READ_32(q);
+    *cpsize = dataSize;
+    *uncpsize = sizes64 ? READ_64(q + 12) : (ZPOS64_T)READ_32(q + 8);
+    return size;
+  }
+  return 0;
+}
+
+/* Cut fp, the recovered file, at size. */
+static int repair_truncate(FILE* fp, ZPOS64_T size) {
+  if (fflush(fp) != 0 || fseeko64(fp, size, SEEK_SET) != 0) {
+    return Z_ERRNO;
+  }
+#if defined(_WIN32) || defined(WIN32)
+  return _chsize_s(_fileno(fp), (__int64)size) == 0 ? Z_OK : Z_ERRNO;
+#else
+  return ftruncate(fileno(fp), (off_t)size) == 0 ? Z_OK : Z_ERRNO;
+#endif
+}
+
+/* Copy the local header at the window position to fpOut, and prepare its
+   central directory entry in central (without sizes, crc and offset). Set
+   zip64 if the header has a Zip64 extra field.
+   Return the size of the entry, or 0 if it is not a complete header. */
+static uLong repair_copy_header(repair_reader* in, FILE* fpOut, ZPOS64_T* offset,
+                                unsigned char* central, ZPOS64_T* cpsize, ZPOS64_T* uncpsize,
+                                int* zip64, int* err) {
+  const unsigned char* header = in->buf + in->pos;
+  uLong fnsize = READ_16(header + 26);
+  uLong extsize = READ_16(header + 28);
+  uLong headerSize = 30 + fnsize + extsize;
+  const unsigned char* extra;
+  uLong centralSize = 46 + fnsize;
+  uLong pos = 0;
+
+  if (repair_fill(in, headerSize) < headerSize) {
+    return 0;
+  }
+  header = in->buf + in->pos;
+  extra = header + 30 + fnsize;
+
+  memset(central, 0, 46);
+  WRITE_32(central, CENTRALHEADERMAGIC);
+  memcpy(central + 4, header + 4, 2);     /* version made by */
+  memcpy(central + 6, header + 4, 12);    /* version, flags, method, time, date */
+  memcpy(central + 28, header + 26, 2);   /* filename length */
+  memcpy(central + 46, header + 30, fnsize);
+  *cpsize = READ_32(header + 18);
+  *uncpsize = READ_32(header + 22);
+
+  /* The extra fields go to the central directory too, except a Zip64 one,
+     which is written again with the offset in the new file */
+  while (pos + 4 <= extsize) {
+    uLong id = READ_16(extra + pos);
+    uLong size = READ_16(extra + pos + 2);
+    if (pos + 4 + size > extsize) {
+      break;
+    }
+    if (id == 0x0001) {
+      uLong field = 0;
+      *zip64 = 1;
+      if (*uncpsize == 0xffffffff && field + 8 <= size) {
+        *uncpsize = READ_64(extra + pos + 4 + field);
+        field += 8;
+      }
+      if (*cpsize == 0xffffffff && field + 8 <= size) {
+        *cpsize = READ_64(extra + pos + 4 + field);
+      }
+    } else {
+      memcpy(central + centralSize, extra + pos, 4 + size);
+      centralSize += 4 + size;
+    }
+    pos += 4 + size;
+  }
+  WRITE_16(central + 30, centralSize - 46 - fnsize);
+
+  *err = repair_write(fpOut, header, headerSize, offset);
+  in->pos += headerSize;
+  return centralSize;
+}
+
+/* Write the end of the central directory, with its Zip64 records if the
+   entries or the offsets do not fit in it. */
+static int repair_write_end(FILE* fp, ZPOS64_T entries, ZPOS64_T sizeCD, ZPOS64_T offsetCD) {
+  unsigned char end[56 + 20 + 22];
+  uLong size = 0;
+  ZPOS64_T written = 0;
+
+  if (entries >= 0xffff || sizeCD >= 0xffffffff || offsetCD >= 0xffffffff) {
+    WRITE_32(end, ZIP64ENDHEADERMAGIC);
+    WRITE_64(end + 4, (ZPOS64_T)44);        /* size of the record after this field */
+    WRITE_16(end + 12, 45);                 /* version made by */
+    WRITE_16(end + 14, 45);                 /* version needed */
+    WRITE_32(end + 16, 0);                  /* disk # */
+    WRITE_32(end + 20, 0);                  /* disk # of the central directory */
+    WRITE_64(end + 24, entries);
+    WRITE_64(end + 32, entries);
+    WRITE_64(end + 40, sizeCD);
+    WRITE_64(end + 48, offsetCD);
+    WRITE_32(end + 56, ZIP64ENDLOCHEADERMAGIC);
+    WRITE_32(end + 60, 0);                  /* disk # */
+    WRITE_64(end + 64, offsetCD + sizeCD);  /* offset of the Zip64 end record */
+    WRITE_32(end + 72, 1);                  /* disks */
+    size = 76;
+  }
+  WRITE_32(end + size, ENDHEADERMAGIC);
+  WRITE_16(end + size + 4, 0);    /* disk # */
+  WRITE_16(end + size + 6, 0);    /* disk # */
+  WRITE_16(end + size + 8, entries >= 0xffff ? 0xffff : (uLong)entries);
+  WRITE_16(end + size + 10, entries >= 0xffff ? 0xffff : (uLong)entries);
+  WRITE_32(end + size + 12, sizeCD >= 0xffffffff ? 0xffffffff : (uLong)sizeCD);
+  WRITE_32(end + size + 16, offsetCD >= 0xffffffff ? 0xffffffff : (uLong)offsetCD);
+  WRITE_16(end + size + 20, 0);   /* comment */
+  size += 22;
+
+  return repair_write(fp, end, size, &written);
+}
+
+extern int ZEXPORT lk_unzRepair64(file, fileOut, fileOutTmp, info)
 const char* file;
 const char* fileOut;
 const char* fileOutTmp;
-uLong* nRecovered;
-uLong* bytesRecovered;
+lk_unz_repair_info* info;
 {
   int err = Z_OK;
-  FILE* fpZip = fopen(file, "rb");
-  FILE* fpOut = fopen(fileOut, "wb");
-  FILE* fpOutCD = fopen(fileOutTmp, "wb");
-  if (fpZip != NULL &&  fpOut != NULL) {
-    int entries = 0;
-    uLong totalBytes = 0;
-    char header[30];
-    char filename[256];
-    char extra[1024];
-    int offset = 0;
-    int offsetCD = 0;
-    while ( fread(header, 1, 30, fpZip) == 30 ) {
-      int currentOffset = offset;
-
-      /* File entry */
-      if (READ_32(header) == 0x04034b50) {
-        unsigned int version = READ_16(header + 4);
-        unsigned int gpflag = READ_16(header + 6);
-        unsigned int method = READ_16(header + 8);
-        unsigned int filetime = READ_16(header + 10);
-        unsigned int filedate = READ_16(header + 12);
-        unsigned int crc = READ_32(header + 14); /* crc */
-        unsigned int cpsize = READ_32(header + 18); /* compressed size */
-        unsigned int uncpsize = READ_32(header + 22); /* uncompressed sz */
-        unsigned int fnsize = READ_16(header + 26); /* file name length */
-        unsigned int extsize = READ_16(header + 28); /* extra field length */
-        filename[0] = extra[0] = '\0';
-        
-        /* Header */
-        if (fwrite(header, 1, 30, fpOut) == 30) {
-          offset += 30;
-        } else {
-          err = Z_ERRNO;
+  repair_reader in;
+  FILE* fpOut = NULL;
+  FILE* fpOutCD = NULL;
+  unsigned char* central = NULL;
+  lk_unz_repair_info stats;
+  ZPOS64_T offset = 0;
+  ZPOS64_T offsetCD = 0;
+
+  memset(&stats, 0, sizeof(stats));
+  memset(&in, 0, sizeof(in));
+  in.fp = fopen64(file, "rb");
+  in.buf = (unsigned char*)malloc(REPAIR_BUFSIZE);
+  central = (unsigned char*)malloc(REPAIR_CENTRAL_MAXSIZE + 28);
+  if (in.fp != NULL && in.buf != NULL && central != NULL) {
+    fpOut = fopen64(fileOut, "wb");
+    fpOutCD = fopen64(fileOutTmp, "w+b");
+  }
+  if (fpOut == NULL || fpOutCD == NULL) {
+    err = Z_STREAM_ERROR;
+  }
+
+  while (err == Z_OK) {
+    ZPOS64_T currentOffset = offset;
+    ZPOS64_T cpsize, uncpsize;
+    ZPOS64_T dataSize = 0;
+    uLong gpflag, crc;
+    uLong centralSize;
+    int zip64 = 0;
+    int complete = 0;
+
+    if (repair_fill(&in, 30) < 30) {
+      break;
+    }
+    if (READ_32(in.buf + in.pos) != LOCALHEADERMAGIC || READ_16(in.buf + in.pos + 26) == 0) {
+      const unsigned char* p;
+      /* the central directory of the damaged file ends the entries */
+      if (READ_32(in.buf + in.pos) != LOCALHEADERMAGIC && repair_is_next_record(in.buf + in.pos)) {
+        break;
+      }
+      /* garbage: skip it to the next header */
+      p = (const unsigned char*)memchr(in.buf + in.pos + 1, 'P', in.len - in.pos - 1);
+      while (p != NULL && p + 4 <= in.buf + in.len && !repair_is_next_record(p)) {
+        p = (const unsigned char*)memchr(p + 1, 'P', in.len - (uLong)(p + 1 - in.buf));
+      }
+      if (p == NULL || p + 4 > in.buf + in.len) {
+        /* keep the last bytes, a signature may start there */
+        p = in.buf + in.len - 3;
+      }
+      stats.bytes_skipped += (uLong)(p - (in.buf + in.pos));
+      in.pos = (uLong)(p - in.buf);
+      continue;
+    }
+
+    /* Local header, filename and extra field */
+    gpflag = READ_16(in.buf + in.pos + 6);
+    crc = READ_32(in.buf + in.pos + 14);
+    centralSize = repair_copy_header(&in, fpOut, &offset, central, &cpsize, &uncpsize, &zip64, &err);
+    if (centralSize == 0) {
+      /* the file ends in the header */
+      stats.entries_dropped++;
+      break;
+    }
+    if (err != Z_OK) {
+      break;
+    }
+
+    /* Data */
+    if ((gpflag & 8) != 0) {
+      /* the sizes follow the data, in a data descriptor which is found by
+         its compressed size, the number of bytes since the data start */
+      while (err == Z_OK) {
+        uLong avail = repair_fill(&in, REPAIR_BUFSIZE);
+        uLong i, limit, descriptorSize = 0;
+        const unsigned char* data = in.buf + in.pos;
+        if (avail == 0) {
           break;
         }
-        
-        /* Filename */
-        if (fnsize > 0) {
-          if (fread(filename, 1, fnsize, fpZip) == fnsize) {
-            if (fwrite(filename, 1, fnsize, fpOut) == fnsize) {
-              offset += fnsize;
-            } else {
-              err = Z_ERRNO;
-              break;
-            }
-          } else {
-            err = Z_ERRNO;
-            break;
-          }
+        if (in.eof) {
+          limit = avail;
         } else {
-          err = Z_STREAM_ERROR;
-          break;
+          limit = avail > REPAIR_DESCRIPTOR_LOOKAHEAD ? avail - REPAIR_DESCRIPTOR_LOOKAHEAD : 0;
         }
-
-        /* Extra field */
-        if (extsize > 0) {
-          if (fread(extra, 1, extsize, fpZip) == extsize) {
-            if (fwrite(extra, 1, extsize, fpOut) == extsize) {
-              offset += extsize;
-            } else {
-              err = Z_ERRNO;
-              break;
-            }
-          } else {
-            err = Z_ERRNO;
-            break;
+        for (i = 0; i < limit; i++) {
+          /* a descriptor starts with its signature, or has the compressed
+             size after the crc: test their first bytes before anything else */
+          if (avail - i < 12 ||
+              (data[i] != 'P' && data[i + 4] != (unsigned char)(dataSize + i))) {
+            continue;
           }
-        }
-        
-        /* Data */
-        {
-          int dataSize = cpsize;
-          if (dataSize == 0) {
-            dataSize = uncpsize;
+          descriptorSize = repair_match_descriptor(data + i, avail - i, dataSize + i, in.eof, zip64, 0,
+                                                   &crc, &cpsize, &uncpsize);
+          if (descriptorSize == 0) {
+            descriptorSize = repair_match_descriptor(data + i, avail - i, dataSize + i, in.eof, zip64, 1,
+                                                     &crc, &cpsize, &uncpsize);
           }
-          if (dataSize > 0) {
-            char* data = malloc(dataSize);
-            if (data != NULL) {
-              if ((int)fread(data, 1, dataSize, fpZip) == dataSize) {
-                if ((int)fwrite(data, 1, dataSize, fpOut) == dataSize) {
-                  offset += dataSize;
-                  totalBytes += dataSize;
-                } else {
-                  err = Z_ERRNO;
-                }
-              } else {
-                err = Z_ERRNO;
-              }
-              free(data);
-              if (err != Z_OK) {
-                break;
-              }
-            } else {
-              err = Z_MEM_ERROR;
-              break;
-            }
+          if (descriptorSize != 0) {
+            break;
           }
         }
-        
-        /* Central directory entry */
-        {
-          char centralDirectoryEntryHeader[46];
-          //char* comment = "";
-          //int comsize = (int) strlen(comment);
-          WRITE_32(centralDirectoryEntryHeader, 0x02014b50);
-          WRITE_16(centralDirectoryEntryHeader + 4, version);
-          WRITE_16(centralDirectoryEntryHeader + 6, version);
-          WRITE_16(centralDirectoryEntryHeader + 8, gpflag);
-          WRITE_16(centralDirectoryEntryHeader + 10, method);
-          WRITE_16(centralDirectoryEntryHeader + 12, filetime);
-          WRITE_16(centralDirectoryEntryHeader + 14, filedate);
-          WRITE_32(centralDirectoryEntryHeader + 16, crc);
-          WRITE_32(centralDirectoryEntryHeader + 20, cpsize);
-          WRITE_32(centralDirectoryEntryHeader + 24, uncpsize);
-          WRITE_16(centralDirectoryEntryHeader + 28, fnsize);
-          WRITE_16(centralDirectoryEntryHeader + 30, extsize);
-          WRITE_16(centralDirectoryEntryHeader + 32, 0 /*comsize*/);
-          WRITE_16(centralDirectoryEntryHeader + 34, 0);     /* disk # */
-          WRITE_16(centralDirectoryEntryHeader + 36, 0);     /* int attrb */
-          WRITE_32(centralDirectoryEntryHeader + 38, 0);     /* ext attrb */
-          WRITE_32(centralDirectoryEntryHeader + 42, currentOffset);
-          /* Header */
-          if (fwrite(centralDirectoryEntryHeader, 1, 46, fpOutCD) == 46) {
-            offsetCD += 46;
-            
-            /* Filename */
-            if (fnsize > 0) {
-              if (fwrite(filename, 1, fnsize, fpOutCD) == fnsize) {
-                offsetCD += fnsize;
-              } else {
-                err = Z_ERRNO;
-                break;
-              }
-            } else {
-              err = Z_STREAM_ERROR;
-              break;
-            }
-            
-            /* Extra field */
-            if (extsize > 0) {
-              if (fwrite(extra, 1, extsize, fpOutCD) == extsize) {
-                offsetCD += extsize;
-              } else {
-                err = Z_ERRNO;
-                break;
-              }
-            }
-            
-            /* Comment field */
-            /*
-            if (comsize > 0) {
-              if ((int)fwrite(comment, 1, comsize, fpOutCD) == comsize) {
-                offsetCD += comsize;
-              } else {
-                err = Z_ERRNO;
-                break;
-              }
-            }
-            */
-            
-          } else {
-            err = Z_ERRNO;
-            break;
+        err = repair_write(fpOut, data, i, &offset);
+        in.pos += i;
+        dataSize += i;
+        if (descriptorSize != 0) {
+          if (err == Z_OK) {
+            err = repair_write(fpOut, in.buf + in.pos, descriptorSize, &offset);
           }
+          in.pos += descriptorSize;
+          stats.entries_with_descriptor++;
+          complete = 1;
+          break;
         }
-
-        /* Success */
-        entries++;
-
-      } else {
-        break;
+        if (in.eof) {
+          break;
+        }
+      }
+    } else {
+      while (err == Z_OK && dataSize < cpsize) {
+        uLong chunk = REPAIR_BUFSIZE;
+        uLong avail;
+        if (cpsize - dataSize < chunk) {
+          chunk = (uLong)(cpsize - dataSize);
+        }
+        avail = repair_fill(&in, chunk);
+        if (avail == 0) {
+          break;
+        }
+        if (avail > chunk) {
+          avail = chunk;
+        }
+        err = repair_write(fpOut, in.buf + in.pos, avail, &offset);
+        in.pos += avail;
+        dataSize += avail;
       }
+      complete = (dataSize == cpsize);
+    }
+    if (err != Z_OK) {
+      break;
+    }
+
+    if (!complete) {
+      /* the file ends in this entry: leave it out */
+      stats.entries_dropped++;
+      stats.bytes_dropped += offset - currentOffset;
+      err = repair_truncate(fpOut, currentOffset);
+      offset = currentOffset;
+      break;
     }
 
-    /* Final central directory  */
+    /* Central directory entry, with a Zip64 extra field for the sizes and
+       offset which do not fit in it */
     {
-      int entriesZip = entries;
-      char finalCentralDirectoryHeader[22];
-      //char* comment = ""; // "ZIP File recovered by zlib/minizip/mztools";
-      //int comsize = (int) strlen(comment);
-      if (entriesZip > 0xffff) {
-        entriesZip = 0xffff;
+      unsigned char* zip64Extra = central + centralSize;
+      uLong zip64ExtraSize = 4;
+      uLong extraSize = READ_16(central + 30);
+      if (uncpsize >= 0xffffffff) {
+        WRITE_64(zip64Extra + zip64ExtraSize, uncpsize);
+        zip64ExtraSize += 8;
       }
-      WRITE_32(finalCentralDirectoryHeader, 0x06054b50);
-      WRITE_16(finalCentralDirectoryHeader + 4, 0);    /* disk # */
-      WRITE_16(finalCentralDirectoryHeader + 6, 0);    /* disk # */
-      WRITE_16(finalCentralDirectoryHeader + 8, entriesZip);   /* hack */
-      WRITE_16(finalCentralDirectoryHeader + 10, entriesZip);  /* hack */
-      WRITE_32(finalCentralDirectoryHeader + 12, offsetCD);    /* size of CD */
-      WRITE_32(finalCentralDirectoryHeader + 16, offset);      /* offset to CD */
-      WRITE_16(finalCentralDirectoryHeader + 20, 0 /*comsize*/);     /* comment */
-      
-      /* Header */
-      if (fwrite(finalCentralDirectoryHeader, 1, 22, fpOutCD) == 22) {
-        
-        /* Comment field */
-        /*
-        if (comsize > 0) {
-          if ((int)fwrite(comment, 1, comsize, fpOutCD) != comsize) {
-            err = Z_ERRNO;
-          }
+      if (cpsize >= 0xffffffff) {
+        WRITE_64(zip64Extra + zip64ExtraSize, cpsize);
+        zip64ExtraSize += 8;
+      }
+      if (currentOffset >= 0xffffffff) {
+        WRITE_64(zip64Extra + zip64ExtraSize, currentOffset);
+        zip64ExtraSize += 8;
+      }
+      if (zip64ExtraSize > 4) {
+        if (extraSize + zip64ExtraSize > 0xffff) {
+          /* no room left for the other extra fields */
+          memmove(central + centralSize - extraSize, zip64Extra, zip64ExtraSize);
+          centralSize -= extraSize;
+          extraSize = 0;
+          zip64Extra = central + centralSize;
         }
-        */
-      } else {
-        err = Z_ERRNO;
+        WRITE_16(zip64Extra, 0x0001);
+        WRITE_16(zip64Extra + 2, zip64ExtraSize - 4);
+        centralSize += zip64ExtraSize;
+        extraSize += zip64ExtraSize;
       }
+      WRITE_16(central + 30, extraSize);
+      WRITE_32(central + 16, crc);
+      WRITE_32(central + 20, cpsize >= 0xffffffff ? 0xffffffff : (uLong)cpsize);
+      WRITE_32(central + 24, uncpsize >= 0xffffffff ? 0xffffffff : (uLong)uncpsize);
+      WRITE_32(central + 42, currentOffset >= 0xffffffff ? 0xffffffff : (uLong)currentOffset);
+      err = repair_write(fpOutCD, central, centralSize, &offsetCD);
+    }
+    if (err != Z_OK) {
+      break;
     }
 
-    /* Final merge (file + central directory) */
-    fclose(fpOutCD);
-    if (err == Z_OK) {
-      fpOutCD = fopen(fileOutTmp, "rb");
-      if (fpOutCD != NULL) {
-        int nRead;
-        char buffer[8192];
-        while ( (nRead = (int)fread(buffer, 1, sizeof(buffer), fpOutCD)) > 0) {
-          if ((int)fwrite(buffer, 1, nRead, fpOut) != nRead) {
-            err = Z_ERRNO;
-            break;
-          }
-        }
-        fclose(fpOutCD);
+    /* Success */
+    stats.entries_recovered++;
+    stats.bytes_recovered += dataSize;
+  }
+  stats.bytes_scanned = in.scanned;
+
+  /* Final central directory, copied after the entries */
+  if (err == Z_OK) {
+    char buffer[8192];
+    size_t nRead;
+    if (fflush(fpOutCD) != 0 || fseeko64(fpOutCD, 0, SEEK_SET) != 0) {
+      err = Z_ERRNO;
+    }
+    while (err == Z_OK && (nRead = fread(buffer, 1, sizeof(buffer), fpOutCD)) > 0) {
+      if (fwrite(buffer, 1, nRead, fpOut) != nRead) {
+        err = Z_ERRNO;
       }
     }
-    
-    /* Close */
-    fclose(fpZip);
-    fclose(fpOut);
-    
+    if (err == Z_OK) {
+      err = repair_write_end(fpOut, stats.entries_recovered, offsetCD, offset);
+    }
+  }
+
+  /* Close */
+  if (in.fp != NULL) {
+    fclose(in.fp);
+  }
+  if (fpOut != NULL && fclose(fpOut) != 0 && err == Z_OK) {
+    err = Z_ERRNO;
+  }
+  if (fpOutCD != NULL) {
+    fclose(fpOutCD);
     /* Wipe temporary file */
     (void)remove(fileOutTmp);
-    
-    /* Number of recovered entries */
-    if (err == Z_OK) {
-      if (nRecovered != NULL) {
-        *nRecovered = entries;
-      }
-      if (bytesRecovered != NULL) {
-        *bytesRecovered = totalBytes;
-      }
+  }
+  free(in.buf);
+  free(central);
+
+  /* Recovery statistics */
+  if (err == Z_OK && info != NULL) {
+    *info = stats;
+  }
+  return err;
+}
+
+extern int ZEXPORT lk_unzRepair(file, fileOut, fileOutTmp, nRecovered, bytesRecovered)
+const char* file;
+const char* fileOut;
+const char* fileOutTmp;
+uLong* nRecovered;
+uLong* bytesRecovered;
+{
+  lk_unz_repair_info info;
+  int err = lk_unzRepair64(file, fileOut, fileOutTmp, &info);
+  if (err == Z_OK) {
+    if (nRecovered != NULL) {
+      *nRecovered = (uLong)info.entries_recovered;
+    }
+    if (bytesRecovered != NULL) {
+      *bytesRecovered = (uLong)info.bytes_recovered;
     }
-  } else {
-    err = Z_STREAM_ERROR;
   }
   return err;
 }
@@ -17,6 +17,19 @@ extern "C" {
 
 #include "lk_unzip.h"
 
+/* Statistics of a ZIP file repair */
+typedef struct lk_unz_repair_info_s
+{
+    ZPOS64_T entries_recovered;       /* entries in the recovered file */
+    ZPOS64_T bytes_recovered;         /* compressed data of these entries */
+    ZPOS64_T entries_with_descriptor; /* entries whose sizes were found in
+                                         their data descriptor */
+    ZPOS64_T entries_dropped;         /* entries cut by the end of the file */
+    ZPOS64_T bytes_dropped;           /* bytes of these entries */
+    ZPOS64_T bytes_skipped;           /* garbage between the entries */
+    ZPOS64_T bytes_scanned;           /* bytes read from the damaged file */
+} lk_unz_repair_info;
+
 /* Repair a ZIP file (missing central directory)
    file: file to recover
    fileOut: output file after recovery
@@ -28,4 +41,18 @@ extern "C" {
                                     uLong* nRecovered,
                                     uLong* bytesRecovered);
 
+/* Same as lk_unzRepair, for files of any size, with the statistics of the
+   repair in info (which may be NULL).
+   The entries are copied in bounded chunks. The end of an entry with a data
+   descriptor is found by scanning its data for a descriptor whose
+   compressed size matches and which is followed by the next header. An
+   entry cut by the end of the file (a partial download) is left out.
+   Return Z_OK, Z_ERRNO on a read or write error, or Z_STREAM_ERROR if a
+   file can not be opened.
+ */
+    extern int ZEXPORT lk_unzRepair64(const char* file,
+                                      const char* fileOut,
+                                      const char* fileOutTmp,
+                                      lk_unz_repair_info* info);
+
 #endif
@@ -74,6 +74,8 @@
 
 #include "zlib.h"
 #include "lk_unzip.h"
+#include "lk_crc32.h"
+#include "lk_aes.h"
 
 #ifdef STDC
 #  include <stddef.h>
@@ -86,6 +88,23 @@
 #   include <errno.h>
 #endif
 
+#ifndef _WIN32
+#   include <unistd.h>
+#endif
+#ifdef __linux__
+#   include <sys/syscall.h>
+#endif
+
+#if defined(_WIN32) || defined(WIN32)
+# ifndef NO_PARALLEL_VERIFY
+#  define NO_PARALLEL_VERIFY
+# endif
+#endif
+
+#ifndef NO_PARALLEL_VERIFY
+#  include <pthread.h>
+#endif
+
 
 #ifndef local
 #  define local static
@@ -104,10 +123,29 @@
 #define UNZ_BUFSIZE (16384)
 #endif
 
+#ifndef UNZ_MAPPEDREADSIZE
+#define UNZ_MAPPEDREADSIZE (0x40000000)
+#endif
+
 #ifndef UNZ_MAXFILENAMEINZIP
 #define UNZ_MAXFILENAMEINZIP (256)
 #endif
 
+/* each handle keeps its own copy, and the concurrent extraction and
+   unzVerifyArchive open one handle per worker: 4MB holds about 50000
+   entries */
+#ifndef UNZ_MAXCENTRALDIRCACHE
+#define UNZ_MAXCENTRALDIRCACHE (4*1024*1024)
+#endif
+
+#ifndef UNZ_VERIFY_BUFSIZE
+#define UNZ_VERIFY_BUFSIZE (256*1024)
+#endif
+
+#define UNZ_VERIFY_MAXTHREADS (64)
+
+/* all the memory, zlib's included, is taken with ALLOC and given back with
+   TRYFREE: define them to count or track the allocations */
 #ifndef ALLOC
 # define ALLOC(size) (malloc(size))
 #endif
@@ -129,16 +167,45 @@ typedef struct unz_file_info64_internal_s
 } unz_file_info64_internal;
 
 
+#ifndef UNZ_SEEKWINDOWSIZE
+#define UNZ_SEEKWINDOWSIZE (32768)  /* deflate window, the most inflate needs */
+#endif
+
+#define SEEKINDEXMAGIC (0x495a4b4c)  /* "LKZI" */
+#define SEEKINDEXVERSION (1)
+#define SIZESEEKINDEXHEADER (40)
+#define SIZESEEKPOINTHEADER (24)
+
+/* unz64_seek_point_s is a checkpoint of inflate at a deflate block boundary,
+   from which the decompression can restart (see zran.c in zlib examples) */
+typedef struct unz64_seek_point_s
+{
+    ZPOS64_T out;               /* offset in the uncompressed data */
+    ZPOS64_T in;                /* offset in the compressed data of the first
+                                   byte with no bit of the previous block */
+    int bits;                   /* bits of the byte before in that belong to
+                                   the next block (0 to 7) */
+    uInt window_size;           /* uncompressed data before out, at most 32KB */
+    unsigned char* window;
+} unz64_seek_point;
+
+typedef struct unz64_seek_index_s
+{
+    ZPOS64_T span;              /* uncompressed bytes between checkpoints, 0
+                                   when no more checkpoints are recorded */
+    uLong count;
+    uLong allocated;
+    unz64_seek_point* points;   /* sorted by out */
+} unz64_seek_index;
+
 /* file_in_zip_read_info_s contain internal information about a file in zipfile,
     when reading and decompress it */
 typedef struct
 {
     char  *read_buffer;         /* internal buffer for compressed data */
     z_stream stream;            /* zLib stream structure for inflate */
-
-#ifdef HAVE_BZIP2
-    bz_stream bstream;          /* bzLib stream structure for bziped */
-#endif
+    const lk_method* codec;     /* methods other than stored and deflated */
+    voidpf codec_state;         /* decompressor of codec, NULL when raw */
 
     ZPOS64_T pos_in_zipfile;       /* position in byte on the zipfile, for fseek*/
     uLong stream_initialised;   /* flag set if stream structure is initialised*/
@@ -157,8 +224,43 @@ typedef struct
     uLong compression_method;   /* compression method (0==store) */
     ZPOS64_T byte_before_the_zipfile;/* byte before the zipfile, (>0 for sfx)*/
     int   raw;
+    const unsigned char* map_base; /* mapping of the zipfile, NULL if the
+                                      compressed data must be read */
+    ZPOS64_T pos_data_start;    /* position of the data, after the crypt header */
+    ZPOS64_T size_compressed;   /* sizes of the file, for unzSeekCurrentFile64 */
+    ZPOS64_T size_uncompressed;
+    int crc_checkable;          /* 0 once a seek skipped some data */
+    unz64_seek_index* seek_index; /* checkpoints recorded or loaded, or NULL */
+    ZPOS64_T pos_in_stream;     /* position of filestream after our last read,
+                                   UNZ_POS_UNKNOWN when something else moved it */
+    int inflate_ready;          /* 1 once inflateInit2 was called on stream,
+                                   it is then reset for the next entries */
 } file_in_zip64_read_info_s;
 
+#define UNZ_POS_UNKNOWN ((ZPOS64_T)-1)
+
+
+/* unz64_index_s contain an in-memory copy of the names of the central
+   directory, built once by unzBuildIndex so that unzLocateFileIndexed does not
+   need to walk the central directory on disk */
+typedef struct unz64_index_entry_s
+{
+    ZPOS64_T pos_in_central_dir;   /* offset of the entry in the central dir */
+    uLong name_offset;             /* offset of the name in names */
+    uLong hash_cs;                 /* hash of the name */
+    uLong hash_ci;                 /* hash of the upper cased name */
+} unz64_index_entry;
+
+typedef struct unz64_index_s
+{
+    ZPOS64_T number_entry;         /* number of entries in the index */
+    unz64_index_entry* entries;
+    char* names;                   /* '\0' terminated names, back to back */
+    uLong hash_mask;               /* size of the hash tables - 1 */
+    uLong* hash_cs;                /* entry number + 1 for each slot, 0 if empty */
+    uLong* hash_ci;
+} unz64_index;
+
 
 /* unz64_s contain internal information about the zipfile
 */
@@ -173,6 +275,8 @@ typedef struct
     ZPOS64_T pos_in_central_dir;   /* pos of the current file in the central dir*/
     ZPOS64_T current_file_ok;      /* flag about the usability of the current file*/
     ZPOS64_T central_pos;          /* position of the beginning of the central dir*/
+    ZPOS64_T end_central_pos;      /* position of the end of central dir record,
+                                      followed by the global comment */
 
     ZPOS64_T size_central_dir;     /* size of the central directory  */
     ZPOS64_T offset_central_dir;   /* offset of start of central directory with
@@ -182,13 +286,25 @@ typedef struct
     unz_file_info64_internal cur_file_info_internal; /* private info about it*/
     file_in_zip64_read_info_s* pfile_in_zip_read; /* structure about the current
                                         file if we are decompressing it */
+    file_in_zip64_read_info_s* read_info_pool; /* structure of the last file
+                                        closed, with its buffer and inflate
+                                        state kept for the next one, or NULL */
     int encrypted;
 
     int isZip64;
 
+    unz64_index* index;            /* optional index built by unzBuildIndex */
+    unsigned char* central_dir;    /* copy of the central directory, or NULL */
+    const unsigned char* map_base; /* mapping of the zipfile, if the io
+                                      functions support it */
+    ZPOS64_T map_size;
+
 #    ifndef NOUNCRYPT
     unsigned long keys[3];     /* keys defining the pseudo-random sequence */
-    const unsigned long* pcrc_32_tab;
+    const z_crc_t* pcrc_32_tab;
+    int aes_version;           /* AE-1 or AE-2 when the current file is
+                                  WinZip AES encrypted, else 0 */
+    lk_aes_ctx aes;
 #    endif
 } unz64_s;
 
@@ -197,6 +313,37 @@ typedef struct
 #include "lk_crypt.h"
 #endif
 
+/* ===========================================================================
+   Read size bytes of the zipfile at pos for the file being read. With
+   positional reads the stream is never moved; else the seek is skipped when
+   the previous read already left the stream at pos, as a seek on a stdio
+   stream throws away its buffer.
+*/
+local uLong unz64local_ReadAt (file_in_zip64_read_info_s* p, void* buf, uLong size, ZPOS64_T pos)
+{
+    uLong read;
+
+    if (p->z_filefunc.zpread64_file != NULL)
+        return ZPREAD64(p->z_filefunc, p->filestream, buf, size, pos);
+
+    if (p->pos_in_stream != pos)
+    {
+        p->pos_in_stream = UNZ_POS_UNKNOWN;
+        if (ZSEEK64(p->z_filefunc, p->filestream, pos, ZLIB_FILEFUNC_SEEK_SET)!=0)
+            return 0;
+    }
+    read = ZREAD64(p->z_filefunc, p->filestream, buf, size);
+    p->pos_in_stream = (read==size) ? pos + size : UNZ_POS_UNKNOWN;
+    return read;
+}
+
+/* the stream is about to be moved by someone else than unz64local_ReadAt */
+local void unz64local_StreamMoved (unz64_s* s)
+{
+    if (s->pfile_in_zip_read!=NULL)
+        s->pfile_in_zip_read->pos_in_stream = UNZ_POS_UNKNOWN;
+}
+
 /* ===========================================================================
      Read a byte from a gz_stream; update next_in and avail_in. Return EOF
    for end of file.
@@ -401,136 +548,77 @@ extern int ZEXPORT unzStringFileNameCompare (const char*  fileName1,
     return STRCMPCASENOSENTIVEFUNCTION(fileName1,fileName2);
 }
 
-#ifndef BUFREADCOMMENT
-#define BUFREADCOMMENT (0x400)
-#endif
-
 /*
-  Locate the Central directory of a zipfile (at the end, just before
-    the global comment)
+  Hash a filename for the central directory index (FNV-1a). If iFoldCase is
+  not 0, 'a'..'z' are hashed as 'A'..'Z', like strcmpcasenosensitive_internal
 */
-local ZPOS64_T unz64local_SearchCentralDir OF((const zlib_filefunc64_32_def* pzlib_filefunc_def, voidpf filestream));
-local ZPOS64_T unz64local_SearchCentralDir(const zlib_filefunc64_32_def* pzlib_filefunc_def, voidpf filestream)
+local uLong unz64local_HashFileName (const char* fileName, int iFoldCase)
 {
-    unsigned char* buf;
-    ZPOS64_T uSizeFile;
-    ZPOS64_T uBackRead;
-    ZPOS64_T uMaxBack=0xffff; /* maximum size of global comment */
-    ZPOS64_T uPosFound=0;
-
-    if (ZSEEK64(*pzlib_filefunc_def,filestream,0,ZLIB_FILEFUNC_SEEK_END) != 0)
-        return 0;
-
-
-    uSizeFile = ZTELL64(*pzlib_filefunc_def,filestream);
-
-    if (uMaxBack>uSizeFile)
-        uMaxBack = uSizeFile;
-
-    buf = (unsigned char*)ALLOC(BUFREADCOMMENT+4);
-    if (buf==NULL)
-        return 0;
-
-    uBackRead = 4;
-    while (uBackRead<uMaxBack)
+    uLong h = 2166136261UL;
+    for (;;)
     {
-        uLong uReadSize;
-        ZPOS64_T uReadPos ;
-        int i;
-        if (uBackRead+BUFREADCOMMENT>uMaxBack)
-            uBackRead = uMaxBack;
-        else
-            uBackRead+=BUFREADCOMMENT;
-        uReadPos = uSizeFile-uBackRead ;
-
-        uReadSize = ((BUFREADCOMMENT+4) < (uSizeFile-uReadPos)) ?
-                     (BUFREADCOMMENT+4) : (uLong)(uSizeFile-uReadPos);
-        if (ZSEEK64(*pzlib_filefunc_def,filestream,uReadPos,ZLIB_FILEFUNC_SEEK_SET)!=0)
+        char c=*(fileName++);
+        if (c=='\0')
             break;
+        if ((iFoldCase) && (c>='a') && (c<='z'))
+            c -= 0x20;
+        h = ((h ^ (unsigned char)c) * 16777619UL) & 0xffffffffUL;
+    }
+    return h;
+}
 
-        if (ZREAD64(*pzlib_filefunc_def,filestream,buf,uReadSize)!=uReadSize)
-            break;
+local void unz64local_FreeIndex (unz64_index* pindex)
+{
+    if (pindex==NULL)
+        return;
+    TRYFREE(pindex->entries);
+    TRYFREE(pindex->names);
+    TRYFREE(pindex->hash_cs);
+    TRYFREE(pindex->hash_ci);
+    TRYFREE(pindex);
+}
 
-        for (i=(int)uReadSize-3; (i--)>0;)
-            if (((*(buf+i))==0x50) && ((*(buf+i+1))==0x4b) &&
-                ((*(buf+i+2))==0x05) && ((*(buf+i+3))==0x06))
-            {
-                uPosFound = uReadPos+i;
-                break;
-            }
+/* zlib allocates through these, so that ALLOC and TRYFREE see it */
+local voidpf unz64local_zalloc OF((voidpf opaque, uInt items, uInt size));
+local voidpf unz64local_zalloc (voidpf opaque, uInt items, uInt size)
+{
+    return (voidpf)ALLOC((size_t)items*size);
+}
 
-        if (uPosFound!=0)
-            break;
-    }
-    TRYFREE(buf);
-    return uPosFound;
+local void unz64local_zfree OF((voidpf opaque, voidpf address));
+local void unz64local_zfree (voidpf opaque, voidpf address)
+{
+    TRYFREE(address);
 }
 
+/* free a file_in_zip64_read_info_s of the pool, or one which failed to open */
+local void unz64local_FreeReadInfo OF((file_in_zip64_read_info_s* pfile_in_zip_read_info));
+local void unz64local_FreeReadInfo (file_in_zip64_read_info_s* pfile_in_zip_read_info)
+{
+    if (pfile_in_zip_read_info==NULL)
+        return;
+    if (pfile_in_zip_read_info->inflate_ready)
+        inflateEnd(&pfile_in_zip_read_info->stream);
+    TRYFREE(pfile_in_zip_read_info->read_buffer);
+    TRYFREE(pfile_in_zip_read_info);
+}
 
 /*
-  Locate the Central directory 64 of a zipfile (at the end, just before
-    the global comment)
+  Check the Zip64 end of central directory locator found at uPosFound, and
+    return the position of the Zip64 end of central directory record
 */
 local ZPOS64_T unz64local_SearchCentralDir64 OF((
     const zlib_filefunc64_32_def* pzlib_filefunc_def,
-    voidpf filestream));
+    voidpf filestream,
+    ZPOS64_T uPosFound));
 
 local ZPOS64_T unz64local_SearchCentralDir64(const zlib_filefunc64_32_def* pzlib_filefunc_def,
-                                      voidpf filestream)
+                                      voidpf filestream,
+                                      ZPOS64_T uPosFound)
 {
-    unsigned char* buf;
-    ZPOS64_T uSizeFile;
-    ZPOS64_T uBackRead;
-    ZPOS64_T uMaxBack=0xffff; /* maximum size of global comment */
-    ZPOS64_T uPosFound=0;
     uLong uL;
-                ZPOS64_T relativeOffset;
-
-    if (ZSEEK64(*pzlib_filefunc_def,filestream,0,ZLIB_FILEFUNC_SEEK_END) != 0)
-        return 0;
-
-
-    uSizeFile = ZTELL64(*pzlib_filefunc_def,filestream);
-
-    if (uMaxBack>uSizeFile)
-        uMaxBack = uSizeFile;
-
-    buf = (unsigned char*)ALLOC(BUFREADCOMMENT+4);
-    if (buf==NULL)
-        return 0;
-
-    uBackRead = 4;
-    while (uBackRead<uMaxBack)
-    {
-        uLong uReadSize;
-        ZPOS64_T uReadPos;
-        int i;
-        if (uBackRead+BUFREADCOMMENT>uMaxBack)
-            uBackRead = uMaxBack;
-        else
-            uBackRead+=BUFREADCOMMENT;
-        uReadPos = uSizeFile-uBackRead ;
-
-        uReadSize = ((BUFREADCOMMENT+4) < (uSizeFile-uReadPos)) ?
-                     (BUFREADCOMMENT+4) : (uLong)(uSizeFile-uReadPos);
-        if (ZSEEK64(*pzlib_filefunc_def,filestream,uReadPos,ZLIB_FILEFUNC_SEEK_SET)!=0)
-            break;
-
-        if (ZREAD64(*pzlib_filefunc_def,filestream,buf,uReadSize)!=uReadSize)
-            break;
-
-        for (i=(int)uReadSize-3; (i--)>0;)
-            if (((*(buf+i))==0x50) && ((*(buf+i+1))==0x4b) &&
-                ((*(buf+i+2))==0x06) && ((*(buf+i+3))==0x07))
-            {
-                uPosFound = uReadPos+i;
-                break;
-            }
+    ZPOS64_T relativeOffset;
 
-        if (uPosFound!=0)
-            break;
-    }
-    TRYFREE(buf);
     if (uPosFound == 0)
         return 0;
 
@@ -572,6 +660,133 @@ local ZPOS64_T unz64local_SearchCentralDir64(const zlib_filefunc64_32_def* pzlib
     return relativeOffset;
 }
 
+/* ===========================================================================
+   Decode little endian values from a buffer already in memory. The compiler
+   turns these into single (unaligned) loads on little endian targets.
+*/
+local uLong unz64local_readShort (const unsigned char* p)
+{
+    return (uLong)p[0] | ((uLong)p[1]<<8);
+}
+
+local uLong unz64local_readLong (const unsigned char* p)
+{
+    return (uLong)p[0] | ((uLong)p[1]<<8) | ((uLong)p[2]<<16) | ((uLong)p[3]<<24);
+}
+
+local ZPOS64_T unz64local_readLong64 (const unsigned char* p)
+{
+    return (ZPOS64_T)unz64local_readLong(p) | ((ZPOS64_T)unz64local_readLong(p+4)<<32);
+}
+
+/*
+  Read the whole central directory in *pbuf with a single seek, and as few
+  reads as ZREAD64 allows (its size is an uLong).
+*/
+local int unz64local_ReadCentralDir (unz64_s* s, unsigned char** pbuf)
+{
+    unsigned char* buf;
+    ZPOS64_T size_read = 0;
+    int err = UNZ_OK;
+
+    *pbuf = NULL;
+    if ((size_t)s->size_central_dir != s->size_central_dir)
+        return UNZ_INTERNALERROR;
+
+    buf = (unsigned char*)ALLOC((size_t)s->size_central_dir + 1);
+    if (buf==NULL)
+        return UNZ_INTERNALERROR;
+
+    unz64local_StreamMoved(s);
+    if (ZSEEK64(s->z_filefunc, s->filestream,
+              s->offset_central_dir+s->byte_before_the_zipfile,
+              ZLIB_FILEFUNC_SEEK_SET)!=0)
+        err=UNZ_ERRNO;
+
+    while ((err==UNZ_OK) && (size_read<s->size_central_dir))
+    {
+        uLong uReadThis = 0x40000000UL;
+        if (s->size_central_dir-size_read<uReadThis)
+            uReadThis = (uLong)(s->size_central_dir-size_read);
+        if (ZREAD64(s->z_filefunc, s->filestream,buf+size_read,uReadThis)!=uReadThis)
+            err=UNZ_ERRNO;
+        size_read += uReadThis;
+    }
+
+    if (err!=UNZ_OK)
+    {
+        TRYFREE(buf);
+        return err;
+    }
+    *pbuf = buf;
+    return UNZ_OK;
+}
+
+/*
+  Return a pointer on the complete central directory record (header, filename,
+  extra field and comment) at s->pos_in_central_dir.
+  It points in the cached central directory when possible, else the record is
+  read from the file in *pentry_buf, which the caller must free.
+  Return NULL and set *perr if there is an error.
+*/
+local const unsigned char* unz64local_GetCentralDirEntry (unz64_s* s,
+                                                         unsigned char** pentry_buf,
+                                                         int* perr)
+{
+    unsigned char header[SIZECENTRALDIRITEM];
+    unsigned char* buf;
+    uLong size_variable;
+
+    *pentry_buf = NULL;
+
+    if ((s->central_dir!=NULL) &&
+        (s->pos_in_central_dir>=s->offset_central_dir) &&
+        (s->pos_in_central_dir-s->offset_central_dir+SIZECENTRALDIRITEM<=s->size_central_dir))
+    {
+        const unsigned char* p = s->central_dir + (s->pos_in_central_dir-s->offset_central_dir);
+        size_variable = unz64local_readShort(p+28) + unz64local_readShort(p+30) +
+                        unz64local_readShort(p+32);
+        if (s->pos_in_central_dir-s->offset_central_dir+SIZECENTRALDIRITEM+size_variable<=s->size_central_dir)
+            return p;
+    }
+
+    unz64local_StreamMoved(s);
+    if (ZSEEK64(s->z_filefunc, s->filestream,
+              s->pos_in_central_dir+s->byte_before_the_zipfile,
+              ZLIB_FILEFUNC_SEEK_SET)!=0)
+    {
+        *perr = UNZ_ERRNO;
+        return NULL;
+    }
+
+    if (ZREAD64(s->z_filefunc, s->filestream,header,SIZECENTRALDIRITEM)!=SIZECENTRALDIRITEM)
+    {
+        *perr = UNZ_ERRNO;
+        return NULL;
+    }
+
+    size_variable = unz64local_readShort(header+28) + unz64local_readShort(header+30) +
+                    unz64local_readShort(header+32);
+    buf = (unsigned char*)ALLOC(SIZECENTRALDIRITEM+size_variable);
+    if (buf==NULL)
+    {
+        *perr = UNZ_INTERNALERROR;
+        return NULL;
+    }
+    memcpy(buf,header,SIZECENTRALDIRITEM);
+
+    if ((size_variable>0) &&
+        (ZREAD64(s->z_filefunc, s->filestream,buf+SIZECENTRALDIRITEM,size_variable)!=size_variable))
+    {
+        TRYFREE(buf);
+        *perr = UNZ_ERRNO;
+        return NULL;
+    }
+
+    *pentry_buf = buf;
+    return buf;
+}
+
 /*
   Open a Zip file. path contain the full pathname (by example,
      on a Windows NT computer "c:\\test\\zlib114.zip" or on an Unix computer
@@ -588,6 +803,8 @@ local unzFile unzOpenInternal (const void *path,
     unz64_s us;
     unz64_s *s;
     ZPOS64_T central_pos;
+    ZPOS64_T end_central_pos;
+    ZPOS64_T locator_pos;
     uLong   uL;
 
     uLong number_disk;          /* number of the current dist, used for
@@ -606,7 +823,13 @@ local unzFile unzOpenInternal (const void *path,
     us.z_filefunc.zseek32_file = NULL;
     us.z_filefunc.ztell32_file = NULL;
     if (pzlib_filefunc64_32_def==NULL)
-        fill_fopen64_filefunc(&us.z_filefunc.zfile_func64);
+    {
+        zlib_filefunc64_ex_def stdio_filefunc;
+        fill_fopen64_filefunc_ex(&stdio_filefunc);
+        us.z_filefunc.zfile_func64 = stdio_filefunc.zfile_func64;
+        us.z_filefunc.zmap64_file = stdio_filefunc.zmap64_file;
+        us.z_filefunc.zpread64_file = stdio_filefunc.zpread64_file;
+    }
     else
         us.z_filefunc = *pzlib_filefunc64_32_def;
     us.is64bitOpenFunction = is64bitOpenFunction;
@@ -620,7 +843,11 @@ local unzFile unzOpenInternal (const void *path,
     if (us.filestream==NULL)
         return NULL;
 
-    central_pos = unz64local_SearchCentralDir64(&us.z_filefunc,us.filestream);
+    /* locate the end of central directory records with a single read */
+    if (call_zsearch_central_dir(&us.z_filefunc,us.filestream,&end_central_pos,&locator_pos)!=0)
+        err=UNZ_ERRNO;
+
+    central_pos = unz64local_SearchCentralDir64(&us.z_filefunc,us.filestream,locator_pos);
     if (central_pos)
     {
         uLong uS;
@@ -678,11 +905,16 @@ local unzFile unzOpenInternal (const void *path,
         if (unz64local_getLong64(&us.z_filefunc, us.filestream,&us.offset_central_dir)!=UNZ_OK)
             err=UNZ_ERRNO;
 
+        /* the comment length is only in the end of central dir record */
         us.gi.size_comment = 0;
+        if ((end_central_pos!=0) &&
+            ((ZSEEK64(us.z_filefunc, us.filestream, end_central_pos+20,ZLIB_FILEFUNC_SEEK_SET)!=0) ||
+             (unz64local_getShort(&us.z_filefunc, us.filestream,&us.gi.size_comment)!=UNZ_OK)))
+            err=UNZ_ERRNO;
     }
     else
     {
-        central_pos = unz64local_SearchCentralDir(&us.z_filefunc,us.filestream);
+        central_pos = end_central_pos;
         if (central_pos==0)
             err=UNZ_ERRNO;
 
@@ -748,14 +980,23 @@ local unzFile unzOpenInternal (const void *path,
     us.byte_before_the_zipfile = central_pos -
                             (us.offset_central_dir+us.size_central_dir);
     us.central_pos = central_pos;
+    us.end_central_pos = end_central_pos;
     us.pfile_in_zip_read = NULL;
+    us.read_info_pool = NULL;
     us.encrypted = 0;
+    us.index = NULL;
+    us.central_dir = NULL;
+    us.map_base = (const unsigned char*)ZMAP64(us.z_filefunc,us.filestream,&us.map_size);
 
 
     s=(unz64_s*)ALLOC(sizeof(unz64_s));
     if( s != NULL)
     {
         *s=us;
+        /* keep the central directory in memory, so browsing it does not cost
+           a read per field. If it is too big, it is read entry by entry */
+        if (s->size_central_dir<=UNZ_MAXCENTRALDIRCACHE)
+            unz64local_ReadCentralDir(s,&s->central_dir);
         unzGoToFirstFile((unzFile)s);
     }
     return (unzFile)s;
@@ -784,6 +1025,25 @@ extern unzFile ZEXPORT unzOpen2_64 (const void *path,
         zlib_filefunc64_32_def_fill.zfile_func64 = *pzlib_filefunc_def;
         zlib_filefunc64_32_def_fill.ztell32_file = NULL;
         zlib_filefunc64_32_def_fill.zseek32_file = NULL;
+        zlib_filefunc64_32_def_fill.zmap64_file = NULL;
+        zlib_filefunc64_32_def_fill.zpread64_file = NULL;
+        return unzOpenInternal(path, &zlib_filefunc64_32_def_fill, 1);
+    }
+    else
+        return unzOpenInternal(path, NULL, 1);
+}
+
+extern unzFile ZEXPORT unzOpen3_64 (const void *path,
+                                     zlib_filefunc64_ex_def* pzlib_filefunc_def)
+{
+    if (pzlib_filefunc_def != NULL)
+    {
+        zlib_filefunc64_32_def zlib_filefunc64_32_def_fill;
+        zlib_filefunc64_32_def_fill.zfile_func64 = pzlib_filefunc_def->zfile_func64;
+        zlib_filefunc64_32_def_fill.ztell32_file = NULL;
+        zlib_filefunc64_32_def_fill.zseek32_file = NULL;
+        zlib_filefunc64_32_def_fill.zmap64_file = pzlib_filefunc_def->zmap64_file;
+        zlib_filefunc64_32_def_fill.zpread64_file = pzlib_filefunc_def->zpread64_file;
         return unzOpenInternal(path, &zlib_filefunc64_32_def_fill, 1);
     }
     else
@@ -815,6 +1075,9 @@ extern int ZEXPORT unzClose (unzFile file)
     if (s->pfile_in_zip_read!=NULL)
         unzCloseCurrentFile(file);
 
+    unz64local_FreeReadInfo(s->read_info_pool);
+    unz64local_FreeIndex(s->index);
+    TRYFREE(s->central_dir);
     ZCLOSE64(s->z_filefunc, s->filestream);
     TRYFREE(s);
     return UNZ_OK;
@@ -862,6 +1125,87 @@ local void unz64local_DosDateToTmuDate (ZPOS64_T ulDosDate, tm_unz* ptm)
     ptm->tm_sec =  (uInt) (2*(ulDosDate&0x1f)) ;
 }
 
+/*
+  Decode the central directory record at p (its signature already checked),
+  with the sizes and offset of its ZIP64 extra field.
+*/
+local void unz64local_ParseCentralDirEntry (const unsigned char* p,
+                                            unz_file_info64* pfile_info,
+                                            unz_file_info64_internal* pfile_info_internal)
+{
+    unz_file_info64 file_info;
+    unz_file_info64_internal file_info_internal;
+    const unsigned char* extra;
+
+    file_info.version = unz64local_readShort(p+4);
+    file_info.version_needed = unz64local_readShort(p+6);
+    file_info.flag = unz64local_readShort(p+8);
+    file_info.compression_method = unz64local_readShort(p+10);
+    file_info.dosDate = unz64local_readLong(p+12);
+
+    unz64local_DosDateToTmuDate(file_info.dosDate,&file_info.tmu_date);
+
+    file_info.crc = unz64local_readLong(p+16);
+    file_info.compressed_size = unz64local_readLong(p+20);
+    file_info.uncompressed_size = unz64local_readLong(p+24);
+    file_info.size_filename = unz64local_readShort(p+28);
+    file_info.size_file_extra = unz64local_readShort(p+30);
+    file_info.size_file_comment = unz64local_readShort(p+32);
+    file_info.disk_num_start = unz64local_readShort(p+34);
+    file_info.internal_fa = unz64local_readShort(p+36);
+    file_info.external_fa = unz64local_readLong(p+38);
+
+    // relative offset of local header
+    file_info_internal.offset_curfile = unz64local_readLong(p+42);
+
+    extra = p + SIZECENTRALDIRITEM + file_info.size_filename;
+
+    if (file_info.size_file_extra != 0)
+    {
+        uLong acc = 0;
+
+        while (acc + 4 <= file_info.size_file_extra)
+        {
+            uLong headerId = unz64local_readShort(extra+acc);
+            uLong dataSize = unz64local_readShort(extra+acc+2);
+            const unsigned char* data = extra+acc+4;
+            const unsigned char* data_end = data+dataSize;
+
+            if (acc + 4 + dataSize > file_info.size_file_extra)
+                break;
+
+            /* ZIP64 extra fields */
+            if (headerId == 0x0001)
+            {
+                if ((file_info.uncompressed_size == 0xffffffff) && (data+8<=data_end))
+                {
+                    file_info.uncompressed_size = unz64local_readLong64(data);
+                    data += 8;
+                }
+
+                if ((file_info.compressed_size == 0xffffffff) && (data+8<=data_end))
+                {
+                    file_info.compressed_size = unz64local_readLong64(data);
+                    data += 8;
+                }
+
+                if ((file_info_internal.offset_curfile == 0xffffffff) && (data+8<=data_end))
+                {
+                    /* Relative Header offset */
+                    file_info_internal.offset_curfile = unz64local_readLong64(data);
+                }
+
+                /* the Disk Start Number is not used, spanning is unsupported */
+            }
+
+            acc += 2 + 2 + dataSize;
+        }
+    }
+
+    *pfile_info = file_info;
+    *pfile_info_internal = file_info_internal;
+}
+
 /*
   Get Info about the current file in the zipfile, with internal only info
 */
@@ -891,81 +1235,30 @@ local int unz64local_GetCurrentFileInfoInternal (unzFile file,
     unz_file_info64 file_info;
     unz_file_info64_internal file_info_internal;
     int err=UNZ_OK;
-    uLong uMagic;
-    long lSeek=0;
-    uLong uL;
+    unsigned char* entry_buf = NULL;
+    const unsigned char* p;
+    const unsigned char* extra;
 
     if (file==NULL)
         return UNZ_PARAMERROR;
     s=(unz64_s*)file;
-    if (ZSEEK64(s->z_filefunc, s->filestream,
-              s->pos_in_central_dir+s->byte_before_the_zipfile,
-              ZLIB_FILEFUNC_SEEK_SET)!=0)
-        err=UNZ_ERRNO;
 
+    p = unz64local_GetCentralDirEntry(s,&entry_buf,&err);
+    if (p==NULL)
+        return err;
 
     /* we check the magic */
-    if (err==UNZ_OK)
+    if (unz64local_readLong(p)!=0x02014b50)
     {
-        if (unz64local_getLong(&s->z_filefunc, s->filestream,&uMagic) != UNZ_OK)
-            err=UNZ_ERRNO;
-        else if (uMagic!=0x02014b50)
-            err=UNZ_BADZIPFILE;
+        TRYFREE(entry_buf);
+        return UNZ_BADZIPFILE;
     }
 
-    if (unz64local_getShort(&s->z_filefunc, s->filestream,&file_info.version) != UNZ_OK)
-        err=UNZ_ERRNO;
-
-    if (unz64local_getShort(&s->z_filefunc, s->filestream,&file_info.version_needed) != UNZ_OK)
-        err=UNZ_ERRNO;
-
-    if (unz64local_getShort(&s->z_filefunc, s->filestream,&file_info.flag) != UNZ_OK)
-        err=UNZ_ERRNO;
-
-    if (unz64local_getShort(&s->z_filefunc, s->filestream,&file_info.compression_method) != UNZ_OK)
-        err=UNZ_ERRNO;
-
-    if (unz64local_getLong(&s->z_filefunc, s->filestream,&file_info.dosDate) != UNZ_OK)
-        err=UNZ_ERRNO;
-
-    unz64local_DosDateToTmuDate(file_info.dosDate,&file_info.tmu_date);
-
-    if (unz64local_getLong(&s->z_filefunc, s->filestream,&file_info.crc) != UNZ_OK)
-        err=UNZ_ERRNO;
-
-    if (unz64local_getLong(&s->z_filefunc, s->filestream,&uL) != UNZ_OK)
-        err=UNZ_ERRNO;
-    file_info.compressed_size = uL;
-
-    if (unz64local_getLong(&s->z_filefunc, s->filestream,&uL) != UNZ_OK)
-        err=UNZ_ERRNO;
-    file_info.uncompressed_size = uL;
-
-    if (unz64local_getShort(&s->z_filefunc, s->filestream,&file_info.size_filename) != UNZ_OK)
-        err=UNZ_ERRNO;
-
-    if (unz64local_getShort(&s->z_filefunc, s->filestream,&file_info.size_file_extra) != UNZ_OK)
-        err=UNZ_ERRNO;
-
-    if (unz64local_getShort(&s->z_filefunc, s->filestream,&file_info.size_file_comment) != UNZ_OK)
-        err=UNZ_ERRNO;
-
-    if (unz64local_getShort(&s->z_filefunc, s->filestream,&file_info.disk_num_start) != UNZ_OK)
-        err=UNZ_ERRNO;
-
-    if (unz64local_getShort(&s->z_filefunc, s->filestream,&file_info.internal_fa) != UNZ_OK)
-        err=UNZ_ERRNO;
-
-    if (unz64local_getLong(&s->z_filefunc, s->filestream,&file_info.external_fa) != UNZ_OK)
-        err=UNZ_ERRNO;
+    unz64local_ParseCentralDirEntry(p,&file_info,&file_info_internal);
 
-                // relative offset of local header
-    if (unz64local_getLong(&s->z_filefunc, s->filestream,&uL) != UNZ_OK)
-        err=UNZ_ERRNO;
-    file_info_internal.offset_curfile = uL;
+    extra = p + SIZECENTRALDIRITEM + file_info.size_filename;
 
-    lSeek+=file_info.size_filename;
-    if ((err==UNZ_OK) && (szFileName!=NULL))
+    if (szFileName!=NULL)
     {
         uLong uSizeRead ;
         if (file_info.size_filename<fileNameBufferSize)
@@ -977,107 +1270,23 @@ local int unz64local_GetCurrentFileInfoInternal (unzFile file,
             uSizeRead = fileNameBufferSize;
 
         if ((file_info.size_filename>0) && (fileNameBufferSize>0))
-            if (ZREAD64(s->z_filefunc, s->filestream,szFileName,uSizeRead)!=uSizeRead)
-                err=UNZ_ERRNO;
-        lSeek -= uSizeRead;
+            memcpy(szFileName,p+SIZECENTRALDIRITEM,uSizeRead);
     }
 
     // Read extrafield
-    if ((err==UNZ_OK) && (extraField!=NULL))
+    if (extraField!=NULL)
     {
-        ZPOS64_T uSizeRead ;
+        uLong uSizeRead ;
         if (file_info.size_file_extra<extraFieldBufferSize)
             uSizeRead = file_info.size_file_extra;
         else
             uSizeRead = extraFieldBufferSize;
 
-        if (lSeek!=0)
-        {
-            if (ZSEEK64(s->z_filefunc, s->filestream,lSeek,ZLIB_FILEFUNC_SEEK_CUR)==0)
-                lSeek=0;
-            else
-                err=UNZ_ERRNO;
-        }
-
         if ((file_info.size_file_extra>0) && (extraFieldBufferSize>0))
-            if (ZREAD64(s->z_filefunc, s->filestream,extraField,(uLong)uSizeRead)!=uSizeRead)
-                err=UNZ_ERRNO;
-
-        lSeek += file_info.size_file_extra - (uLong)uSizeRead;
-    }
-    else
-        lSeek += file_info.size_file_extra;
-
-
-    if ((err==UNZ_OK) && (file_info.size_file_extra != 0))
-    {
-                                uLong acc = 0;
-
-        // since lSeek now points to after the extra field we need to move back
-        lSeek -= file_info.size_file_extra;
-
-        if (lSeek!=0)
-        {
-            if (ZSEEK64(s->z_filefunc, s->filestream,lSeek,ZLIB_FILEFUNC_SEEK_CUR)==0)
-                lSeek=0;
-            else
-                err=UNZ_ERRNO;
-        }
-
-        while(acc < file_info.size_file_extra)
-        {
-            uLong headerId;
-                                                uLong dataSize;
-
-            if (unz64local_getShort(&s->z_filefunc, s->filestream,&headerId) != UNZ_OK)
-                err=UNZ_ERRNO;
-
-            if (unz64local_getShort(&s->z_filefunc, s->filestream,&dataSize) != UNZ_OK)
-                err=UNZ_ERRNO;
-
-            /* ZIP64 extra fields */
-            if (headerId == 0x0001)
-            {
-                                                        uLong uLZip64;
-
-                                                                if(file_info.uncompressed_size == (ZPOS64_T)(unsigned long)-1)
-                                                                {
-                                                                        if (unz64local_getLong64(&s->z_filefunc, s->filestream,&file_info.uncompressed_size) != UNZ_OK)
-                                                                                        err=UNZ_ERRNO;
-                                                                }
-
-                                                                if(file_info.compressed_size == (ZPOS64_T)(unsigned long)-1)
-                                                                {
-                                                                        if (unz64local_getLong64(&s->z_filefunc, s->filestream,&file_info.compressed_size) != UNZ_OK)
-                                                                                  err=UNZ_ERRNO;
-                                                                }
-
-                                                                if(file_info_internal.offset_curfile == (ZPOS64_T)(unsigned long)-1)
-                                                                {
-                                                                        /* Relative Header offset */
-                                                                        if (unz64local_getLong64(&s->z_filefunc, s->filestream,&file_info_internal.offset_curfile) != UNZ_OK)
-                                                                                err=UNZ_ERRNO;
-                                                                }
-
-                                                                if(file_info.disk_num_start == (unsigned long)-1)
-                                                                {
-                                                                        /* Disk Start Number */
-                                                                        if (unz64local_getLong(&s->z_filefunc, s->filestream,&uLZip64) != UNZ_OK)
-                                                                                err=UNZ_ERRNO;
-                                                                }
-
-            }
-            else
-            {
-                if (ZSEEK64(s->z_filefunc, s->filestream,dataSize,ZLIB_FILEFUNC_SEEK_CUR)!=0)
-                    err=UNZ_ERRNO;
-            }
-
-            acc += 2 + 2 + dataSize;
-        }
+            memcpy(extraField,extra,uSizeRead);
     }
 
-    if ((err==UNZ_OK) && (szComment!=NULL))
+    if (szComment!=NULL)
     {
         uLong uSizeRead ;
         if (file_info.size_file_comment<commentBufferSize)
@@ -1088,30 +1297,11 @@ local int unz64local_GetCurrentFileInfoInternal (unzFile file,
         else
             uSizeRead = commentBufferSize;
 
-        if (lSeek!=0)
-        {
-            if (ZSEEK64(s->z_filefunc, s->filestream,lSeek,ZLIB_FILEFUNC_SEEK_CUR)==0)
-			{
-#ifndef __clang_analyzer__
-                lSeek=0;
-#endif
-			}
-            else
-                err=UNZ_ERRNO;
-        }
-
         if ((file_info.size_file_comment>0) && (commentBufferSize>0))
-            if (ZREAD64(s->z_filefunc, s->filestream,szComment,uSizeRead)!=uSizeRead)
-                err=UNZ_ERRNO;
-#ifndef __clang_analyzer__
-        lSeek+=file_info.size_file_comment - uSizeRead;
-#endif
+            memcpy(szComment,extra+file_info.size_file_extra,uSizeRead);
     }
-#ifndef __clang_analyzer__
-    else
-        lSeek+=file_info.size_file_comment;
-#endif
 
+    TRYFREE(entry_buf);
 
     if ((err==UNZ_OK) && (pfile_info!=NULL))
         *pfile_info=file_info;
@@ -1295,6 +1485,200 @@ extern int ZEXPORT unzLocateFile (unzFile file, const char *szFileName, int iCas
 }
 
 
+/*
+  Read the whole central directory in one pass and build an index of the
+  filenames, with one hash table for case sensitive and one for case
+  insensitive lookups.
+  return UNZ_OK if there is no problem
+*/
+extern int ZEXPORT unzBuildIndex (unzFile file)
+{
+    unz64_s* s;
+    unz64_index* pindex;
+    unsigned char* buf;
+    ZPOS64_T pos;
+    ZPOS64_T number_entry = 0;
+    ZPOS64_T size_names = 0;
+    ZPOS64_T i;
+    uLong hash_size;
+    uLong name_offset = 0;
+    int err = UNZ_OK;
+
+    if (file==NULL)
+        return UNZ_PARAMERROR;
+    s=(unz64_s*)file;
+
+    if (s->index != NULL)
+        return UNZ_OK;
+
+    if (s->central_dir != NULL)
+        buf = s->central_dir;
+    else
+    {
+        err = unz64local_ReadCentralDir(s,&buf);
+        if (err!=UNZ_OK)
+            return err;
+    }
+
+    /* first pass : count the entries and the size of the names */
+    pos = 0;
+    while ((err==UNZ_OK) && (pos+SIZECENTRALDIRITEM<=s->size_central_dir))
+    {
+        const unsigned char* p = buf+pos;
+        uLong size_filename,size_file_extra,size_file_comment;
+
+        if ((p[0]!=0x50) || (p[1]!=0x4b) || (p[2]!=0x01) || (p[3]!=0x02))
+            break;
+        size_filename = (uLong)p[28] | ((uLong)p[29]<<8);
+        size_file_extra = (uLong)p[30] | ((uLong)p[31]<<8);
+        size_file_comment = (uLong)p[32] | ((uLong)p[33]<<8);
+        if (pos+SIZECENTRALDIRITEM+size_filename>s->size_central_dir)
+        {
+            err=UNZ_BADZIPFILE;
+            break;
+        }
+        number_entry++;
+        size_names += size_filename + 1;
+        pos += SIZECENTRALDIRITEM + size_filename + size_file_extra + size_file_comment;
+    }
+
+    if ((err==UNZ_OK) && ((number_entry>=0x40000000UL) || (size_names>=0xffffffffUL)))
+        err=UNZ_INTERNALERROR;
+
+    if (err!=UNZ_OK)
+    {
+        if (buf!=s->central_dir)
+            TRYFREE(buf);
+        return err;
+    }
+
+    /* keep the hash tables at most half full */
+    hash_size = 1;
+    while (hash_size < number_entry*2)
+        hash_size <<= 1;
+
+    pindex = (unz64_index*)ALLOC(sizeof(unz64_index));
+    if (pindex==NULL)
+    {
+        if (buf!=s->central_dir)
+            TRYFREE(buf);
+        return UNZ_INTERNALERROR;
+    }
+    pindex->number_entry = number_entry;
+    pindex->hash_mask = hash_size-1;
+    pindex->entries = (unz64_index_entry*)ALLOC((size_t)(number_entry+1)*sizeof(unz64_index_entry));
+    pindex->names = (char*)ALLOC((size_t)size_names+1);
+    pindex->hash_cs = (uLong*)ALLOC((size_t)hash_size*sizeof(uLong));
+    pindex->hash_ci = (uLong*)ALLOC((size_t)hash_size*sizeof(uLong));
+    if ((pindex->entries==NULL) || (pindex->names==NULL) ||
+        (pindex->hash_cs==NULL) || (pindex->hash_ci==NULL))
+    {
+        unz64local_FreeIndex(pindex);
+        if (buf!=s->central_dir)
+            TRYFREE(buf);
+        return UNZ_INTERNALERROR;
+    }
+    memset(pindex->hash_cs,0,(size_t)hash_size*sizeof(uLong));
+    memset(pindex->hash_ci,0,(size_t)hash_size*sizeof(uLong));
+
+    /* second pass : copy the names and fill the hash tables.
+       Entries are inserted in central directory order, so with linear probing
+       the first of several identical names is found first, like unzLocateFile */
+    pos = 0;
+    for (i=0;i<number_entry;i++)
+    {
+        const unsigned char* p = buf+pos;
+        unz64_index_entry* pentry = &pindex->entries[i];
+        uLong size_filename = (uLong)p[28] | ((uLong)p[29]<<8);
+        uLong size_file_extra = (uLong)p[30] | ((uLong)p[31]<<8);
+        uLong size_file_comment = (uLong)p[32] | ((uLong)p[33]<<8);
+        uLong slot;
+
+        pentry->pos_in_central_dir = s->offset_central_dir + pos;
+        pentry->name_offset = name_offset;
+        memcpy(pindex->names+name_offset,p+SIZECENTRALDIRITEM,size_filename);
+        pindex->names[name_offset+size_filename] = '\0';
+        pentry->hash_cs = unz64local_HashFileName(pindex->names+name_offset,0);
+        pentry->hash_ci = unz64local_HashFileName(pindex->names+name_offset,1);
+        name_offset += size_filename + 1;
+
+        slot = pentry->hash_cs & pindex->hash_mask;
+        while (pindex->hash_cs[slot]!=0)
+            slot = (slot+1) & pindex->hash_mask;
+        pindex->hash_cs[slot] = (uLong)i+1;
+
+        slot = pentry->hash_ci & pindex->hash_mask;
+        while (pindex->hash_ci[slot]!=0)
+            slot = (slot+1) & pindex->hash_mask;
+        pindex->hash_ci[slot] = (uLong)i+1;
+
+        pos += SIZECENTRALDIRITEM + size_filename + size_file_extra + size_file_comment;
+    }
+
+    if (buf!=s->central_dir)
+        TRYFREE(buf);
+    s->index = pindex;
+    return UNZ_OK;
+}
+
+/*
+  Same than unzLocateFile, but use the index built by unzBuildIndex (if any)
+  to find the file with a single hash lookup.
+*/
+extern int ZEXPORT unzLocateFileIndexed (unzFile file, const char *szFileName, int iCaseSensitivity)
+{
+    unz64_s* s;
+    unz64_index* pindex;
+    const uLong* table;
+    uLong hash;
+    uLong slot;
+    int err;
+
+    if ((file==NULL) || (szFileName==NULL))
+        return UNZ_PARAMERROR;
+    s=(unz64_s*)file;
+
+    pindex = s->index;
+    if (pindex==NULL)
+        return unzLocateFile(file,szFileName,iCaseSensitivity);
+
+    if (iCaseSensitivity==0)
+        iCaseSensitivity=CASESENSITIVITYDEFAULTVALUE;
+
+    if (iCaseSensitivity==1)
+    {
+        hash = unz64local_HashFileName(szFileName,0);
+        table = pindex->hash_cs;
+    }
+    else
+    {
+        hash = unz64local_HashFileName(szFileName,1);
+        table = pindex->hash_ci;
+    }
+
+    for (slot = hash & pindex->hash_mask; table[slot]!=0; slot = (slot+1) & pindex->hash_mask)
+    {
+        ZPOS64_T num_file = table[slot]-1;
+        const unz64_index_entry* pentry = &pindex->entries[num_file];
+        if (((iCaseSensitivity==1) ? pentry->hash_cs : pentry->hash_ci) != hash)
+            continue;
+        if (unzStringFileNameCompare(pindex->names+pentry->name_offset,
+                                     szFileName,iCaseSensitivity)!=0)
+            continue;
+
+        s->pos_in_central_dir = pentry->pos_in_central_dir;
+        s->num_file = num_file;
+        err = unz64local_GetCurrentFileInfoInternal(file,&s->cur_file_info,
+                                                   &s->cur_file_info_internal,
+                                                   NULL,0,NULL,0,NULL,0);
+        s->current_file_ok = (err == UNZ_OK);
+        return err;
+    }
+
+    return UNZ_END_OF_LIST_OF_FILE;
+}
+
+
 /*
 ///////////////////////////////////////////
 // Contributed by Ryan Haksi (mailto://cryogen@infoserve.net)
@@ -1378,6 +1762,102 @@ extern int ZEXPORT unzGoToFilePos(
     return unzGoToFilePos64(file,&file_pos64);
 }
 
+/*
+  Describe all the entries in one pass over the central directory, in a
+  caller provided arena: the array of unz_entry64 first, then the names.
+*/
+extern int ZEXPORT unzListEntries64 (unzFile file, void* arena, ZPOS64_T arena_size,
+                                     unz_entry64** pentries, ZPOS64_T* pnumber_entry,
+                                     ZPOS64_T* parena_needed)
+{
+    unz64_s* s;
+    unsigned char* buf;
+    unz_entry64* entries;
+    char* names;
+    ZPOS64_T pos;
+    ZPOS64_T number_entry = 0;
+    ZPOS64_T size_names = 0;
+    ZPOS64_T needed;
+    ZPOS64_T i;
+    int err = UNZ_OK;
+
+    if (file==NULL)
+        return UNZ_PARAMERROR;
+    s=(unz64_s*)file;
+
+    /* a central directory too big to be cached is read once, in bulk */
+    if (s->central_dir != NULL)
+        buf = s->central_dir;
+    else
+    {
+        err = unz64local_ReadCentralDir(s,&buf);
+        if (err!=UNZ_OK)
+            return err;
+    }
+
+    /* first pass : count the entries and the size of the names */
+    pos = 0;
+    while (pos+SIZECENTRALDIRITEM<=s->size_central_dir)
+    {
+        const unsigned char* p = buf+pos;
+        ZPOS64_T size_record;
+
+        if (unz64local_readLong(p)!=0x02014b50)
+            break;
+        size_record = SIZECENTRALDIRITEM + unz64local_readShort(p+28) +
+                      unz64local_readShort(p+30) + unz64local_readShort(p+32);
+        if (pos+size_record>s->size_central_dir)
+        {
+            err=UNZ_BADZIPFILE;
+            break;
+        }
+        number_entry++;
+        size_names += unz64local_readShort(p+28) + 1;
+        pos += size_record;
+    }
+
+    needed = number_entry*sizeof(unz_entry64) + size_names;
+    if (parena_needed!=NULL)
+        *parena_needed = needed;
+    if (pnumber_entry!=NULL)
+        *pnumber_entry = number_entry;
+    if ((err==UNZ_OK) && (arena!=NULL) && (arena_size<needed))
+        err=UNZ_PARAMERROR;
+    if ((err!=UNZ_OK) || (arena==NULL))
+    {
+        if (buf!=s->central_dir)
+            TRYFREE(buf);
+        return err;
+    }
+
+    /* second pass : decode the records */
+    entries = (unz_entry64*)arena;
+    names = (char*)arena + number_entry*sizeof(unz_entry64);
+    pos = 0;
+    for (i=0;i<number_entry;i++)
+    {
+        const unsigned char* p = buf+pos;
+        unz_file_info64_internal file_info_internal;
+
+        unz64local_ParseCentralDirEntry(p,&entries[i].info,&file_info_internal);
+        entries[i].pos.pos_in_zip_directory = s->offset_central_dir + pos;
+        entries[i].pos.num_of_file = i;
+        entries[i].filename = names;
+        memcpy(names,p+SIZECENTRALDIRITEM,entries[i].info.size_filename);
+        names[entries[i].info.size_filename] = '\0';
+        names += entries[i].info.size_filename + 1;
+
+        pos += SIZECENTRALDIRITEM + entries[i].info.size_filename +
+               entries[i].info.size_file_extra + entries[i].info.size_file_comment;
+    }
+
+    if (buf!=s->central_dir)
+        TRYFREE(buf);
+    if (pentries!=NULL)
+        *pentries = entries;
+    return UNZ_OK;
+}
+
 /*
 // Unzip Helper Functions - should be here?
 ///////////////////////////////////////////
@@ -1431,10 +1911,9 @@ local int unz64local_CheckCurrentFileCoherencyHeader (unz64_s* s, uInt* piSizeVa
         err=UNZ_BADZIPFILE;
 
     if ((err==UNZ_OK) && (s->cur_file_info.compression_method!=0) &&
-/* #ifdef HAVE_BZIP2 */
-                         (s->cur_file_info.compression_method!=Z_BZIP2ED) &&
-/* #endif */
-                         (s->cur_file_info.compression_method!=Z_DEFLATED))
+                         (s->cur_file_info.compression_method!=Z_DEFLATED) &&
+                         (s->cur_file_info.compression_method!=LK_AES_METHOD) &&
+                         (lk_method_find(s->cur_file_info.compression_method)==NULL))
         err=UNZ_BADZIPFILE;
 
     if (unz64local_getLong(&s->z_filefunc, s->filestream,&uData) != UNZ_OK) /* date/time */
@@ -1473,6 +1952,64 @@ local int unz64local_CheckCurrentFileCoherencyHeader (unz64_s* s, uInt* piSizeVa
     return err;
 }
 
+#ifndef NOUNCRYPT
+/*
+  Find the WinZip AES extra field (0x9901) among the size bytes of local
+  extra fields at offset, and get the AE version, the key strength and the
+  real compression method of the file from it.
+*/
+local int unz64local_GetAESExtraField OF((unz64_s* s, ZPOS64_T offset, uInt size,
+                                          int* paes_version, int* paes_strength,
+                                          uLong* pcompression_method));
+local int unz64local_GetAESExtraField (unz64_s* s, ZPOS64_T offset, uInt size,
+                                       int* paes_version, int* paes_strength,
+                                       uLong* pcompression_method)
+{
+    unsigned char* extra;
+    uInt pos = 0;
+    int err = UNZ_BADZIPFILE;
+
+    if (size == 0)
+        return UNZ_BADZIPFILE;
+    extra = (unsigned char*)ALLOC(size);
+    if (extra == NULL)
+        return UNZ_INTERNALERROR;
+
+    unz64local_StreamMoved(s);
+    if ((ZSEEK64(s->z_filefunc, s->filestream, offset + s->byte_before_the_zipfile,
+                 ZLIB_FILEFUNC_SEEK_SET) != 0) ||
+        (ZREAD64(s->z_filefunc, s->filestream, extra, size) != size))
+        err = UNZ_ERRNO;
+    else
+    {
+        while (pos + 4 <= size)
+        {
+            uLong header_id = extra[pos] | ((uLong)extra[pos+1] << 8);
+            uInt data_size = extra[pos+2] | ((uInt)extra[pos+3] << 8);
+            const unsigned char* data = extra + pos + 4;
+
+            if (pos + 4 + data_size > size)
+                break;
+            if ((header_id == LK_AES_EXTRAFIELD_ID) && (data_size >= LK_AES_EXTRAFIELD_SIZE))
+            {
+                *paes_version = data[0] | (data[1] << 8);
+                *paes_strength = data[4];
+                *pcompression_method = data[5] | ((uLong)data[6] << 8);
+                if ((data[2] == 'A') && (data[3] == 'E') &&
+                    ((*paes_version == LK_AES_VERSION_AE1) || (*paes_version == LK_AES_VERSION_AE2)) &&
+                    (*paes_strength >= LK_AES_STRENGTH_128) && (*paes_strength <= LK_AES_STRENGTH_256))
+                    err = UNZ_OK;
+                break;
+            }
+            pos += 4 + data_size;
+        }
+    }
+
+    TRYFREE(extra);
+    return err;
+}
+#endif
+
 /*
   Open for reading data the current file in the zipfile.
   If there is no error and the file is opened, the return value is UNZ_OK.
@@ -1486,8 +2023,11 @@ extern int ZEXPORT unzOpenCurrentFile3 (unzFile file, int* method,
     file_in_zip64_read_info_s* pfile_in_zip_read_info;
     ZPOS64_T offset_local_extrafield;  /* offset of the local extra field */
     uInt  size_local_extrafield;    /* size of the local extra field */
+    uLong compression_method;
 #    ifndef NOUNCRYPT
     char source[12];
+    int aes_version = 0;
+    int aes_strength = 0;
 #    else
     if (password != NULL)
         return UNZ_PARAMERROR;
@@ -1505,11 +2045,41 @@ extern int ZEXPORT unzOpenCurrentFile3 (unzFile file, int* method,
     if (unz64local_CheckCurrentFileCoherencyHeader(s,&iSizeVar, &offset_local_extrafield,&size_local_extrafield)!=UNZ_OK)
         return UNZ_BADZIPFILE;
 
-    pfile_in_zip_read_info = (file_in_zip64_read_info_s*)ALLOC(sizeof(file_in_zip64_read_info_s));
+    /* a WinZip AES file has method 99, its real method is in its extra field.
+       Without the password only its raw data can be read */
+    compression_method = s->cur_file_info.compression_method;
+    if (compression_method == LK_AES_METHOD)
+    {
+        if (password == NULL)
+        {
+            if (!raw)
+                return UNZ_PARAMERROR;
+        }
+#    ifndef NOUNCRYPT
+        else
+        {
+            err = unz64local_GetAESExtraField(s, offset_local_extrafield, size_local_extrafield,
+                                              &aes_version, &aes_strength, &compression_method);
+            if (err != UNZ_OK)
+                return err;
+        }
+#    endif
+    }
+
+    /* the buffer and inflate state of the last file are used again, files
+       of a few bytes would otherwise spend most of their time allocating */
+    pfile_in_zip_read_info = s->read_info_pool;
+    s->read_info_pool = NULL;
     if (pfile_in_zip_read_info==NULL)
-        return UNZ_INTERNALERROR;
+    {
+        pfile_in_zip_read_info = (file_in_zip64_read_info_s*)ALLOC(sizeof(file_in_zip64_read_info_s));
+        if (pfile_in_zip_read_info==NULL)
+            return UNZ_INTERNALERROR;
+
+        pfile_in_zip_read_info->read_buffer=(char*)ALLOC(UNZ_BUFSIZE);
+        pfile_in_zip_read_info->inflate_ready=0;
+    }
 
-    pfile_in_zip_read_info->read_buffer=(char*)ALLOC(UNZ_BUFSIZE);
     pfile_in_zip_read_info->offset_local_extrafield = offset_local_extrafield;
     pfile_in_zip_read_info->size_local_extrafield = size_local_extrafield;
     pfile_in_zip_read_info->pos_local_extrafield=0;
@@ -1518,14 +2088,14 @@ extern int ZEXPORT unzOpenCurrentFile3 (unzFile file, int* method,
 
     if (pfile_in_zip_read_info->read_buffer==NULL)
     {
-        TRYFREE(pfile_in_zip_read_info);
+        unz64local_FreeReadInfo(pfile_in_zip_read_info);
         return UNZ_INTERNALERROR;
     }
 
     pfile_in_zip_read_info->stream_initialised=0;
 
     if (method!=NULL)
-        *method = (int)s->cur_file_info.compression_method;
+        *method = (int)compression_method;
 
     if (level!=NULL)
     {
@@ -1538,11 +2108,9 @@ extern int ZEXPORT unzOpenCurrentFile3 (unzFile file, int* method,
         }
     }
 
-    if ((s->cur_file_info.compression_method!=0) &&
-/* #ifdef HAVE_BZIP2 */
-        (s->cur_file_info.compression_method!=Z_BZIP2ED) &&
-/* #endif */
-        (s->cur_file_info.compression_method!=Z_DEFLATED))
+    if ((compression_method!=0) &&
+        (compression_method!=Z_DEFLATED) &&
+        (lk_method_find(compression_method)==NULL))
 	{
 #ifndef __clang_analyzer__
         err=UNZ_BADZIPFILE;
@@ -1552,53 +2120,41 @@ extern int ZEXPORT unzOpenCurrentFile3 (unzFile file, int* method,
     pfile_in_zip_read_info->crc32_wait=s->cur_file_info.crc;
     pfile_in_zip_read_info->crc32=0;
     pfile_in_zip_read_info->total_out_64=0;
-    pfile_in_zip_read_info->compression_method = s->cur_file_info.compression_method;
+    pfile_in_zip_read_info->compression_method = compression_method;
+    pfile_in_zip_read_info->codec = NULL;
+    pfile_in_zip_read_info->codec_state = NULL;
     pfile_in_zip_read_info->filestream=s->filestream;
     pfile_in_zip_read_info->z_filefunc=s->z_filefunc;
     pfile_in_zip_read_info->byte_before_the_zipfile=s->byte_before_the_zipfile;
+    pfile_in_zip_read_info->map_base=NULL;
+    pfile_in_zip_read_info->size_compressed = s->cur_file_info.compressed_size;
+    pfile_in_zip_read_info->size_uncompressed = s->cur_file_info.uncompressed_size;
+    pfile_in_zip_read_info->crc_checkable=1;
+    pfile_in_zip_read_info->seek_index=NULL;
 
     pfile_in_zip_read_info->stream.total_out = 0;
 
-    if ((s->cur_file_info.compression_method==Z_BZIP2ED) && (!raw))
+    if ((compression_method==Z_DEFLATED) && (!raw))
     {
-#ifdef HAVE_BZIP2
-      pfile_in_zip_read_info->bstream.bzalloc = (void *(*) (void *, int, int))0;
-      pfile_in_zip_read_info->bstream.bzfree = (free_func)0;
-      pfile_in_zip_read_info->bstream.opaque = (voidpf)0;
-      pfile_in_zip_read_info->bstream.state = (voidpf)0;
-
-      pfile_in_zip_read_info->stream.zalloc = (alloc_func)0;
-      pfile_in_zip_read_info->stream.zfree = (free_func)0;
-      pfile_in_zip_read_info->stream.opaque = (voidpf)0;
-      pfile_in_zip_read_info->stream.next_in = (voidpf)0;
+      pfile_in_zip_read_info->stream.next_in = 0;
       pfile_in_zip_read_info->stream.avail_in = 0;
 
-      err=BZ2_bzDecompressInit(&pfile_in_zip_read_info->bstream, 0, 0);
-      if (err == Z_OK)
-        pfile_in_zip_read_info->stream_initialised=Z_BZIP2ED;
+      if (pfile_in_zip_read_info->inflate_ready)
+        err=inflateReset(&pfile_in_zip_read_info->stream);
       else
       {
-        TRYFREE(pfile_in_zip_read_info);
-        return err;
+        pfile_in_zip_read_info->stream.zalloc = unz64local_zalloc;
+        pfile_in_zip_read_info->stream.zfree = unz64local_zfree;
+        pfile_in_zip_read_info->stream.opaque = (voidpf)0;
+        err=inflateInit2(&pfile_in_zip_read_info->stream, -MAX_WBITS);
+        if (err == Z_OK)
+          pfile_in_zip_read_info->inflate_ready=1;
       }
-#else
-      pfile_in_zip_read_info->raw=1;
-#endif
-    }
-    else if ((s->cur_file_info.compression_method==Z_DEFLATED) && (!raw))
-    {
-      pfile_in_zip_read_info->stream.zalloc = (alloc_func)0;
-      pfile_in_zip_read_info->stream.zfree = (free_func)0;
-      pfile_in_zip_read_info->stream.opaque = (voidpf)0;
-      pfile_in_zip_read_info->stream.next_in = 0;
-      pfile_in_zip_read_info->stream.avail_in = 0;
-
-      err=inflateInit2(&pfile_in_zip_read_info->stream, -MAX_WBITS);
       if (err == Z_OK)
         pfile_in_zip_read_info->stream_initialised=Z_DEFLATED;
       else
       {
-        TRYFREE(pfile_in_zip_read_info);
+        unz64local_FreeReadInfo(pfile_in_zip_read_info);
         return err;
       }
         /* windowBits is passed < 0 to tell that there is no zlib header.
@@ -1609,6 +2165,20 @@ extern int ZEXPORT unzOpenCurrentFile3 (unzFile file, int* method,
          * size of both compressed and uncompressed data
          */
     }
+    else if ((compression_method!=0) && (!raw))
+    {
+      pfile_in_zip_read_info->codec = lk_method_find(compression_method);
+      pfile_in_zip_read_info->codec_state = pfile_in_zip_read_info->codec->decompress_init();
+      if (pfile_in_zip_read_info->codec_state == NULL)
+      {
+        unz64local_FreeReadInfo(pfile_in_zip_read_info);
+        return UNZ_INTERNALERROR;
+      }
+      pfile_in_zip_read_info->stream_initialised = compression_method;
+      pfile_in_zip_read_info->stream.next_in = 0;
+      pfile_in_zip_read_info->stream.avail_in = 0;
+      pfile_in_zip_read_info->stream.total_in = 0;
+    }
     pfile_in_zip_read_info->rest_read_compressed =
             s->cur_file_info.compressed_size ;
     pfile_in_zip_read_info->rest_read_uncompressed =
@@ -1620,15 +2190,60 @@ extern int ZEXPORT unzOpenCurrentFile3 (unzFile file, int* method,
               iSizeVar;
 
     pfile_in_zip_read_info->stream.avail_in = (uInt)0;
+    pfile_in_zip_read_info->pos_in_stream = UNZ_POS_UNKNOWN;
+
+    /* when the whole entry is in the mapping, read it from there */
+    if ((s->map_base!=NULL) && (password==NULL) &&
+        (pfile_in_zip_read_info->pos_in_zipfile+s->byte_before_the_zipfile+
+         pfile_in_zip_read_info->rest_read_compressed<=s->map_size))
+        pfile_in_zip_read_info->map_base=s->map_base;
 
     s->pfile_in_zip_read = pfile_in_zip_read_info;
                 s->encrypted = 0;
 
 #    ifndef NOUNCRYPT
-    if (password != NULL)
+    s->aes_version = 0;
+    if ((password != NULL) && (aes_version != 0))
+    {
+        /* salt and password verifier, then the data, then the authentication code */
+        unsigned char header[16 + LK_AES_PWVERIFY_SIZE];
+        unsigned char pwverify[LK_AES_PWVERIFY_SIZE];
+        unsigned char authcode[LK_AES_AUTHCODE_SIZE];
+        uInt size_salt = LK_AES_SALT_SIZE(aes_strength);
+
+        if (pfile_in_zip_read_info->rest_read_compressed <
+            size_salt + LK_AES_PWVERIFY_SIZE + LK_AES_AUTHCODE_SIZE)
+            err = UNZ_BADZIPFILE;
+        else if (unz64local_ReadAt(pfile_in_zip_read_info, header, size_salt + LK_AES_PWVERIFY_SIZE,
+                                   pfile_in_zip_read_info->pos_in_zipfile +
+                                   pfile_in_zip_read_info->byte_before_the_zipfile) !=
+                 size_salt + LK_AES_PWVERIFY_SIZE)
+            err = UNZ_ERRNO;
+        else if (lk_aes_init(&s->aes, password, aes_strength, header, pwverify) != Z_OK)
+            err = UNZ_INTERNALERROR;
+        else if (memcmp(pwverify, header + size_salt, LK_AES_PWVERIFY_SIZE) != 0)
+        {
+            lk_aes_finish(&s->aes, authcode);
+            err = UNZ_BADPASSWORD;
+        }
+        if (err != UNZ_OK)
+        {
+            unzCloseCurrentFile(file);
+            return err;
+        }
+
+        pfile_in_zip_read_info->pos_in_zipfile += size_salt + LK_AES_PWVERIFY_SIZE;
+        pfile_in_zip_read_info->rest_read_compressed -=
+            size_salt + LK_AES_PWVERIFY_SIZE + LK_AES_AUTHCODE_SIZE;
+        /* AE-2 files store no crc, the authentication code checks them */
+        if (aes_version == LK_AES_VERSION_AE2)
+            pfile_in_zip_read_info->crc_checkable = 0;
+        s->aes_version = aes_version;
+        s->encrypted=1;
+    }
+    else if (password != NULL)
     {
-        int i;
-        s->pcrc_32_tab = (const unsigned long*)get_crc_table();
+        s->pcrc_32_tab = get_crc_table();
         init_keys(password,s->keys,s->pcrc_32_tab);
         if (ZSEEK64(s->z_filefunc, s->filestream,
                   s->pfile_in_zip_read->pos_in_zipfile +
@@ -1638,14 +2253,18 @@ extern int ZEXPORT unzOpenCurrentFile3 (unzFile file, int* method,
         if(ZREAD64(s->z_filefunc, s->filestream,source, 12)<12)
             return UNZ_INTERNALERROR;
 
-        for (i = 0; i<12; i++)
-            zdecode(s->keys,s->pcrc_32_tab,source[i]);
+        decrypt_block(s->keys,s->pcrc_32_tab,(unsigned char*)source,12);
 
+        /* the 12 bytes of the header are not data: stored files would
+           otherwise be read 12 bytes too far */
         s->pfile_in_zip_read->pos_in_zipfile+=12;
+        if (s->pfile_in_zip_read->rest_read_compressed >= 12)
+            s->pfile_in_zip_read->rest_read_compressed-=12;
         s->encrypted=1;
     }
 #    endif
 
+    pfile_in_zip_read_info->pos_data_start = pfile_in_zip_read_info->pos_in_zipfile;
 
     return UNZ_OK;
 }
@@ -1683,6 +2302,85 @@ extern ZPOS64_T ZEXPORT unzGetCurrentFileZStreamPos64( unzFile file)
 
 /** Addition for GDAL : END */
 
+/* ===========================================================================
+   Checkpoints for unzSeekCurrentFile64
+*/
+local void unz64local_FreeSeekIndex (unz64_seek_index* index)
+{
+    uLong i;
+    if (index==NULL)
+        return;
+    for (i=0;i<index->count;i++)
+        TRYFREE(index->points[i].window);
+    TRYFREE(index->points);
+    TRYFREE(index);
+}
+
+local unz64_seek_point* unz64local_NewSeekPoint (unz64_seek_index* index)
+{
+    unz64_seek_point* point;
+    if (index->count==index->allocated)
+    {
+        uLong allocated = (index->allocated>0) ? index->allocated*2 : 16;
+        unz64_seek_point* points = (unz64_seek_point*)ALLOC(allocated*sizeof(unz64_seek_point));
+        if (points==NULL)
+            return NULL;
+        if (index->count>0)
+            memcpy(points,index->points,index->count*sizeof(unz64_seek_point));
+        TRYFREE(index->points);
+        index->points = points;
+        index->allocated = allocated;
+    }
+    point = &index->points[index->count];
+    point->window = (unsigned char*)ALLOC(UNZ_SEEKWINDOWSIZE);
+    if (point->window==NULL)
+        return NULL;
+    point->out = point->in = 0;
+    point->bits = 0;
+    point->window_size = 0;
+    return point;
+}
+
+/* called when inflate stopped with Z_BLOCK: record a checkpoint if it is at
+   the end of a block, span bytes after the last one */
+local void unz64local_AddSeekPoint (file_in_zip64_read_info_s* pfile_in_zip_read_info)
+{
+#if ZLIB_VERNUM >= 0x1280
+    unz64_seek_index* index = pfile_in_zip_read_info->seek_index;
+    ZPOS64_T last = (index->count>0) ? index->points[index->count-1].out : 0;
+    unz64_seek_point* point;
+
+    /* bit 7: end of a block, bit 6: that block is the last one */
+    if (((pfile_in_zip_read_info->stream.data_type & 128)==0) ||
+        ((pfile_in_zip_read_info->stream.data_type & 64)!=0))
+        return;
+    if ((pfile_in_zip_read_info->total_out_64<=last) ||
+        (pfile_in_zip_read_info->total_out_64-last<index->span))
+        return;
+
+    point = unz64local_NewSeekPoint(index);
+    if (point==NULL)
+    {
+        index->span = 0; /* out of memory, stop recording */
+        return;
+    }
+    point->out = pfile_in_zip_read_info->total_out_64;
+    point->in = (pfile_in_zip_read_info->pos_in_zipfile - pfile_in_zip_read_info->pos_data_start) -
+                    pfile_in_zip_read_info->stream.avail_in;
+    point->bits = pfile_in_zip_read_info->stream.data_type & 7;
+    point->window_size = UNZ_SEEKWINDOWSIZE;
+    if (inflateGetDictionary(&pfile_in_zip_read_info->stream, point->window, &point->window_size)!=Z_OK)
+    {
+        TRYFREE(point->window);
+        index->span = 0;
+        return;
+    }
+    index->count++;
+#else
+    (void)pfile_in_zip_read_info;
+#endif
+}
+
 /*
   Read bytes from the current file.
   buf contain buffer where data must be copied
@@ -1745,51 +2443,89 @@ extern int ZEXPORT unzReadCurrentFile  (unzFile file, voidp buf, unsigned len)
 
     while (pfile_in_zip_read_info->stream.avail_out>0)
     {
+        /* stored data with nothing buffered is read straight in buf, in one read */
+        if ((pfile_in_zip_read_info->stream.avail_in==0) &&
+            (pfile_in_zip_read_info->rest_read_compressed>0) &&
+            (pfile_in_zip_read_info->map_base==NULL) &&
+            ((pfile_in_zip_read_info->compression_method==0) || (pfile_in_zip_read_info->raw)) &&
+            (!s->encrypted))
+        {
+            uInt uReadThis = pfile_in_zip_read_info->stream.avail_out;
+            if (pfile_in_zip_read_info->rest_read_compressed<uReadThis)
+                uReadThis = (uInt)pfile_in_zip_read_info->rest_read_compressed;
+
+            if (unz64local_ReadAt(pfile_in_zip_read_info,
+                      pfile_in_zip_read_info->stream.next_out, uReadThis,
+                      pfile_in_zip_read_info->pos_in_zipfile +
+                         pfile_in_zip_read_info->byte_before_the_zipfile)!=uReadThis)
+                return UNZ_ERRNO;
+
+            pfile_in_zip_read_info->crc32 = lk_crc32(pfile_in_zip_read_info->crc32,
+                                pfile_in_zip_read_info->stream.next_out,
+                                uReadThis);
+            pfile_in_zip_read_info->pos_in_zipfile += uReadThis;
+            pfile_in_zip_read_info->rest_read_compressed -= uReadThis;
+            pfile_in_zip_read_info->rest_read_uncompressed -= uReadThis;
+            pfile_in_zip_read_info->total_out_64 = pfile_in_zip_read_info->total_out_64 + uReadThis;
+            pfile_in_zip_read_info->stream.avail_out -= uReadThis;
+            pfile_in_zip_read_info->stream.next_out += uReadThis;
+            pfile_in_zip_read_info->stream.total_out += uReadThis;
+            iRead += uReadThis;
+            continue;
+        }
+
         if ((pfile_in_zip_read_info->stream.avail_in==0) &&
             (pfile_in_zip_read_info->rest_read_compressed>0))
         {
             uInt uReadThis = UNZ_BUFSIZE;
+
+            /* with a mapped zipfile, inflate reads the compressed data in place */
+            if (pfile_in_zip_read_info->map_base!=NULL)
+                uReadThis = UNZ_MAPPEDREADSIZE;
+
             if (pfile_in_zip_read_info->rest_read_compressed<uReadThis)
                 uReadThis = (uInt)pfile_in_zip_read_info->rest_read_compressed;
             if (uReadThis == 0)
                 return UNZ_EOF;
-            if (ZSEEK64(pfile_in_zip_read_info->z_filefunc,
-                      pfile_in_zip_read_info->filestream,
-                      pfile_in_zip_read_info->pos_in_zipfile +
-                         pfile_in_zip_read_info->byte_before_the_zipfile,
-                         ZLIB_FILEFUNC_SEEK_SET)!=0)
-                return UNZ_ERRNO;
-            if (ZREAD64(pfile_in_zip_read_info->z_filefunc,
-                      pfile_in_zip_read_info->filestream,
-                      pfile_in_zip_read_info->read_buffer,
-                      uReadThis)!=uReadThis)
-                return UNZ_ERRNO;
 
-
-#            ifndef NOUNCRYPT
-            if(s->encrypted)
+            if (pfile_in_zip_read_info->map_base!=NULL)
             {
-                uInt i;
-                for(i=0;i<uReadThis;i++)
-                  pfile_in_zip_read_info->read_buffer[i] =
-                      zdecode(s->keys,s->pcrc_32_tab,
-                              pfile_in_zip_read_info->read_buffer[i]);
+                pfile_in_zip_read_info->stream.next_in =
+                    (Bytef*)pfile_in_zip_read_info->map_base +
+                        pfile_in_zip_read_info->pos_in_zipfile +
+                        pfile_in_zip_read_info->byte_before_the_zipfile;
+            }
+            else
+            {
+                if (unz64local_ReadAt(pfile_in_zip_read_info,
+                          pfile_in_zip_read_info->read_buffer, uReadThis,
+                          pfile_in_zip_read_info->pos_in_zipfile +
+                             pfile_in_zip_read_info->byte_before_the_zipfile)!=uReadThis)
+                    return UNZ_ERRNO;
+
+
+#                ifndef NOUNCRYPT
+                if(s->aes_version != 0)
+                    lk_aes_decrypt(&s->aes, (unsigned char*)pfile_in_zip_read_info->read_buffer, uReadThis);
+                else if(s->encrypted)
+                    decrypt_block(s->keys,s->pcrc_32_tab,
+                                  (unsigned char*)pfile_in_zip_read_info->read_buffer,uReadThis);
+#                endif
+
+                pfile_in_zip_read_info->stream.next_in =
+                    (Bytef*)pfile_in_zip_read_info->read_buffer;
             }
-#            endif
-
 
             pfile_in_zip_read_info->pos_in_zipfile += uReadThis;
 
             pfile_in_zip_read_info->rest_read_compressed-=uReadThis;
 
-            pfile_in_zip_read_info->stream.next_in =
-                (Bytef*)pfile_in_zip_read_info->read_buffer;
             pfile_in_zip_read_info->stream.avail_in = (uInt)uReadThis;
         }
 
         if ((pfile_in_zip_read_info->compression_method==0) || (pfile_in_zip_read_info->raw))
         {
-            uInt uDoCopy,i ;
+            uInt uDoCopy;
 
             if ((pfile_in_zip_read_info->stream.avail_in == 0) &&
                 (pfile_in_zip_read_info->rest_read_compressed == 0))
@@ -1801,13 +2537,12 @@ extern int ZEXPORT unzReadCurrentFile  (unzFile file, voidp buf, unsigned len)
             else
                 uDoCopy = pfile_in_zip_read_info->stream.avail_in ;
 
-            for (i=0;i<uDoCopy;i++)
-                *(pfile_in_zip_read_info->stream.next_out+i) =
-                        *(pfile_in_zip_read_info->stream.next_in+i);
+            memcpy(pfile_in_zip_read_info->stream.next_out,
+                   pfile_in_zip_read_info->stream.next_in, uDoCopy);
 
             pfile_in_zip_read_info->total_out_64 = pfile_in_zip_read_info->total_out_64 + uDoCopy;
 
-            pfile_in_zip_read_info->crc32 = crc32(pfile_in_zip_read_info->crc32,
+            pfile_in_zip_read_info->crc32 = lk_crc32(pfile_in_zip_read_info->crc32,
                                 pfile_in_zip_read_info->stream.next_out,
                                 uDoCopy);
             pfile_in_zip_read_info->rest_read_uncompressed-=uDoCopy;
@@ -1818,49 +2553,34 @@ extern int ZEXPORT unzReadCurrentFile  (unzFile file, voidp buf, unsigned len)
             pfile_in_zip_read_info->stream.total_out += uDoCopy;
             iRead += uDoCopy;
         }
-        else if (pfile_in_zip_read_info->compression_method==Z_BZIP2ED)
+        else if (pfile_in_zip_read_info->codec_state!=NULL)
         {
-#ifdef HAVE_BZIP2
-            uLong uTotalOutBefore,uTotalOutAfter;
+            ZPOS64_T uTotalOutBefore,uOutThis;
             const Bytef *bufBefore;
-            uLong uOutThis;
 
-            pfile_in_zip_read_info->bstream.next_in        = (char*)pfile_in_zip_read_info->stream.next_in;
-            pfile_in_zip_read_info->bstream.avail_in       = pfile_in_zip_read_info->stream.avail_in;
-            pfile_in_zip_read_info->bstream.total_in_lo32  = pfile_in_zip_read_info->stream.total_in;
-            pfile_in_zip_read_info->bstream.total_in_hi32  = 0;
-            pfile_in_zip_read_info->bstream.next_out       = (char*)pfile_in_zip_read_info->stream.next_out;
-            pfile_in_zip_read_info->bstream.avail_out      = pfile_in_zip_read_info->stream.avail_out;
-            pfile_in_zip_read_info->bstream.total_out_lo32 = pfile_in_zip_read_info->stream.total_out;
-            pfile_in_zip_read_info->bstream.total_out_hi32 = 0;
+            /* the codecs need not be called again once their stream ended */
+            if ((pfile_in_zip_read_info->stream.avail_in==0) &&
+                (pfile_in_zip_read_info->rest_read_compressed==0) &&
+                (pfile_in_zip_read_info->rest_read_uncompressed==0))
+                return (iRead==0) ? UNZ_EOF : iRead;
 
-            uTotalOutBefore = pfile_in_zip_read_info->bstream.total_out_lo32;
-            bufBefore = (const Bytef *)pfile_in_zip_read_info->bstream.next_out;
-
-            err=BZ2_bzDecompress(&pfile_in_zip_read_info->bstream);
+            uTotalOutBefore = pfile_in_zip_read_info->stream.total_out;
+            bufBefore = pfile_in_zip_read_info->stream.next_out;
 
-            uTotalOutAfter = pfile_in_zip_read_info->bstream.total_out_lo32;
-            uOutThis = uTotalOutAfter-uTotalOutBefore;
+            err = pfile_in_zip_read_info->codec->decompress(pfile_in_zip_read_info->codec_state,
+                                                            &pfile_in_zip_read_info->stream);
 
+            uOutThis = pfile_in_zip_read_info->stream.total_out - uTotalOutBefore;
             pfile_in_zip_read_info->total_out_64 = pfile_in_zip_read_info->total_out_64 + uOutThis;
-
-            pfile_in_zip_read_info->crc32 = crc32(pfile_in_zip_read_info->crc32,bufBefore, (uInt)(uOutThis));
+            pfile_in_zip_read_info->crc32 = lk_crc32(pfile_in_zip_read_info->crc32,bufBefore,(uInt)uOutThis);
             pfile_in_zip_read_info->rest_read_uncompressed -= uOutThis;
-            iRead += (uInt)(uTotalOutAfter - uTotalOutBefore);
+            iRead += (uInt)uOutThis;
 
-            pfile_in_zip_read_info->stream.next_in   = (Bytef*)pfile_in_zip_read_info->bstream.next_in;
-            pfile_in_zip_read_info->stream.avail_in  = pfile_in_zip_read_info->bstream.avail_in;
-            pfile_in_zip_read_info->stream.total_in  = pfile_in_zip_read_info->bstream.total_in_lo32;
-            pfile_in_zip_read_info->stream.next_out  = (Bytef*)pfile_in_zip_read_info->bstream.next_out;
-            pfile_in_zip_read_info->stream.avail_out = pfile_in_zip_read_info->bstream.avail_out;
-            pfile_in_zip_read_info->stream.total_out = pfile_in_zip_read_info->bstream.total_out_lo32;
-
-            if (err==BZ_STREAM_END)
-              return (iRead==0) ? UNZ_EOF : iRead;
-            if (err!=BZ_OK)
-              break;
-#endif
-        } // end Z_BZIP2ED
+            if (err==Z_STREAM_END)
+                return (iRead==0) ? UNZ_EOF : iRead;
+            if (err!=Z_OK)
+                break;
+        }
         else
         {
             ZPOS64_T uTotalOutBefore,uTotalOutAfter;
@@ -1868,6 +2588,11 @@ extern int ZEXPORT unzReadCurrentFile  (unzFile file, voidp buf, unsigned len)
             ZPOS64_T uOutThis;
             int flush=Z_SYNC_FLUSH;
 
+            /* stop at the block boundaries, where checkpoints are taken */
+            if ((pfile_in_zip_read_info->seek_index!=NULL) &&
+                (pfile_in_zip_read_info->seek_index->span>0))
+                flush = Z_BLOCK;
+
             uTotalOutBefore = pfile_in_zip_read_info->stream.total_out;
             bufBefore = pfile_in_zip_read_info->stream.next_out;
 
@@ -1888,7 +2613,7 @@ extern int ZEXPORT unzReadCurrentFile  (unzFile file, voidp buf, unsigned len)
             pfile_in_zip_read_info->total_out_64 = pfile_in_zip_read_info->total_out_64 + uOutThis;
 
             pfile_in_zip_read_info->crc32 =
-                crc32(pfile_in_zip_read_info->crc32,bufBefore,
+                lk_crc32(pfile_in_zip_read_info->crc32,bufBefore,
                         (uInt)(uOutThis));
 
             pfile_in_zip_read_info->rest_read_uncompressed -=
@@ -1900,6 +2625,9 @@ extern int ZEXPORT unzReadCurrentFile  (unzFile file, voidp buf, unsigned len)
                 return (iRead==0) ? UNZ_EOF : iRead;
             if (err!=Z_OK)
                 break;
+
+            if (flush==Z_BLOCK)
+                unz64local_AddSeekPoint(pfile_in_zip_read_info);
         }
     }
 
@@ -1909,6 +2637,183 @@ extern int ZEXPORT unzReadCurrentFile  (unzFile file, voidp buf, unsigned len)
 }
 
 
+/*
+  Read bytes from the current file without copying them, when the zipfile
+  was opened with io functions which map it in memory (fill_mmap_filefunc64)
+  and the file is stored (or opened raw) and not encrypted.
+  *pbuf receive a pointer in the mapping, valid until unzClose.
+
+  return the number of bytes available at *pbuf (at most len)
+  return 0 if the end of file was reached
+  return UNZ_PARAMERROR if the current file cannot be read in place
+*/
+extern int ZEXPORT unzReadCurrentFileMapped (unzFile file, const void** pbuf, unsigned len)
+{
+    unz64_s* s;
+    file_in_zip64_read_info_s* pfile_in_zip_read_info;
+    uInt uDoCopy;
+    if ((file==NULL) || (pbuf==NULL))
+        return UNZ_PARAMERROR;
+    s=(unz64_s*)file;
+    pfile_in_zip_read_info=s->pfile_in_zip_read;
+
+    if (pfile_in_zip_read_info==NULL)
+        return UNZ_PARAMERROR;
+
+    if ((pfile_in_zip_read_info->map_base==NULL) ||
+        ((pfile_in_zip_read_info->compression_method!=0) && (!pfile_in_zip_read_info->raw)))
+        return UNZ_PARAMERROR;
+
+    *pbuf = NULL;
+    if (len==0)
+        return 0;
+    if (len>0x7fffffff)
+        len = 0x7fffffff;
+
+    /* data already handed to the stream by unzReadCurrentFile comes first */
+    if (pfile_in_zip_read_info->stream.avail_in>0)
+    {
+        uDoCopy = pfile_in_zip_read_info->stream.avail_in;
+        if (len<uDoCopy)
+            uDoCopy = len;
+        *pbuf = pfile_in_zip_read_info->stream.next_in;
+        pfile_in_zip_read_info->stream.avail_in -= uDoCopy;
+        pfile_in_zip_read_info->stream.next_in += uDoCopy;
+    }
+    else
+    {
+        if (pfile_in_zip_read_info->rest_read_compressed==0)
+            return UNZ_EOF;
+        uDoCopy = len;
+        if (pfile_in_zip_read_info->rest_read_compressed<uDoCopy)
+            uDoCopy = (uInt)pfile_in_zip_read_info->rest_read_compressed;
+        *pbuf = pfile_in_zip_read_info->map_base +
+                    pfile_in_zip_read_info->pos_in_zipfile +
+                    pfile_in_zip_read_info->byte_before_the_zipfile;
+        pfile_in_zip_read_info->pos_in_zipfile += uDoCopy;
+        pfile_in_zip_read_info->rest_read_compressed -= uDoCopy;
+    }
+
+    pfile_in_zip_read_info->total_out_64 = pfile_in_zip_read_info->total_out_64 + uDoCopy;
+    pfile_in_zip_read_info->crc32 = lk_crc32(pfile_in_zip_read_info->crc32,
+                                          (const Bytef*)*pbuf, uDoCopy);
+    pfile_in_zip_read_info->rest_read_uncompressed -= uDoCopy;
+    pfile_in_zip_read_info->stream.total_out += uDoCopy;
+    return (int)uDoCopy;
+}
+
+#ifndef _WIN32
+local int unz64local_WriteFully (int fd, const void* buf, size_t len)
+{
+    const char* p = (const char*)buf;
+    while (len>0)
+    {
+        ssize_t written = write(fd, p, len);
+        if (written<0)
+        {
+            if (errno==EINTR)
+                continue;
+            return UNZ_ERRNO;
+        }
+        p += written;
+        len -= (size_t)written;
+    }
+    return UNZ_OK;
+}
+
+/*
+  Copy the rest of the current stored file to fd, with the least copies the
+  system allows: one write from the mapping of the zipfile, else
+  copy_file_range from zip_fd on Linux, else reads straight in a buffer.
+*/
+extern int ZEXPORT unzCopyCurrentFileToFd (unzFile file, int fd, int zip_fd, ZPOS64_T* copied)
+{
+    unz64_s* s;
+    file_in_zip64_read_info_s* pfile_in_zip_read_info;
+    char* buf;
+    int err = UNZ_OK;
+
+    if (copied!=NULL)
+        *copied = 0;
+    if ((file==NULL) || (fd<0))
+        return UNZ_PARAMERROR;
+    s=(unz64_s*)file;
+    pfile_in_zip_read_info=s->pfile_in_zip_read;
+
+    if ((pfile_in_zip_read_info==NULL) || (pfile_in_zip_read_info->read_buffer==NULL) ||
+        ((pfile_in_zip_read_info->compression_method!=0) && (!pfile_in_zip_read_info->raw)) ||
+        (s->encrypted))
+        return UNZ_PARAMERROR;
+
+    if (pfile_in_zip_read_info->map_base!=NULL)
+    {
+        for (;;)
+        {
+            const void* pbuf;
+            int len = unzReadCurrentFileMapped(file, &pbuf, UNZ_MAPPEDREADSIZE);
+            if (len<=0)
+                return len;
+            err = unz64local_WriteFully(fd, pbuf, (size_t)len);
+            if (err!=UNZ_OK)
+                return err;
+            if (copied!=NULL)
+                *copied += (ZPOS64_T)len;
+        }
+    }
+
+#if defined(__linux__) && defined(SYS_copy_file_range)
+    /* the data never leaves the kernel, so the CRC can not be checked */
+    if ((zip_fd>=0) && (pfile_in_zip_read_info->stream.avail_in==0))
+    {
+        while (pfile_in_zip_read_info->rest_read_compressed>0)
+        {
+            long long pos = (long long)(pfile_in_zip_read_info->pos_in_zipfile +
+                                        pfile_in_zip_read_info->byte_before_the_zipfile);
+            size_t len = UNZ_MAPPEDREADSIZE;
+            long n;
+            if (pfile_in_zip_read_info->rest_read_compressed<len)
+                len = (size_t)pfile_in_zip_read_info->rest_read_compressed;
+
+            n = syscall(SYS_copy_file_range, zip_fd, &pos, fd, NULL, len, 0);
+            if ((n<0) && (errno==EINTR))
+                continue;
+            if (n<=0)
+                break; /* not supported for these files, copy them below */
+
+            pfile_in_zip_read_info->pos_in_zipfile += n;
+            pfile_in_zip_read_info->rest_read_compressed -= n;
+            pfile_in_zip_read_info->rest_read_uncompressed -= n;
+            pfile_in_zip_read_info->total_out_64 += n;
+            pfile_in_zip_read_info->stream.total_out += n;
+            pfile_in_zip_read_info->crc_checkable = 0;
+            if (copied!=NULL)
+                *copied += (ZPOS64_T)n;
+        }
+    }
+#else
+    (void)zip_fd;
+#endif
+
+    buf = (char*)ALLOC(UNZ_BUFSIZE*16);
+    if (buf==NULL)
+        return UNZ_INTERNALERROR;
+    while (err==UNZ_OK)
+    {
+        int len = unzReadCurrentFile(file, buf, UNZ_BUFSIZE*16);
+        if (len<=0)
+        {
+            err = len;
+            break;
+        }
+        err = unz64local_WriteFully(fd, buf, (size_t)len);
+        if ((err==UNZ_OK) && (copied!=NULL))
+            *copied += (ZPOS64_T)len;
+    }
+    TRYFREE(buf);
+    return err;
+}
+#endif
+
 /*
   Give the current position in uncompressed data
 */
@@ -1965,6 +2870,342 @@ extern int ZEXPORT unzeof (unzFile file)
         return 0;
 }
 
+/* ===========================================================================
+   Random access in the current file
+*/
+
+/* restart the current file at the beginning of its data */
+local int unz64local_RewindCurrentFile (file_in_zip64_read_info_s* pfile_in_zip_read_info)
+{
+    if (pfile_in_zip_read_info->stream_initialised==Z_DEFLATED)
+    {
+        int err = inflateReset(&pfile_in_zip_read_info->stream);
+        if (err!=Z_OK)
+            return err;
+    }
+    pfile_in_zip_read_info->pos_in_zipfile = pfile_in_zip_read_info->pos_data_start;
+    pfile_in_zip_read_info->rest_read_compressed = pfile_in_zip_read_info->size_compressed;
+    pfile_in_zip_read_info->rest_read_uncompressed = pfile_in_zip_read_info->size_uncompressed;
+    pfile_in_zip_read_info->stream.avail_in = 0;
+    pfile_in_zip_read_info->stream.total_out = 0;
+    pfile_in_zip_read_info->total_out_64 = 0;
+    pfile_in_zip_read_info->crc32 = 0;
+    pfile_in_zip_read_info->crc_checkable = 1;
+    return UNZ_OK;
+}
+
+/* restart inflate at a checkpoint */
+local int unz64local_GoToSeekPoint (file_in_zip64_read_info_s* pfile_in_zip_read_info,
+                                    const unz64_seek_point* point)
+{
+    int err = inflateReset(&pfile_in_zip_read_info->stream);
+
+    if ((err==Z_OK) && (point->bits>0))
+    {
+        /* the block starts in the middle of the byte before in */
+        ZPOS64_T pos = pfile_in_zip_read_info->pos_data_start + point->in - 1 +
+                            pfile_in_zip_read_info->byte_before_the_zipfile;
+        unsigned char c;
+        if (pfile_in_zip_read_info->map_base!=NULL)
+            c = pfile_in_zip_read_info->map_base[pos];
+        else if (unz64local_ReadAt(pfile_in_zip_read_info, &c, 1, pos)!=1)
+            return UNZ_ERRNO;
+        err = inflatePrime(&pfile_in_zip_read_info->stream, point->bits, c >> (8 - point->bits));
+    }
+    if (err==Z_OK)
+        err = inflateSetDictionary(&pfile_in_zip_read_info->stream, point->window, point->window_size);
+    if (err!=Z_OK)
+        return err;
+
+    pfile_in_zip_read_info->pos_in_zipfile = pfile_in_zip_read_info->pos_data_start + point->in;
+    pfile_in_zip_read_info->rest_read_compressed = pfile_in_zip_read_info->size_compressed - point->in;
+    pfile_in_zip_read_info->rest_read_uncompressed = pfile_in_zip_read_info->size_uncompressed - point->out;
+    pfile_in_zip_read_info->stream.avail_in = 0;
+    pfile_in_zip_read_info->stream.total_out = (uLong)point->out;
+    pfile_in_zip_read_info->total_out_64 = point->out;
+    pfile_in_zip_read_info->crc_checkable = 0;
+    return UNZ_OK;
+}
+
+extern int ZEXPORT unzSeekCurrentFile64 (unzFile file, ZPOS64_T pos)
+{
+    unz64_s* s;
+    file_in_zip64_read_info_s* pfile_in_zip_read_info;
+    int err = UNZ_OK;
+    char* buf;
+
+    if (file==NULL)
+        return UNZ_PARAMERROR;
+    s=(unz64_s*)file;
+    pfile_in_zip_read_info=s->pfile_in_zip_read;
+
+    if ((pfile_in_zip_read_info==NULL) || (pfile_in_zip_read_info->read_buffer==NULL))
+        return UNZ_PARAMERROR;
+    if (pos==pfile_in_zip_read_info->total_out_64)
+        return UNZ_OK;
+
+    if (((pfile_in_zip_read_info->compression_method==0) || (pfile_in_zip_read_info->raw)) &&
+        (!s->encrypted))
+    {
+        /* stored data: pos is also the offset in the zipfile */
+        if (pos>pfile_in_zip_read_info->size_compressed)
+            return UNZ_PARAMERROR;
+        err = unz64local_RewindCurrentFile(pfile_in_zip_read_info);
+        if ((err==UNZ_OK) && (pos>0))
+        {
+            pfile_in_zip_read_info->pos_in_zipfile += pos;
+            pfile_in_zip_read_info->rest_read_compressed -= pos;
+            pfile_in_zip_read_info->rest_read_uncompressed -= pos;
+            pfile_in_zip_read_info->stream.total_out = (uLong)pos;
+            pfile_in_zip_read_info->total_out_64 = pos;
+            pfile_in_zip_read_info->crc_checkable = 0;
+        }
+        return err;
+    }
+
+    if (pos>pfile_in_zip_read_info->size_uncompressed)
+        return UNZ_PARAMERROR;
+
+    if ((pfile_in_zip_read_info->stream_initialised==Z_DEFLATED) && (!s->encrypted))
+    {
+        const unz64_seek_point* point = NULL;
+        unz64_seek_index* index = pfile_in_zip_read_info->seek_index;
+
+        /* last checkpoint at or before pos */
+        if ((index!=NULL) && (index->count>0) && (index->points[0].out<=pos))
+        {
+            uLong lo = 0, hi = index->count-1;
+            while (lo<hi)
+            {
+                uLong mid = lo + (hi-lo+1)/2;
+                if (index->points[mid].out<=pos)
+                    lo = mid;
+                else
+                    hi = mid-1;
+            }
+            point = &index->points[lo];
+        }
+
+        if ((point!=NULL) &&
+            ((pos<pfile_in_zip_read_info->total_out_64) || (point->out>pfile_in_zip_read_info->total_out_64)))
+            err = unz64local_GoToSeekPoint(pfile_in_zip_read_info, point);
+        else if (pos<pfile_in_zip_read_info->total_out_64)
+            err = unz64local_RewindCurrentFile(pfile_in_zip_read_info);
+    }
+    else if (pos<pfile_in_zip_read_info->total_out_64)
+        return UNZ_PARAMERROR; /* encrypted data or other methods can only be skipped */
+
+    if ((err!=UNZ_OK) || (pos==pfile_in_zip_read_info->total_out_64))
+        return err;
+
+    /* decompress up to pos, recording checkpoints on the way */
+    buf = (char*)ALLOC(UNZ_BUFSIZE*4);
+    if (buf==NULL)
+        return UNZ_INTERNALERROR;
+    while ((err==UNZ_OK) && (pfile_in_zip_read_info->total_out_64<pos))
+    {
+        ZPOS64_T left = pos - pfile_in_zip_read_info->total_out_64;
+        int read = unzReadCurrentFile(file, buf, (left<UNZ_BUFSIZE*4) ? (unsigned)left : UNZ_BUFSIZE*4);
+        if (read<0)
+            err = read;
+        else if (read==0)
+            err = UNZ_BADZIPFILE; /* shorter than its header says */
+    }
+    TRYFREE(buf);
+    return err;
+}
+
+extern int ZEXPORT unzSetCurrentFileSeekSpan (unzFile file, ZPOS64_T span)
+{
+    unz64_s* s;
+    file_in_zip64_read_info_s* pfile_in_zip_read_info;
+
+    if (file==NULL)
+        return UNZ_PARAMERROR;
+    s=(unz64_s*)file;
+    pfile_in_zip_read_info=s->pfile_in_zip_read;
+
+#if ZLIB_VERNUM < 0x1280
+    /* inflateGetDictionary is needed to take the checkpoints */
+    if (span>0)
+        return UNZ_PARAMERROR;
+#endif
+    if ((pfile_in_zip_read_info==NULL) ||
+        (pfile_in_zip_read_info->stream_initialised!=Z_DEFLATED) || (s->encrypted))
+        return UNZ_PARAMERROR;
+
+    if (pfile_in_zip_read_info->seek_index==NULL)
+    {
+        if (span==0)
+            return UNZ_OK;
+        pfile_in_zip_read_info->seek_index = (unz64_seek_index*)ALLOC(sizeof(unz64_seek_index));
+        if (pfile_in_zip_read_info->seek_index==NULL)
+            return UNZ_INTERNALERROR;
+        pfile_in_zip_read_info->seek_index->count = 0;
+        pfile_in_zip_read_info->seek_index->allocated = 0;
+        pfile_in_zip_read_info->seek_index->points = NULL;
+    }
+    pfile_in_zip_read_info->seek_index->span = span;
+    return UNZ_OK;
+}
+
+local void unz64local_putValue (unsigned char* p, ZPOS64_T x, int nbByte)
+{
+    int n;
+    for (n=0;n<nbByte;n++)
+    {
+        p[n] = (unsigned char)(x & 0xff);
+        x >>= 8;
+    }
+}
+
+/*
+  The index file is a header
+    magic "LKZI", version, crc32, compressed size, uncompressed size, span,
+    number of checkpoints
+  followed by each checkpoint
+    out, in, bits, window size, window
+  all in little endian.
+*/
+extern int ZEXPORT unzSaveCurrentFileSeekIndex (unzFile file, const char* path)
+{
+    unz64_s* s;
+    file_in_zip64_read_info_s* pfile_in_zip_read_info;
+    unz64_seek_index* index;
+    unsigned char header[SIZESEEKINDEXHEADER];
+    FILE* fout;
+    uLong i;
+    int err = UNZ_OK;
+
+    if ((file==NULL) || (path==NULL))
+        return UNZ_PARAMERROR;
+    s=(unz64_s*)file;
+    pfile_in_zip_read_info=s->pfile_in_zip_read;
+    if ((pfile_in_zip_read_info==NULL) || (pfile_in_zip_read_info->seek_index==NULL))
+        return UNZ_PARAMERROR;
+    index = pfile_in_zip_read_info->seek_index;
+
+    fout = fopen(path, "wb");
+    if (fout==NULL)
+        return UNZ_ERRNO;
+
+    unz64local_putValue(header, SEEKINDEXMAGIC, 4);
+    unz64local_putValue(header+4, SEEKINDEXVERSION, 4);
+    unz64local_putValue(header+8, pfile_in_zip_read_info->crc32_wait, 4);
+    unz64local_putValue(header+12, pfile_in_zip_read_info->size_compressed, 8);
+    unz64local_putValue(header+20, pfile_in_zip_read_info->size_uncompressed, 8);
+    unz64local_putValue(header+28, index->span, 8);
+    unz64local_putValue(header+36, index->count, 4);
+    if (fwrite(header, SIZESEEKINDEXHEADER, 1, fout)!=1)
+        err = UNZ_ERRNO;
+
+    for (i=0;(i<index->count) && (err==UNZ_OK);i++)
+    {
+        const unz64_seek_point* point = &index->points[i];
+        unz64local_putValue(header, point->out, 8);
+        unz64local_putValue(header+8, point->in, 8);
+        unz64local_putValue(header+16, point->bits, 4);
+        unz64local_putValue(header+20, point->window_size, 4);
+        if ((fwrite(header, SIZESEEKPOINTHEADER, 1, fout)!=1) ||
+            (fwrite(point->window, point->window_size, 1, fout)!=1))
+            err = UNZ_ERRNO;
+    }
+
+    if (fclose(fout)!=0)
+        err = UNZ_ERRNO;
+    if (err!=UNZ_OK)
+        remove(path);
+    return err;
+}
+
+extern int ZEXPORT unzLoadCurrentFileSeekIndex (unzFile file, const char* path)
+{
+    unz64_s* s;
+    file_in_zip64_read_info_s* pfile_in_zip_read_info;
+    unz64_seek_index* index;
+    unsigned char header[SIZESEEKINDEXHEADER];
+    FILE* fin;
+    uLong i, count;
+    int err = UNZ_OK;
+
+    if ((file==NULL) || (path==NULL))
+        return UNZ_PARAMERROR;
+    s=(unz64_s*)file;
+    pfile_in_zip_read_info=s->pfile_in_zip_read;
+    if ((pfile_in_zip_read_info==NULL) ||
+        (pfile_in_zip_read_info->stream_initialised!=Z_DEFLATED) || (s->encrypted))
+        return UNZ_PARAMERROR;
+
+    fin = fopen(path, "rb");
+    if (fin==NULL)
+        return UNZ_ERRNO;
+
+    index = (unz64_seek_index*)ALLOC(sizeof(unz64_seek_index));
+    if (index==NULL)
+    {
+        fclose(fin);
+        return UNZ_INTERNALERROR;
+    }
+    index->count = index->allocated = 0;
+    index->points = NULL;
+
+    /* the index must be the one of this file */
+    if (fread(header, SIZESEEKINDEXHEADER, 1, fin)!=1)
+        err = UNZ_ERRNO;
+    else if ((unz64local_readLong(header)!=SEEKINDEXMAGIC) ||
+             (unz64local_readLong(header+4)!=SEEKINDEXVERSION) ||
+             (unz64local_readLong(header+8)!=pfile_in_zip_read_info->crc32_wait) ||
+             (unz64local_readLong64(header+12)!=pfile_in_zip_read_info->size_compressed) ||
+             (unz64local_readLong64(header+20)!=pfile_in_zip_read_info->size_uncompressed))
+        err = UNZ_BADZIPFILE;
+    index->span = unz64local_readLong64(header+28);
+    count = unz64local_readLong(header+36);
+
+    for (i=0;(i<count) && (err==UNZ_OK);i++)
+    {
+        unz64_seek_point* point = unz64local_NewSeekPoint(index);
+        ZPOS64_T last = (index->count>0) ? index->points[index->count-1].out : 0;
+        if (point==NULL)
+        {
+            err = UNZ_INTERNALERROR;
+            break;
+        }
+        if (fread(header, SIZESEEKPOINTHEADER, 1, fin)!=1)
+            err = UNZ_ERRNO;
+        else
+        {
+            point->out = unz64local_readLong64(header);
+            point->in = unz64local_readLong64(header+8);
+            point->bits = (int)unz64local_readLong(header+16);
+            point->window_size = (uInt)unz64local_readLong(header+20);
+            if ((point->out<=last) || (point->out>pfile_in_zip_read_info->size_uncompressed) ||
+                (point->in==0) || (point->in>pfile_in_zip_read_info->size_compressed) ||
+                (point->bits>7) || (point->window_size>UNZ_SEEKWINDOWSIZE))
+                err = UNZ_BADZIPFILE;
+            else if ((point->window_size>0) && (fread(point->window, point->window_size, 1, fin)!=1))
+                err = UNZ_ERRNO;
+        }
+        if (err==UNZ_OK)
+            index->count++;
+        else
+            TRYFREE(point->window);
+    }
+
+    fclose(fin);
+    if (err!=UNZ_OK)
+    {
+        unz64local_FreeSeekIndex(index);
+        return err;
+    }
+
+#if ZLIB_VERNUM < 0x1280
+    index->span = 0;
+#endif
+    unz64local_FreeSeekIndex(pfile_in_zip_read_info->seek_index);
+    pfile_in_zip_read_info->seek_index = index;
+    return UNZ_OK;
+}
+
 
 
 /*
@@ -2008,16 +3249,9 @@ extern int ZEXPORT unzGetLocalExtrafield (unzFile file, voidp buf, unsigned len)
     if (read_now==0)
         return 0;
 
-    if (ZSEEK64(pfile_in_zip_read_info->z_filefunc,
-              pfile_in_zip_read_info->filestream,
+    if (unz64local_ReadAt(pfile_in_zip_read_info, buf, read_now,
               pfile_in_zip_read_info->offset_local_extrafield +
-              pfile_in_zip_read_info->pos_local_extrafield,
-              ZLIB_FILEFUNC_SEEK_SET)!=0)
-        return UNZ_ERRNO;
-
-    if (ZREAD64(pfile_in_zip_read_info->z_filefunc,
-              pfile_in_zip_read_info->filestream,
-              buf,read_now)!=read_now)
+              pfile_in_zip_read_info->pos_local_extrafield)!=read_now)
         return UNZ_ERRNO;
 
     return (int)read_now;
@@ -2043,25 +3277,46 @@ extern int ZEXPORT unzCloseCurrentFile (unzFile file)
 
 
     if ((pfile_in_zip_read_info->rest_read_uncompressed == 0) &&
-        (!pfile_in_zip_read_info->raw))
+        (!pfile_in_zip_read_info->raw) &&
+        (pfile_in_zip_read_info->crc_checkable))
     {
         if (pfile_in_zip_read_info->crc32 != pfile_in_zip_read_info->crc32_wait)
             err=UNZ_CRCERROR;
     }
 
+#    ifndef NOUNCRYPT
+    /* once all the encrypted data went through the HMAC, it must give the
+       authentication code which follows it */
+    if (s->aes_version != 0)
+    {
+        unsigned char authcode[LK_AES_AUTHCODE_SIZE];
+        unsigned char stored[LK_AES_AUTHCODE_SIZE];
+
+        lk_aes_finish(&s->aes, authcode);
+        if ((err == UNZ_OK) && (pfile_in_zip_read_info->rest_read_compressed == 0))
+        {
+            if (unz64local_ReadAt(pfile_in_zip_read_info, stored, LK_AES_AUTHCODE_SIZE,
+                                  pfile_in_zip_read_info->pos_in_zipfile +
+                                  pfile_in_zip_read_info->byte_before_the_zipfile) != LK_AES_AUTHCODE_SIZE)
+                err = UNZ_ERRNO;
+            else if (memcmp(authcode, stored, LK_AES_AUTHCODE_SIZE) != 0)
+                err = UNZ_CRCERROR;
+        }
+        s->aes_version = 0;
+    }
+#    endif
 
-    TRYFREE(pfile_in_zip_read_info->read_buffer);
-    pfile_in_zip_read_info->read_buffer = NULL;
-    if (pfile_in_zip_read_info->stream_initialised == Z_DEFLATED)
-        inflateEnd(&pfile_in_zip_read_info->stream);
-#ifdef HAVE_BZIP2
-    else if (pfile_in_zip_read_info->stream_initialised == Z_BZIP2ED)
-        BZ2_bzDecompressEnd(&pfile_in_zip_read_info->bstream);
-#endif
 
+    unz64local_FreeSeekIndex(pfile_in_zip_read_info->seek_index);
+    pfile_in_zip_read_info->seek_index = NULL;
+    if (pfile_in_zip_read_info->codec_state != NULL)
+        pfile_in_zip_read_info->codec->decompress_end(pfile_in_zip_read_info->codec_state);
+    pfile_in_zip_read_info->codec_state = NULL;
 
+
+    /* the buffer and the inflate state wait in the pool for the next file */
     pfile_in_zip_read_info->stream_initialised = 0;
-    TRYFREE(pfile_in_zip_read_info);
+    s->read_info_pool = pfile_in_zip_read_info;
 
     s->pfile_in_zip_read=NULL;
 
@@ -2086,7 +3341,8 @@ extern int ZEXPORT unzGetGlobalComment (unzFile file, char * szComment, uLong uS
     if (uReadThis>s->gi.size_comment)
         uReadThis = s->gi.size_comment;
 
-    if (ZSEEK64(s->z_filefunc,s->filestream,s->central_pos+22,ZLIB_FILEFUNC_SEEK_SET)!=0)
+    unz64local_StreamMoved(s);
+    if (ZSEEK64(s->z_filefunc,s->filestream,s->end_central_pos+22,ZLIB_FILEFUNC_SEEK_SET)!=0)
         return UNZ_ERRNO;
 
     if (uReadThis>0)
@@ -2149,3 +3405,397 @@ extern int ZEXPORT unzSetOffset (unzFile file, uLong pos)
 {
     return unzSetOffset64(file,pos);
 }
+
+
+/* ===========================================================================
+   Verification of all the entries, shared out between worker threads
+*/
+
+typedef struct unz64_verify_order_s
+{
+    ZPOS64_T compressed_size;
+    ZPOS64_T index;
+} unz64_verify_order;
+
+typedef struct unz64_verify_job_s
+{
+    const void* path;
+    zlib_filefunc64_ex_def* pzlib_filefunc_def;
+    const char* password;
+    const unz_entry64* entries;
+    const unz64_verify_order* order;    /* largest entries first */
+    ZPOS64_T number_entry;
+    unz_verify_entry* report;
+#ifndef NO_PARALLEL_VERIFY
+    pthread_mutex_t lock;
+#endif
+    ZPOS64_T next;                      /* next entry of order to check */
+} unz64_verify_job;
+
+local int unz64local_CompareVerifyOrder OF((const void* a, const void* b));
+local int unz64local_CompareVerifyOrder (const void* a, const void* b)
+{
+    ZPOS64_T size_a = ((const unz64_verify_order*)a)->compressed_size;
+    ZPOS64_T size_b = ((const unz64_verify_order*)b)->compressed_size;
+    return (size_a < size_b) ? 1 : ((size_a > size_b) ? -1 : 0);
+}
+
+/*
+  Read the local header of the current file, check that its name and method
+  are those of the central directory, and get the crc and sizes it gives
+  (zip64 extra field included) and where the data starts.
+*/
+local int unz64local_ReadLocalHeader OF((unz64_s* s, const unz_entry64* entry,
+                                         uLong* pcrc, ZPOS64_T* pcompressed_size,
+                                         ZPOS64_T* puncompressed_size, int* pzip64,
+                                         ZPOS64_T* pdata_offset, uLong* pmismatch));
+local int unz64local_ReadLocalHeader (unz64_s* s, const unz_entry64* entry,
+                                      uLong* pcrc, ZPOS64_T* pcompressed_size,
+                                      ZPOS64_T* puncompressed_size, int* pzip64,
+                                      ZPOS64_T* pdata_offset, uLong* pmismatch)
+{
+    unsigned char header[SIZEZIPLOCALHEADER];
+    unsigned char* name_extra;
+    uLong size_filename;
+    uLong size_extra;
+    uLong pos = 0;
+    ZPOS64_T offset = s->cur_file_info_internal.offset_curfile + s->byte_before_the_zipfile;
+
+    unz64local_StreamMoved(s);
+    if ((ZSEEK64(s->z_filefunc, s->filestream, offset, ZLIB_FILEFUNC_SEEK_SET) != 0) ||
+        (ZREAD64(s->z_filefunc, s->filestream, header, SIZEZIPLOCALHEADER) != SIZEZIPLOCALHEADER))
+        return UNZ_ERRNO;
+    if (unz64local_readLong(header) != 0x04034b50)
+        return UNZ_BADZIPFILE;
+
+    if (unz64local_readShort(header + 8) != entry->info.compression_method)
+        *pmismatch |= UNZ_VERIFY_LOCAL_HEADER;
+    *pcrc = unz64local_readLong(header + 14);
+    *pcompressed_size = unz64local_readLong(header + 18);
+    *puncompressed_size = unz64local_readLong(header + 22);
+    size_filename = unz64local_readShort(header + 26);
+    size_extra = unz64local_readShort(header + 28);
+    *pzip64 = 0;
+    *pdata_offset = s->cur_file_info_internal.offset_curfile + SIZEZIPLOCALHEADER +
+                    size_filename + size_extra;
+
+    name_extra = (unsigned char*)ALLOC(size_filename + size_extra + 1);
+    if (name_extra == NULL)
+        return UNZ_INTERNALERROR;
+    if (ZREAD64(s->z_filefunc, s->filestream, name_extra, size_filename + size_extra) !=
+        size_filename + size_extra)
+    {
+        TRYFREE(name_extra);
+        return UNZ_ERRNO;
+    }
+
+    if ((size_filename != entry->info.size_filename) ||
+        (memcmp(name_extra, entry->filename, size_filename) != 0))
+        *pmismatch |= UNZ_VERIFY_LOCAL_HEADER;
+
+    /* sizes of 0xffffffff are in the zip64 extra field */
+    while (pos + 4 <= size_extra)
+    {
+        const unsigned char* field = name_extra + size_filename + pos;
+        uLong header_id = unz64local_readShort(field);
+        uLong data_size = unz64local_readShort(field + 2);
+        uLong used = 0;
+
+        if (pos + 4 + data_size > size_extra)
+            break;
+        if (header_id == 0x0001)
+        {
+            *pzip64 = 1;
+            if ((*puncompressed_size == 0xffffffff) && (used + 8 <= data_size))
+            {
+                *puncompressed_size = unz64local_readLong64(field + 4 + used);
+                used += 8;
+            }
+            if ((*pcompressed_size == 0xffffffff) && (used + 8 <= data_size))
+                *pcompressed_size = unz64local_readLong64(field + 4 + used);
+        }
+        pos += 4 + data_size;
+    }
+
+    TRYFREE(name_extra);
+    return UNZ_OK;
+}
+
+/* decompress the entry into buf, which is thrown away, and compare what was
+   read with the central directory and the local header */
+local void unz64local_VerifyEntry OF((unzFile file, const unz_entry64* entry,
+                                      const char* password, void* buf,
+                                      unz_verify_entry* result));
+local void unz64local_VerifyEntry (unzFile file, const unz_entry64* entry,
+                                   const char* password, void* buf,
+                                   unz_verify_entry* result)
+{
+    unz64_s* s = (unz64_s*)file;
+    const unz_file_info64* info = &entry->info;
+    file_in_zip64_read_info_s* pfile_in_zip_read_info;
+    uLong local_crc = 0;
+    ZPOS64_T local_compressed_size = 0;
+    ZPOS64_T local_uncompressed_size = 0;
+    ZPOS64_T data_offset = 0;
+    int local_zip64 = 0;
+    int crc_checkable;
+    int err;
+    int close_err;
+    int read;
+
+    memset(result, 0, sizeof(unz_verify_entry));
+
+    err = unzGoToFilePos64(file, &entry->pos);
+    if (err == UNZ_OK)
+        err = unz64local_ReadLocalHeader(s, entry, &local_crc, &local_compressed_size,
+                                         &local_uncompressed_size, &local_zip64,
+                                         &data_offset, &result->mismatch);
+    if ((err == UNZ_OK) && ((info->flag & 1) != 0) && (password == NULL))
+        err = UNZ_PARAMERROR;
+    if ((err == UNZ_OK) && ((info->flag & 8) == 0))
+    {
+        /* unzOpenCurrentFile3 refuses a local header which disagrees with
+           the central directory, the data is then not read */
+        if ((info->compression_method != LK_AES_METHOD) && (local_crc != info->crc))
+            result->mismatch |= UNZ_VERIFY_CRC_LOCAL;
+        if (local_compressed_size != info->compressed_size)
+            result->mismatch |= UNZ_VERIFY_COMPRESSED_LOCAL;
+        if (local_uncompressed_size != info->uncompressed_size)
+            result->mismatch |= UNZ_VERIFY_UNCOMPRESSED_LOCAL;
+    }
+    if ((err == UNZ_OK) && (result->mismatch != 0))
+        err = UNZ_CRCERROR;
+    if (err == UNZ_OK)
+        err = unzOpenCurrentFile3(file, NULL, NULL, 0, ((info->flag & 1) != 0) ? password : NULL);
+    if (err != UNZ_OK)
+    {
+        result->err = err;
+        return;
+    }
+    pfile_in_zip_read_info = s->pfile_in_zip_read;
+
+    /* stored data is checked in place when the zipfile is mapped */
+    do
+    {
+        const void* data;
+        read = unzReadCurrentFileMapped(file, &data, UNZ_VERIFY_BUFSIZE);
+    } while (read > 0);
+    if (read == UNZ_PARAMERROR)
+    {
+        do
+            read = unzReadCurrentFile(file, buf, UNZ_VERIFY_BUFSIZE);
+        while (read > 0);
+    }
+    if (read < 0)
+        err = read;
+
+    result->crc = pfile_in_zip_read_info->crc32;
+    result->uncompressed_size = pfile_in_zip_read_info->total_out_64;
+    result->compressed_size = info->compressed_size - pfile_in_zip_read_info->rest_read_compressed -
+                              pfile_in_zip_read_info->stream.avail_in;
+    crc_checkable = pfile_in_zip_read_info->crc_checkable;
+
+    /* the local crc and sizes of an entry written with bit 3 are in the data
+       descriptor following the data, with or without its signature */
+    if ((err == UNZ_OK) && ((info->flag & 8) != 0))
+    {
+        unsigned char descriptor[24];
+        const unsigned char* p = descriptor;
+        uLong size_descriptor = (local_zip64 ? 20 : 12) + 4;
+        if (unz64local_ReadAt(pfile_in_zip_read_info, descriptor, size_descriptor,
+                              data_offset + info->compressed_size + s->byte_before_the_zipfile) !=
+            size_descriptor)
+            err = UNZ_BADZIPFILE;
+        else
+        {
+            if (unz64local_readLong(p) == 0x08074b50)
+                p += 4;
+            local_crc = unz64local_readLong(p);
+            if (local_zip64)
+            {
+                local_compressed_size = unz64local_readLong64(p + 4);
+                local_uncompressed_size = unz64local_readLong64(p + 12);
+            }
+            else
+            {
+                local_compressed_size = unz64local_readLong(p + 4);
+                local_uncompressed_size = unz64local_readLong(p + 8);
+            }
+        }
+    }
+
+    close_err = unzCloseCurrentFile(file);
+
+    if (err == UNZ_OK)
+    {
+        /* AE-2 entries store no crc, their authentication code was checked */
+        if (crc_checkable && (result->crc != info->crc))
+            result->mismatch |= UNZ_VERIFY_CRC_CENTRAL;
+        if (crc_checkable && (result->crc != local_crc))
+            result->mismatch |= UNZ_VERIFY_CRC_LOCAL;
+        if (result->compressed_size != info->compressed_size)
+            result->mismatch |= UNZ_VERIFY_COMPRESSED_CENTRAL;
+        if (result->compressed_size != local_compressed_size)
+            result->mismatch |= UNZ_VERIFY_COMPRESSED_LOCAL;
+        if (result->uncompressed_size != info->uncompressed_size)
+            result->mismatch |= UNZ_VERIFY_UNCOMPRESSED_CENTRAL;
+        if (result->uncompressed_size != local_uncompressed_size)
+            result->mismatch |= UNZ_VERIFY_UNCOMPRESSED_LOCAL;
+
+        if ((result->mismatch != 0) || (close_err == UNZ_CRCERROR))
+            err = UNZ_CRCERROR;
+        else
+            err = close_err;
+    }
+    result->err = err;
+}
+
+/* check entries until there are no more, with file or a handle of its own */
+local void unz64local_VerifyEntries OF((unz64_verify_job* job, unzFile file));
+local void unz64local_VerifyEntries (unz64_verify_job* job, unzFile file)
+{
+    unzFile own_file = NULL;
+    void* buf = ALLOC(UNZ_VERIFY_BUFSIZE);
+
+    if (file == NULL)
+        file = own_file = unzOpen3_64(job->path, job->pzlib_filefunc_def);
+
+    for (;;)
+    {
+        ZPOS64_T i;
+
+#ifndef NO_PARALLEL_VERIFY
+        pthread_mutex_lock(&job->lock);
+#endif
+        i = job->next++;
+#ifndef NO_PARALLEL_VERIFY
+        pthread_mutex_unlock(&job->lock);
+#endif
+        if (i >= job->number_entry)
+            break;
+        i = job->order[i].index;
+
+        if ((file == NULL) || (buf == NULL))
+        {
+            memset(&job->report[i], 0, sizeof(unz_verify_entry));
+            job->report[i].err = (file == NULL) ? UNZ_ERRNO : UNZ_INTERNALERROR;
+        }
+        else
+            unz64local_VerifyEntry(file, &job->entries[i], job->password, buf, &job->report[i]);
+    }
+
+    if (own_file != NULL)
+        unzClose(own_file);
+    TRYFREE(buf);
+}
+
+#ifndef NO_PARALLEL_VERIFY
+local void* unz64local_VerifyWorker OF((void* arg));
+local void* unz64local_VerifyWorker (void* arg)
+{
+    unz64local_VerifyEntries((unz64_verify_job*)arg, NULL);
+    return NULL;
+}
+#endif
+
+extern int ZEXPORT unzVerifyArchive (const void* path, zlib_filefunc64_ex_def* pzlib_filefunc_def,
+                                     const char* password, int threads,
+                                     unz_verify_entry* report, ZPOS64_T number_entry,
+                                     ZPOS64_T* pnumber_bad)
+{
+    unzFile file;
+    unz64_verify_job job;
+    unz_entry64* entries = NULL;
+    unz64_verify_order* order = NULL;
+    unz_verify_entry* results = NULL;
+    void* arena = NULL;
+    ZPOS64_T arena_size = 0;
+    ZPOS64_T number = 0;
+    ZPOS64_T number_bad = 0;
+    ZPOS64_T i;
+    int err;
+
+    if (pnumber_bad != NULL)
+        *pnumber_bad = 0;
+
+    file = unzOpen3_64(path, pzlib_filefunc_def);
+    if (file == NULL)
+        return UNZ_BADZIPFILE;
+
+    err = unzListEntries64(file, NULL, 0, NULL, &number, &arena_size);
+    if ((err == UNZ_OK) && (report != NULL) && (number_entry < number))
+        err = UNZ_PARAMERROR;
+    if (err == UNZ_OK)
+    {
+        arena = ALLOC((size_t)(arena_size > 0 ? arena_size : 1));
+        order = (unz64_verify_order*)ALLOC((size_t)(number > 0 ? number : 1) * sizeof(unz64_verify_order));
+        results = (report != NULL) ? report :
+                  (unz_verify_entry*)ALLOC((size_t)(number > 0 ? number : 1) * sizeof(unz_verify_entry));
+        if ((arena == NULL) || (order == NULL) || (results == NULL))
+            err = UNZ_INTERNALERROR;
+    }
+    if (err == UNZ_OK)
+        err = unzListEntries64(file, arena, arena_size, &entries, &number, NULL);
+
+    if (err == UNZ_OK)
+    {
+        /* the largest entries are handed out first, so the workers end together */
+        for (i = 0; i < number; i++)
+        {
+            order[i].compressed_size = entries[i].info.compressed_size;
+            order[i].index = i;
+        }
+        qsort(order, (size_t)number, sizeof(unz64_verify_order), unz64local_CompareVerifyOrder);
+
+        job.path = path;
+        job.pzlib_filefunc_def = pzlib_filefunc_def;
+        job.password = password;
+        job.entries = entries;
+        job.order = order;
+        job.number_entry = number;
+        job.report = results;
+        job.next = 0;
+
+#ifndef NO_PARALLEL_VERIFY
+        if (threads > UNZ_VERIFY_MAXTHREADS)
+            threads = UNZ_VERIFY_MAXTHREADS;
+        if ((ZPOS64_T)threads > number)
+            threads = (int)number;
+        {
+            pthread_t workers[UNZ_VERIFY_MAXTHREADS];
+            int started = 0;
+
+            pthread_mutex_init(&job.lock, NULL);
+            /* the calling thread is one of the workers */
+            while (started < threads - 1)
+            {
+                if (pthread_create(&workers[started], NULL, unz64local_VerifyWorker, &job) != 0)
+                    break;
+                started++;
+            }
+            unz64local_VerifyEntries(&job, file);
+            while (started > 0)
+                pthread_join(workers[--started], NULL);
+            pthread_mutex_destroy(&job.lock);
+        }
+#else
+        (void)threads;
+        unz64local_VerifyEntries(&job, file);
+#endif
+
+        for (i = 0; i < number; i++)
+            if (results[i].err != UNZ_OK)
+                number_bad++;
+        if (pnumber_bad != NULL)
+            *pnumber_bad = number_bad;
+        if (number_bad > 0)
+            err = UNZ_CRCERROR;
+    }
+
+    unzClose(file);
+    if (results != report)
+        TRYFREE(results);
+    TRYFREE(order);
+    TRYFREE(arena);
+    return err;
+}
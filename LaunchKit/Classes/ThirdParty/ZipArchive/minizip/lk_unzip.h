@@ -59,6 +59,10 @@ extern "C" {
 #include "bzlib.h"
 #endif
 
+#ifndef _LK_METHOD_H
+#include "lk_method.h"
+#endif
+
 #define Z_BZIP2ED 12
 
 #if defined(STRICTUNZIP) || defined(STRICTZIPUNZIP)
@@ -79,6 +83,7 @@ typedef voidp unzFile;
 #define UNZ_BADZIPFILE                  (-103)
 #define UNZ_INTERNALERROR               (-104)
 #define UNZ_CRCERROR                    (-105)
+#define UNZ_BADPASSWORD                 (-106)
 
 /* tm_unz contain date/time info */
 typedef struct tm_unz_s
@@ -195,6 +200,15 @@ extern unzFile ZEXPORT unzOpen2_64 OF((const void *path,
       for read/write the zip file (see ioapi.h)
 */
 
+extern unzFile ZEXPORT unzOpen3_64 OF((const void *path,
+                                    zlib_filefunc64_ex_def* pzlib_filefunc_def));
+/*
+   Open a Zip file, like unzOpen2_64, with file functions which may also map
+      the zipfile in memory (zmap64_file, as fill_mmap_filefunc64 does) and
+      read it at an offset without moving the stream (zpread64_file, as
+      fill_fopen64_filefunc_ex does)
+*/
+
 extern int ZEXPORT unzClose OF((unzFile file));
 /*
   Close a ZipFile opened with unzipOpen.
@@ -252,6 +266,28 @@ extern int ZEXPORT unzLocateFile OF((unzFile file,
 */
 
 
+extern int ZEXPORT unzBuildIndex OF((unzFile file));
+/*
+  Read the central directory in a single pass and keep an in-memory index of
+  the filenames (a contiguous name table plus hash tables), so later calls to
+  unzLocateFileIndexed don't walk the central directory. The index is freed
+  by unzClose.
+  return UNZ_OK if there is no problem
+*/
+
+extern int ZEXPORT unzLocateFileIndexed OF((unzFile file,
+                     const char *szFileName,
+                     int iCaseSensitivity));
+/*
+  Same than unzLocateFile, but with a constant time lookup in the index built
+  by unzBuildIndex. If no index was built, this falls back to unzLocateFile.
+
+  return value :
+  UNZ_OK if the file is found. It becomes the current file.
+  UNZ_END_OF_LIST_OF_FILE if the file is not found (the current file is
+    left unchanged)
+*/
+
 /* ****************************************** */
 /* Ryan supplied functions */
 /* unz_file_info contain information about a file in the zipfile */
@@ -283,6 +319,86 @@ extern int ZEXPORT unzGoToFilePos64(
     unzFile file,
     const unz64_file_pos* file_pos);
 
+/* one entry listed by unzListEntries64 */
+typedef struct unz_entry64_s
+{
+    unz_file_info64 info;       /* as returned by unzGetCurrentFileInfo64 */
+    unz64_file_pos pos;         /* to make it the current file with unzGoToFilePos64 */
+    const char* filename;       /* zero terminated, in the name table of the arena */
+} unz_entry64;
+
+extern int ZEXPORT unzListEntries64 OF((unzFile file,
+                                       void* arena,
+                                       ZPOS64_T arena_size,
+                                       unz_entry64** pentries,
+                                       ZPOS64_T* pnumber_entry,
+                                       ZPOS64_T* parena_needed));
+/*
+  Describe every entry of the zipfile in a single pass over the central
+  directory, without allocating anything per entry: arena receives the array
+  of the entries, in the order of the central directory, followed by the
+  table of their names. arena must be aligned as malloc does.
+  *pentries and *pnumber_entry receive the array and its length, and
+  *parena_needed the size of arena the listing needs (any of the three can be
+  NULL). Call it with a NULL arena to learn that size; nothing else is done
+  then. The current file is left unchanged.
+  return UNZ_OK if there is no problem, UNZ_PARAMERROR if arena_size is too
+  small.
+*/
+
+/* what unzVerifyArchive found about one entry */
+typedef struct unz_verify_entry_s
+{
+    int err;                    /* UNZ_OK if the entry is sound, else the first
+                                   problem found: UNZ_CRCERROR when its data or
+                                   its local header do not match the central
+                                   directory, UNZ_BADZIPFILE when there is no
+                                   local header, the error of
+                                   unzOpenCurrentFile3 or unzReadCurrentFile
+                                   otherwise */
+    uLong mismatch;             /* UNZ_VERIFY_* bits: the headers which differ
+                                   from the data read. When the local header
+                                   differs from the central directory the data
+                                   is not read, the _LOCAL bits then tell
+                                   where they differ */
+    uLong crc;                  /* crc-32 of the data read */
+    ZPOS64_T compressed_size;   /* bytes of the entry consumed */
+    ZPOS64_T uncompressed_size; /* bytes of data read */
+} unz_verify_entry;
+
+#define UNZ_VERIFY_LOCAL_HEADER          (0x01) /* name or method differ */
+#define UNZ_VERIFY_CRC_CENTRAL           (0x02)
+#define UNZ_VERIFY_CRC_LOCAL             (0x04)
+#define UNZ_VERIFY_COMPRESSED_CENTRAL    (0x08)
+#define UNZ_VERIFY_COMPRESSED_LOCAL      (0x10)
+#define UNZ_VERIFY_UNCOMPRESSED_CENTRAL  (0x20)
+#define UNZ_VERIFY_UNCOMPRESSED_LOCAL    (0x40)
+
+extern int ZEXPORT unzVerifyArchive OF((const void* path,
+                                       zlib_filefunc64_ex_def* pzlib_filefunc_def,
+                                       const char* password,
+                                       int threads,
+                                       unz_verify_entry* report,
+                                       ZPOS64_T number_entry,
+                                       ZPOS64_T* pnumber_bad));
+/*
+  Check every entry of the zipfile at path without extracting anything: its
+  data is decompressed and thrown away, and its crc-32 and sizes are compared
+  with those of its central directory record and of its local header (of its
+  data descriptor when it has one). The entries are shared out between
+  threads worker threads (at most 64), largest first, each with its own
+  handle on the zipfile, opened with unzOpen3_64 and pzlib_filefunc_def (the
+  stdio functions if NULL). threads of 0 or 1 checks everything on the calling thread.
+  password is used for encrypted entries; without it they are reported with
+  UNZ_PARAMERROR.
+  report (if not NULL) receives one unz_verify_entry per entry, in the order
+  of the central directory (the order of unzListEntries64), and
+  *pnumber_bad (if not NULL) the number of entries which are not sound.
+  return UNZ_OK if all the entries are sound, UNZ_CRCERROR if some are not,
+  UNZ_PARAMERROR if number_entry is smaller than the number of entries, or
+  the error met opening the zipfile.
+*/
+
 /* ****************************************** */
 
 extern int ZEXPORT unzGetCurrentFileInfo64 OF((unzFile file,
@@ -340,6 +456,11 @@ extern int ZEXPORT unzOpenCurrentFilePassword OF((unzFile file,
   Open for reading data the current file in the zipfile.
   password is a crypting password
   If there is no error, the return value is UNZ_OK.
+  Files encrypted with WinZip AES (AE-1 and AE-2, see lk_aes.h) are read
+  the same way. Their password is checked when they are opened, which
+  returns UNZ_BADPASSWORD if it is not the right one, and their
+  authentication code when they are closed after reading all their data,
+  which returns UNZ_CRCERROR if it does not match.
 */
 
 extern int ZEXPORT unzOpenCurrentFile2 OF((unzFile file,
@@ -390,6 +511,41 @@ extern int ZEXPORT unzReadCurrentFile OF((unzFile file,
     (UNZ_ERRNO for IO error, or zLib error for uncompress error)
 */
 
+extern int ZEXPORT unzReadCurrentFileMapped OF((unzFile file,
+                      const void** pbuf,
+                      unsigned len));
+/*
+  Same than unzReadCurrentFile, but without copy : *pbuf receive a pointer
+  on the data in the mapping of the zipfile, valid until unzClose.
+  Only available when the zipfile was opened with unzOpen3_64 and
+  fill_mmap_filefunc64, and the current file is stored (or opened raw) and
+  not encrypted.
+
+  return the number of byte available at *pbuf (at most len)
+  return 0 if the end of file was reached
+  return UNZ_PARAMERROR if the current file cannot be read in place
+*/
+
+#ifndef _WIN32
+extern int ZEXPORT unzCopyCurrentFileToFd OF((unzFile file,
+                      int fd,
+                      int zip_fd,
+                      ZPOS64_T* copied));
+/*
+  Write the rest of the current file, which must be stored (or opened raw) and
+    not encrypted, to the file descriptor fd.
+  When the zipfile is mapped (unzOpen3_64 with fill_mmap_filefunc64) the data
+    is written from the mapping. Otherwise, on Linux, with zip_fd a descriptor
+    open on the zipfile, it is copied by the kernel with copy_file_range, and
+    its CRC is then not checked by unzCloseCurrentFile. Else it is read
+    straight in a buffer and written. Pass -1 as zip_fd when there is none.
+  *copied (if not NULL) receives the number of bytes written.
+
+  return UNZ_OK, UNZ_PARAMERROR if the current file is compressed or
+    encrypted, UNZ_ERRNO on IO error
+*/
+#endif
+
 extern z_off_t ZEXPORT unztell OF((unzFile file));
 
 extern ZPOS64_T ZEXPORT unztell64 OF((unzFile file));
@@ -402,6 +558,42 @@ extern int ZEXPORT unzeof OF((unzFile file));
   return 1 if the end of file was reached, 0 elsewhere
 */
 
+extern int ZEXPORT unzSeekCurrentFile64 OF((unzFile file, ZPOS64_T pos));
+/*
+  Move the read position in the current file to pos bytes from the beginning
+    of the uncompressed data (at most the uncompressed size).
+  Stored files (or files opened raw) move there directly. Deflated files
+    restart from the last checkpoint before pos (see unzSetCurrentFileSeekSpan)
+    when it is closer than the current position, or from the beginning when
+    going back without a checkpoint, and decompress up to pos.
+  Encrypted and bzip2 files can only move forward.
+  Once data was skipped by a seek, unzCloseCurrentFile does not check the CRC,
+    unless the file was read again from the beginning.
+
+  return UNZ_OK, UNZ_PARAMERROR if the file can not move to pos, or the error
+    of unzReadCurrentFile
+*/
+
+extern int ZEXPORT unzSetCurrentFileSeekSpan OF((unzFile file, ZPOS64_T span));
+/*
+  Record a checkpoint every span bytes of uncompressed data while the current
+    (deflated, not encrypted) file is read or seeked, so unzSeekCurrentFile64
+    decompresses at most about span bytes after a first pass. Each checkpoint
+    holds 32KB. A span of 0 stops recording, keeping the checkpoints taken.
+  The checkpoints are freed by unzCloseCurrentFile; save them with
+    unzSaveCurrentFileSeekIndex to reuse them later.
+  Needs zlib 1.2.8 or later, UNZ_PARAMERROR is returned otherwise.
+*/
+
+extern int ZEXPORT unzSaveCurrentFileSeekIndex OF((unzFile file, const char* path));
+extern int ZEXPORT unzLoadCurrentFileSeekIndex OF((unzFile file, const char* path));
+/*
+  Write the checkpoints of the current file to path, or replace them with the
+    ones read from path (usually next to the zipfile). A loaded index must
+    match the CRC and the sizes of the current file, UNZ_BADZIPFILE is
+    returned otherwise.
+*/
+
 extern int ZEXPORT unzGetLocalExtrafield OF((unzFile file,
                                              voidp buf,
                                              unsigned len));
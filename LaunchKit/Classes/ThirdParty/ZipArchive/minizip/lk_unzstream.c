@@ -0,0 +1,884 @@
+/* lk_unzstream.c -- push based unzip of a zipfile as it arrives
+
+   The zipfile is parsed with a small state machine: fixed size records
+   are gathered in a holding buffer across the chunks given to
+   unzStreamWrite, while the compressed data is decompressed straight from
+   the caller's chunks.
+
+   License: Same as ZLIB (www.gzip.org)
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "zlib.h"
+#include "lk_unzstream.h"
+#include "lk_crc32.h"
+
+#ifndef local
+#  define local static
+#endif
+
+#ifndef ALLOC
+# define ALLOC(size) (malloc(size))
+#endif
+#ifndef TRYFREE
+# define TRYFREE(p) {if (p) free(p);}
+#endif
+
+#ifndef UNZ_STREAMBUFSIZE
+#define UNZ_STREAMBUFSIZE (65536)
+#endif
+
+#define LOCALHEADERMAGIC       (0x04034b50)
+#define CENTRALHEADERMAGIC     (0x02014b50)
+#define ENDHEADERMAGIC         (0x06054b50)
+#define ZIP64ENDHEADERMAGIC    (0x06064b50)
+#define DESCRIPTORHEADERMAGIC  (0x08074b50)
+#define SIGNATUREHEADERMAGIC   (0x05054b50)
+
+#define SIZELOCALHEADER        (26) /* after the signature */
+#define SIZECENTRALHEADER      (42) /* after the signature */
+
+#define STREAM_SIGNATURE       (0)
+#define STREAM_LOCALHEADER     (1)
+#define STREAM_NAMEEXTRA       (2)
+#define STREAM_DATA            (3)
+#define STREAM_DESCRIPTOR      (4) /* its signature or crc */
+#define STREAM_DESCRIPTORSIZES (5)
+#define STREAM_CENTRALHEADER   (6)
+#define STREAM_CENTRALVAR      (7) /* filename and extra field */
+#define STREAM_SKIP            (8) /* file comment */
+#define STREAM_END             (9)
+
+/* what an entry turned out to be, for the check of the central directory */
+typedef struct
+{
+    ZPOS64_T offset;                /* of its local header */
+    uLong crc;
+    ZPOS64_T compressed_size;
+    ZPOS64_T uncompressed_size;
+} unz_stream_record;
+
+typedef struct
+{
+    unz_stream_callbacks callbacks;
+    int state;
+    int err;                        /* stops the stream once not UNZ_OK */
+
+    unsigned char hold[SIZECENTRALHEADER]; /* fixed size records being gathered */
+    uLong hold_needed;
+    uLong hold_filled;
+
+    unsigned char* name_extra;      /* filename, nul, then the extra field */
+    uLong size_name_extra;
+    uLong name_extra_filled;
+    uLong size_file_extra;
+
+    unz_stream_entry entry;
+    voidpf handle;                  /* from open_entry, NULL when skipping */
+    int zip64;                      /* the local header has a zip64 extra field */
+    int descriptor;                 /* bit 3 of the flag */
+    unsigned char tail[24];         /* of a stored entry with a descriptor:
+                                       bytes that may start the descriptor */
+    uLong tail_filled;
+
+    z_stream stream;
+    int inflate_initialised;
+    const lk_method* codec;         /* for methods other than stored and deflated */
+    voidpf codec_state;
+    ZPOS64_T rest_compressed;       /* without a data descriptor */
+    ZPOS64_T total_in;
+    ZPOS64_T total_out;
+    uLong crc;
+
+    unsigned char* out;             /* UNZ_STREAMBUFSIZE bytes */
+
+    ZPOS64_T offset;                /* in the zipfile, of the next byte pushed */
+    ZPOS64_T resume_offset;         /* of the first entry not yet complete */
+    ZPOS64_T start_offset;          /* of the first byte pushed */
+    ZPOS64_T entry_offset;          /* of the local header of the entry */
+
+    unz_stream_record* records;     /* entries completed, in zipfile order */
+    ZPOS64_T number_records;
+    ZPOS64_T records_allocated;
+    ZPOS64_T records_checked;       /* found in the central directory */
+    int in_central;                 /* 1 once the central directory started */
+    ZPOS64_T central_offset;        /* local header offset of a central record */
+    ZPOS64_T rest_skip;
+} unz64_stream_s;
+
+
+local uLong unzstream_getValue OF((const unsigned char* p, int nbByte));
+local uLong unzstream_getValue (const unsigned char* p, int nbByte)
+{
+    uLong x = 0;
+    int n;
+    for (n = nbByte - 1; n >= 0; n--)
+        x = (x << 8) | p[n];
+    return x;
+}
+
+local ZPOS64_T unzstream_getValue64 OF((const unsigned char* p));
+local ZPOS64_T unzstream_getValue64 (const unsigned char* p)
+{
+    return ((ZPOS64_T)unzstream_getValue(p+4,4) << 32) | unzstream_getValue(p,4);
+}
+
+local void unzstream_DosDateToTmuDate OF((uLong ulDosDate, tm_unz* ptm));
+local void unzstream_DosDateToTmuDate (uLong ulDosDate, tm_unz* ptm)
+{
+    uLong uDate = ulDosDate>>16;
+    ptm->tm_mday = (uInt)(uDate&0x1f) ;
+    ptm->tm_mon =  (uInt)((((uDate)&0x1E0)/0x20)-1) ;
+    ptm->tm_year = (uInt)(((uDate&0x0FE00)/0x0200)+1980) ;
+
+    ptm->tm_hour = (uInt) ((ulDosDate &0xF800)/0x800);
+    ptm->tm_min =  (uInt) ((ulDosDate&0x7E0)/0x20) ;
+    ptm->tm_sec =  (uInt) (2*(ulDosDate&0x1f)) ;
+}
+
+/* move up to hold_needed bytes into the holding buffer, return how many */
+local uLong unzstream_gather OF((unz64_stream_s* s, const unsigned char* buf, uLong len));
+local uLong unzstream_gather (unz64_stream_s* s, const unsigned char* buf, uLong len)
+{
+    uLong take = s->hold_needed - s->hold_filled;
+    if (take > len)
+        take = len;
+    memcpy(s->hold + s->hold_filled, buf, take);
+    s->hold_filled += take;
+    return take;
+}
+
+local void unzstream_expect OF((unz64_stream_s* s, int state, uLong needed));
+local void unzstream_expect (unz64_stream_s* s, int state, uLong needed)
+{
+    s->state = state;
+    s->hold_needed = needed;
+    s->hold_filled = 0;
+}
+
+/* the entry is over, keep what it was for the central directory */
+local int unzstream_record OF((unz64_stream_s* s));
+local int unzstream_record (unz64_stream_s* s)
+{
+    unz_stream_record* record;
+    if (s->number_records == s->records_allocated)
+    {
+        ZPOS64_T allocated = (s->records_allocated == 0) ? 64 : s->records_allocated * 2;
+        unz_stream_record* records = (unz_stream_record*)ALLOC((size_t)allocated * sizeof(unz_stream_record));
+        if (records == NULL)
+            return UNZ_INTERNALERROR;
+        if (s->number_records > 0)
+            memcpy(records, s->records, (size_t)s->number_records * sizeof(unz_stream_record));
+        TRYFREE(s->records);
+        s->records = records;
+        s->records_allocated = allocated;
+    }
+    record = &s->records[s->number_records++];
+    record->offset = s->entry_offset;
+    record->crc = s->entry.crc;
+    record->compressed_size = s->entry.compressed_size;
+    record->uncompressed_size = s->entry.uncompressed_size;
+    return UNZ_OK;
+}
+
+local void unzstream_closeEntry OF((unz64_stream_s* s, int err));
+local void unzstream_closeEntry (unz64_stream_s* s, int err)
+{
+    if (s->codec_state != NULL)
+    {
+        s->codec->decompress_end(s->codec_state);
+        s->codec_state = NULL;
+    }
+    if ((s->handle != NULL) && (s->callbacks.close_entry != NULL))
+        s->callbacks.close_entry(s->callbacks.opaque, s->handle, &s->entry, err);
+    s->handle = NULL;
+}
+
+/* the local header and its filename and extra field are complete */
+local int unzstream_openEntry OF((unz64_stream_s* s));
+local int unzstream_openEntry (unz64_stream_s* s)
+{
+    const unsigned char* extra = s->name_extra + s->entry.size_filename + 1;
+    uLong extra_pos = 0;
+
+    s->name_extra[s->entry.size_filename] = '\0';
+    s->entry.filename = (const char*)s->name_extra;
+
+    /* sizes of 0xffffffff are in the zip64 extra field */
+    s->zip64 = 0;
+    while (extra_pos + 4 <= s->size_file_extra)
+    {
+        uLong header_id = unzstream_getValue(extra + extra_pos, 2);
+        uLong data_size = unzstream_getValue(extra + extra_pos + 2, 2);
+        const unsigned char* data = extra + extra_pos + 4;
+        if (extra_pos + 4 + data_size > s->size_file_extra)
+            break;
+        if (header_id == 0x0001)
+        {
+            uLong used = 0;
+            s->zip64 = 1;
+            if ((s->entry.uncompressed_size == 0xffffffff) && (used + 8 <= data_size))
+            {
+                s->entry.uncompressed_size = unzstream_getValue64(data + used);
+                used += 8;
+            }
+            if ((s->entry.compressed_size == 0xffffffff) && (used + 8 <= data_size))
+            {
+                s->entry.compressed_size = unzstream_getValue64(data + used);
+                used += 8;
+            }
+        }
+        extra_pos += 4 + data_size;
+    }
+
+    if ((s->entry.flag & 1) != 0)
+        return UNZ_PARAMERROR;
+
+    s->codec = NULL;
+    if ((s->entry.compression_method != 0) && (s->entry.compression_method != Z_DEFLATED))
+    {
+        s->codec = lk_method_find(s->entry.compression_method);
+        if ((s->codec == NULL) || (s->codec->decompress_init == NULL))
+            return UNZ_BADZIPFILE;
+    }
+
+    /* the end of a compressed stream tells where the data stops, the
+       descriptor itself where the data of a stored entry does */
+    if (s->descriptor)
+    {
+        s->entry.crc = 0;
+        s->entry.compressed_size = 0;
+        s->entry.uncompressed_size = 0;
+    }
+
+    if (s->entry.compression_method == Z_DEFLATED)
+    {
+        int err;
+        if (s->inflate_initialised)
+            err = inflateReset(&s->stream);
+        else
+        {
+            s->stream.zalloc = (alloc_func)0;
+            s->stream.zfree = (free_func)0;
+            s->stream.opaque = (voidpf)0;
+            s->stream.next_in = 0;
+            s->stream.avail_in = 0;
+            err = inflateInit2(&s->stream, -MAX_WBITS);
+            s->inflate_initialised = (err == Z_OK);
+        }
+        if (err != Z_OK)
+            return UNZ_INTERNALERROR;
+    }
+    else if (s->codec != NULL)
+    {
+        s->codec_state = s->codec->decompress_init();
+        if (s->codec_state == NULL)
+            return UNZ_INTERNALERROR;
+    }
+
+    s->rest_compressed = s->entry.compressed_size;
+    s->total_in = 0;
+    s->total_out = 0;
+    s->crc = 0;
+    s->tail_filled = 0;
+    s->state = STREAM_DATA;
+
+    s->handle = NULL;
+    if (s->callbacks.open_entry != NULL)
+        s->handle = s->callbacks.open_entry(s->callbacks.opaque, &s->entry);
+    return UNZ_OK;
+}
+
+/* the data is complete: check it, or wait for its data descriptor */
+local void unzstream_endData OF((unz64_stream_s* s));
+local void unzstream_endData (unz64_stream_s* s)
+{
+    if (s->descriptor)
+    {
+        unzstream_expect(s, STREAM_DESCRIPTOR, 4);
+        return;
+    }
+
+    if ((s->crc != s->entry.crc) || (s->total_out != s->entry.uncompressed_size))
+        unzstream_closeEntry(s, UNZ_CRCERROR);
+    else
+        unzstream_closeEntry(s, UNZ_OK);
+    s->err = unzstream_record(s);
+    unzstream_expect(s, STREAM_SIGNATURE, 4);
+}
+
+local int unzstream_output OF((unz64_stream_s* s, const unsigned char* buf, uLong len));
+local int unzstream_output (unz64_stream_s* s, const unsigned char* buf, uLong len)
+{
+    if (len == 0)
+        return UNZ_OK;
+    s->total_out += len;
+    /* a stored entry needs its crc to find its data descriptor */
+    if ((s->handle == NULL) && !(s->descriptor && (s->entry.compression_method == 0)))
+        return UNZ_OK;
+    s->crc = lk_crc32(s->crc, buf, (uInt)len);
+    if (s->handle == NULL)
+        return UNZ_OK;
+    return s->callbacks.write_entry(s->callbacks.opaque, s->handle, buf, len);
+}
+
+local int unzstream_descriptor OF((unz64_stream_s* s));
+
+/* p starts a data descriptor, with its signature, for the data before it */
+local int unzstream_isDescriptor OF((const unz64_stream_s* s, const unsigned char* p));
+local int unzstream_isDescriptor (const unz64_stream_s* s, const unsigned char* p)
+{
+    ZPOS64_T compressed_size, uncompressed_size;
+    if ((unzstream_getValue(p, 4) != DESCRIPTORHEADERMAGIC) || (unzstream_getValue(p + 4, 4) != s->crc))
+        return 0;
+    if (s->zip64)
+    {
+        compressed_size = unzstream_getValue64(p + 8);
+        uncompressed_size = unzstream_getValue64(p + 16);
+    }
+    else
+    {
+        compressed_size = unzstream_getValue(p + 8, 4);
+        uncompressed_size = unzstream_getValue(p + 12, 4);
+    }
+    return (compressed_size == s->total_in) && (uncompressed_size == s->total_out);
+}
+
+local int unzstream_storedOutput OF((unz64_stream_s* s, const unsigned char* buf, uLong len));
+local int unzstream_storedOutput (unz64_stream_s* s, const unsigned char* buf, uLong len)
+{
+    s->total_in += len;
+    return unzstream_output(s, buf, len);
+}
+
+/* the data of a stored entry with a data descriptor ends at the first
+   descriptor whose signature, crc and sizes match the bytes before it, as
+   in unzRepair. The bytes that may start one are held back in tail until
+   the chunks after them tell. Consume from buf, return how many bytes or
+   an error */
+local long unzstream_storedData OF((unz64_stream_s* s, const unsigned char* buf, uLong len));
+local long unzstream_storedData (unz64_stream_s* s, const unsigned char* buf, uLong len)
+{
+    const uLong size = s->zip64 ? 24 : 16;
+    uLong held = s->tail_filled;    /* bytes of tail from previous chunks */
+    uLong used = 0;
+    uLong pos;
+    int err;
+
+    while (s->tail_filled > 0)
+    {
+        uLong take = size - s->tail_filled;
+        uLong skip;
+        if (take > len)
+            take = len;
+        memcpy(s->tail + s->tail_filled, buf, take);
+        s->tail_filled += take;
+        used = take;
+        if (s->tail_filled < size)
+            return (long)used;
+
+        if (unzstream_isDescriptor(s, s->tail))
+        {
+            memcpy(s->hold, s->tail + 4, size - 4);
+            s->tail_filled = 0;
+            err = unzstream_descriptor(s);
+            return (err == UNZ_OK) ? (long)used : err;
+        }
+
+        /* not a descriptor: up to the next byte that may start one is data */
+        for (skip = 1; (skip < size) && (s->tail[skip] != 0x50); skip++)
+            ;
+        if (skip > held)
+            skip = held;
+        err = unzstream_storedOutput(s, s->tail, skip);
+        if (err != UNZ_OK)
+            return err;
+        held -= skip;
+        if (held == 0)
+        {
+            /* the rest of tail is still in buf */
+            s->tail_filled = 0;
+            used = 0;
+            break;
+        }
+        memmove(s->tail, s->tail + skip, held);
+        s->tail_filled = held;
+    }
+
+    pos = used;
+    while (pos + size <= len)
+    {
+        const unsigned char* found = (const unsigned char*)memchr(buf + pos, 0x50, len - size + 1 - pos);
+        if (found == NULL)
+        {
+            pos = len - size + 1;
+            break;
+        }
+        pos = (uLong)(found - buf);
+        if (unzstream_getValue(found, 4) == DESCRIPTORHEADERMAGIC)
+        {
+            /* the crc must cover the data up to it */
+            err = unzstream_storedOutput(s, buf + used, pos - used);
+            if (err != UNZ_OK)
+                return err;
+            used = pos;
+            if (unzstream_isDescriptor(s, found))
+            {
+                memcpy(s->hold, found + 4, size - 4);
+                err = unzstream_descriptor(s);
+                return (err == UNZ_OK) ? (long)(pos + size) : err;
+            }
+        }
+        pos++;
+    }
+
+    err = unzstream_storedOutput(s, buf + used, pos - used);
+    if (err != UNZ_OK)
+        return err;
+    memcpy(s->tail, buf + pos, len - pos);
+    s->tail_filled = len - pos;
+    return (long)len;
+}
+
+/* consume compressed data from buf, return how many bytes or an error */
+local long unzstream_data OF((unz64_stream_s* s, const unsigned char* buf, uLong len));
+local long unzstream_data (unz64_stream_s* s, const unsigned char* buf, uLong len)
+{
+    uLong avail = len;
+    int err = UNZ_OK;
+    int ended = 0;
+
+    if (!s->descriptor && (avail > s->rest_compressed))
+        avail = (uLong)s->rest_compressed;
+
+    if ((s->entry.compression_method == 0) && s->descriptor)
+        return unzstream_storedData(s, buf, len);
+
+    if (s->entry.compression_method == 0)
+    {
+        err = unzstream_output(s, buf, avail);
+        s->total_in += avail;
+        s->rest_compressed -= avail;
+        if (err != UNZ_OK)
+            return err;
+        if (s->rest_compressed == 0)
+            unzstream_endData(s);
+        return (long)avail;
+    }
+
+    /* a skipped entry of known size does not need to be decompressed */
+    if ((s->handle == NULL) && !s->descriptor)
+    {
+        s->total_in += avail;
+        s->rest_compressed -= avail;
+        if (s->rest_compressed == 0)
+        {
+            unzstream_expect(s, STREAM_SIGNATURE, 4);
+            if (s->codec_state != NULL)
+                unzstream_closeEntry(s, UNZ_OK);
+            s->err = unzstream_record(s);
+        }
+        return (long)avail;
+    }
+
+    s->stream.next_in = (Bytef*)buf;
+    s->stream.avail_in = (uInt)avail;
+    for (;;)
+    {
+        uInt before_in = s->stream.avail_in;
+        int zerr;
+
+        s->stream.next_out = s->out;
+        s->stream.avail_out = UNZ_STREAMBUFSIZE;
+        if (s->codec != NULL)
+            zerr = s->codec->decompress(s->codec_state, &s->stream);
+        else
+            zerr = inflate(&s->stream, Z_SYNC_FLUSH);
+
+        s->total_in += before_in - s->stream.avail_in;
+        if (!s->descriptor)
+            s->rest_compressed -= before_in - s->stream.avail_in;
+        err = unzstream_output(s, s->out, UNZ_STREAMBUFSIZE - s->stream.avail_out);
+        if (err != UNZ_OK)
+            return err;
+
+        if (zerr == Z_STREAM_END)
+        {
+            ended = 1;
+            break;
+        }
+        if ((zerr != Z_OK) && (zerr != Z_BUF_ERROR))
+            return (zerr == Z_NEED_DICT) ? Z_DATA_ERROR : zerr;
+        if ((s->stream.avail_out != 0) && (s->stream.avail_in == 0))
+            break;
+        if ((zerr == Z_BUF_ERROR) && (s->stream.avail_out != 0))
+            break;
+    }
+
+    avail -= s->stream.avail_in;
+    if (ended)
+    {
+        /* the header counts compressed bytes beyond the end of the stream */
+        if (!s->descriptor && (s->rest_compressed > 0))
+            return Z_DATA_ERROR;
+        unzstream_endData(s);
+    }
+    else if (!s->descriptor && (s->rest_compressed == 0))
+        return Z_DATA_ERROR;    /* the stream does not end with its data */
+
+    return (long)avail;
+}
+
+local int unzstream_descriptor (unz64_stream_s* s)
+{
+    const unsigned char* p = s->hold;
+    s->entry.crc = unzstream_getValue(p, 4);
+    if (s->zip64)
+    {
+        s->entry.compressed_size = unzstream_getValue64(p + 4);
+        s->entry.uncompressed_size = unzstream_getValue64(p + 12);
+    }
+    else
+    {
+        s->entry.compressed_size = unzstream_getValue(p + 4, 4);
+        s->entry.uncompressed_size = unzstream_getValue(p + 8, 4);
+    }
+
+    if ((s->handle != NULL) &&
+        ((s->crc != s->entry.crc) ||
+         (s->total_in != s->entry.compressed_size) ||
+         (s->total_out != s->entry.uncompressed_size)))
+        unzstream_closeEntry(s, UNZ_CRCERROR);
+    else
+        unzstream_closeEntry(s, UNZ_OK);
+    unzstream_expect(s, STREAM_SIGNATURE, 4);
+    return unzstream_record(s);
+}
+
+/* a central directory record and its extra field are complete: it must
+   describe an entry extracted with the same crc and sizes */
+local int unzstream_central OF((unz64_stream_s* s));
+local int unzstream_central (unz64_stream_s* s)
+{
+    const unsigned char* h = s->hold;
+    const unsigned char* extra = s->name_extra + unzstream_getValue(h + 24, 2);
+    uLong size_extra = unzstream_getValue(h + 26, 2);
+    uLong crc = unzstream_getValue(h + 12, 4);
+    ZPOS64_T compressed_size = unzstream_getValue(h + 16, 4);
+    ZPOS64_T uncompressed_size = unzstream_getValue(h + 20, 4);
+    ZPOS64_T offset = unzstream_getValue(h + 38, 4);
+    const unz_stream_record* record = NULL;
+    uLong extra_pos = 0;
+
+    /* values of 0xffffffff are in the zip64 extra field, in this order */
+    while (extra_pos + 4 <= size_extra)
+    {
+        uLong header_id = unzstream_getValue(extra + extra_pos, 2);
+        uLong data_size = unzstream_getValue(extra + extra_pos + 2, 2);
+        const unsigned char* data = extra + extra_pos + 4;
+        if (extra_pos + 4 + data_size > size_extra)
+            break;
+        if (header_id == 0x0001)
+        {
+            uLong used = 0;
+            if ((uncompressed_size == 0xffffffff) && (used + 8 <= data_size))
+            {
+                uncompressed_size = unzstream_getValue64(data + used);
+                used += 8;
+            }
+            if ((compressed_size == 0xffffffff) && (used + 8 <= data_size))
+            {
+                compressed_size = unzstream_getValue64(data + used);
+                used += 8;
+            }
+            if ((offset == 0xffffffff) && (used + 8 <= data_size))
+                offset = unzstream_getValue64(data + used);
+        }
+        extra_pos += 4 + data_size;
+    }
+
+    /* entries before a resume were extracted, and checked, by another stream */
+    if (offset < s->start_offset)
+        return UNZ_OK;
+
+    /* the central directory is usually in the order of the entries */
+    if ((s->records_checked < s->number_records) &&
+        (s->records[s->records_checked].offset == offset))
+        record = &s->records[s->records_checked];
+    else
+    {
+        ZPOS64_T low = 0;
+        ZPOS64_T high = s->number_records;
+        while (low < high)
+        {
+            ZPOS64_T middle = low + (high - low) / 2;
+            if (s->records[middle].offset < offset)
+                low = middle + 1;
+            else
+                high = middle;
+        }
+        if ((low < s->number_records) && (s->records[low].offset == offset))
+            record = &s->records[low];
+    }
+    if (record == NULL)
+        return UNZ_BADZIPFILE;
+    s->records_checked++;
+
+    if ((record->crc != crc) ||
+        (record->compressed_size != compressed_size) ||
+        (record->uncompressed_size != uncompressed_size))
+        return UNZ_CRCERROR;
+    return UNZ_OK;
+}
+
+extern unzStream ZEXPORT unzStreamOpen (const unz_stream_callbacks* callbacks)
+{
+    return unzStreamOpenAt(callbacks, 0);
+}
+
+extern unzStream ZEXPORT unzStreamOpenAt (const unz_stream_callbacks* callbacks, ZPOS64_T offset)
+{
+    unz64_stream_s* s;
+
+    if ((callbacks == NULL) || (callbacks->write_entry == NULL))
+        return NULL;
+
+    s = (unz64_stream_s*)ALLOC(sizeof(unz64_stream_s));
+    if (s == NULL)
+        return NULL;
+    memset(s, 0, sizeof(unz64_stream_s));
+    s->callbacks = *callbacks;
+    s->out = (unsigned char*)ALLOC(UNZ_STREAMBUFSIZE);
+    if (s->out == NULL)
+    {
+        TRYFREE(s);
+        return NULL;
+    }
+    s->offset = offset;
+    s->resume_offset = offset;
+    s->start_offset = offset;
+    unzstream_expect(s, STREAM_SIGNATURE, 4);
+    return (unzStream)s;
+}
+
+extern int ZEXPORT unzStreamWrite (unzStream stream, const void* buf, uLong len)
+{
+    unz64_stream_s* s;
+    const unsigned char* p = (const unsigned char*)buf;
+
+    if (stream == NULL)
+        return UNZ_PARAMERROR;
+    s = (unz64_stream_s*)stream;
+
+    while ((s->err == UNZ_OK) && (s->state != STREAM_END))
+    {
+        /* between two entries: everything before p is extracted */
+        if ((s->state == STREAM_SIGNATURE) && (s->hold_filled == 0) && !s->in_central)
+            s->resume_offset = s->offset + (ZPOS64_T)(p - (const unsigned char*)buf);
+
+        /* entries of known size may have no data at all */
+        if ((s->state == STREAM_DATA) && !s->descriptor && (s->rest_compressed == 0) &&
+            (s->entry.compression_method == 0))
+        {
+            unzstream_endData(s);
+            continue;
+        }
+
+        if (len == 0)
+            break;
+
+        if (s->state == STREAM_DATA)
+        {
+            long used = unzstream_data(s, p, len);
+            if (used < 0)
+            {
+                s->err = (int)used;
+                break;
+            }
+            p += used;
+            len -= (uLong)used;
+            continue;
+        }
+
+        if (s->state == STREAM_NAMEEXTRA)
+        {
+            uLong take = s->size_name_extra - s->name_extra_filled;
+            unsigned char* dest = s->name_extra + s->name_extra_filled;
+            if (s->name_extra_filled >= s->entry.size_filename)
+                dest++;         /* past the nul ending the filename */
+            else if (take > s->entry.size_filename - s->name_extra_filled)
+                take = s->entry.size_filename - s->name_extra_filled;
+            if (take > len)
+                take = len;
+            memcpy(dest, p, take);
+            s->name_extra_filled += take;
+            p += take;
+            len -= take;
+            if (s->name_extra_filled == s->size_name_extra)
+                s->err = unzstream_openEntry(s);
+            continue;
+        }
+
+        if (s->state == STREAM_CENTRALVAR)
+        {
+            uLong take = s->size_name_extra - s->name_extra_filled;
+            if (take > len)
+                take = len;
+            memcpy(s->name_extra + s->name_extra_filled, p, take);
+            s->name_extra_filled += take;
+            p += take;
+            len -= take;
+            if (s->name_extra_filled == s->size_name_extra)
+            {
+                s->err = unzstream_central(s);
+                if (s->rest_skip > 0)
+                    s->state = STREAM_SKIP;
+                else
+                    unzstream_expect(s, STREAM_SIGNATURE, 4);
+            }
+            continue;
+        }
+
+        if (s->state == STREAM_SKIP)
+        {
+            uLong take = len;
+            if (take > s->rest_skip)
+                take = (uLong)s->rest_skip;
+            s->rest_skip -= take;
+            p += take;
+            len -= take;
+            if (s->rest_skip == 0)
+                unzstream_expect(s, STREAM_SIGNATURE, 4);
+            continue;
+        }
+
+        {
+            uLong used = unzstream_gather(s, p, len);
+            p += used;
+            len -= used;
+        }
+        if (s->hold_filled < s->hold_needed)
+            break;
+
+        switch (s->state)
+        {
+        case STREAM_SIGNATURE:
+        {
+            uLong magic = unzstream_getValue(s->hold, 4);
+            if ((magic == LOCALHEADERMAGIC) && !s->in_central)
+            {
+                s->entry_offset = s->resume_offset;
+                unzstream_expect(s, STREAM_LOCALHEADER, SIZELOCALHEADER);
+            }
+            else if (magic == CENTRALHEADERMAGIC)
+            {
+                s->in_central = 1;
+                unzstream_expect(s, STREAM_CENTRALHEADER, SIZECENTRALHEADER);
+            }
+            else if ((magic == ENDHEADERMAGIC) || (magic == ZIP64ENDHEADERMAGIC) ||
+                     (magic == SIGNATUREHEADERMAGIC))
+            {
+                /* every entry extracted must be in the central directory */
+                s->in_central = 1;
+                if (s->records_checked != s->number_records)
+                    s->err = UNZ_BADZIPFILE;
+                s->state = STREAM_END;
+            }
+            else
+                s->err = UNZ_BADZIPFILE;
+            break;
+        }
+
+        case STREAM_LOCALHEADER:
+        {
+            const unsigned char* h = s->hold;
+            memset(&s->entry, 0, sizeof(unz_stream_entry));
+            s->entry.version_needed = unzstream_getValue(h, 2);
+            s->entry.flag = unzstream_getValue(h + 2, 2);
+            s->entry.compression_method = unzstream_getValue(h + 4, 2);
+            s->entry.dosDate = unzstream_getValue(h + 6, 4);
+            unzstream_DosDateToTmuDate(s->entry.dosDate, &s->entry.tmu_date);
+            s->entry.crc = unzstream_getValue(h + 10, 4);
+            s->entry.compressed_size = unzstream_getValue(h + 14, 4);
+            s->entry.uncompressed_size = unzstream_getValue(h + 18, 4);
+            s->entry.size_filename = unzstream_getValue(h + 22, 2);
+            s->size_file_extra = unzstream_getValue(h + 24, 2);
+            s->descriptor = (s->entry.flag & 8) != 0;
+
+            TRYFREE(s->name_extra);
+            s->size_name_extra = s->entry.size_filename + s->size_file_extra;
+            s->name_extra = (unsigned char*)ALLOC(s->size_name_extra + 1);
+            s->name_extra_filled = 0;
+            if (s->name_extra == NULL)
+                s->err = UNZ_INTERNALERROR;
+            else if (s->size_name_extra == 0)
+                s->err = unzstream_openEntry(s);
+            else
+                s->state = STREAM_NAMEEXTRA;
+            break;
+        }
+
+        case STREAM_DESCRIPTOR:
+            /* the signature of the data descriptor is optional */
+            if (unzstream_getValue(s->hold, 4) == DESCRIPTORHEADERMAGIC)
+                unzstream_expect(s, STREAM_DESCRIPTORSIZES, s->zip64 ? 20 : 12);
+            else
+            {
+                s->state = STREAM_DESCRIPTORSIZES;
+                s->hold_needed = s->zip64 ? 20 : 12;
+            }
+            break;
+
+        case STREAM_DESCRIPTORSIZES:
+            s->err = unzstream_descriptor(s);
+            break;
+
+        case STREAM_CENTRALHEADER:
+            TRYFREE(s->name_extra);
+            s->size_name_extra = unzstream_getValue(s->hold + 24, 2) + unzstream_getValue(s->hold + 26, 2);
+            s->rest_skip = unzstream_getValue(s->hold + 28, 2);
+            s->name_extra = (unsigned char*)ALLOC(s->size_name_extra + 1);
+            s->name_extra_filled = 0;
+            if (s->name_extra == NULL)
+                s->err = UNZ_INTERNALERROR;
+            s->state = STREAM_CENTRALVAR;
+            break;
+        }
+    }
+
+    s->offset += (ZPOS64_T)(p - (const unsigned char*)buf);
+    if ((s->err != UNZ_OK) && (s->handle != NULL))
+        unzstream_closeEntry(s, s->err);
+    return s->err;
+}
+
+extern ZPOS64_T ZEXPORT unzStreamResumeOffset (unzStream stream)
+{
+    if (stream == NULL)
+        return 0;
+    return ((unz64_stream_s*)stream)->resume_offset;
+}
+
+extern int ZEXPORT unzStreamClose (unzStream stream)
+{
+    unz64_stream_s* s;
+    int err;
+
+    if (stream == NULL)
+        return UNZ_PARAMERROR;
+    s = (unz64_stream_s*)stream;
+
+    err = s->err;
+    if ((err == UNZ_OK) && (s->state != STREAM_END))
+        err = UNZ_BADZIPFILE;
+    unzstream_closeEntry(s, err);
+
+    if (s->inflate_initialised)
+        inflateEnd(&s->stream);
+    TRYFREE(s->name_extra);
+    TRYFREE(s->records);
+    TRYFREE(s->out);
+    TRYFREE(s);
+    return err;
+}
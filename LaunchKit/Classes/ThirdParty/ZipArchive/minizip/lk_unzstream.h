@@ -0,0 +1,128 @@
+/* lk_unzstream.h -- push based unzip of a zipfile as it arrives
+
+   unzip.c needs the whole zipfile to find the central directory at its end.
+   This reads the local headers instead, so a zipfile can be extracted from
+   a byte stream (a download) while the rest of it is still coming: the
+   caller pushes the bytes in chunks of any size with unzStreamWrite, and
+   each entry is handed to callbacks as soon as its data is decompressed.
+
+   Entries written with a data descriptor (bit 3 of the flag) are supported,
+   the end of the compressed stream telling where the descriptor is. The
+   data of a stored entry ends at the first descriptor with a signature
+   whose crc and sizes are those of the bytes before it, as written by
+   APPEND_STATUS_CREATESTREAM. Encrypted entries are not supported.
+
+   An interrupted transfer can be resumed at the first entry it did not
+   complete (unzStreamResumeOffset), in a new stream opened with
+   unzStreamOpenAt, so only the bytes of that entry are fetched again.
+
+   The central directory is read as well, and each of its records checked
+   against the crc and sizes of the entry extracted at its offset, so a
+   zipfile whose local headers and central directory disagree is rejected
+   before it is used. After a resume, the entries extracted by the previous
+   stream are only checked against their local headers.
+
+   License: Same as ZLIB (www.gzip.org)
+*/
+
+#ifndef _LK_UNZSTREAM_H
+#define _LK_UNZSTREAM_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef _unz64_H
+#include "lk_unzip.h"
+#endif
+
+#if defined(STRICTUNZIP) || defined(STRICTZIPUNZIP)
+typedef struct TagunzStream__ { int unused; } unzStream__;
+typedef unzStream__ *unzStream;
+#else
+typedef voidp unzStream;
+#endif
+
+/* what the local header of an entry tells about it */
+typedef struct unz_stream_entry_s
+{
+    const char* filename;       /* nul terminated, valid until close_entry */
+    uLong size_filename;        /* filename length                 2 bytes */
+    uLong version_needed;       /* version needed to extract       2 bytes */
+    uLong flag;                 /* general purpose bit flag        2 bytes */
+    uLong compression_method;   /* compression method              2 bytes */
+    uLong dosDate;              /* last mod file date in Dos fmt   4 bytes */
+    tm_unz tmu_date;
+
+    /* with bit 3 of flag set, these are 0 in open_entry and only known
+       from the data descriptor when close_entry is called */
+    uLong crc;                  /* crc-32                          4 bytes */
+    ZPOS64_T compressed_size;   /* compressed size                 8 bytes */
+    ZPOS64_T uncompressed_size; /* uncompressed size               8 bytes */
+} unz_stream_entry;
+
+typedef struct unz_stream_callbacks_s
+{
+    /* an entry starts. Return a handle to receive its data, or NULL to skip
+       the entry (close_entry is not called for skipped entries) */
+    voidpf (*open_entry)  OF((voidpf opaque, const unz_stream_entry* entry));
+
+    /* the next uncompressed bytes of the entry. Return UNZ_OK, or an error
+       which stops the extraction and is returned by unzStreamWrite */
+    int    (*write_entry) OF((voidpf opaque, voidpf handle, const void* buf, uLong size));
+
+    /* the entry is complete when err is UNZ_OK. It is UNZ_CRCERROR when the
+       data does not match its crc or sizes, or the error which stopped
+       the extraction */
+    void   (*close_entry) OF((voidpf opaque, voidpf handle, const unz_stream_entry* entry, int err));
+
+    voidpf opaque;
+} unz_stream_callbacks;
+
+extern unzStream ZEXPORT unzStreamOpen OF((const unz_stream_callbacks* callbacks));
+/*
+  Prepare to extract a zipfile pushed with unzStreamWrite. The callbacks are
+  copied. Return NULL if there is not enough memory.
+*/
+
+extern unzStream ZEXPORT unzStreamOpenAt OF((const unz_stream_callbacks* callbacks, ZPOS64_T offset));
+/*
+  Like unzStreamOpen, for a zipfile pushed from offset on instead of from its
+  start. offset must be where a local header starts, as returned by
+  unzStreamResumeOffset.
+*/
+
+extern int ZEXPORT unzStreamWrite OF((unzStream stream, const void* buf, uLong len));
+/*
+  Push the next len bytes of the zipfile, calling the callbacks for the
+  entries they complete or continue. Once the end of central directory
+  record is reached the remaining bytes are ignored.
+  Return UNZ_OK, or the error which stopped the extraction (UNZ_BADZIPFILE,
+  also for an entry missing from the central directory, UNZ_CRCERROR for a
+  central record which does not match its entry, UNZ_PARAMERROR for an
+  encrypted entry, a zlib error for corrupt data or the error of a
+  callback); later calls return the same error.
+*/
+
+extern ZPOS64_T ZEXPORT unzStreamResumeOffset OF((unzStream stream));
+/*
+  Return the offset in the zipfile of the local header of the first entry
+  which is not complete yet: close_entry has been called for all the entries
+  before it. If the transfer stops, the zipfile can be pushed again from
+  there to a stream opened with unzStreamOpenAt. Once the central directory
+  is reached, return its offset.
+*/
+
+extern int ZEXPORT unzStreamClose OF((unzStream stream));
+/*
+  Free the stream. Return UNZ_OK if the whole central directory was checked,
+  the error which stopped the extraction, or UNZ_BADZIPFILE if the zipfile
+  was truncated, in which case close_entry is called with that error for the
+  entry being extracted.
+*/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _LK_UNZSTREAM_H */
@@ -28,6 +28,18 @@
 #include <time.h>
 #include "zlib.h"
 #include "lk_zip.h"
+#include "lk_crc32.h"
+#include "lk_aes.h"
+
+#if defined(_WIN32) || defined(WIN32)
+# ifndef NO_PARALLEL_DEFLATE
+#  define NO_PARALLEL_DEFLATE
+# endif
+#endif
+
+#ifndef NO_PARALLEL_DEFLATE
+#  include <pthread.h>
+#endif
 
 #ifdef STDC
 #  include <stddef.h>
@@ -58,6 +70,8 @@
 #define Z_MAXFILENAMEINZIP (256)
 #endif
 
+/* the memory, and zlib's for the entries, is taken with ALLOC and given
+   back with TRYFREE: define them to count or track the allocations */
 #ifndef ALLOC
 # define ALLOC(size) (malloc(size))
 #endif
@@ -98,41 +112,82 @@
 const char zip_copyright[] =" zip 1.01 Copyright 1998-2004 Gilles Vollant - http://www.winimage.com/zLibDll";
 
 
-#define SIZEDATA_INDATABLOCK (4096-(4*4))
+/* initial size of the buffer of the central directory in construction */
+#define SIZEDATA_INCENTRALDIR (0x10000)
+
+/* largest size given to a single ZREAD64/ZWRITE64 call */
+#define SIZEDATA_MAXIO (0x40000000)
 
 #define LOCALHEADERMAGIC    (0x04034b50)
 #define CENTRALHEADERMAGIC  (0x02014b50)
 #define ENDHEADERMAGIC      (0x06054b50)
 #define ZIP64ENDHEADERMAGIC      (0x6064b50)
 #define ZIP64ENDLOCHEADERMAGIC   (0x7064b50)
+#define DESCRIPTORHEADERMAGIC    (0x08074b50)
 
 #define FLAG_LOCALHEADER_OFFSET (0x06)
 #define CRC_LOCALHEADER_OFFSET  (0x0e)
 
 #define SIZECENTRALHEADER (0x2e) /* 46 */
 
-typedef struct linkedlist_datablock_internal_s
+#ifndef NO_PARALLEL_DEFLATE
+/* parallel deflate cuts the input of an entry in blocks of PDEFLATE_BLOCK
+   bytes, each one primed with the PDEFLATE_DICT bytes that precede it */
+#define PDEFLATE_BLOCK (128*1024)
+#define PDEFLATE_DICT  (32*1024)
+#define PDEFLATE_MAXTHREADS (64)
+
+typedef struct pdeflate_job_s
 {
-  struct linkedlist_datablock_internal_s* next_datablock;
-  uLong  avail_in_this_block;
-  uLong  filled_in_this_block;
-  uLong  unused; /* for future use and alignement */
-  unsigned char data[SIZEDATA_INDATABLOCK];
-} linkedlist_datablock_internal;
+    Bytef* in;                  /* PDEFLATE_DICT + PDEFLATE_BLOCK bytes */
+    uInt dict_size;             /* dictionary at the start of in */
+    uInt in_size;               /* block data following the dictionary */
+    int  last;                  /* 1 to terminate the deflate stream */
+    Bytef* out;                 /* compressed block */
+    uInt out_size;
+    uInt out_allocated;
+    uLong crc;                  /* crc32 of the block data alone */
+    int  err;
+    int  done;                  /* 1 once a worker has compressed it */
+} pdeflate_job;
+
+typedef struct pdeflate_pool_s
+{
+    pthread_mutex_t lock;
+    pthread_cond_t work_cond;   /* signaled when a block is queued */
+    pthread_cond_t done_cond;   /* signaled when a block is compressed */
+    pthread_t threads[PDEFLATE_MAXTHREADS];
+    int  max_threads;
+    int  thread_count;          /* threads started, 0 until needed */
+    int  quit;
+
+    int  level;                 /* deflate parameters of the current entry */
+    int  windowBits;
+    int  memLevel;
+    int  strategy;
+
+    pdeflate_job* jobs;         /* ring of 2*max_threads blocks */
+    int  job_count;
+    ZPOS64_T next_submit;       /* sequence number of the block being filled */
+    ZPOS64_T next_take;         /* next block a worker will compress */
+    ZPOS64_T next_write;        /* next block to write in the zipfile */
+    int  filling;               /* 1 if the block next_submit has data */
+} pdeflate_pool;
+#endif
 
-typedef struct linkedlist_data_s
+typedef struct growable_buffer_s
 {
-    linkedlist_datablock_internal* first_block;
-    linkedlist_datablock_internal* last_block;
-} linkedlist_data;
+    unsigned char* data;
+    size_t filled;      /* bytes used in data */
+    size_t allocated;   /* size of data */
+} growable_buffer;
 
 
 typedef struct
 {
     z_stream stream;            /* zLib stream structure for inflate */
-#ifdef HAVE_BZIP2
-    bz_stream bstream;          /* bzLib stream structure for bziped */
-#endif
+    const lk_method* codec;     /* methods other than stored and deflated */
+    voidpf codec_state;         /* compressor of codec, NULL when raw */
 
     int  stream_initialised;    /* 1 is stream is initialised */
     uInt pos_in_buffered_data;  /* last written byte in buffered_data */
@@ -146,6 +201,7 @@ typedef struct
     uLong flag;                 /* flag of the file currently writing */
 
     int  method;                /* compression method of file currenty wr.*/
+    uLong version_needed;       /* version needed to extract the file */
     int  raw;                   /* 1 for directly writing raw data */
     Byte buffered_data[Z_BUFSIZE];/* buffer contain compressed data to be writ*/
     uLong dosDate;
@@ -155,10 +211,14 @@ typedef struct
     ZPOS64_T pos_zip64extrainfo;
     ZPOS64_T totalCompressedData;
     ZPOS64_T totalUncompressedData;
+    int  parallel;              /* 1 if the data goes through the deflate pool */
 #ifndef NOCRYPT
     unsigned long keys[3];     /* keys defining the pseudo-random sequence */
-    const unsigned long* pcrc_32_tab;
+    const z_crc_t* pcrc_32_tab;
     int crypt_header_size;
+    int aes_strength;          /* WinZip AES key strength, 0 for the
+                                  traditional PKWARE encryption */
+    lk_aes_ctx aes;
 #endif
 } curfile64_info;
 
@@ -166,7 +226,7 @@ typedef struct
 {
     zlib_filefunc64_32_def z_filefunc;
     voidpf filestream;        /* io structore of the zipfile */
-    linkedlist_data central_dir;/* datablock with central dir in construction*/
+    growable_buffer central_dir;/* buffer with central dir in construction*/
     int  in_opened_file_inzip;  /* 1 if a file in the zip is currently writ.*/
     curfile64_info ci;            /* info on the file curretly writing */
 
@@ -178,6 +238,25 @@ typedef struct
     char *globalcomment;
 #endif
 
+    int  deflate_ready;         /* 1 once deflateInit2 was called on ci.stream,
+                                   it is then reset for the next entries */
+    int  deflate_level;         /* parameters ci.stream was initialised with */
+    int  deflate_windowBits;
+    int  deflate_memLevel;
+    int  deflate_strategy;
+    uLong central_header_allocated; /* size of ci.central_header, which is
+                                   kept for the next entries too */
+
+    int streaming;              /* APPEND_STATUS_CREATESTREAM */
+    zlib_filefunc64_32_def sink_filefunc; /* the output, z_filefunc counts what goes to it */
+    ZPOS64_T sink_written;
+
+    int parallel_threads;       /* set by zipSetParallelDeflate */
+    int aes_strength;           /* set by zipSetAESStrength */
+#ifndef NO_PARALLEL_DEFLATE
+    pdeflate_pool* pdeflate;    /* created with the first parallel entry */
+#endif
+
 } zip64_internal;
 
 
@@ -186,93 +265,440 @@ typedef struct
 #include "lk_crypt.h"
 #endif
 
-local linkedlist_datablock_internal* allocate_new_datablock()
+local void init_buffer(growable_buffer* gb)
+{
+    gb->data = NULL;
+    gb->filled = gb->allocated = 0;
+}
+
+local void free_buffer(growable_buffer* gb)
+{
+    TRYFREE(gb->data);
+    init_buffer(gb);
+}
+
+/* zlib allocates through these, so that ALLOC and TRYFREE see it */
+local voidpf zip64local_zalloc OF((voidpf opaque, uInt items, uInt size));
+local voidpf zip64local_zalloc (voidpf opaque, uInt items, uInt size)
+{
+    return (voidpf)ALLOC((size_t)items*size);
+}
+
+local void zip64local_zfree OF((voidpf opaque, voidpf address));
+local void zip64local_zfree (voidpf opaque, voidpf address)
 {
-    linkedlist_datablock_internal* ldi;
-    ldi = (linkedlist_datablock_internal*)
-                 ALLOC(sizeof(linkedlist_datablock_internal));
-    if (ldi!=NULL)
+    TRYFREE(address);
+}
+
+/* make room for len more bytes, doubling the allocation as needed so
+   appending n bytes costs O(log n) reallocations */
+local int reserve_in_buffer(growable_buffer* gb, ZPOS64_T len)
+{
+    size_t needed;
+    size_t allocated;
+    unsigned char* data;
+
+    if ((ZPOS64_T)(size_t)len != len || gb->filled + (size_t)len < gb->filled)
+        return ZIP_INTERNALERROR;
+
+    needed = gb->filled + (size_t)len;
+    if (needed <= gb->allocated)
+        return ZIP_OK;
+
+    allocated = (gb->allocated > 0) ? gb->allocated : SIZEDATA_INCENTRALDIR;
+    while (allocated < needed)
     {
-        ldi->next_datablock = NULL ;
-        ldi->filled_in_this_block = 0 ;
-        ldi->avail_in_this_block = SIZEDATA_INDATABLOCK ;
+        if (allocated*2 < allocated)
+        {
+            allocated = needed;
+            break;
+        }
+        allocated *= 2;
     }
-    return ldi;
+
+    /* not realloc, so that all the memory goes through ALLOC and TRYFREE */
+    data = (unsigned char*)ALLOC(allocated);
+    if (data == NULL)
+        return ZIP_INTERNALERROR;
+    if (gb->filled > 0)
+        memcpy(data, gb->data, gb->filled);
+    TRYFREE(gb->data);
+    gb->data = data;
+    gb->allocated = allocated;
+    return ZIP_OK;
+}
+
+local int add_data_in_buffer(growable_buffer* gb, const void* buf, uLong len)
+{
+    int err;
+
+    if (gb==NULL)
+        return ZIP_INTERNALERROR;
+
+    err = reserve_in_buffer(gb, len);
+    if (err != ZIP_OK)
+        return err;
+
+    memcpy(gb->data + gb->filled, buf, len);
+    gb->filled += len;
+    return ZIP_OK;
 }
 
-local void free_datablock(linkedlist_datablock_internal* ldi)
+#ifndef NO_PARALLEL_DEFLATE
+/* ===========================================================================
+   Parallel deflate. The data of an entry is cut in blocks that worker
+   threads compress independently, each one primed with the last
+   PDEFLATE_DICT bytes of the previous block so little ratio is lost.
+   Every block but the last ends with a Z_SYNC_FLUSH, which leaves the
+   stream on a byte boundary without ending it, so the blocks written one
+   after the other in order are a single ordinary deflate stream. The crc
+   of each block is computed by its worker and merged with crc32_combine.
+*/
+
+local void pdeflate_compress(z_streamp strm, pdeflate_job* job)
 {
-    while (ldi!=NULL)
+    int err = Z_OK;
+
+    job->crc = lk_crc32(0L, job->in + job->dict_size, job->in_size);
+    job->out_size = 0;
+
+    if (strm == NULL)
+        err = Z_MEM_ERROR;
+    if (err == Z_OK)
+        err = deflateReset(strm);
+    if ((err == Z_OK) && (job->dict_size > 0))
+        err = deflateSetDictionary(strm, job->in, job->dict_size);
+
+    if (err == Z_OK)
     {
-        linkedlist_datablock_internal* ldinext = ldi->next_datablock;
-        TRYFREE(ldi);
-        ldi = ldinext;
+        strm->next_in = job->in + job->dict_size;
+        strm->avail_in = job->in_size;
+        for (;;)
+        {
+            Bytef* out;
+
+            strm->next_out = job->out + job->out_size;
+            strm->avail_out = job->out_allocated - job->out_size;
+            err = deflate(strm, job->last ? Z_FINISH : Z_SYNC_FLUSH);
+            job->out_size = job->out_allocated - strm->avail_out;
+
+            if (job->last ? (err == Z_STREAM_END) : ((err == Z_OK) && (strm->avail_out != 0)))
+            {
+                err = Z_OK;
+                break;
+            }
+            if (((err != Z_OK) && (err != Z_BUF_ERROR)) || (strm->avail_out != 0))
+            {
+                if (err == Z_OK)
+                    err = Z_BUF_ERROR;
+                break;
+            }
+
+            /* incompressible data, the output did not fit */
+            out = (Bytef*)ALLOC(job->out_allocated * 2);
+            if (out == NULL)
+            {
+                err = Z_MEM_ERROR;
+                break;
+            }
+            memcpy(out, job->out, job->out_size);
+            TRYFREE(job->out);
+            job->out = out;
+            job->out_allocated *= 2;
+        }
     }
+
+    job->err = (err == Z_OK) ? ZIP_OK : ZIP_INTERNALERROR;
 }
 
-local void init_linkedlist(linkedlist_data* ll)
+local void* pdeflate_worker(void* arg)
 {
-    ll->first_block = ll->last_block = NULL;
+    pdeflate_pool* pd = (pdeflate_pool*)arg;
+    z_stream stream;
+    int initialised = 0;
+    int level = 0, windowBits = 0, memLevel = 0, strategy = 0;
+
+    pthread_mutex_lock(&pd->lock);
+    for (;;)
+    {
+        pdeflate_job* job;
+        int reinit;
+
+        while ((!pd->quit) && (pd->next_take == pd->next_submit))
+            pthread_cond_wait(&pd->work_cond, &pd->lock);
+        if (pd->next_take == pd->next_submit)
+            break;
+
+        job = &pd->jobs[pd->next_take % pd->job_count];
+        pd->next_take++;
+
+        /* the parameters only change between entries, when no block is queued */
+        reinit = (!initialised) || (level != pd->level) || (windowBits != pd->windowBits) ||
+                 (memLevel != pd->memLevel) || (strategy != pd->strategy);
+        level = pd->level;
+        windowBits = pd->windowBits;
+        memLevel = pd->memLevel;
+        strategy = pd->strategy;
+        pthread_mutex_unlock(&pd->lock);
+
+        if (reinit)
+        {
+            if (initialised)
+                deflateEnd(&stream);
+            stream.zalloc = (alloc_func)0;
+            stream.zfree = (free_func)0;
+            stream.opaque = (voidpf)0;
+            initialised = (deflateInit2(&stream, level, Z_DEFLATED, windowBits, memLevel, strategy) == Z_OK);
+        }
+        pdeflate_compress(initialised ? &stream : NULL, job);
+
+        pthread_mutex_lock(&pd->lock);
+        job->done = 1;
+        pthread_cond_broadcast(&pd->done_cond);
+    }
+    pthread_mutex_unlock(&pd->lock);
+
+    if (initialised)
+        deflateEnd(&stream);
+    return NULL;
 }
 
-local void free_linkedlist(linkedlist_data* ll)
+local pdeflate_pool* pdeflate_create(int max_threads)
 {
-    free_datablock(ll->first_block);
-    ll->first_block = ll->last_block = NULL;
+    pdeflate_pool* pd = (pdeflate_pool*)ALLOC(sizeof(pdeflate_pool));
+    if (pd == NULL)
+        return NULL;
+    memset(pd, 0, sizeof(pdeflate_pool));
+
+    pd->max_threads = max_threads;
+    pd->job_count = max_threads * 2;
+    pd->jobs = (pdeflate_job*)ALLOC(sizeof(pdeflate_job) * pd->job_count);
+    if (pd->jobs == NULL)
+    {
+        TRYFREE(pd);
+        return NULL;
+    }
+    memset(pd->jobs, 0, sizeof(pdeflate_job) * pd->job_count);
+
+    pthread_mutex_init(&pd->lock, NULL);
+    pthread_cond_init(&pd->work_cond, NULL);
+    pthread_cond_init(&pd->done_cond, NULL);
+    return pd;
 }
 
+local void pdeflate_free(pdeflate_pool* pd)
+{
+    int i;
+
+    if (pd == NULL)
+        return;
 
-local int add_data_in_datablock(linkedlist_data* ll, const void* buf, uLong len)
+    pthread_mutex_lock(&pd->lock);
+    pd->quit = 1;
+    pthread_cond_broadcast(&pd->work_cond);
+    pthread_mutex_unlock(&pd->lock);
+    for (i = 0; i < pd->thread_count; i++)
+        pthread_join(pd->threads[i], NULL);
+
+    for (i = 0; i < pd->job_count; i++)
+    {
+        TRYFREE(pd->jobs[i].in);
+        TRYFREE(pd->jobs[i].out);
+    }
+    TRYFREE(pd->jobs);
+    pthread_cond_destroy(&pd->done_cond);
+    pthread_cond_destroy(&pd->work_cond);
+    pthread_mutex_destroy(&pd->lock);
+    TRYFREE(pd);
+}
+
+/* write the compressed blocks that are ready, in order; if wait is set,
+   wait for all the queued blocks to be compressed */
+local int pdeflate_write_ready(zip64_internal* zi, int wait)
 {
-    linkedlist_datablock_internal* ldi;
-    const unsigned char* from_copy;
+    pdeflate_pool* pd = zi->pdeflate;
+    int err = ZIP_OK;
 
-    if (ll==NULL)
-        return ZIP_INTERNALERROR;
+    while (pd->next_write < pd->next_submit)
+    {
+        pdeflate_job* job = &pd->jobs[pd->next_write % pd->job_count];
+        int done;
+
+        pthread_mutex_lock(&pd->lock);
+        while (wait && (!job->done))
+            pthread_cond_wait(&pd->done_cond, &pd->lock);
+        done = job->done;
+        pthread_mutex_unlock(&pd->lock);
+        if (!done)
+            break;
+
+        if (err == ZIP_OK)
+            err = job->err;
+        if (err == ZIP_OK)
+        {
+            if (ZWRITE64(zi->z_filefunc,zi->filestream,job->out,job->out_size) != job->out_size)
+                err = ZIP_ERRNO;
+            zi->ci.totalCompressedData += job->out_size;
+            zi->ci.totalUncompressedData += job->in_size;
+            zi->ci.crc32 = crc32_combine(zi->ci.crc32, job->crc, (z_off_t)job->in_size);
+        }
+        job->done = 0;
+        pd->next_write++;
+    }
+    return err;
+}
+
+/* make the block next_submit ready to receive data */
+local int pdeflate_begin_block(zip64_internal* zi)
+{
+    pdeflate_pool* pd = zi->pdeflate;
+    pdeflate_job* job;
+    int err = ZIP_OK;
 
-    if (ll->last_block == NULL)
+    /* the ring is full, wait for the oldest block */
+    while ((err == ZIP_OK) && (pd->next_submit - pd->next_write >= (ZPOS64_T)pd->job_count))
+        err = pdeflate_write_ready(zi, 1);
+    if (err != ZIP_OK)
+        return err;
+
+    job = &pd->jobs[pd->next_submit % pd->job_count];
+    if (job->in == NULL)
     {
-        ll->first_block = ll->last_block = allocate_new_datablock();
-        if (ll->first_block == NULL)
+        job->in = (Bytef*)ALLOC(PDEFLATE_DICT + PDEFLATE_BLOCK);
+        job->out_allocated = PDEFLATE_BLOCK + (PDEFLATE_BLOCK >> 3) + 64;
+        job->out = (Bytef*)ALLOC(job->out_allocated);
+        if ((job->in == NULL) || (job->out == NULL))
+        {
+            TRYFREE(job->in);
+            TRYFREE(job->out);
+            job->in = job->out = NULL;
             return ZIP_INTERNALERROR;
+        }
     }
 
-    ldi = ll->last_block;
-    from_copy = (unsigned char*)buf;
-
-    while (len>0)
+    /* every block but the last one is full, so the previous block, still
+       untouched in its slot, holds the whole dictionary */
+    job->dict_size = 0;
+    if ((zi->ci.totalUncompressedData > 0) || (pd->next_submit > pd->next_write))
     {
-        uInt copy_this;
-        uInt i;
-        unsigned char* to_copy;
+        const pdeflate_job* prev = &pd->jobs[(pd->next_submit + pd->job_count - 1) % pd->job_count];
+        memcpy(job->in, prev->in + prev->dict_size + prev->in_size - PDEFLATE_DICT, PDEFLATE_DICT);
+        job->dict_size = PDEFLATE_DICT;
+    }
+    job->in_size = 0;
+    job->last = 0;
+    pd->filling = 1;
+    return ZIP_OK;
+}
+
+local void pdeflate_submit(zip64_internal* zi, int last)
+{
+    pdeflate_pool* pd = zi->pdeflate;
+    pdeflate_job* job = &pd->jobs[pd->next_submit % pd->job_count];
+
+    job->last = last;
+    pd->filling = 0;
 
-        if (ldi->avail_in_this_block==0)
+    /* start the workers with the first entry that needs more than one block */
+    if ((!last) && (pd->thread_count == 0))
+    {
+        while (pd->thread_count < pd->max_threads)
         {
-            ldi->next_datablock = allocate_new_datablock();
-            if (ldi->next_datablock == NULL)
-                return ZIP_INTERNALERROR;
-            ldi = ldi->next_datablock ;
-            ll->last_block = ldi;
+            if (pthread_create(&pd->threads[pd->thread_count], NULL, pdeflate_worker, pd) != 0)
+                break;
+            pd->thread_count++;
         }
+    }
 
-        if (ldi->avail_in_this_block < len)
-            copy_this = (uInt)ldi->avail_in_this_block;
-        else
-            copy_this = (uInt)len;
+    pthread_mutex_lock(&pd->lock);
+    if (pd->thread_count == 0)
+    {
+        /* single block, or no thread could be started: compress it here */
+        pthread_mutex_unlock(&pd->lock);
+        pdeflate_compress(&zi->ci.stream, job);
+        pthread_mutex_lock(&pd->lock);
+        job->done = 1;
+        pd->next_take++;
+    }
+    pd->next_submit++;
+    pthread_cond_signal(&pd->work_cond);
+    pthread_mutex_unlock(&pd->lock);
+}
+
+local int pdeflate_start_entry(zip64_internal* zi, int level, int windowBits, int memLevel, int strategy)
+{
+    pdeflate_pool* pd;
 
-        to_copy = &(ldi->data[ldi->filled_in_this_block]);
+    if (zi->pdeflate == NULL)
+        zi->pdeflate = pdeflate_create(zi->parallel_threads);
+    pd = zi->pdeflate;
+    if (pd == NULL)
+        return ZIP_INTERNALERROR;
+
+    pthread_mutex_lock(&pd->lock);
+    pd->level = level;
+    pd->windowBits = windowBits;
+    pd->memLevel = memLevel;
+    pd->strategy = strategy;
+    pthread_mutex_unlock(&pd->lock);
+    pd->filling = 0;
+    return ZIP_OK;
+}
+
+local int pdeflate_write(zip64_internal* zi, const void* buf, unsigned len)
+{
+    pdeflate_pool* pd = zi->pdeflate;
+    const Bytef* from = (const Bytef*)buf;
+    int err = ZIP_OK;
 
-        for (i=0;i<copy_this;i++)
-            *(to_copy+i)=*(from_copy+i);
+    while ((err == ZIP_OK) && (len > 0))
+    {
+        pdeflate_job* job;
+        uInt copy_this;
 
-        ldi->filled_in_this_block += copy_this;
-        ldi->avail_in_this_block -= copy_this;
-        from_copy += copy_this ;
+        if (!pd->filling)
+            err = pdeflate_begin_block(zi);
+        if (err != ZIP_OK)
+            break;
+
+        job = &pd->jobs[pd->next_submit % pd->job_count];
+        copy_this = PDEFLATE_BLOCK - job->in_size;
+        if (copy_this > len)
+            copy_this = len;
+        memcpy(job->in + job->dict_size + job->in_size, from, copy_this);
+        job->in_size += copy_this;
+        from += copy_this;
         len -= copy_this;
+
+        if (job->in_size == PDEFLATE_BLOCK)
+        {
+            pdeflate_submit(zi, 0);
+            err = pdeflate_write_ready(zi, 0);
+        }
     }
-    return ZIP_OK;
+    return err;
 }
 
+/* terminate the deflate stream of the current entry and write everything */
+local int pdeflate_finish(zip64_internal* zi)
+{
+    pdeflate_pool* pd = zi->pdeflate;
+    int err = ZIP_OK;
+    int tmp_err;
+
+    if (!pd->filling)
+        err = pdeflate_begin_block(zi);
+    if (err == ZIP_OK)
+        pdeflate_submit(zi, 1);
+
+    /* drain the ring even after an error, it is reused by the next entry */
+    tmp_err = pdeflate_write_ready(zi, 1);
+    if (err == ZIP_OK)
+        err = tmp_err;
+    return err;
+}
+#endif
+
 
 
 /****************************************************************************/
@@ -344,294 +770,66 @@ local uLong zip64local_TmzDateToDosDate(const tm_zip* ptm)
 
 /****************************************************************************/
 
-local int zip64local_getByte OF((const zlib_filefunc64_32_def* pzlib_filefunc_def, voidpf filestream, int *pi));
+/* the end of central directory records are decoded from one read each
+   instead of being fetched a byte at a time through the io functions */
+#define SIZEENDHEADER         (22) /* end of central dir, without comment */
+#define SIZEZIP64ENDLOCATOR   (20)
+#define SIZEZIP64ENDHEADER    (56) /* zip64 end of central dir, fixed part */
 
-local int zip64local_getByte(const zlib_filefunc64_32_def* pzlib_filefunc_def,voidpf filestream,int* pi)
+local ZPOS64_T zip64local_getValue_inmemory OF((const unsigned char* src, int nbByte));
+local ZPOS64_T zip64local_getValue_inmemory (const unsigned char* src, int nbByte)
 {
-    unsigned char c;
-    int err = (int)ZREAD64(*pzlib_filefunc_def,filestream,&c,1);
-    if (err==1)
-    {
-        *pi = (int)c;
-        return ZIP_OK;
-    }
-    else
-    {
-        if (ZERROR64(*pzlib_filefunc_def,filestream))
-            return ZIP_ERRNO;
-        else
-            return ZIP_EOF;
-    }
-}
-
-
-/* ===========================================================================
-   Reads a long in LSB order from the given gz_stream. Sets
-*/
-local int zip64local_getShort OF((const zlib_filefunc64_32_def* pzlib_filefunc_def, voidpf filestream, uLong *pX));
-
-local int zip64local_getShort (const zlib_filefunc64_32_def* pzlib_filefunc_def, voidpf filestream, uLong* pX)
-{
-    uLong x ;
-    int i = 0;
-    int err;
-
-    err = zip64local_getByte(pzlib_filefunc_def,filestream,&i);
-    x = (uLong)i;
-
-    if (err==ZIP_OK)
-        err = zip64local_getByte(pzlib_filefunc_def,filestream,&i);
-    x += ((uLong)i)<<8;
-
-    if (err==ZIP_OK)
-        *pX = x;
-    else
-        *pX = 0;
-    return err;
-}
-
-local int zip64local_getLong OF((const zlib_filefunc64_32_def* pzlib_filefunc_def, voidpf filestream, uLong *pX));
-
-local int zip64local_getLong (const zlib_filefunc64_32_def* pzlib_filefunc_def, voidpf filestream, uLong* pX)
-{
-    uLong x ;
-    int i = 0;
-    int err;
-
-    err = zip64local_getByte(pzlib_filefunc_def,filestream,&i);
-    x = (uLong)i;
-
-    if (err==ZIP_OK)
-        err = zip64local_getByte(pzlib_filefunc_def,filestream,&i);
-    x += ((uLong)i)<<8;
-
-    if (err==ZIP_OK)
-        err = zip64local_getByte(pzlib_filefunc_def,filestream,&i);
-    x += ((uLong)i)<<16;
-
-    if (err==ZIP_OK)
-        err = zip64local_getByte(pzlib_filefunc_def,filestream,&i);
-    x += ((uLong)i)<<24;
-
-    if (err==ZIP_OK)
-        *pX = x;
-    else
-        *pX = 0;
-    return err;
-}
-
-local int zip64local_getLong64 OF((const zlib_filefunc64_32_def* pzlib_filefunc_def, voidpf filestream, ZPOS64_T *pX));
-
-
-local int zip64local_getLong64 (const zlib_filefunc64_32_def* pzlib_filefunc_def, voidpf filestream, ZPOS64_T *pX)
-{
-  ZPOS64_T x;
-  int i = 0;
-  int err;
-
-  err = zip64local_getByte(pzlib_filefunc_def,filestream,&i);
-  x = (ZPOS64_T)i;
-
-  if (err==ZIP_OK)
-    err = zip64local_getByte(pzlib_filefunc_def,filestream,&i);
-  x += ((ZPOS64_T)i)<<8;
-
-  if (err==ZIP_OK)
-    err = zip64local_getByte(pzlib_filefunc_def,filestream,&i);
-  x += ((ZPOS64_T)i)<<16;
-
-  if (err==ZIP_OK)
-    err = zip64local_getByte(pzlib_filefunc_def,filestream,&i);
-  x += ((ZPOS64_T)i)<<24;
-
-  if (err==ZIP_OK)
-    err = zip64local_getByte(pzlib_filefunc_def,filestream,&i);
-  x += ((ZPOS64_T)i)<<32;
-
-  if (err==ZIP_OK)
-    err = zip64local_getByte(pzlib_filefunc_def,filestream,&i);
-  x += ((ZPOS64_T)i)<<40;
-
-  if (err==ZIP_OK)
-    err = zip64local_getByte(pzlib_filefunc_def,filestream,&i);
-  x += ((ZPOS64_T)i)<<48;
-
-  if (err==ZIP_OK)
-    err = zip64local_getByte(pzlib_filefunc_def,filestream,&i);
-  x += ((ZPOS64_T)i)<<56;
-
-  if (err==ZIP_OK)
-    *pX = x;
-  else
-    *pX = 0;
-
-  return err;
+    ZPOS64_T x = 0;
+    int n;
+    for (n = nbByte - 1; n >= 0; n--)
+        x = (x << 8) | src[n];
+    return x;
 }
 
-#ifndef BUFREADCOMMENT
-#define BUFREADCOMMENT (0x400)
-#endif
-/*
-  Locate the Central directory of a zipfile (at the end, just before
-    the global comment)
-*/
-local ZPOS64_T zip64local_SearchCentralDir OF((const zlib_filefunc64_32_def* pzlib_filefunc_def, voidpf filestream));
-
-local ZPOS64_T zip64local_SearchCentralDir(const zlib_filefunc64_32_def* pzlib_filefunc_def, voidpf filestream)
+local int zip64local_readAt OF((const zlib_filefunc64_32_def* pzlib_filefunc_def, voidpf filestream, ZPOS64_T pos, void* buf, uLong size));
+local int zip64local_readAt (const zlib_filefunc64_32_def* pzlib_filefunc_def, voidpf filestream, ZPOS64_T pos, void* buf, uLong size)
 {
-  unsigned char* buf;
-  ZPOS64_T uSizeFile;
-  ZPOS64_T uBackRead;
-  ZPOS64_T uMaxBack=0xffff; /* maximum size of global comment */
-  ZPOS64_T uPosFound=0;
-
-  if (ZSEEK64(*pzlib_filefunc_def,filestream,0,ZLIB_FILEFUNC_SEEK_END) != 0)
-    return 0;
-
-
-  uSizeFile = ZTELL64(*pzlib_filefunc_def,filestream);
-
-  if (uMaxBack>uSizeFile)
-    uMaxBack = uSizeFile;
-
-  buf = (unsigned char*)ALLOC(BUFREADCOMMENT+4);
-  if (buf==NULL)
-    return 0;
-
-  uBackRead = 4;
-  while (uBackRead<uMaxBack)
-  {
-    uLong uReadSize;
-    ZPOS64_T uReadPos ;
-    int i;
-    if (uBackRead+BUFREADCOMMENT>uMaxBack)
-      uBackRead = uMaxBack;
-    else
-      uBackRead+=BUFREADCOMMENT;
-    uReadPos = uSizeFile-uBackRead ;
-
-    uReadSize = ((BUFREADCOMMENT+4) < (uSizeFile-uReadPos)) ?
-      (BUFREADCOMMENT+4) : (uLong)(uSizeFile-uReadPos);
-    if (ZSEEK64(*pzlib_filefunc_def,filestream,uReadPos,ZLIB_FILEFUNC_SEEK_SET)!=0)
-      break;
-
-    if (ZREAD64(*pzlib_filefunc_def,filestream,buf,uReadSize)!=uReadSize)
-      break;
-
-    for (i=(int)uReadSize-3; (i--)>0;)
-      if (((*(buf+i))==0x50) && ((*(buf+i+1))==0x4b) &&
-        ((*(buf+i+2))==0x05) && ((*(buf+i+3))==0x06))
-      {
-        uPosFound = uReadPos+i;
-        break;
-      }
-
-      if (uPosFound!=0)
-        break;
-  }
-  TRYFREE(buf);
-  return uPosFound;
+    if (ZSEEK64(*pzlib_filefunc_def,filestream,pos,ZLIB_FILEFUNC_SEEK_SET)!=0)
+        return ZIP_ERRNO;
+    if (ZREAD64(*pzlib_filefunc_def,filestream,buf,size)!=size)
+        return ZIP_ERRNO;
+    return ZIP_OK;
 }
 
 /*
-Locate the End of Zip64 Central directory locator and from there find the CD of a zipfile (at the end, just before
-the global comment)
+Check the End of Zip64 Central directory locator found at uPosFound, and from there find the CD of a zipfile
 */
-local ZPOS64_T zip64local_SearchCentralDir64 OF((const zlib_filefunc64_32_def* pzlib_filefunc_def, voidpf filestream));
+local ZPOS64_T zip64local_SearchCentralDir64 OF((const zlib_filefunc64_32_def* pzlib_filefunc_def, voidpf filestream, ZPOS64_T uPosFound));
 
-local ZPOS64_T zip64local_SearchCentralDir64(const zlib_filefunc64_32_def* pzlib_filefunc_def, voidpf filestream)
+local ZPOS64_T zip64local_SearchCentralDir64(const zlib_filefunc64_32_def* pzlib_filefunc_def, voidpf filestream, ZPOS64_T uPosFound)
 {
-  unsigned char* buf;
-  ZPOS64_T uSizeFile;
-  ZPOS64_T uBackRead;
-  ZPOS64_T uMaxBack=0xffff; /* maximum size of global comment */
-  ZPOS64_T uPosFound=0;
-  uLong uL;
+  unsigned char locator[SIZEZIP64ENDLOCATOR];
+  unsigned char signature[4];
   ZPOS64_T relativeOffset;
 
-  if (ZSEEK64(*pzlib_filefunc_def,filestream,0,ZLIB_FILEFUNC_SEEK_END) != 0)
-    return 0;
-
-  uSizeFile = ZTELL64(*pzlib_filefunc_def,filestream);
-
-  if (uMaxBack>uSizeFile)
-    uMaxBack = uSizeFile;
-
-  buf = (unsigned char*)ALLOC(BUFREADCOMMENT+4);
-  if (buf==NULL)
-    return 0;
-
-  uBackRead = 4;
-  while (uBackRead<uMaxBack)
-  {
-    uLong uReadSize;
-    ZPOS64_T uReadPos;
-    int i;
-    if (uBackRead+BUFREADCOMMENT>uMaxBack)
-      uBackRead = uMaxBack;
-    else
-      uBackRead+=BUFREADCOMMENT;
-    uReadPos = uSizeFile-uBackRead ;
-
-    uReadSize = ((BUFREADCOMMENT+4) < (uSizeFile-uReadPos)) ?
-      (BUFREADCOMMENT+4) : (uLong)(uSizeFile-uReadPos);
-    if (ZSEEK64(*pzlib_filefunc_def,filestream,uReadPos,ZLIB_FILEFUNC_SEEK_SET)!=0)
-      break;
-
-    if (ZREAD64(*pzlib_filefunc_def,filestream,buf,uReadSize)!=uReadSize)
-      break;
-
-    for (i=(int)uReadSize-3; (i--)>0;)
-    {
-      // Signature "0x07064b50" Zip64 end of central directory locater
-      if (((*(buf+i))==0x50) && ((*(buf+i+1))==0x4b) && ((*(buf+i+2))==0x06) && ((*(buf+i+3))==0x07))
-      {
-        uPosFound = uReadPos+i;
-        break;
-      }
-    }
-
-      if (uPosFound!=0)
-        break;
-  }
-
-  TRYFREE(buf);
   if (uPosFound == 0)
     return 0;
 
-  /* Zip64 end of central directory locator */
-  if (ZSEEK64(*pzlib_filefunc_def,filestream, uPosFound,ZLIB_FILEFUNC_SEEK_SET)!=0)
+  /* Zip64 end of central directory locator, its signature already checked */
+  if (zip64local_readAt(pzlib_filefunc_def,filestream,uPosFound,locator,SIZEZIP64ENDLOCATOR)!=ZIP_OK)
     return 0;
 
-  /* the signature, already checked */
-  if (zip64local_getLong(pzlib_filefunc_def,filestream,&uL)!=ZIP_OK)
-    return 0;
-
-  /* number of the disk with the start of the zip64 end of  central directory */
-  if (zip64local_getLong(pzlib_filefunc_def,filestream,&uL)!=ZIP_OK)
-    return 0;
-  if (uL != 0)
+  /* number of the disk with the start of the zip64 end of central directory */
+  if (zip64local_getValue_inmemory(locator+4,4) != 0)
     return 0;
 
   /* relative offset of the zip64 end of central directory record */
-  if (zip64local_getLong64(pzlib_filefunc_def,filestream,&relativeOffset)!=ZIP_OK)
-    return 0;
+  relativeOffset = zip64local_getValue_inmemory(locator+8,8);
 
   /* total number of disks */
-  if (zip64local_getLong(pzlib_filefunc_def,filestream,&uL)!=ZIP_OK)
-    return 0;
-  if (uL != 1)
+  if (zip64local_getValue_inmemory(locator+16,4) != 1)
     return 0;
 
   /* Goto Zip64 end of central directory record */
-  if (ZSEEK64(*pzlib_filefunc_def,filestream, relativeOffset,ZLIB_FILEFUNC_SEEK_SET)!=0)
-    return 0;
-
-  /* the signature */
-  if (zip64local_getLong(pzlib_filefunc_def,filestream,&uL)!=ZIP_OK)
+  if (zip64local_readAt(pzlib_filefunc_def,filestream,relativeOffset,signature,4)!=ZIP_OK)
     return 0;
 
-  if (uL != 0x06064b50) // signature of 'Zip64 end of central directory'
+  if (zip64local_getValue_inmemory(signature,4) != ZIP64ENDHEADERMAGIC)
     return 0;
 
   return relativeOffset;
@@ -646,7 +844,8 @@ int LoadCentralDirectoryRecord(zip64_internal* pziinit)
   ZPOS64_T size_central_dir;     /* size of the central directory  */
   ZPOS64_T offset_central_dir;   /* offset of start of central directory */
   ZPOS64_T central_pos;
-  uLong uL;
+  ZPOS64_T end_central_pos;
+  ZPOS64_T locator_pos;
 
   uLong number_disk;          /* number of the current dist, used for
                               spaning ZIP, unsupported, always 0*/
@@ -656,21 +855,24 @@ int LoadCentralDirectoryRecord(zip64_internal* pziinit)
   ZPOS64_T number_entry_CD;      /* total number of entries in
                                 the central dir
                                 (same than number_entry on nospan) */
-  uLong VersionMadeBy;
-  uLong VersionNeeded;
   uLong size_comment;
 
+  unsigned char end_header[SIZEENDHEADER];
   int hasZIP64Record = 0;
 
+  // locate the end of central directory records with a single read
+  if (call_zsearch_central_dir(&pziinit->z_filefunc,pziinit->filestream,&end_central_pos,&locator_pos)!=0)
+    err=ZIP_ERRNO;
+
   // check first if we find a ZIP64 record
-  central_pos = zip64local_SearchCentralDir64(&pziinit->z_filefunc,pziinit->filestream);
+  central_pos = zip64local_SearchCentralDir64(&pziinit->z_filefunc,pziinit->filestream,locator_pos);
   if(central_pos > 0)
   {
     hasZIP64Record = 1;
   }
   else if(central_pos == 0)
   {
-    central_pos = zip64local_SearchCentralDir(&pziinit->z_filefunc,pziinit->filestream);
+    central_pos = end_central_pos;
   }
 
 /* disable to allow appending to empty ZIP archive
@@ -678,115 +880,46 @@ int LoadCentralDirectoryRecord(zip64_internal* pziinit)
             err=ZIP_ERRNO;
 */
 
-  if(hasZIP64Record)
-  {
-    ZPOS64_T sizeEndOfCentralDirectory;
-    if (ZSEEK64(pziinit->z_filefunc, pziinit->filestream, central_pos, ZLIB_FILEFUNC_SEEK_SET) != 0)
-      err=ZIP_ERRNO;
-
-    /* the signature, already checked */
-    if (zip64local_getLong(&pziinit->z_filefunc, pziinit->filestream,&uL)!=ZIP_OK)
-      err=ZIP_ERRNO;
-
-    /* size of zip64 end of central directory record */
-    if (zip64local_getLong64(&pziinit->z_filefunc, pziinit->filestream, &sizeEndOfCentralDirectory)!=ZIP_OK)
-      err=ZIP_ERRNO;
-
-    /* version made by */
-    if (zip64local_getShort(&pziinit->z_filefunc, pziinit->filestream, &VersionMadeBy)!=ZIP_OK)
-      err=ZIP_ERRNO;
-
-    /* version needed to extract */
-    if (zip64local_getShort(&pziinit->z_filefunc, pziinit->filestream, &VersionNeeded)!=ZIP_OK)
-      err=ZIP_ERRNO;
-
-    /* number of this disk */
-    if (zip64local_getLong(&pziinit->z_filefunc, pziinit->filestream,&number_disk)!=ZIP_OK)
-      err=ZIP_ERRNO;
-
-    /* number of the disk with the start of the central directory */
-    if (zip64local_getLong(&pziinit->z_filefunc, pziinit->filestream,&number_disk_with_CD)!=ZIP_OK)
-      err=ZIP_ERRNO;
-
-    /* total number of entries in the central directory on this disk */
-    if (zip64local_getLong64(&pziinit->z_filefunc, pziinit->filestream, &number_entry)!=ZIP_OK)
-      err=ZIP_ERRNO;
-
-    /* total number of entries in the central directory */
-    if (zip64local_getLong64(&pziinit->z_filefunc, pziinit->filestream,&number_entry_CD)!=ZIP_OK)
-      err=ZIP_ERRNO;
-
-    if ((number_entry_CD!=number_entry) || (number_disk_with_CD!=0) || (number_disk!=0))
-      err=ZIP_BADZIPFILE;
-
-    /* size of the central directory */
-    if (zip64local_getLong64(&pziinit->z_filefunc, pziinit->filestream,&size_central_dir)!=ZIP_OK)
-      err=ZIP_ERRNO;
-
-    /* offset of start of central directory with respect to the
-    starting disk number */
-    if (zip64local_getLong64(&pziinit->z_filefunc, pziinit->filestream,&offset_central_dir)!=ZIP_OK)
-      err=ZIP_ERRNO;
+  // Read End of central Directory info, which also holds the global comment
+  if ((err==ZIP_OK) &&
+      (zip64local_readAt(&pziinit->z_filefunc,pziinit->filestream,end_central_pos,end_header,SIZEENDHEADER)!=ZIP_OK))
+    err=ZIP_ERRNO;
 
-    // TODO..
-    // read the comment from the standard central header.
-    size_comment = 0;
-  }
-  else
+  if (err==ZIP_OK)
   {
-    // Read End of central Directory info
-    if (ZSEEK64(pziinit->z_filefunc, pziinit->filestream, central_pos,ZLIB_FILEFUNC_SEEK_SET)!=0)
-      err=ZIP_ERRNO;
-
     /* the signature, already checked */
-    if (zip64local_getLong(&pziinit->z_filefunc, pziinit->filestream,&uL)!=ZIP_OK)
-      err=ZIP_ERRNO;
-
-    /* number of this disk */
-    if (zip64local_getShort(&pziinit->z_filefunc, pziinit->filestream,&number_disk)!=ZIP_OK)
-      err=ZIP_ERRNO;
-
-    /* number of the disk with the start of the central directory */
-    if (zip64local_getShort(&pziinit->z_filefunc, pziinit->filestream,&number_disk_with_CD)!=ZIP_OK)
-      err=ZIP_ERRNO;
-
-    /* total number of entries in the central dir on this disk */
-    number_entry = 0;
-    if (zip64local_getShort(&pziinit->z_filefunc, pziinit->filestream, &uL)!=ZIP_OK)
-      err=ZIP_ERRNO;
-    else
-      number_entry = uL;
-
-    /* total number of entries in the central dir */
-    number_entry_CD = 0;
-    if (zip64local_getShort(&pziinit->z_filefunc, pziinit->filestream, &uL)!=ZIP_OK)
-      err=ZIP_ERRNO;
-    else
-      number_entry_CD = uL;
-
-    if ((number_entry_CD!=number_entry) || (number_disk_with_CD!=0) || (number_disk!=0))
-      err=ZIP_BADZIPFILE;
+    number_disk = (uLong)zip64local_getValue_inmemory(end_header+4,2);
+    number_disk_with_CD = (uLong)zip64local_getValue_inmemory(end_header+6,2);
+    number_entry = zip64local_getValue_inmemory(end_header+8,2);
+    number_entry_CD = zip64local_getValue_inmemory(end_header+10,2);
+    size_central_dir = zip64local_getValue_inmemory(end_header+12,4);
+    offset_central_dir = zip64local_getValue_inmemory(end_header+16,4);
+    size_comment = (uLong)zip64local_getValue_inmemory(end_header+20,2);
+  }
 
-    /* size of the central directory */
-    size_central_dir = 0;
-    if (zip64local_getLong(&pziinit->z_filefunc, pziinit->filestream, &uL)!=ZIP_OK)
-      err=ZIP_ERRNO;
-    else
-      size_central_dir = uL;
+  if ((err==ZIP_OK) && hasZIP64Record)
+  {
+    unsigned char zip64_header[SIZEZIP64ENDHEADER];
 
-    /* offset of start of central directory with respect to the starting disk number */
-    offset_central_dir = 0;
-    if (zip64local_getLong(&pziinit->z_filefunc, pziinit->filestream, &uL)!=ZIP_OK)
+    /* the signature, already checked; the size of the record, the versions
+       made by and needed and any extensible data are not used */
+    if (zip64local_readAt(&pziinit->z_filefunc,pziinit->filestream,central_pos,zip64_header,SIZEZIP64ENDHEADER)!=ZIP_OK)
       err=ZIP_ERRNO;
     else
-      offset_central_dir = uL;
-
-
-    /* zipfile global comment length */
-    if (zip64local_getShort(&pziinit->z_filefunc, pziinit->filestream, &size_comment)!=ZIP_OK)
-      err=ZIP_ERRNO;
+    {
+      number_disk = (uLong)zip64local_getValue_inmemory(zip64_header+16,4);
+      number_disk_with_CD = (uLong)zip64local_getValue_inmemory(zip64_header+20,4);
+      number_entry = zip64local_getValue_inmemory(zip64_header+24,8);
+      number_entry_CD = zip64local_getValue_inmemory(zip64_header+32,8);
+      size_central_dir = zip64local_getValue_inmemory(zip64_header+40,8);
+      offset_central_dir = zip64local_getValue_inmemory(zip64_header+48,8);
+    }
   }
 
+  if ((err==ZIP_OK) &&
+      ((number_entry_CD!=number_entry) || (number_disk_with_CD!=0) || (number_disk!=0)))
+    err=ZIP_BADZIPFILE;
+
   if ((central_pos<offset_central_dir+size_central_dir) &&
     (err==ZIP_OK))
     err=ZIP_BADZIPFILE;
@@ -802,7 +935,10 @@ int LoadCentralDirectoryRecord(zip64_internal* pziinit)
     pziinit->globalcomment = (char*)ALLOC(size_comment+1);
     if (pziinit->globalcomment)
     {
-      size_comment = ZREAD64(pziinit->z_filefunc, pziinit->filestream, pziinit->globalcomment,size_comment);
+      if (ZSEEK64(pziinit->z_filefunc, pziinit->filestream, end_central_pos+SIZEENDHEADER, ZLIB_FILEFUNC_SEEK_SET) != 0)
+        size_comment = 0;
+      else
+        size_comment = ZREAD64(pziinit->z_filefunc, pziinit->filestream, pziinit->globalcomment,size_comment);
       pziinit->globalcomment[size_comment]=0;
     }
   }
@@ -811,28 +947,48 @@ int LoadCentralDirectoryRecord(zip64_internal* pziinit)
   pziinit->add_position_when_writting_offset = byte_before_the_zipfile;
 
   {
+    // read the existing central directory straight into the buffer, with
+    // room for the headers of a few new files so that the first ones
+    // appended do not have to move it
     ZPOS64_T size_central_dir_to_read = size_central_dir;
-    size_t buf_size = SIZEDATA_INDATABLOCK;
-    void* buf_read = (void*)ALLOC(buf_size);
-    if (ZSEEK64(pziinit->z_filefunc, pziinit->filestream, offset_central_dir + byte_before_the_zipfile, ZLIB_FILEFUNC_SEEK_SET) != 0)
+    if ((err==ZIP_OK) && (ZSEEK64(pziinit->z_filefunc, pziinit->filestream, offset_central_dir + byte_before_the_zipfile, ZLIB_FILEFUNC_SEEK_SET) != 0))
       err=ZIP_ERRNO;
 
+    if (err==ZIP_OK)
+      err = reserve_in_buffer(&pziinit->central_dir, size_central_dir + SIZEDATA_INCENTRALDIR);
+
     while ((size_central_dir_to_read>0) && (err==ZIP_OK))
     {
-      ZPOS64_T read_this = SIZEDATA_INDATABLOCK;
+      ZPOS64_T read_this = SIZEDATA_MAXIO;
       if (read_this > size_central_dir_to_read)
         read_this = size_central_dir_to_read;
 
-      if (ZREAD64(pziinit->z_filefunc, pziinit->filestream,buf_read,(uLong)read_this) != read_this)
+      if (ZREAD64(pziinit->z_filefunc, pziinit->filestream,
+                  pziinit->central_dir.data + pziinit->central_dir.filled,(uLong)read_this) != read_this)
         err=ZIP_ERRNO;
-
-      if (err==ZIP_OK)
-        err = add_data_in_datablock(&pziinit->central_dir,buf_read, (uLong)read_this);
+      else
+        pziinit->central_dir.filled += (size_t)read_this;
 
       size_central_dir_to_read-=read_this;
     }
-    TRYFREE(buf_read);
   }
+
+  if ((err==ZIP_OK) && !hasZIP64Record && (number_entry_CD==0xffff))
+  {
+    // zipfiles with 65535 entries or more written without a zip64 end of
+    // central directory record: count the entries in the loaded directory
+    const unsigned char* p = pziinit->central_dir.data;
+    const unsigned char* end = p + pziinit->central_dir.filled;
+    number_entry_CD = 0;
+    while ((end - p >= SIZECENTRALHEADER) &&
+           (zip64local_getValue_inmemory(p,4) == CENTRALHEADERMAGIC))
+    {
+      p += SIZECENTRALHEADER + zip64local_getValue_inmemory(p+28,2) +
+           zip64local_getValue_inmemory(p+30,2) + zip64local_getValue_inmemory(p+32,2);
+      number_entry_CD++;
+    }
+  }
+
   pziinit->begin_pos = byte_before_the_zipfile;
   pziinit->number_entry = number_entry_CD;
 
@@ -846,6 +1002,70 @@ int LoadCentralDirectoryRecord(zip64_internal* pziinit)
 #endif /* !NO_ADDFILEINEXISTINGZIP*/
 
 
+/* ===========================================================================
+   io functions of APPEND_STATUS_CREATESTREAM: the writes go to the output
+   given to zipOpen3 and are counted, so that ZTELL64 still gives the offsets
+   the headers need without the output being asked for them
+*/
+local uLong ZCALLBACK zip64local_stream_read OF((voidpf opaque, voidpf stream, void* buf, uLong size));
+local uLong ZCALLBACK zip64local_stream_read (voidpf opaque, voidpf stream, void* buf, uLong size)
+{
+    return 0;
+}
+
+local uLong ZCALLBACK zip64local_stream_write OF((voidpf opaque, voidpf stream, const void* buf, uLong size));
+local uLong ZCALLBACK zip64local_stream_write (voidpf opaque, voidpf stream, const void* buf, uLong size)
+{
+    zip64_internal* zi = (zip64_internal*)opaque;
+    uLong written = ZWRITE64(zi->sink_filefunc, stream, buf, size);
+    zi->sink_written += written;
+    return written;
+}
+
+local ZPOS64_T ZCALLBACK zip64local_stream_tell OF((voidpf opaque, voidpf stream));
+local ZPOS64_T ZCALLBACK zip64local_stream_tell (voidpf opaque, voidpf stream)
+{
+    return ((zip64_internal*)opaque)->sink_written;
+}
+
+local long ZCALLBACK zip64local_stream_seek OF((voidpf opaque, voidpf stream, ZPOS64_T offset, int origin));
+local long ZCALLBACK zip64local_stream_seek (voidpf opaque, voidpf stream, ZPOS64_T offset, int origin)
+{
+    return -1;
+}
+
+local int ZCALLBACK zip64local_stream_close OF((voidpf opaque, voidpf stream));
+local int ZCALLBACK zip64local_stream_close (voidpf opaque, voidpf stream)
+{
+    return ZCLOSE64(((zip64_internal*)opaque)->sink_filefunc, stream);
+}
+
+local int ZCALLBACK zip64local_stream_error OF((voidpf opaque, voidpf stream));
+local int ZCALLBACK zip64local_stream_error (voidpf opaque, voidpf stream)
+{
+    return ZERROR64(((zip64_internal*)opaque)->sink_filefunc, stream);
+}
+
+local void zip64local_stream_filefunc OF((zip64_internal* zi));
+local void zip64local_stream_filefunc (zip64_internal* zi)
+{
+    zi->sink_filefunc = zi->z_filefunc;
+    zi->sink_written = 0;
+    zi->z_filefunc.zfile_func64.zopen64_file = NULL;
+    zi->z_filefunc.zfile_func64.zread_file = zip64local_stream_read;
+    zi->z_filefunc.zfile_func64.zwrite_file = zip64local_stream_write;
+    zi->z_filefunc.zfile_func64.ztell64_file = zip64local_stream_tell;
+    zi->z_filefunc.zfile_func64.zseek64_file = zip64local_stream_seek;
+    zi->z_filefunc.zfile_func64.zclose_file = zip64local_stream_close;
+    zi->z_filefunc.zfile_func64.zerror_file = zip64local_stream_error;
+    zi->z_filefunc.zfile_func64.opaque = (voidpf)zi;
+    zi->z_filefunc.ztell32_file = NULL;
+    zi->z_filefunc.zseek32_file = NULL;
+    zi->z_filefunc.zmap64_file = NULL;
+    zi->z_filefunc.zpread64_file = NULL;
+}
+
+
 /************************************************************/
 extern zipFile ZEXPORT zipOpen3 (const void *pathname, int append, zipcharpc* globalcomment, zlib_filefunc64_32_def* pzlib_filefunc64_32_def);
 extern zipFile ZEXPORT zipOpen3 (const void *pathname, int append, zipcharpc* globalcomment, zlib_filefunc64_32_def* pzlib_filefunc64_32_def)
@@ -856,13 +1076,18 @@ extern zipFile ZEXPORT zipOpen3 (const void *pathname, int append, zipcharpc* gl
 
     ziinit.z_filefunc.zseek32_file = NULL;
     ziinit.z_filefunc.ztell32_file = NULL;
+    ziinit.z_filefunc.zmap64_file = NULL;
+    ziinit.z_filefunc.zpread64_file = NULL;
     if (pzlib_filefunc64_32_def==NULL)
         fill_fopen64_filefunc(&ziinit.z_filefunc.zfile_func64);
     else
         ziinit.z_filefunc = *pzlib_filefunc64_32_def;
 
+    ziinit.streaming = (append == APPEND_STATUS_CREATESTREAM);
     ziinit.filestream = ZOPEN64(ziinit.z_filefunc,
                   pathname,
+                  (append == APPEND_STATUS_CREATESTREAM) ?
+                  (ZLIB_FILEFUNC_MODE_WRITE | ZLIB_FILEFUNC_MODE_CREATE) :
                   (append == APPEND_STATUS_CREATE) ?
                   (ZLIB_FILEFUNC_MODE_READ | ZLIB_FILEFUNC_MODE_WRITE | ZLIB_FILEFUNC_MODE_CREATE) :
                     (ZLIB_FILEFUNC_MODE_READ | ZLIB_FILEFUNC_MODE_WRITE | ZLIB_FILEFUNC_MODE_EXISTING));
@@ -873,12 +1098,22 @@ extern zipFile ZEXPORT zipOpen3 (const void *pathname, int append, zipcharpc* gl
     if (append == APPEND_STATUS_CREATEAFTER)
         ZSEEK64(ziinit.z_filefunc,ziinit.filestream,0,SEEK_END);
 
-    ziinit.begin_pos = ZTELL64(ziinit.z_filefunc,ziinit.filestream);
+    /* a stream starts where the output is, offsets are counted from there */
+    ziinit.begin_pos = ziinit.streaming ? 0 : ZTELL64(ziinit.z_filefunc,ziinit.filestream);
     ziinit.in_opened_file_inzip = 0;
     ziinit.ci.stream_initialised = 0;
+    ziinit.deflate_ready = 0;
+    ziinit.ci.central_header = NULL;
+    ziinit.central_header_allocated = 0;
     ziinit.number_entry = 0;
     ziinit.add_position_when_writting_offset = 0;
-    init_linkedlist(&(ziinit.central_dir));
+    ziinit.ci.parallel = 0;
+    ziinit.parallel_threads = 0;
+    ziinit.aes_strength = 0;
+#ifndef NO_PARALLEL_DEFLATE
+    ziinit.pdeflate = NULL;
+#endif
+    init_buffer(&(ziinit.central_dir));
 
 
 
@@ -909,12 +1144,15 @@ extern zipFile ZEXPORT zipOpen3 (const void *pathname, int append, zipcharpc* gl
 #    ifndef NO_ADDFILEINEXISTINGZIP
         TRYFREE(ziinit.globalcomment);
 #    endif /* !NO_ADDFILEINEXISTINGZIP*/
+        free_buffer(&(ziinit.central_dir));
         TRYFREE(zi);
         return NULL;
     }
     else
     {
         *zi = ziinit;
+        if (zi->streaming)
+            zip64local_stream_filefunc(zi);
         return (zipFile)zi;
     }
 }
@@ -939,6 +1177,8 @@ extern zipFile ZEXPORT zipOpen2_64 (const void *pathname, int append, zipcharpc*
         zlib_filefunc64_32_def_fill.zfile_func64 = *pzlib_filefunc_def;
         zlib_filefunc64_32_def_fill.ztell32_file = NULL;
         zlib_filefunc64_32_def_fill.zseek32_file = NULL;
+        zlib_filefunc64_32_def_fill.zmap64_file = NULL;
+        zlib_filefunc64_32_def_fill.zpread64_file = NULL;
         return zipOpen3(pathname, append, globalcomment, &zlib_filefunc64_32_def_fill);
     }
     else
@@ -957,6 +1197,34 @@ extern zipFile ZEXPORT zipOpen64 (const void* pathname, int append)
     return zipOpen3(pathname,append,NULL,NULL);
 }
 
+/* the method in the headers, 99 for WinZip AES whose real method is in
+   its extra field */
+local uLong zip64local_HeaderMethod OF((zip64_internal* zi));
+local uLong zip64local_HeaderMethod (zip64_internal* zi)
+{
+#ifndef NOCRYPT
+  if (zi->ci.aes_strength != 0)
+    return LK_AES_METHOD;
+#endif
+  return (uLong)zi->ci.method;
+}
+
+#ifndef NOCRYPT
+/* the WinZip AES extra field, AE-2: the crc is not stored, as it would
+   tell something about the content of small files */
+local void zip64local_AESExtraField OF((zip64_internal* zi, char* p));
+local void zip64local_AESExtraField (zip64_internal* zi, char* p)
+{
+  zip64local_putValue_inmemory(p, LK_AES_EXTRAFIELD_ID, 2);
+  zip64local_putValue_inmemory(p+2, LK_AES_EXTRAFIELD_SIZE, 2);
+  zip64local_putValue_inmemory(p+4, LK_AES_VERSION_AE2, 2);
+  p[6] = 'A';
+  p[7] = 'E';
+  p[8] = (char)zi->ci.aes_strength;
+  zip64local_putValue_inmemory(p+9, (uLong)zi->ci.method, 2);
+}
+#endif
+
 int Write_LocalFileHeader(zip64_internal* zi, const char* filename, uInt size_extrafield_local, const void* extrafield_local);
 int Write_LocalFileHeader(zip64_internal* zi, const char* filename, uInt size_extrafield_local, const void* extrafield_local)
 {
@@ -969,17 +1237,17 @@ int Write_LocalFileHeader(zip64_internal* zi, const char* filename, uInt size_ex
 
   if (err==ZIP_OK)
   {
-    if(zi->ci.zip64)
+    if(zi->ci.zip64 && zi->ci.version_needed < 45)
       err = zip64local_putValue(&zi->z_filefunc,zi->filestream,(uLong)45,2);/* version needed to extract */
     else
-      err = zip64local_putValue(&zi->z_filefunc,zi->filestream,(uLong)20,2);/* version needed to extract */
+      err = zip64local_putValue(&zi->z_filefunc,zi->filestream,zi->ci.version_needed,2);/* version needed to extract */
   }
 
   if (err==ZIP_OK)
     err = zip64local_putValue(&zi->z_filefunc,zi->filestream,(uLong)zi->ci.flag,2);
 
   if (err==ZIP_OK)
-    err = zip64local_putValue(&zi->z_filefunc,zi->filestream,(uLong)zi->ci.method,2);
+    err = zip64local_putValue(&zi->z_filefunc,zi->filestream,zip64local_HeaderMethod(zi),2);
 
   if (err==ZIP_OK)
     err = zip64local_putValue(&zi->z_filefunc,zi->filestream,(uLong)zi->ci.dosDate,4);
@@ -1009,6 +1277,10 @@ int Write_LocalFileHeader(zip64_internal* zi, const char* filename, uInt size_ex
   {
     size_extrafield += 20;
   }
+#ifndef NOCRYPT
+  if (zi->ci.aes_strength != 0)
+    size_extrafield += 4 + LK_AES_EXTRAFIELD_SIZE;
+#endif
 
   if (err==ZIP_OK)
     err = zip64local_putValue(&zi->z_filefunc,zi->filestream,(uLong)size_extrafield,2);
@@ -1046,6 +1318,16 @@ int Write_LocalFileHeader(zip64_internal* zi, const char* filename, uInt size_ex
 #endif
   }
 
+#ifndef NOCRYPT
+  if ((err==ZIP_OK) && (zi->ci.aes_strength != 0))
+  {
+      char aes_extra[4 + LK_AES_EXTRAFIELD_SIZE];
+      zip64local_AESExtraField(zi, aes_extra);
+      if (ZWRITE64(zi->z_filefunc, zi->filestream, aes_extra, sizeof(aes_extra)) != sizeof(aes_extra))
+        err = ZIP_ERRNO;
+  }
+#endif
+
   return err;
 }
 
@@ -1066,8 +1348,10 @@ extern int ZEXPORT zipOpenNewFileInZip4_64 (zipFile file, const char* filename,
                                          uLong versionMadeBy, uLong flagBase, int zip64)
 {
     zip64_internal* zi;
+    const lk_method* codec;
     uInt size_filename;
     uInt size_comment;
+    uInt size_extrafield_aes = 0;
     uInt i;
     int err = ZIP_OK;
 
@@ -1079,13 +1363,13 @@ extern int ZEXPORT zipOpenNewFileInZip4_64 (zipFile file, const char* filename,
     if (file == NULL)
         return ZIP_PARAMERROR;
 
-#ifdef HAVE_BZIP2
-    if ((method!=0) && (method!=Z_DEFLATED) && (method!=Z_BZIP2ED))
-      return ZIP_PARAMERROR;
-#else
+    codec = NULL;
     if ((method!=0) && (method!=Z_DEFLATED))
-      return ZIP_PARAMERROR;
-#endif
+    {
+        codec = lk_method_find((uLong)method);
+        if ((codec == NULL) || ((!raw) && (codec->compress_init == NULL)))
+            return ZIP_PARAMERROR;
+    }
 
     zi = (zip64_internal*)file;
 
@@ -1125,33 +1409,60 @@ extern int ZEXPORT zipOpenNewFileInZip4_64 (zipFile file, const char* filename,
       zi->ci.flag |= 6;
     if (password != NULL)
       zi->ci.flag |= 1;
+    if (zi->streaming)
+      zi->ci.flag |= 8;     /* crc and sizes in a data descriptor */
 
     zi->ci.crc32 = 0;
     zi->ci.method = method;
+    zi->ci.codec = codec;
+    zi->ci.codec_state = NULL;
+    zi->ci.version_needed = 20;
+    if ((codec != NULL) && (codec->version_needed > zi->ci.version_needed))
+        zi->ci.version_needed = codec->version_needed;
     zi->ci.encrypt = 0;
+#    ifndef NOCRYPT
+    zi->ci.aes_strength = (password != NULL) ? zi->aes_strength : 0;
+    if (zi->ci.aes_strength != 0)
+    {
+        zi->ci.version_needed = 51;
+        size_extrafield_aes = 4 + LK_AES_EXTRAFIELD_SIZE;
+    }
+#    endif
     zi->ci.stream_initialised = 0;
     zi->ci.pos_in_buffered_data = 0;
     zi->ci.raw = raw;
     zi->ci.pos_local_header = ZTELL64(zi->z_filefunc,zi->filestream);
 
-    zi->ci.size_centralheader = SIZECENTRALHEADER + size_filename + size_extrafield_global + size_comment;
+    zi->ci.size_centralheader = SIZECENTRALHEADER + size_filename + size_extrafield_global +
+                                size_extrafield_aes + size_comment;
     zi->ci.size_centralExtraFree = 32; // Extra space we have reserved in case we need to add ZIP64 extra info data
 
-    zi->ci.central_header = (char*)ALLOC((uInt)zi->ci.size_centralheader + zi->ci.size_centralExtraFree);
+    /* the buffer of the last entry is used again when it is big enough */
+    if (zi->central_header_allocated < zi->ci.size_centralheader + zi->ci.size_centralExtraFree)
+    {
+        TRYFREE(zi->ci.central_header);
+        zi->central_header_allocated = (zi->ci.size_centralheader + zi->ci.size_centralExtraFree + 255) & ~255UL;
+        zi->ci.central_header = (char*)ALLOC((uInt)zi->central_header_allocated);
+        if (zi->ci.central_header == NULL)
+        {
+            zi->central_header_allocated = 0;
+            return ZIP_INTERNALERROR;
+        }
+    }
 
-    zi->ci.size_centralExtra = size_extrafield_global;
+    zi->ci.size_centralExtra = size_extrafield_global + size_extrafield_aes;
     zip64local_putValue_inmemory(zi->ci.central_header,(uLong)CENTRALHEADERMAGIC,4);
     /* version info */
     zip64local_putValue_inmemory(zi->ci.central_header+4,(uLong)versionMadeBy,2);
-    zip64local_putValue_inmemory(zi->ci.central_header+6,(uLong)20,2);
+    zip64local_putValue_inmemory(zi->ci.central_header+6,zi->ci.version_needed,2);
     zip64local_putValue_inmemory(zi->ci.central_header+8,(uLong)zi->ci.flag,2);
-    zip64local_putValue_inmemory(zi->ci.central_header+10,(uLong)zi->ci.method,2);
+    zip64local_putValue_inmemory(zi->ci.central_header+10,zip64local_HeaderMethod(zi),2);
     zip64local_putValue_inmemory(zi->ci.central_header+12,(uLong)zi->ci.dosDate,4);
     zip64local_putValue_inmemory(zi->ci.central_header+16,(uLong)0,4); /*crc*/
     zip64local_putValue_inmemory(zi->ci.central_header+20,(uLong)0,4); /*compr size*/
     zip64local_putValue_inmemory(zi->ci.central_header+24,(uLong)0,4); /*uncompr size*/
     zip64local_putValue_inmemory(zi->ci.central_header+28,(uLong)size_filename,2);
-    zip64local_putValue_inmemory(zi->ci.central_header+30,(uLong)size_extrafield_global,2);
+    zip64local_putValue_inmemory(zi->ci.central_header+30,(uLong)zi->ci.size_centralExtra,2);
     zip64local_putValue_inmemory(zi->ci.central_header+32,(uLong)size_comment,2);
     zip64local_putValue_inmemory(zi->ci.central_header+34,(uLong)0,2); /*disk nm start*/
 
@@ -1177,11 +1488,15 @@ extern int ZEXPORT zipOpenNewFileInZip4_64 (zipFile file, const char* filename,
         *(zi->ci.central_header+SIZECENTRALHEADER+size_filename+i) =
               *(((const char*)extrafield_global)+i);
 
+#    ifndef NOCRYPT
+    if (size_extrafield_aes > 0)
+        zip64local_AESExtraField(zi, zi->ci.central_header+SIZECENTRALHEADER+size_filename+
+                                     size_extrafield_global);
+#    endif
+
     for (i=0;i<size_comment;i++)
         *(zi->ci.central_header+SIZECENTRALHEADER+size_filename+
-              size_extrafield_global+i) = *(comment+i);
-    if (zi->ci.central_header == NULL)
-        return ZIP_INTERNALERROR;
+              size_extrafield_global+size_extrafield_aes+i) = *(comment+i);
 
     zi->ci.zip64 = zip64;
     zi->ci.totalCompressedData = 0;
@@ -1190,16 +1505,6 @@ extern int ZEXPORT zipOpenNewFileInZip4_64 (zipFile file, const char* filename,
 
     err = Write_LocalFileHeader(zi, filename, size_extrafield_local, extrafield_local);
 
-#ifdef HAVE_BZIP2
-    zi->ci.bstream.avail_in = (uInt)0;
-    zi->ci.bstream.avail_out = (uInt)Z_BUFSIZE;
-    zi->ci.bstream.next_out = (char*)zi->ci.buffered_data;
-    zi->ci.bstream.total_in_hi32 = 0;
-    zi->ci.bstream.total_in_lo32 = 0;
-    zi->ci.bstream.total_out_hi32 = 0;
-    zi->ci.bstream.total_out_lo32 = 0;
-#endif
-
     zi->ci.stream.avail_in = (uInt)0;
     zi->ci.stream.avail_out = (uInt)Z_BUFSIZE;
     zi->ci.stream.next_out = zi->ci.buffered_data;
@@ -1207,52 +1512,96 @@ extern int ZEXPORT zipOpenNewFileInZip4_64 (zipFile file, const char* filename,
     zi->ci.stream.total_out = 0;
     zi->ci.stream.data_type = Z_BINARY;
 
-#ifdef HAVE_BZIP2
-    if ((err==ZIP_OK) && (zi->ci.method == Z_DEFLATED || zi->ci.method == Z_BZIP2ED) && (!zi->ci.raw))
-#else
-    if ((err==ZIP_OK) && (zi->ci.method == Z_DEFLATED) && (!zi->ci.raw))
-#endif
+    if ((err==ZIP_OK) && (zi->ci.method != 0) && (!zi->ci.raw))
     {
         if(zi->ci.method == Z_DEFLATED)
         {
-          zi->ci.stream.zalloc = (alloc_func)0;
-          zi->ci.stream.zfree = (free_func)0;
-          zi->ci.stream.opaque = (voidpf)0;
-
           if (windowBits>0)
               windowBits = -windowBits;
 
-          err = deflateInit2(&zi->ci.stream, level, Z_DEFLATED, windowBits, memLevel, strategy);
+          /* the state of the previous entry is reset rather than allocated
+             again, unless the entries are compressed differently */
+          if (zi->deflate_ready && (level == zi->deflate_level) &&
+              (windowBits == zi->deflate_windowBits) && (memLevel == zi->deflate_memLevel) &&
+              (strategy == zi->deflate_strategy))
+              err = deflateReset(&zi->ci.stream);
+          else
+          {
+              if (zi->deflate_ready)
+                  deflateEnd(&zi->ci.stream);
+              zi->deflate_ready = 0;
+              zi->ci.stream.zalloc = zip64local_zalloc;
+              zi->ci.stream.zfree = zip64local_zfree;
+              zi->ci.stream.opaque = (voidpf)0;
+
+              err = deflateInit2(&zi->ci.stream, level, Z_DEFLATED, windowBits, memLevel, strategy);
+              if (err==Z_OK)
+              {
+                  zi->deflate_ready = 1;
+                  zi->deflate_level = level;
+                  zi->deflate_windowBits = windowBits;
+                  zi->deflate_memLevel = memLevel;
+                  zi->deflate_strategy = strategy;
+              }
+          }
 
           if (err==Z_OK)
               zi->ci.stream_initialised = Z_DEFLATED;
         }
-        else if(zi->ci.method == Z_BZIP2ED)
+        else
         {
-#ifdef HAVE_BZIP2
-            // Init BZip stuff here
-          zi->ci.bstream.bzalloc = 0;
-          zi->ci.bstream.bzfree = 0;
-          zi->ci.bstream.opaque = (voidpf)0;
-
-          err = BZ2_bzCompressInit(&zi->ci.bstream, level, 0,35);
-          if(err == BZ_OK)
-            zi->ci.stream_initialised = Z_BZIP2ED;
-#endif
+          zi->ci.codec_state = codec->compress_init(level);
+          if (zi->ci.codec_state != NULL)
+            zi->ci.stream_initialised = method;
+          else
+            err = ZIP_INTERNALERROR;
         }
 
     }
 
+    zi->ci.parallel = 0;
+#ifndef NO_PARALLEL_DEFLATE
+    if ((err==Z_OK) && (zi->ci.stream_initialised == Z_DEFLATED) && (password == NULL) &&
+        (zi->parallel_threads > 1))
+    {
+        /* on failure the entry is simply compressed on this thread */
+        if (pdeflate_start_entry(zi, level, windowBits, memLevel, strategy) == ZIP_OK)
+            zi->ci.parallel = 1;
+    }
+#endif
+
 #    ifndef NOCRYPT
     zi->ci.crypt_header_size = 0;
-    if ((err==Z_OK) && (password != NULL))
+    if ((err==Z_OK) && (zi->ci.aes_strength != 0))
+    {
+        /* a random salt and the password verifier */
+        unsigned char bufHead[16 + LK_AES_PWVERIFY_SIZE];
+        uInt size_salt = LK_AES_SALT_SIZE(zi->ci.aes_strength);
+
+        zi->ci.encrypt = 1;
+        if (lk_aes_random(bufHead, size_salt) != Z_OK)
+            err = ZIP_INTERNALERROR;
+        else if (lk_aes_init(&zi->ci.aes, password, zi->ci.aes_strength, bufHead, bufHead + size_salt) != Z_OK)
+            err = ZIP_PARAMERROR;
+        else
+        {
+            zi->ci.crypt_header_size = size_salt + LK_AES_PWVERIFY_SIZE;
+            if (ZWRITE64(zi->z_filefunc,zi->filestream,bufHead,zi->ci.crypt_header_size) != (uLong)zi->ci.crypt_header_size)
+                err = ZIP_ERRNO;
+        }
+    }
+    else if ((err==Z_OK) && (password != NULL))
     {
         unsigned char bufHead[RAND_HEAD_LEN];
         unsigned int sizeHead;
         zi->ci.encrypt = 1;
-        zi->ci.pcrc_32_tab = (const unsigned long*)get_crc_table();
+        zi->ci.pcrc_32_tab = get_crc_table();
         /*init_keys(password,zi->ci.keys,zi->ci.pcrc_32_tab);*/
 
+        /* with a data descriptor, readers check the header against the
+           high byte of the time instead of the crc */
+        if (zi->ci.flag & 8)
+            crcForCrypting = zi->ci.dosDate << 16;
         sizeHead=crypthead(password,bufHead,RAND_HEAD_LEN,zi->ci.keys,zi->ci.pcrc_32_tab,crcForCrypting);
         zi->ci.crypt_header_size = sizeHead;
 
@@ -1371,10 +1720,10 @@ local int zip64FlushWriteBuffer(zip64_internal* zi)
     if (zi->ci.encrypt != 0)
     {
 #ifndef NOCRYPT
-        uInt i;
-        int t;
-        for (i=0;i<zi->ci.pos_in_buffered_data;i++)
-            zi->ci.buffered_data[i] = zencode(zi->ci.keys, zi->ci.pcrc_32_tab, zi->ci.buffered_data[i],t);
+        if (zi->ci.aes_strength != 0)
+            lk_aes_encrypt(&zi->ci.aes, zi->ci.buffered_data, zi->ci.pos_in_buffered_data);
+        else
+            encrypt_block(zi->ci.keys, zi->ci.pcrc_32_tab, zi->ci.buffered_data, zi->ci.pos_in_buffered_data);
 #endif
     }
 
@@ -1382,20 +1731,8 @@ local int zip64FlushWriteBuffer(zip64_internal* zi)
       err = ZIP_ERRNO;
 
     zi->ci.totalCompressedData += zi->ci.pos_in_buffered_data;
-
-#ifdef HAVE_BZIP2
-    if(zi->ci.method == Z_BZIP2ED)
-    {
-      zi->ci.totalUncompressedData += zi->ci.bstream.total_in_lo32;
-      zi->ci.bstream.total_in_lo32 = 0;
-      zi->ci.bstream.total_in_hi32 = 0;
-    }
-    else
-#endif
-    {
-      zi->ci.totalUncompressedData += zi->ci.stream.total_in;
-      zi->ci.stream.total_in = 0;
-    }
+    zi->ci.totalUncompressedData += zi->ci.stream.total_in;
+    zi->ci.stream.total_in = 0;
 
 
     zi->ci.pos_in_buffered_data = 0;
@@ -1415,44 +1752,13 @@ extern int ZEXPORT zipWriteInFileInZip (zipFile file,const void* buf,unsigned in
     if (zi->in_opened_file_inzip == 0)
         return ZIP_PARAMERROR;
 
-    zi->ci.crc32 = crc32(zi->ci.crc32,buf,(uInt)len);
-
-#ifdef HAVE_BZIP2
-    if(zi->ci.method == Z_BZIP2ED && (!zi->ci.raw))
-    {
-      zi->ci.bstream.next_in = (void*)buf;
-      zi->ci.bstream.avail_in = len;
-      err = BZ_RUN_OK;
-
-      while ((err==BZ_RUN_OK) && (zi->ci.bstream.avail_in>0))
-      {
-        if (zi->ci.bstream.avail_out == 0)
-        {
-          if (zip64FlushWriteBuffer(zi) == ZIP_ERRNO)
-            err = ZIP_ERRNO;
-          zi->ci.bstream.avail_out = (uInt)Z_BUFSIZE;
-          zi->ci.bstream.next_out = (char*)zi->ci.buffered_data;
-        }
-
-
-        if(err != BZ_RUN_OK)
-          break;
-
-        if ((zi->ci.method == Z_BZIP2ED) && (!zi->ci.raw))
-        {
-          uLong uTotalOutBefore_lo = zi->ci.bstream.total_out_lo32;
-//          uLong uTotalOutBefore_hi = zi->ci.bstream.total_out_hi32;
-          err=BZ2_bzCompress(&zi->ci.bstream,  BZ_RUN);
+#ifndef NO_PARALLEL_DEFLATE
+    if (zi->ci.parallel)
+        return pdeflate_write(zi, buf, len);
+#endif
 
-          zi->ci.pos_in_buffered_data += (uInt)(zi->ci.bstream.total_out_lo32 - uTotalOutBefore_lo) ;
-        }
-      }
+    zi->ci.crc32 = lk_crc32(zi->ci.crc32,buf,(uInt)len);
 
-      if(err == BZ_RUN_OK)
-        err = ZIP_OK;
-    }
-    else
-#endif
     {
       zi->ci.stream.next_in = (Bytef*)buf;
       zi->ci.stream.avail_in = len;
@@ -1483,17 +1789,21 @@ extern int ZEXPORT zipWriteInFileInZip (zipFile file,const void* buf,unsigned in
 
               zi->ci.pos_in_buffered_data += (uInt)(zi->ci.stream.total_out - uTotalOutBefore) ;
           }
+          else if (zi->ci.codec_state != NULL)
+          {
+              uLong uTotalOutBefore = zi->ci.stream.total_out;
+              err = zi->ci.codec->compress(zi->ci.codec_state, &zi->ci.stream, Z_NO_FLUSH);
+              zi->ci.pos_in_buffered_data += (uInt)(zi->ci.stream.total_out - uTotalOutBefore) ;
+          }
           else
           {
-              uInt copy_this,i;
+              uInt copy_this;
               if (zi->ci.stream.avail_in < zi->ci.stream.avail_out)
                   copy_this = zi->ci.stream.avail_in;
               else
                   copy_this = zi->ci.stream.avail_out;
 
-              for (i = 0; i < copy_this; i++)
-                  *(((char*)zi->ci.stream.next_out)+i) =
-                      *(((const char*)zi->ci.stream.next_in)+i);
+              memcpy(zi->ci.stream.next_out, zi->ci.stream.next_in, copy_this);
               {
                   zi->ci.stream.avail_in -= copy_this;
                   zi->ci.stream.avail_out-= copy_this;
@@ -1531,6 +1841,14 @@ extern int ZEXPORT zipCloseFileInZipRaw64 (zipFile file, ZPOS64_T uncompressed_s
         return ZIP_PARAMERROR;
     zi->ci.stream.avail_in = 0;
 
+#ifndef NO_PARALLEL_DEFLATE
+    if (zi->ci.parallel)
+    {
+        err = pdeflate_finish(zi);
+        zi->ci.parallel = 0;
+    }
+    else
+#endif
     if ((zi->ci.method == Z_DEFLATED) && (!zi->ci.raw))
                 {
                         while (err==ZIP_OK)
@@ -1554,31 +1872,24 @@ extern int ZEXPORT zipCloseFileInZipRaw64 (zipFile file, ZPOS64_T uncompressed_s
                                 zi->ci.pos_in_buffered_data += (uInt)(zi->ci.stream.total_out - uTotalOutBefore) ;
                         }
                 }
-    else if ((zi->ci.method == Z_BZIP2ED) && (!zi->ci.raw))
+    else if (zi->ci.codec_state != NULL)
     {
-#ifdef HAVE_BZIP2
-      err = BZ_FINISH_OK;
-      while (err==BZ_FINISH_OK)
-      {
-        uLong uTotalOutBefore;
-        if (zi->ci.bstream.avail_out == 0)
+        while (err==ZIP_OK)
         {
-          if (zip64FlushWriteBuffer(zi) == ZIP_ERRNO)
-            err = ZIP_ERRNO;
-          zi->ci.bstream.avail_out = (uInt)Z_BUFSIZE;
-          zi->ci.bstream.next_out = (char*)zi->ci.buffered_data;
+            uLong uTotalOutBefore;
+            if (zi->ci.stream.avail_out == 0)
+            {
+                if (zip64FlushWriteBuffer(zi) == ZIP_ERRNO)
+                    err = ZIP_ERRNO;
+                zi->ci.stream.avail_out = (uInt)Z_BUFSIZE;
+                zi->ci.stream.next_out = zi->ci.buffered_data;
+            }
+            if (err != ZIP_OK)
+                break;
+            uTotalOutBefore = zi->ci.stream.total_out;
+            err = zi->ci.codec->compress(zi->ci.codec_state, &zi->ci.stream, Z_FINISH);
+            zi->ci.pos_in_buffered_data += (uInt)(zi->ci.stream.total_out - uTotalOutBefore);
         }
-        uTotalOutBefore = zi->ci.bstream.total_out_lo32;
-        err=BZ2_bzCompress(&zi->ci.bstream,  BZ_FINISH);
-        if(err == BZ_STREAM_END)
-          err = Z_STREAM_END;
-
-        zi->ci.pos_in_buffered_data += (uInt)(zi->ci.bstream.total_out_lo32 - uTotalOutBefore);
-      }
-
-      if(err == BZ_FINISH_OK)
-        err = ZIP_OK;
-#endif
     }
 
     if (err==Z_STREAM_END)
@@ -1592,20 +1903,15 @@ extern int ZEXPORT zipCloseFileInZipRaw64 (zipFile file, ZPOS64_T uncompressed_s
 
     if ((zi->ci.method == Z_DEFLATED) && (!zi->ci.raw))
     {
-        int tmp_err = deflateEnd(&zi->ci.stream);
-        if (err == ZIP_OK)
-            err = tmp_err;
+        /* deflateEnd is left to zipClose, the next entry resets the state */
         zi->ci.stream_initialised = 0;
     }
-#ifdef HAVE_BZIP2
-    else if((zi->ci.method == Z_BZIP2ED) && (!zi->ci.raw))
+    else if (zi->ci.codec_state != NULL)
     {
-      int tmperr = BZ2_bzCompressEnd(&zi->ci.bstream);
-                        if (err==ZIP_OK)
-                                err = tmperr;
-                        zi->ci.stream_initialised = 0;
+        zi->ci.codec->compress_end(zi->ci.codec_state);
+        zi->ci.codec_state = NULL;
+        zi->ci.stream_initialised = 0;
     }
-#endif
 
     if (!zi->ci.raw)
     {
@@ -1616,6 +1922,17 @@ extern int ZEXPORT zipCloseFileInZipRaw64 (zipFile file, ZPOS64_T uncompressed_s
 
 #    ifndef NOCRYPT
     compressed_size += zi->ci.crypt_header_size;
+    if (zi->ci.aes_strength != 0)
+    {
+        /* the authentication code follows the data, and AE-2 has no crc */
+        unsigned char authcode[LK_AES_AUTHCODE_SIZE];
+        lk_aes_finish(&zi->ci.aes, authcode);
+        if ((err==ZIP_OK) &&
+            (ZWRITE64(zi->z_filefunc,zi->filestream,authcode,LK_AES_AUTHCODE_SIZE) != LK_AES_AUTHCODE_SIZE))
+            err = ZIP_ERRNO;
+        compressed_size += LK_AES_AUTHCODE_SIZE;
+        crc32 = 0;
+    }
 #    endif
 
     // update Current Item crc and sizes,
@@ -1624,7 +1941,8 @@ extern int ZEXPORT zipCloseFileInZipRaw64 (zipFile file, ZPOS64_T uncompressed_s
       /*version Made by*/
       zip64local_putValue_inmemory(zi->ci.central_header+4,(uLong)45,2);
       /*version needed*/
-      zip64local_putValue_inmemory(zi->ci.central_header+6,(uLong)45,2);
+      if (zi->ci.version_needed < 45)
+        zip64local_putValue_inmemory(zi->ci.central_header+6,(uLong)45,2);
 
     }
 
@@ -1667,7 +1985,12 @@ extern int ZEXPORT zipCloseFileInZipRaw64 (zipFile file, ZPOS64_T uncompressed_s
         return ZIP_BADZIPFILE;
       }
 
-      p = zi->ci.central_header + zi->ci.size_centralheader;
+      // The extra fields end before the file comment, move the comment
+      // out of the way so the new field is with the others
+      p = zi->ci.central_header + SIZECENTRALHEADER +
+          zip64local_getValue_inmemory((const unsigned char*)zi->ci.central_header+28,2) +
+          zi->ci.size_centralExtra;
+      memmove(p + datasize + 4, p, (size_t)(zi->ci.central_header + zi->ci.size_centralheader - p));
 
       // Add Extra Information Header for 'ZIP64 information'
       zip64local_putValue_inmemory(p, 0x0001, 2); // HeaderID
@@ -1707,11 +2030,25 @@ extern int ZEXPORT zipCloseFileInZipRaw64 (zipFile file, ZPOS64_T uncompressed_s
     }
 
     if (err==ZIP_OK)
-        err = add_data_in_datablock(&zi->central_dir, zi->ci.central_header, (uLong)zi->ci.size_centralheader);
+        err = add_data_in_buffer(&zi->central_dir, zi->ci.central_header, (uLong)zi->ci.size_centralheader);
 
-    free(zi->ci.central_header);
+    if ((err==ZIP_OK) && zi->streaming)
+    {
+        // The LocalFileHeader cannot be updated, the values follow the data.
+        // Without a zip64 extra field in it, sizes have to fit in 4 bytes
+        if (!zi->ci.zip64 && ((compressed_size >= 0xffffffff) || (uncompressed_size >= 0xffffffff)))
+            err = ZIP_BADZIPFILE;
 
-    if (err==ZIP_OK)
+        if (err==ZIP_OK)
+            err = zip64local_putValue(&zi->z_filefunc,zi->filestream,(uLong)DESCRIPTORHEADERMAGIC,4);
+        if (err==ZIP_OK)
+            err = zip64local_putValue(&zi->z_filefunc,zi->filestream,crc32,4);
+        if (err==ZIP_OK)
+            err = zip64local_putValue(&zi->z_filefunc,zi->filestream,compressed_size,zi->ci.zip64 ? 8 : 4);
+        if (err==ZIP_OK)
+            err = zip64local_putValue(&zi->z_filefunc,zi->filestream,uncompressed_size,zi->ci.zip64 ? 8 : 4);
+    }
+    else if (err==ZIP_OK)
     {
         // Update the LocalFileHeader with the new values.
 
@@ -1921,23 +2258,25 @@ extern int ZEXPORT zipClose (zipFile file, const char* global_comment)
 
     if (err==ZIP_OK)
     {
-        linkedlist_datablock_internal* ldi = zi->central_dir.first_block;
-        while (ldi!=NULL)
+        /* the whole central directory is contiguous, write it at once */
+        while ((err==ZIP_OK) && (size_centraldir < zi->central_dir.filled))
         {
-            if ((err==ZIP_OK) && (ldi->filled_in_this_block>0))
-            {
-                if (ZWRITE64(zi->z_filefunc,zi->filestream, ldi->data, ldi->filled_in_this_block) != ldi->filled_in_this_block)
-                    err = ZIP_ERRNO;
-            }
+            uLong write_this = SIZEDATA_MAXIO;
+            if (write_this > zi->central_dir.filled - size_centraldir)
+                write_this = (uLong)(zi->central_dir.filled - size_centraldir);
+
+            if (ZWRITE64(zi->z_filefunc,zi->filestream, zi->central_dir.data + size_centraldir, write_this) != write_this)
+                err = ZIP_ERRNO;
 
-            size_centraldir += ldi->filled_in_this_block;
-            ldi = ldi->next_datablock;
+            size_centraldir += write_this;
         }
     }
-    free_linkedlist(&(zi->central_dir));
+    free_buffer(&(zi->central_dir));
 
+    /* the end of central directory record only has room for 65534 entries
+       and 32-bit offsets, beyond them it refers to the zip64 record */
     pos = centraldir_pos_inzip - zi->add_position_when_writting_offset;
-    if(pos >= 0xffffffff)
+    if((pos >= 0xffffffff) || (zi->number_entry >= 0xffff))
     {
       ZPOS64_T Zip64EOCDpos = ZTELL64(zi->z_filefunc,zi->filestream);
       Write_Zip64EndOfCentralDirectoryRecord(zi, size_centraldir, centraldir_pos_inzip);
@@ -1955,14 +2294,59 @@ extern int ZEXPORT zipClose (zipFile file, const char* global_comment)
         if (err == ZIP_OK)
             err = ZIP_ERRNO;
 
+    if (zi->deflate_ready)
+        deflateEnd(&zi->ci.stream);
+    TRYFREE(zi->ci.central_header);
 #ifndef NO_ADDFILEINEXISTINGZIP
     TRYFREE(zi->globalcomment);
+#endif
+#ifndef NO_PARALLEL_DEFLATE
+    pdeflate_free(zi->pdeflate);
 #endif
     TRYFREE(zi);
 
     return err;
 }
 
+extern int ZEXPORT zipSetParallelDeflate (zipFile file, int threads)
+{
+    zip64_internal* zi;
+
+    if ((file == NULL) || (threads < 0))
+        return ZIP_PARAMERROR;
+    zi = (zip64_internal*)file;
+
+    if (zi->in_opened_file_inzip == 1)
+        return ZIP_PARAMERROR;
+
+#ifndef NO_PARALLEL_DEFLATE
+    if (threads > PDEFLATE_MAXTHREADS)
+        threads = PDEFLATE_MAXTHREADS;
+
+    /* the pool is sized for its thread count, make a new one next time */
+    pdeflate_free(zi->pdeflate);
+    zi->pdeflate = NULL;
+#endif
+    zi->parallel_threads = threads;
+    return ZIP_OK;
+}
+
+extern int ZEXPORT zipSetAESStrength (zipFile file, int strength)
+{
+    zip64_internal* zi;
+
+    if ((file == NULL) || (strength < 0) || (strength > LK_AES_STRENGTH_256))
+        return ZIP_PARAMERROR;
+    zi = (zip64_internal*)file;
+
+#ifdef NOCRYPT
+    if (strength != 0)
+        return ZIP_PARAMERROR;
+#endif
+    zi->aes_strength = strength;
+    return ZIP_OK;
+}
+
 extern int ZEXPORT zipRemoveExtraInfoBlock (char* pData, int* dataLen, short sHeader)
 {
   char* p = pData;
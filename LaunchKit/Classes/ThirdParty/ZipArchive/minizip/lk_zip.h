@@ -58,6 +58,10 @@ extern "C" {
 #include "bzlib.h"
 #endif
 
+#ifndef _LK_METHOD_H
+#include "lk_method.h"
+#endif
+
 #define Z_BZIP2ED 12
 
 #if defined(STRICTZIP) || defined(STRICTZIPUNZIP)
@@ -112,6 +116,7 @@ typedef const char* zipcharpc;
 #define APPEND_STATUS_CREATE        (0)
 #define APPEND_STATUS_CREATEAFTER   (1)
 #define APPEND_STATUS_ADDINZIP      (2)
+#define APPEND_STATUS_CREATESTREAM  (3)
 
 extern zipFile ZEXPORT zipOpen OF((const char *pathname, int append));
 extern zipFile ZEXPORT zipOpen64 OF((const void *pathname, int append));
@@ -124,6 +129,13 @@ extern zipFile ZEXPORT zipOpen64 OF((const void *pathname, int append));
          (useful if the file contain a self extractor code)
      if the file pathname exist and append==APPEND_STATUS_ADDINZIP, we will
        add files in existing zip (be sure you don't add file that doesn't exist)
+     if append==APPEND_STATUS_CREATESTREAM, the zipfile is written in a single
+       pass, without ever seeking or reading back: the crc and sizes of each
+       file follow its data in a data descriptor (bit 3 of the flag, zip64
+       descriptors for files opened with zip64=1). The output can then be a
+       pipe, a socket or the write function of a custom zlib_filefunc64_def.
+       A file of 4GB or more must be opened with zip64=1, zipCloseFileInZip
+       returns ZIP_BADZIPFILE for it otherwise.
      If the zipfile cannot be opened, the return value is NULL.
      Else, the return value is a zipFile Handle, usable with other function
        of this zip package.
@@ -252,8 +264,12 @@ extern int ZEXPORT zipOpenNewFileInZip3_64 OF((zipFile file,
 /*
   Same than zipOpenNewFileInZip2, except
     windowBits,memLevel,,strategy : see parameter strategy in deflateInit2
-    password : crypting password (NULL for no crypting)
-    crcForCrypting : crc of file to compress (needed for crypting)
+    password : crypting password (NULL for no crypting). The file is
+      encrypted with the traditional PKWARE encryption, or with WinZip AES
+      (AE-2, see lk_aes.h) once zipSetAESStrength selected a strength.
+    crcForCrypting : crc of file to compress (needed for the traditional
+      PKWARE encryption, unused with AES and with APPEND_STATUS_CREATESTREAM,
+      whose encryption headers are checked against the time)
  */
 
 extern int ZEXPORT zipOpenNewFileInZip4 OF((zipFile file,
@@ -336,6 +352,30 @@ extern int ZEXPORT zipClose OF((zipFile file,
   Close the zipfile
 */
 
+extern int ZEXPORT zipSetParallelDeflate OF((zipFile file, int threads));
+/*
+  Compress the next deflated entries with threads worker threads (at most
+    64). Each entry is cut in 128KB blocks that are compressed in parallel,
+    every block primed with the 32KB of data before it, and joined with
+    Z_SYNC_FLUSH so the entry remains a standard deflate stream.
+  Entries written raw or with a password are still compressed on the
+    calling thread. The workers are started with the first entry larger
+    than one block, and are stopped by zipClose.
+  threads of 0 or 1 (the default) compresses everything on the calling
+    thread. It can not be called while a file in the zipfile is opened.
+  Return ZIP_OK, or ZIP_PARAMERROR.
+*/
+
+extern int ZEXPORT zipSetAESStrength OF((zipFile file, int strength));
+/*
+  Encrypt the next files opened with a password with WinZip AES of strength
+    LK_AES_STRENGTH_128, LK_AES_STRENGTH_192 or LK_AES_STRENGTH_256, or with
+    the traditional PKWARE encryption if strength is 0 (the default, which
+    every reader supports). The traditional encryption is weak: select AES
+    when the readers of the zipfile support it.
+  Return ZIP_OK, or ZIP_PARAMERROR.
+*/
+
 
 extern int ZEXPORT zipRemoveExtraInfoBlock OF((char* pData, int* dataLen, short sHeader));
 /*
@@ -0,0 +1,33 @@
+/* arm_acle.h -- portable stand-ins for the ARMv8 CRC32 intrinsics
+
+   Only for the tests: built with -Iarmv8 -DLK_CRC32_ARMV8 on a host which
+   is not ARMv8, lk_crc32.c compiles its ARMv8 kernel on these, so that its
+   handling of lengths and alignment can be run and checked. They compute
+   what the CRC32B and CRC32X instructions do, a bit at a time.
+
+   License: Same as ZLIB (www.gzip.org)
+*/
+
+#ifndef _LK_TEST_ARM_ACLE_H
+#define _LK_TEST_ARM_ACLE_H
+
+#include <stdint.h>
+
+static inline uint32_t __crc32b(uint32_t crc, uint8_t data)
+{
+    int k;
+    crc ^= data;
+    for (k = 0; k < 8; k++)
+        crc = (crc >> 1) ^ (0xedb88320U & (0U - (crc & 1)));
+    return crc;
+}
+
+static inline uint32_t __crc32d(uint32_t crc, uint64_t data)
+{
+    int k;
+    for (k = 0; k < 8; k++)
+        crc = __crc32b(crc, (uint8_t)(data >> (8 * k)));
+    return crc;
+}
+
+#endif /* _LK_TEST_ARM_ACLE_H */
@@ -0,0 +1,128 @@
+/* arm_neon.h -- portable stand-ins for the NEON and ARMv8 AES intrinsics
+
+   Only for the tests: built with -Iarmv8 -DLK_AES_ARMV8 on a host which is
+   not ARMv8, lk_aes.c compiles its ARMv8 kernel on these, so that its
+   counter blocks, round keys and tails can be run and checked. They
+   compute what the AESE and AESMC instructions do, a byte at a time, on
+   vectors held in memory order like the registers of a little-endian ARM.
+
+   License: Same as ZLIB (www.gzip.org)
+*/
+
+#ifndef _LK_TEST_ARM_NEON_H
+#define _LK_TEST_ARM_NEON_H
+
+#include <stdint.h>
+#include <string.h>
+
+typedef struct { uint8_t b[16]; } uint8x16_t;
+typedef struct { uint64_t v[2]; } uint64x2_t;
+typedef struct { uint64_t v; } uint64x1_t;
+
+static inline uint8x16_t vld1q_u8(const uint8_t* p)
+{
+    uint8x16_t r;
+    memcpy(r.b, p, 16);
+    return r;
+}
+
+static inline void vst1q_u8(uint8_t* p, uint8x16_t a)
+{
+    memcpy(p, a.b, 16);
+}
+
+static inline uint8x16_t veorq_u8(uint8x16_t a, uint8x16_t b)
+{
+    int i;
+    for (i = 0; i < 16; i++)
+        a.b[i] ^= b.b[i];
+    return a;
+}
+
+static inline uint64x1_t vcreate_u64(uint64_t a)
+{
+    uint64x1_t r;
+    r.v = a;
+    return r;
+}
+
+static inline uint64x2_t vcombine_u64(uint64x1_t low, uint64x1_t high)
+{
+    uint64x2_t r;
+    r.v[0] = low.v;
+    r.v[1] = high.v;
+    return r;
+}
+
+/* lane 0 in bytes 0 to 7, least significant byte first */
+static inline uint8x16_t vreinterpretq_u8_u64(uint64x2_t a)
+{
+    uint8x16_t r;
+    int i;
+    for (i = 0; i < 16; i++)
+        r.b[i] = (uint8_t)(a.v[i / 8] >> (8 * (i % 8)));
+    return r;
+}
+
+static inline uint8_t lk_test_aes_xtime(uint8_t x)
+{
+    return (uint8_t)((x << 1) ^ ((x & 0x80) ? 0x1b : 0));
+}
+
+/* the S-box of FIPS-197, from the inverse in GF(2^8) and the affine map */
+static inline uint8_t lk_test_aes_sbox(uint8_t x)
+{
+    static uint8_t sbox[256];
+    static int ready = 0;
+    if (!ready)
+    {
+        uint8_t p = 1, q = 1;
+        do
+        {
+            /* p runs over the powers of 3, q over those of its inverse */
+            p = (uint8_t)(p ^ lk_test_aes_xtime(p));
+            q ^= (uint8_t)(q << 1);
+            q ^= (uint8_t)(q << 2);
+            q ^= (uint8_t)(q << 4);
+            if (q & 0x80)
+                q ^= 0x09;
+            sbox[p] = (uint8_t)(q ^ (uint8_t)((q << 1) | (q >> 7)) ^ (uint8_t)((q << 2) | (q >> 6)) ^
+                                (uint8_t)((q << 3) | (q >> 5)) ^ (uint8_t)((q << 4) | (q >> 4)) ^ 0x63);
+        } while (p != 1);
+        sbox[0] = 0x63;
+        ready = 1;
+    }
+    return sbox[x];
+}
+
+/* AESE: AddRoundKey, then ShiftRows and SubBytes. Byte r + 4c is row r of
+   column c. */
+static inline uint8x16_t vaeseq_u8(uint8x16_t data, uint8x16_t key)
+{
+    uint8x16_t s = veorq_u8(data, key), r;
+    int row, col;
+    for (col = 0; col < 4; col++)
+        for (row = 0; row < 4; row++)
+            r.b[row + 4 * col] = lk_test_aes_sbox(s.b[row + 4 * ((col + row) % 4)]);
+    return r;
+}
+
+/* AESMC: MixColumns */
+static inline uint8x16_t vaesmcq_u8(uint8x16_t data)
+{
+    uint8x16_t r;
+    int col;
+    for (col = 0; col < 4; col++)
+    {
+        const uint8_t* a = data.b + 4 * col;
+        uint8_t* b = r.b + 4 * col;
+        uint8_t all = (uint8_t)(a[0] ^ a[1] ^ a[2] ^ a[3]);
+        b[0] = (uint8_t)(a[0] ^ all ^ lk_test_aes_xtime((uint8_t)(a[0] ^ a[1])));
+        b[1] = (uint8_t)(a[1] ^ all ^ lk_test_aes_xtime((uint8_t)(a[1] ^ a[2])));
+        b[2] = (uint8_t)(a[2] ^ all ^ lk_test_aes_xtime((uint8_t)(a[2] ^ a[3])));
+        b[3] = (uint8_t)(a[3] ^ all ^ lk_test_aes_xtime((uint8_t)(a[3] ^ a[0])));
+    }
+    return r;
+}
+
+#endif /* _LK_TEST_ARM_NEON_H */
@@ -0,0 +1,523 @@
+/* test_aes.c -- the WinZip AES encryption of lk_aes.c, and its choice
+
+   lk_aes.c is included, so its AES kernels can be called one by one: the
+   lookup tables, AES-NI on x86 when the processor has it, and the ARMv8
+   kernel, natively on ARMv8 and on the stand-ins of armv8/arm_neon.h
+   elsewhere. The block cipher must give the vectors of FIPS-197, SHA-1 and
+   HMAC-SHA1 those of FIPS 180 and RFC 2202, PBKDF2 at 1000 iterations that
+   of Python's hashlib, and each kernel the counter blocks of the block
+   cipher for every number of blocks up to 40. A password without
+   zipSetAESStrength must give the traditional encryption, whose stored
+   entries must read back in reads of any size, with their length and crc,
+   the 12 bytes of the encryption header not counted in the data. With
+   zipSetAESStrength, entries written with each kernel at each strength
+   must read back, not with a wrong password, and not once damaged. bsdtar,
+   when it is installed with AES support, must extract them.
+
+   With -b, times writing and reading 64MB of stored entries encrypted with
+   the traditional encryption and with AES-128 and AES-256 on each native
+   kernel, then decrypting a single stored entry of 100MB in reads of 64KB,
+   and prints the MB/s of each.
+
+   License: Same as ZLIB (www.gzip.org)
+*/
+
+#include "lk_aes.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "lk_unzip.h"
+#include "lk_zip.h"
+#include "testutil.h"
+
+#define PASSWORD "aes password"
+#define ENTRIES 12
+
+typedef struct
+{
+    const char* name;
+    lk_aes_ctr_func func;
+    int emulated;
+} kernel;
+
+static int list_kernels(kernel* kernels)
+{
+    int n = 0;
+    /* the tables, and the choice made once */
+    lk_aes_implementation();
+    kernels[n].name = "tables";
+    kernels[n].func = lk_aes_ctr_tables;
+    kernels[n++].emulated = 0;
+#ifdef LK_AES_AESNI
+    if (lk_aes_has_aesni())
+    {
+        kernels[n].name = "aesni";
+        kernels[n].func = lk_aes_ctr_aesni;
+        kernels[n++].emulated = 0;
+    }
+#endif
+#ifdef LK_AES_ARMV8
+    kernels[n].name = "armv8";
+    kernels[n].func = lk_aes_ctr_armv8;
+#if defined(__aarch64__)
+    kernels[n++].emulated = !lk_aes_has_armv8();
+#else
+    kernels[n++].emulated = 1;
+#endif
+#endif
+    return n;
+}
+
+static void from_hex(const char* hex, unsigned char* out)
+{
+    size_t i;
+    for (i = 0; hex[2*i] != 0; i++)
+    {
+        unsigned int byte;
+        sscanf(hex + 2*i, "%2x", &byte);
+        out[i] = (unsigned char)byte;
+    }
+}
+
+static void check_hex(const unsigned char* got, const char* hex)
+{
+    unsigned char expected[64];
+    size_t len = strlen(hex) / 2;
+    from_hex(hex, expected);
+    TU_CHECK(memcmp(got, expected, len) == 0);
+}
+
+/* ---- the primitives ---- */
+
+static void check_vectors(void)
+{
+    static const char* ciphertexts[3] = {
+        "69c4e0d86a7b0430d8cdb78070b4c55a",
+        "dda97ca4864cdfe06eaf70a0ec0d7191",
+        "8ea2b7ca516745bfeafc49904b496089"
+    };
+    unsigned char key[32], plaintext[16], block[16], round_keys[15*16], digest[20];
+    unsigned char long_key[80], derived[40];
+    lk_sha1_ctx inner, outer;
+    int i, key_words;
+
+    for (i = 0; i < 32; i++)
+        key[i] = (unsigned char)i;
+    from_hex("00112233445566778899aabbccddeeff", plaintext);
+    for (key_words = 4, i = 0; key_words <= 8; key_words += 2, i++)
+    {
+        lk_aes_expand_key(key, key_words, round_keys, 6 + key_words);
+        lk_aes_encrypt_block(round_keys, 6 + key_words, plaintext, block);
+        check_hex(block, ciphertexts[i]);
+    }
+    printf("ok: AES-128, AES-192 and AES-256 give the vectors of FIPS-197\n");
+
+    lk_sha1_init(&inner);
+    lk_sha1_update(&inner, (const unsigned char*)"abc", 3);
+    lk_sha1_final(&inner, digest);
+    check_hex(digest, "a9993e364706816aba3e25717850c26c9cd0d89d");
+    lk_sha1_init(&inner);
+    /* in two pieces, across a block */
+    lk_sha1_update(&inner, (const unsigned char*)"abcdbcdecdefdefgefghfghighijhijk", 32);
+    lk_sha1_update(&inner, (const unsigned char*)"ijkljklmklmnlmnomnopnopq", 24);
+    lk_sha1_final(&inner, digest);
+    check_hex(digest, "84983e441c3bd26ebaae4aa1f95129e5e54670f1");
+
+    memset(key, 0x0b, 20);
+    lk_hmac_sha1_init(&inner, &outer, key, 20);
+    lk_sha1_update(&inner, (const unsigned char*)"Hi There", 8);
+    lk_hmac_sha1_final(&inner, &outer, digest);
+    check_hex(digest, "b617318655057264e28bc0b6fb378c8ef146be00");
+    /* a key longer than a block is hashed first */
+    memset(long_key, 0xaa, 80);
+    lk_hmac_sha1_init(&inner, &outer, long_key, 80);
+    lk_sha1_update(&inner, (const unsigned char*)"Test Using Larger Than Block-Size Key - Hash Key First", 54);
+    lk_hmac_sha1_final(&inner, &outer, digest);
+    check_hex(digest, "aa4ae5e15272d00e95705637ce8a3b55ed402112");
+
+    /* two blocks of output, at the 1000 iterations of WinZip AES */
+    lk_pbkdf2_sha1((const unsigned char*)"password", 8, (const unsigned char*)"salt", 4, derived, 40);
+    check_hex(derived, "6e88be8bad7eae9d9e10aa061224034fed48d03f"
+                       "cbad968b56006784539d5214ce970d912ec2049b");
+    printf("ok: SHA-1, HMAC-SHA1 and PBKDF2 give the vectors of FIPS 180, RFC 2202 and hashlib\n");
+}
+
+/* buf xored with the counter blocks after start, as lk_aes_ctr_tables
+   would, one block at a time through lk_aes_encrypt_block */
+static void reference_ctr(const unsigned char* round_keys, int rounds, uint64_t start,
+                          unsigned char* buf, size_t blocks)
+{
+    unsigned char block[16];
+    size_t i;
+    int k;
+
+    for (i = 0; i < blocks; i++)
+    {
+        uint64_t c = start + 1 + i;
+        for (k = 0; k < 8; k++)
+            block[k] = (unsigned char)(c >> (8*k));
+        memset(block + 8, 0, 8);
+        lk_aes_encrypt_block(round_keys, rounds, block, block);
+        for (k = 0; k < 16; k++)
+            buf[16*i + k] ^= block[k];
+    }
+}
+
+static void check_kernel(const kernel* k)
+{
+    /* the last ones carry into the second and fifth bytes of the counter */
+    static const uint64_t starts[] = { 0, 250, 0xfffffff0UL };
+    unsigned char key[32], round_keys[15*16], data[41*16], got[41*16], expected[41*16];
+    size_t blocks;
+    int key_words, s;
+
+    tu_fill_random(key, sizeof(key), 21);
+    tu_fill_random(data, sizeof(data), 22);
+    for (key_words = 4; key_words <= 8; key_words += 2)
+    {
+        int rounds = 6 + key_words;
+        lk_aes_expand_key(key, key_words, round_keys, rounds);
+        for (s = 0; s < 3; s++)
+            for (blocks = 0; blocks <= 40; blocks++)
+            {
+                uint64_t counter = starts[s];
+                memcpy(got, data, sizeof(data));
+                memcpy(expected, data, sizeof(data));
+                k->func(round_keys, rounds, &counter, got, blocks);
+                reference_ctr(round_keys, rounds, starts[s], expected, blocks);
+                TU_CHECK(memcmp(got, expected, sizeof(got)) == 0);
+                TU_CHECK(counter == starts[s] + blocks);
+            }
+    }
+}
+
+/* ---- entries in zipfiles ---- */
+
+static size_t entry_size(long i)
+{
+    static const size_t sizes[] = { 0, 1, 15, 16, 17, 4099, 100000 };
+    return sizes[i % 7];
+}
+
+static void write_entries(const char* path, int strength, long entries)
+{
+    unsigned char data[100000];
+    zipFile zf = zipOpen64(path, APPEND_STATUS_CREATE);
+    long i;
+
+    TU_CHECK(zf != NULL);
+    if (strength >= 0)
+        TU_CHECK(zipSetAESStrength(zf, strength) == ZIP_OK);
+    for (i = 0; i < entries; i++)
+    {
+        int level = (i % 2 == 0) ? 0 : 6;
+        zip_fileinfo zi;
+        memset(&zi, 0, sizeof(zi));
+        tu_fill_text(data, entry_size(i), (unsigned long long)i);
+        TU_CHECK(zipOpenNewFileInZip3_64(zf, tu_entry_name(i), &zi, NULL, 0, NULL, 0, NULL,
+                                         level ? Z_DEFLATED : 0, level, 0,
+                                         -MAX_WBITS, DEF_MEM_LEVEL, Z_DEFAULT_STRATEGY,
+                                         PASSWORD, 0, 0) == ZIP_OK);
+        TU_CHECK(zipWriteInFileInZip(zf, data, (unsigned)entry_size(i)) == ZIP_OK);
+        TU_CHECK(zipCloseFileInZip(zf) == ZIP_OK);
+    }
+    TU_CHECK(zipClose(zf, NULL) == ZIP_OK);
+}
+
+/* read every entry back, and return the compression method of the first */
+static uLong check_entries(const char* path, long entries)
+{
+    unsigned char got[100001], expected[100000];
+    unz_file_info64 info;
+    uLong method = 0;
+    unzFile uf = unzOpen64(path);
+    long i = 0;
+    int err;
+
+    TU_CHECK(uf != NULL);
+    for (err = unzGoToFirstFile(uf); err == UNZ_OK; err = unzGoToNextFile(uf), i++)
+    {
+        TU_CHECK(unzGetCurrentFileInfo64(uf, &info, NULL, 0, NULL, 0, NULL, 0) == UNZ_OK);
+        TU_CHECK((info.flag & 1) != 0);
+        if (i == 0)
+            method = info.compression_method;
+        TU_CHECK(unzOpenCurrentFilePassword(uf, PASSWORD) == UNZ_OK);
+        TU_CHECK(unzReadCurrentFile(uf, got, sizeof(got)) == (int)entry_size(i));
+        /* checks the CRC, or the HMAC */
+        TU_CHECK(unzCloseCurrentFile(uf) == UNZ_OK);
+        tu_fill_text(expected, entry_size(i), (unsigned long long)i);
+        TU_CHECK(memcmp(got, expected, entry_size(i)) == 0);
+    }
+    TU_CHECK(i == entries);
+    TU_CHECK(unzClose(uf) == UNZ_OK);
+    return method;
+}
+
+/* the stored entries of the traditional encryption, read in pieces of
+   1, 7 and 4096 bytes: nothing past their data may come out */
+static void check_traditional_reads(const char* path, long entries)
+{
+    static const unsigned pieces[] = { 1, 7, 4096 };
+    unsigned char got[100000 + 4096];
+    unz_file_info64 info;
+    unzFile uf = unzOpen64(path);
+    long i = 0;
+    int err, k;
+
+    TU_CHECK(uf != NULL);
+    for (err = unzGoToFirstFile(uf); err == UNZ_OK; err = unzGoToNextFile(uf), i++)
+    {
+        TU_CHECK(unzGetCurrentFileInfo64(uf, &info, NULL, 0, NULL, 0, NULL, 0) == UNZ_OK);
+        if (info.compression_method != 0)
+            continue;
+        TU_CHECK((info.flag & 1) != 0);
+        TU_CHECK(info.compressed_size == entry_size(i) + 12);
+        for (k = 0; k < 3; k++)
+        {
+            size_t total = 0;
+            int got_now;
+            TU_CHECK(unzOpenCurrentFilePassword(uf, PASSWORD) == UNZ_OK);
+            while ((got_now = unzReadCurrentFile(uf, got + total, pieces[k])) > 0)
+                total += (size_t)got_now;
+            TU_CHECK(got_now == 0);
+            TU_CHECK(total == entry_size(i));
+            TU_CHECK(crc32(0L, got, (uInt)total) == info.crc);
+            TU_CHECK(unzCloseCurrentFile(uf) == UNZ_OK);
+        }
+    }
+    TU_CHECK(i == entries);
+    TU_CHECK(unzClose(uf) == UNZ_OK);
+}
+
+/* a wrong password, then a byte of the data of entry 6 changed: its
+   HMAC must no longer match */
+static void check_refused(const char* path)
+{
+    unsigned char got[100001];
+    unz_file_info64 info;
+    unzFile uf;
+    FILE* f;
+    int err, c;
+
+    uf = unzOpen64(path);
+    TU_CHECK(uf != NULL);
+    TU_CHECK(unzLocateFile(uf, tu_entry_name(6), 0) == UNZ_OK);
+    err = unzOpenCurrentFilePassword(uf, "not the " PASSWORD);
+    /* the two bytes of the verifier match one password in 65536 */
+    if (err == UNZ_OK)
+    {
+        unzReadCurrentFile(uf, got, sizeof(got));
+        TU_CHECK(unzCloseCurrentFile(uf) != UNZ_OK);
+    }
+    else
+        TU_CHECK(err == UNZ_BADPASSWORD);
+
+    TU_CHECK(unzGetCurrentFileInfo64(uf, &info, NULL, 0, NULL, 0, NULL, 0) == UNZ_OK);
+    TU_CHECK(info.compressed_size > 50000);
+    TU_CHECK(unzOpenCurrentFilePassword(uf, PASSWORD) == UNZ_OK);
+    f = fopen(path, "r+b");
+    TU_CHECK(f != NULL);
+    /* the middle of the data of the entry, stored */
+    TU_CHECK(fseek(f, (long)(unzGetCurrentFileZStreamPos64(uf) + 50000), SEEK_SET) == 0);
+    c = fgetc(f);
+    TU_CHECK(fseek(f, -1L, SEEK_CUR) == 0);
+    fputc(c ^ 0x20, f);
+    TU_CHECK(fclose(f) == 0);
+    TU_CHECK(unzReadCurrentFile(uf, got, sizeof(got)) == (int)entry_size(6));
+    TU_CHECK(unzCloseCurrentFile(uf) == UNZ_CRCERROR);
+    TU_CHECK(unzClose(uf) == UNZ_OK);
+}
+
+static void test(void)
+{
+    const char* path = tu_path("aes.zip");
+    kernel kernels[3];
+    int n = list_kernels(kernels), i, strength;
+    char command[1024];
+
+    check_vectors();
+    for (i = 0; i < n; i++)
+    {
+        check_kernel(&kernels[i]);
+        printf("ok: %s%s gives the counter blocks of the block cipher\n",
+               kernels[i].name, kernels[i].emulated ? " (emulated)" : "");
+    }
+
+    /* no zipSetAESStrength: the traditional encryption, that every reader has */
+    write_entries(path, -1, ENTRIES);
+    TU_CHECK(check_entries(path, ENTRIES) != LK_AES_METHOD);
+    printf("ok: a password alone gives the traditional encryption\n");
+    check_traditional_reads(path, ENTRIES);
+    printf("ok: traditional stored entries read in pieces give their length and crc\n");
+
+    for (i = 0; i < n; i++)
+        for (strength = LK_AES_STRENGTH_128; strength <= LK_AES_STRENGTH_256; strength++)
+        {
+            /* written with the kernel, read with the tables */
+            aes_ctr_impl = kernels[i].func;
+            write_entries(path, strength, ENTRIES);
+            aes_ctr_impl = lk_aes_ctr_tables;
+            TU_CHECK(check_entries(path, ENTRIES) == LK_AES_METHOD);
+            aes_ctr_impl = kernels[i].func;
+            TU_CHECK(check_entries(path, ENTRIES) == LK_AES_METHOD);
+        }
+    printf("ok: AES-128, AES-192 and AES-256 entries read back, whatever the kernel\n");
+    check_refused(path);
+    printf("ok: a wrong password and damaged data are refused\n");
+
+    write_entries(path, LK_AES_STRENGTH_256, ENTRIES);
+    snprintf(command, sizeof(command), "bsdtar --passphrase '" PASSWORD "' -xOf '%s' > /dev/null 2>&1", path);
+    if (system("command -v bsdtar > /dev/null 2>&1") != 0)
+        printf("-- bsdtar is not installed\n");
+    else if (system(command) != 0)
+        printf("-- bsdtar cannot extract AES entries (built without a crypto library?)\n");
+    else
+        printf("ok: bsdtar extracts the AES-256 entries\n");
+    remove(path);
+}
+
+static void bench(void)
+{
+    static const int strengths[] = { 0, LK_AES_STRENGTH_128, LK_AES_STRENGTH_256 };
+    const char* path = tu_path("aes_bench.zip");
+    const size_t size = 64 << 20, chunk = 1 << 20;
+    unsigned char* data = (unsigned char*)malloc(size);
+    unsigned char* got = (unsigned char*)malloc(chunk);
+    kernel kernels[3];
+    int n = list_kernels(kernels), i, s;
+
+    TU_CHECK(data != NULL && got != NULL);
+    tu_fill_random(data, size, 1);
+    printf("%luMB in 64 stored entries           write       read\n", (unsigned long)(size >> 20));
+    for (i = 0; i < n; i++)
+        for (s = 0; s < 3; s++)
+        {
+            double start, write_time, read_time;
+            char name[64];
+            size_t pos;
+            zipFile zf;
+            unzFile uf;
+
+            if (kernels[i].emulated || ((strengths[s] == 0) && (i > 0)))
+                continue;
+            aes_ctr_impl = kernels[i].func;
+            start = tu_now();
+            zf = zipOpen64(path, APPEND_STATUS_CREATE);
+            TU_CHECK(zf != NULL);
+            TU_CHECK(zipSetAESStrength(zf, strengths[s]) == ZIP_OK);
+            for (pos = 0; pos < size; pos += chunk)
+            {
+                zip_fileinfo zi;
+                memset(&zi, 0, sizeof(zi));
+                TU_CHECK(zipOpenNewFileInZip3_64(zf, tu_entry_name((long)(pos / chunk)), &zi, NULL, 0, NULL, 0,
+                                                 NULL, 0, 0, 0, -MAX_WBITS, DEF_MEM_LEVEL, Z_DEFAULT_STRATEGY,
+                                                 PASSWORD, crc32(0L, data + pos, (uInt)chunk), 0) == ZIP_OK);
+                TU_CHECK(zipWriteInFileInZip(zf, data + pos, (unsigned)chunk) == ZIP_OK);
+                TU_CHECK(zipCloseFileInZip(zf) == ZIP_OK);
+            }
+            TU_CHECK(zipClose(zf, NULL) == ZIP_OK);
+            write_time = tu_now() - start;
+
+            start = tu_now();
+            uf = unzOpen64(path);
+            TU_CHECK(uf != NULL);
+            for (pos = 0; pos < size; pos += chunk)
+            {
+                TU_CHECK(unzLocateFile(uf, tu_entry_name((long)(pos / chunk)), 0) == UNZ_OK);
+                TU_CHECK(unzOpenCurrentFilePassword(uf, PASSWORD) == UNZ_OK);
+                TU_CHECK(unzReadCurrentFile(uf, got, (unsigned)chunk) == (int)chunk);
+                TU_CHECK(unzCloseCurrentFile(uf) == UNZ_OK);
+            }
+            TU_CHECK(unzClose(uf) == UNZ_OK);
+            read_time = tu_now() - start;
+
+            if (strengths[s] == 0)
+                snprintf(name, sizeof(name), "traditional");
+            else
+                snprintf(name, sizeof(name), "AES-%d, %s", 64 + 64 * strengths[s], kernels[i].name);
+            printf("%-32s %6.1f MB/s %6.1f MB/s\n", name,
+                   (double)size / (1 << 20) / write_time, (double)size / (1 << 20) / read_time);
+        }
+    aes_ctr_impl = lk_aes_ctr_tables;
+    remove(path);
+    free(got);
+    free(data);
+}
+
+/* a single large entry, so the time is that of decrypting its data */
+static void bench_large_entry(void)
+{
+    static const int strengths[] = { 0, LK_AES_STRENGTH_128, LK_AES_STRENGTH_256 };
+    const char* path = tu_path("aes_bench_large.zip");
+    const size_t size = 100 << 20, piece = 64 << 10;
+    unsigned char* data = (unsigned char*)malloc(size);
+    unsigned char* got = (unsigned char*)malloc(piece);
+    uLong crc;
+    kernel kernels[3];
+    int n = list_kernels(kernels), i, s;
+
+    TU_CHECK(data != NULL && got != NULL);
+    tu_fill_random(data, size, 2);
+    crc = crc32(0L, data, (uInt)size);
+    printf("a stored entry of %luMB, in reads of %luKB   read\n",
+           (unsigned long)(size >> 20), (unsigned long)(piece >> 10));
+    for (i = 0; i < n; i++)
+        for (s = 0; s < 3; s++)
+        {
+            double start;
+            char name[64];
+            size_t total = 0;
+            int got_now;
+            zip_fileinfo zi;
+            zipFile zf;
+            unzFile uf;
+
+            if (kernels[i].emulated || ((strengths[s] == 0) && (i > 0)))
+                continue;
+            aes_ctr_impl = kernels[i].func;
+            zf = zipOpen64(path, APPEND_STATUS_CREATE);
+            TU_CHECK(zf != NULL);
+            TU_CHECK(zipSetAESStrength(zf, strengths[s]) == ZIP_OK);
+            memset(&zi, 0, sizeof(zi));
+            TU_CHECK(zipOpenNewFileInZip3_64(zf, tu_entry_name(0), &zi, NULL, 0, NULL, 0, NULL,
+                                             0, 0, 0, -MAX_WBITS, DEF_MEM_LEVEL, Z_DEFAULT_STRATEGY,
+                                             PASSWORD, crc, 1) == ZIP_OK);
+            TU_CHECK(zipWriteInFileInZip(zf, data, (unsigned)size) == ZIP_OK);
+            TU_CHECK(zipCloseFileInZip(zf) == ZIP_OK);
+            TU_CHECK(zipClose(zf, NULL) == ZIP_OK);
+
+            start = tu_now();
+            uf = unzOpen64(path);
+            TU_CHECK(uf != NULL);
+            TU_CHECK(unzGoToFirstFile(uf) == UNZ_OK);
+            TU_CHECK(unzOpenCurrentFilePassword(uf, PASSWORD) == UNZ_OK);
+            while ((got_now = unzReadCurrentFile(uf, got, (unsigned)piece)) > 0)
+                total += (size_t)got_now;
+            TU_CHECK(got_now == 0 && total == size);
+            /* checks the CRC, or the HMAC */
+            TU_CHECK(unzCloseCurrentFile(uf) == UNZ_OK);
+            TU_CHECK(unzClose(uf) == UNZ_OK);
+
+            if (strengths[s] == 0)
+                snprintf(name, sizeof(name), "traditional");
+            else
+                snprintf(name, sizeof(name), "AES-%d, %s", 64 + 64 * strengths[s], kernels[i].name);
+            printf("%-43s %6.1f MB/s\n", name, (double)size / (1 << 20) / (tu_now() - start));
+        }
+    aes_ctr_impl = lk_aes_ctr_tables;
+    remove(path);
+    free(got);
+    free(data);
+}
+
+int main(int argc, char** argv)
+{
+    if (tu_bench_mode(argc, argv))
+    {
+        bench();
+        bench_large_entry();
+    }
+    else
+        test();
+    return 0;
+}
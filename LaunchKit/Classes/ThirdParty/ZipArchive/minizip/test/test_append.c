@@ -0,0 +1,177 @@
+/* test_append.c -- appending to a zipfile with APPEND_STATUS_ADDINZIP
+
+   Opening a zipfile to append to it loads its end records and its central
+   directory in a few reads, however many entries it has. The test appends
+   one entry at a time, 300 times, to a zipfile of 200 entries with a global
+   comment, and checks: the reads made by each open, which must not grow
+   with the entries; the comment, kept by every close; and every entry,
+   read back with its CRC. A zipfile of 65535 entries must take one more as
+   a zip64 zipfile, keeping its comment.
+
+   With -b, times 1000 successive appends of 512 bytes (open, add the
+   entry, close) to zipfiles of 100 and 20000 entries, and prints the reads
+   made by each open.
+
+   License: Same as ZLIB (www.gzip.org)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lk_unzip.h"
+#include "lk_zip.h"
+#include "testutil.h"
+
+/* the end record, the zip64 locator and record, the central directory and
+   the global comment: one read each, and a few more to find the end */
+#define MAX_OPEN_READS 8
+
+#define ENTRY_SIZE 512
+
+static const char* global_comment = "the global comment";
+
+static void make_zipfile(const char* path, long entries)
+{
+    unsigned char data[ENTRY_SIZE];
+    zipFile zf = zipOpen64(path, APPEND_STATUS_CREATE);
+    long i;
+
+    TU_CHECK(zf != NULL);
+    for (i = 0; i < entries; i++)
+    {
+        zip_fileinfo zi;
+        memset(&zi, 0, sizeof(zi));
+        tu_fill_text(data, sizeof(data), (unsigned long long)i);
+        TU_CHECK(zipOpenNewFileInZip64(zf, tu_entry_name(i), &zi, NULL, 0, NULL, 0, NULL, Z_DEFLATED, 6, 0) == ZIP_OK);
+        TU_CHECK(zipWriteInFileInZip(zf, data, sizeof(data)) == ZIP_OK);
+        TU_CHECK(zipCloseFileInZip(zf) == ZIP_OK);
+    }
+    TU_CHECK(zipClose(zf, global_comment) == ZIP_OK);
+}
+
+/* open path to append entry i to it, add it and close, keeping the global
+   comment. Return the reads made by the open. */
+static unsigned long append_one(const char* path, long i)
+{
+    zlib_filefunc64_def base, counting;
+    unsigned char data[ENTRY_SIZE];
+    const char* comment = NULL;
+    unsigned long reads;
+    zip_fileinfo zi;
+    zipFile zf;
+
+    fill_fopen64_filefunc(&base);
+    tu_counting_filefunc(&counting, &base);
+    memset(&tu_counts, 0, sizeof(tu_counts));
+    zf = zipOpen2_64(path, APPEND_STATUS_ADDINZIP, &comment, &counting);
+    reads = tu_counts.reads;
+    TU_CHECK(zf != NULL);
+    TU_CHECK(comment != NULL && strcmp(comment, global_comment) == 0);
+
+    memset(&zi, 0, sizeof(zi));
+    tu_fill_text(data, sizeof(data), (unsigned long long)i);
+    TU_CHECK(zipOpenNewFileInZip64(zf, tu_entry_name(i), &zi, NULL, 0, NULL, 0, NULL, Z_DEFLATED, 6, 0) == ZIP_OK);
+    TU_CHECK(zipWriteInFileInZip(zf, data, sizeof(data)) == ZIP_OK);
+    TU_CHECK(zipCloseFileInZip(zf) == ZIP_OK);
+    /* NULL keeps the comment loaded by the open */
+    TU_CHECK(zipClose(zf, NULL) == ZIP_OK);
+    return reads;
+}
+
+/* read every entry back, in order, and check the comment */
+static void check_zipfile(const char* path, long entries, int check_data)
+{
+    unsigned char got[ENTRY_SIZE + 1], expected[ENTRY_SIZE];
+    char comment[64];
+    unz_global_info64 gi;
+    unzFile uf = unzOpen64(path);
+    long i = 0;
+    int err;
+
+    TU_CHECK(uf != NULL);
+    TU_CHECK(unzGetGlobalInfo64(uf, &gi) == UNZ_OK);
+    TU_CHECK(gi.number_entry == (ZPOS64_T)entries);
+    TU_CHECK(unzGetGlobalComment(uf, comment, sizeof(comment)) == (int)strlen(global_comment));
+    TU_CHECK(strcmp(comment, global_comment) == 0);
+    for (err = unzGoToFirstFile(uf); err == UNZ_OK; err = unzGoToNextFile(uf), i++)
+    {
+        char name[64];
+        TU_CHECK(unzGetCurrentFileInfo64(uf, NULL, name, sizeof(name), NULL, 0, NULL, 0) == UNZ_OK);
+        TU_CHECK(strcmp(name, tu_entry_name(i)) == 0);
+        if (!check_data && i < entries - 1)
+            continue;
+        TU_CHECK(unzOpenCurrentFile(uf) == UNZ_OK);
+        TU_CHECK(unzReadCurrentFile(uf, got, sizeof(got)) == ENTRY_SIZE);
+        /* checks the CRC */
+        TU_CHECK(unzCloseCurrentFile(uf) == UNZ_OK);
+        tu_fill_text(expected, sizeof(expected), (unsigned long long)i);
+        TU_CHECK(memcmp(got, expected, ENTRY_SIZE) == 0);
+    }
+    TU_CHECK(err == UNZ_END_OF_LIST_OF_FILE);
+    TU_CHECK(i == entries);
+    TU_CHECK(unzClose(uf) == UNZ_OK);
+}
+
+static void test(void)
+{
+    const char* path = tu_path("append.zip");
+    const long first = 200, appends = 300, many = 65535;
+    unsigned long reads, max_reads = 0;
+    long i;
+
+    make_zipfile(path, first);
+    for (i = first; i < first + appends; i++)
+    {
+        reads = append_one(path, i);
+        if (reads > max_reads)
+            max_reads = reads;
+    }
+    TU_CHECK(max_reads <= MAX_OPEN_READS);
+    check_zipfile(path, first + appends, 1);
+    printf("ok: %ld successive appends, at most %lu reads to open\n", appends, max_reads);
+
+    /* the end record cannot count more than 65534 entries */
+    make_zipfile(path, many);
+    reads = append_one(path, many);
+    TU_CHECK(reads <= MAX_OPEN_READS);
+    reads = append_one(path, many + 1);
+    TU_CHECK(reads <= MAX_OPEN_READS);
+    check_zipfile(path, many + 2, 0);
+    printf("ok: appends to %ld entries give a zip64 zipfile, %lu reads to open\n", many, reads);
+
+    remove(path);
+}
+
+static void bench(void)
+{
+    const char* path = tu_path("append_bench.zip");
+    const long sizes[] = { 100, 20000 };
+    const long appends = 1000;
+    unsigned long reads = 0;
+    double start, elapsed;
+    long i;
+    int k;
+
+    printf("%ld successive appends of %d bytes\n", appends, ENTRY_SIZE);
+    for (k = 0; k < 2; k++)
+    {
+        make_zipfile(path, sizes[k]);
+        start = tu_now();
+        for (i = 0; i < appends; i++)
+            reads = append_one(path, sizes[k] + i);
+        elapsed = tu_now() - start;
+        check_zipfile(path, sizes[k] + appends, 0);
+        printf("to %6ld entries: %6.3f ms per append, %3lu reads to open the last time\n",
+               sizes[k], elapsed / appends * 1e3, reads);
+    }
+    remove(path);
+}
+
+int main(int argc, char** argv)
+{
+    if (tu_bench_mode(argc, argv))
+        bench();
+    else
+        test();
+    return 0;
+}
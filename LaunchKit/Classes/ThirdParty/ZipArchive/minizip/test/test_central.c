@@ -0,0 +1,182 @@
+/* test_central.c -- parsing of the central directory
+
+   Entries with extra fields and comments, stored or deflated, some written
+   with the zip64 flag, must come back from unzGetCurrentFileInfo64 as they
+   were written, browsing forward and through unzGoToFilePos64. With the central directory cached (the
+   default), browsing it makes no read at all. Built with
+   UNZ_MAXCENTRALDIRCACHE=0 (test_central_nocache) the same checks run on
+   the record by record reads.
+
+   With -b, measures the cost per entry of unzGoToNextFile plus
+   unzGetCurrentFileInfo64 on a 50k entry archive, and the reads it makes.
+
+   License: Same as ZLIB (www.gzip.org)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lk_unzip.h"
+#include "lk_zip.h"
+#include "testutil.h"
+
+#ifndef UNZ_MAXCENTRALDIRCACHE
+#define CENTRAL_DIR_CACHED 1
+#else
+#define CENTRAL_DIR_CACHED (UNZ_MAXCENTRALDIRCACHE > 0)
+#endif
+
+#define ENTRIES 500
+
+static void make_extra(unsigned char* extra, long i, unsigned* size)
+{
+    /* an unknown extra field of i % 40 bytes */
+    unsigned data_size = (unsigned)(i % 40);
+    unsigned k;
+    extra[0] = 0x34;
+    extra[1] = 0x12;
+    extra[2] = (unsigned char)data_size;
+    extra[3] = 0;
+    for (k = 0; k < data_size; k++)
+        extra[4 + k] = (unsigned char)(i + k);
+    *size = 4 + data_size;
+}
+
+static void check_entry(unzFile uf, long i)
+{
+    unz_file_info64 info;
+    char name[256];
+    char comment[256];
+    char expected_comment[64];
+    unsigned char extra[256];
+    unsigned char expected_extra[64];
+    unsigned expected_extra_size;
+
+    TU_CHECK(unzGetCurrentFileInfo64(uf, &info, name, sizeof(name), extra, sizeof(extra),
+                                     comment, sizeof(comment)) == UNZ_OK);
+    TU_CHECK(strcmp(name, tu_entry_name(i)) == 0);
+    TU_CHECK(info.size_filename == strlen(name));
+    TU_CHECK(info.uncompressed_size == (ZPOS64_T)(i % 100));
+
+    snprintf(expected_comment, sizeof(expected_comment), "comment of %ld", i);
+    TU_CHECK(info.size_file_comment == strlen(expected_comment));
+    TU_CHECK(strcmp(comment, expected_comment) == 0);
+
+    make_extra(expected_extra, i, &expected_extra_size);
+    TU_CHECK(info.size_file_extra == expected_extra_size);
+    TU_CHECK(memcmp(extra, expected_extra, expected_extra_size) == 0);
+}
+
+static void test(void)
+{
+    const char* path = tu_path("central.zip");
+    zlib_filefunc64_def stdio_functions, counting;
+    unsigned char data[100];
+    unz64_file_pos positions[ENTRIES];
+    zipFile zf;
+    unzFile uf;
+    long i;
+    int err;
+
+    zf = zipOpen64(path, APPEND_STATUS_CREATE);
+    TU_CHECK(zf != NULL);
+    for (i = 0; i < ENTRIES; i++)
+    {
+        zip_fileinfo zi;
+        unsigned char extra[64];
+        unsigned extra_size;
+        char comment[64];
+
+        memset(&zi, 0, sizeof(zi));
+        make_extra(extra, i, &extra_size);
+        snprintf(comment, sizeof(comment), "comment of %ld", i);
+        tu_fill_text(data, sizeof(data), (unsigned long long)i);
+        TU_CHECK(zipOpenNewFileInZip64(zf, tu_entry_name(i), &zi, NULL, 0, extra, extra_size,
+                                       comment, (i % 2) ? Z_DEFLATED : 0, 6, i % 3 == 0) == ZIP_OK);
+        TU_CHECK(zipWriteInFileInZip(zf, data, (unsigned)(i % 100)) == ZIP_OK);
+        TU_CHECK(zipCloseFileInZip(zf) == ZIP_OK);
+    }
+    TU_CHECK(zipClose(zf, "global comment") == ZIP_OK);
+
+    fill_fopen64_filefunc(&stdio_functions);
+    tu_counting_filefunc(&counting, &stdio_functions);
+    uf = unzOpen2_64(path, &counting);
+    TU_CHECK(uf != NULL);
+
+    memset(&tu_counts, 0, sizeof(tu_counts));
+    for (i = 0, err = unzGoToFirstFile(uf); err == UNZ_OK; i++, err = unzGoToNextFile(uf))
+    {
+        TU_CHECK(i < ENTRIES);
+        check_entry(uf, i);
+        TU_CHECK(unzGetFilePos64(uf, &positions[i]) == UNZ_OK);
+    }
+    TU_CHECK(err == UNZ_END_OF_LIST_OF_FILE);
+    TU_CHECK(i == ENTRIES);
+    if (CENTRAL_DIR_CACHED)
+        TU_CHECK(tu_counts.reads == 0);
+    else
+        TU_CHECK(tu_counts.reads > 0);
+    printf("ok: %d entries browsed with %lu reads\n", ENTRIES, tu_counts.reads);
+
+    /* jumping around */
+    for (i = 0; i < ENTRIES; i++)
+    {
+        long j = (i * 211) % ENTRIES;
+        TU_CHECK(unzGoToFilePos64(uf, &positions[j]) == UNZ_OK);
+        check_entry(uf, j);
+        if (j % 50 == 0)
+        {
+            TU_CHECK(unzOpenCurrentFile(uf) == UNZ_OK);
+            TU_CHECK(unzReadCurrentFile(uf, data, sizeof(data)) == (int)(j % 100));
+            TU_CHECK(unzCloseCurrentFile(uf) == UNZ_OK);
+        }
+    }
+    TU_CHECK(unzClose(uf) == UNZ_OK);
+    remove(path);
+    printf("ok: %d entries found again by position\n", ENTRIES);
+}
+
+static void bench(void)
+{
+    const char* path = tu_path("central_bench.zip");
+    const long entries = 50000;
+    const int passes = 20;
+    zlib_filefunc64_def stdio_functions, counting;
+    unz_file_info64 info;
+    char name[256];
+    double start, elapsed;
+    unzFile uf;
+    long n = 0;
+    int pass, err;
+
+    TU_CHECK(tu_make_archive(path, entries, 16, 0, 0) == ZIP_OK);
+    fill_fopen64_filefunc(&stdio_functions);
+    tu_counting_filefunc(&counting, &stdio_functions);
+    uf = unzOpen2_64(path, &counting);
+    TU_CHECK(uf != NULL);
+
+    memset(&tu_counts, 0, sizeof(tu_counts));
+    start = tu_now();
+    for (pass = 0; pass < passes; pass++)
+        for (err = unzGoToFirstFile(uf); err == UNZ_OK; err = unzGoToNextFile(uf))
+        {
+            TU_CHECK(unzGetCurrentFileInfo64(uf, &info, name, sizeof(name), NULL, 0, NULL, 0) == UNZ_OK);
+            n++;
+        }
+    elapsed = tu_now() - start;
+    TU_CHECK(n == entries * passes);
+
+    printf("%ld entries: %.0f ns/entry, %.2f reads/entry, %.2f seeks/entry\n",
+           entries, elapsed / n * 1e9, (double)tu_counts.reads / n, (double)tu_counts.seeks / n);
+    TU_CHECK(unzClose(uf) == UNZ_OK);
+    remove(path);
+}
+
+int main(int argc, char** argv)
+{
+    if (tu_bench_mode(argc, argv))
+        bench();
+    else
+        test();
+    return 0;
+}
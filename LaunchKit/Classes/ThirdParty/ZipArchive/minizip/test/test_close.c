@@ -0,0 +1,154 @@
+/* test_close.c -- the central directory of the zip writer
+
+   The central directory is built in one growable buffer and written at
+   zipClose. Built against the _counted lk_zip.c, the test checks that it
+   costs a number of allocations logarithmic in its size, on top of the one
+   central header of each entry, and that the archive reads back, also after
+   an append with APPEND_STATUS_ADDINZIP (which loads the central directory
+   into the buffer).
+
+   With -b, writes 100k entries and prints the time zipClose takes, the
+   writes it makes, and the allocations of the whole writing.
+
+   License: Same as ZLIB (www.gzip.org)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lk_unzip.h"
+#include "lk_zip.h"
+#include "testutil.h"
+
+/* zipClose writes the central directory at once, whatever its size, then
+   the fields of the end of central directory records one by one */
+#define MAX_CLOSE_WRITES 12
+
+typedef struct
+{
+    double close_seconds;
+    unsigned long close_writes;
+    unsigned long close_allocs;
+    unsigned long allocs;       /* during the whole writing */
+} write_stats;
+
+static void write_archive(const char* path, long first, long entries, int append, write_stats* stats)
+{
+    zlib_filefunc64_def stdio_functions, counting;
+    zipFile zf;
+    double start;
+    long i;
+
+    fill_fopen64_filefunc(&stdio_functions);
+    tu_counting_filefunc(&counting, &stdio_functions);
+    memset(&tu_allocs, 0, sizeof(tu_allocs));
+    zf = zipOpen2_64(path, append ? APPEND_STATUS_ADDINZIP : APPEND_STATUS_CREATE, NULL, &counting);
+    TU_CHECK(zf != NULL);
+    for (i = first; i < first + entries; i++)
+    {
+        zip_fileinfo zi;
+        memset(&zi, 0, sizeof(zi));
+        TU_CHECK(zipOpenNewFileInZip64(zf, tu_entry_name(i), &zi, NULL, 0, NULL, 0,
+                                       (i % 10 == 0) ? "a comment" : NULL, 0, 0, 0) == ZIP_OK);
+        TU_CHECK(zipWriteInFileInZip(zf, "data", 4) == ZIP_OK);
+        TU_CHECK(zipCloseFileInZip(zf) == ZIP_OK);
+    }
+
+    stats->close_allocs = tu_allocs.allocs;
+    stats->close_writes = tu_counts.writes;
+    start = tu_now();
+    TU_CHECK(zipClose(zf, "global comment") == ZIP_OK);
+    stats->close_seconds = tu_now() - start;
+    stats->close_writes = tu_counts.writes - stats->close_writes;
+    stats->close_allocs = tu_allocs.allocs - stats->close_allocs;
+    stats->allocs = tu_allocs.allocs;
+    TU_CHECK(tu_allocs.allocs == tu_allocs.frees);
+}
+
+static void check_archive(const char* path, long entries)
+{
+    char name[256];
+    char comment[64];
+    unz_file_info64 info;
+    unzFile uf = unzOpen64(path);
+    long i = 0;
+    int err;
+
+    TU_CHECK(uf != NULL);
+    for (err = unzGoToFirstFile(uf); err == UNZ_OK; err = unzGoToNextFile(uf), i++)
+    {
+        TU_CHECK(unzGetCurrentFileInfo64(uf, &info, name, sizeof(name), NULL, 0, comment, sizeof(comment)) == UNZ_OK);
+        TU_CHECK(strcmp(name, tu_entry_name(i)) == 0);
+        TU_CHECK(strcmp(comment, (i % 10 == 0) ? "a comment" : "") == 0);
+    }
+    TU_CHECK(err == UNZ_END_OF_LIST_OF_FILE);
+    TU_CHECK(i == entries);
+    TU_CHECK(unzGetGlobalComment(uf, comment, sizeof(comment)) > 0);
+    TU_CHECK(strcmp(comment, "global comment") == 0);
+    TU_CHECK(unzClose(uf) == UNZ_OK);
+}
+
+/* rounded up log2 of n */
+static unsigned long log2_ceil(unsigned long n)
+{
+    unsigned long log = 0;
+    while ((1UL << log) < n)
+        log++;
+    return log;
+}
+
+static void test(void)
+{
+    const char* path = tu_path("close.zip");
+    long sizes[] = { 1, 1000, 20000 };
+    write_stats stats;
+    int k;
+
+    for (k = 0; k < (int)(sizeof(sizes) / sizeof(sizes[0])); k++)
+    {
+        long entries = sizes[k];
+        write_archive(path, 0, entries, 0, &stats);
+        check_archive(path, entries);
+        /* a central header per entry, the zip64local_data of the handle, and
+           the doublings of the buffer */
+        TU_CHECK(stats.allocs <= (unsigned long)entries + 4 + log2_ceil((unsigned long)entries * 100));
+        TU_CHECK(stats.close_allocs == 0);
+        TU_CHECK(stats.close_writes <= MAX_CLOSE_WRITES);
+        printf("ok: %ld entries, %lu allocations, zipClose made %lu writes\n",
+               entries, stats.allocs, stats.close_writes);
+    }
+
+    write_archive(path, 20000, 500, 1, &stats);
+    check_archive(path, 20500);
+    TU_CHECK(stats.close_writes <= MAX_CLOSE_WRITES);
+    printf("ok: 500 entries appended to 20000, %lu allocations\n", stats.allocs);
+    remove(path);
+}
+
+static void bench(void)
+{
+    const char* path = tu_path("close_bench.zip");
+    const long entries = 100000;
+    write_stats stats;
+    int pass;
+
+    for (pass = 0; pass < 3; pass++)
+    {
+        write_archive(path, 0, entries, 0, &stats);
+        printf("%ld entries: zipClose %.1f ms, %lu writes, %lu allocations; "
+               "%lu allocations in all (%.2f per entry)\n",
+               entries, stats.close_seconds * 1e3, stats.close_writes, stats.close_allocs,
+               stats.allocs, (double)stats.allocs / entries);
+    }
+    check_archive(path, entries);
+    remove(path);
+}
+
+int main(int argc, char** argv)
+{
+    if (tu_bench_mode(argc, argv))
+        bench();
+    else
+        test();
+    return 0;
+}
@@ -0,0 +1,366 @@
+/* test_concurrent.c -- concurrent extraction of the entries of an archive
+
+   The scheme of +[LK_SSZipArchive unzipFileAtPath:...concurrently:YES ...]
+   on the minizip API alone: the central directory is listed once with
+   unzListEntries64, and a pool of threads, each with its own handle on the
+   mapped archive, extracts the entries to files, largest first. The calling
+   thread announces every entry (will-unzip) in archive order before the
+   workers start, then reports them (did-unzip) in archive order as they
+   complete, and stops at the first entry which fails.
+
+   The test checks the files and the order of the reports, and that a
+   corrupted entry stops the reports right before it. With -b, times the
+   extraction of 256 entries of text with 1 thread up to twice as many
+   threads as processors.
+
+   License: Same as ZLIB (www.gzip.org)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "lk_unzip.h"
+#include "lk_zip.h"
+#include "testutil.h"
+
+typedef struct
+{
+    const char* path;           /* the archive */
+    const char* destination;    /* directory of the extracted files */
+    unz_entry64* entries;
+    ZPOS64_T count;
+    long* order;                /* indexes of the entries, largest first */
+    int* results;
+    int* done;
+    long next;                  /* next index of order to extract */
+    int aborted;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} extraction;
+
+typedef struct
+{
+    long will[1024];
+    long did[1024];
+    long wills;
+    long dids;
+} report_log;
+
+static int extract_entry(unzFile uf, const unz_entry64* entry, const char* destination, long i)
+{
+    char out_path[1024];
+    unsigned char buf[65536];
+    FILE* out;
+    int err, n;
+
+    err = unzGoToFilePos64(uf, &entry->pos);
+    if (err == UNZ_OK)
+        err = unzOpenCurrentFile(uf);
+    if (err != UNZ_OK)
+        return err;
+    snprintf(out_path, sizeof(out_path), "%s/entry_%05ld", destination, i);
+    out = fopen(out_path, "wb");
+    if (out == NULL)
+    {
+        unzCloseCurrentFile(uf);
+        return UNZ_ERRNO;
+    }
+    while ((n = unzReadCurrentFile(uf, buf, sizeof(buf))) > 0)
+        if (fwrite(buf, 1, (size_t)n, out) != (size_t)n)
+        {
+            n = UNZ_ERRNO;
+            break;
+        }
+    fclose(out);
+    /* the crc is checked when the entry is closed after reading it all */
+    err = unzCloseCurrentFile(uf);
+    return (n < 0) ? n : err;
+}
+
+static void* worker(void* arg)
+{
+    extraction* ex = (extraction*)arg;
+    zlib_filefunc64_ex_def mmap_functions;
+    unzFile uf;
+
+    fill_mmap_filefunc64(&mmap_functions);
+    uf = unzOpen3_64(ex->path, &mmap_functions);
+    for (;;)
+    {
+        long i;
+        int result;
+
+        pthread_mutex_lock(&ex->mutex);
+        if (ex->aborted || ex->next >= (long)ex->count)
+        {
+            pthread_mutex_unlock(&ex->mutex);
+            break;
+        }
+        i = ex->order[ex->next++];
+        pthread_mutex_unlock(&ex->mutex);
+
+        result = (uf != NULL) ? extract_entry(uf, &ex->entries[i], ex->destination, i) : UNZ_ERRNO;
+
+        pthread_mutex_lock(&ex->mutex);
+        ex->results[i] = result;
+        ex->done[i] = 1;
+        pthread_cond_broadcast(&ex->cond);
+        pthread_mutex_unlock(&ex->mutex);
+    }
+    if (uf != NULL)
+        unzClose(uf);
+    return NULL;
+}
+
+static const unz_entry64* sort_entries;
+
+static int larger_first(const void* a, const void* b)
+{
+    ZPOS64_T size_a = sort_entries[*(const long*)a].info.compressed_size;
+    ZPOS64_T size_b = sort_entries[*(const long*)b].info.compressed_size;
+    return (size_a < size_b) ? 1 : ((size_a > size_b) ? -1 : 0);
+}
+
+/* extract the archive at path into destination with threads workers and
+   return the index of the first entry which failed, or -1; log (if not NULL)
+   receives the reports */
+static long extract_concurrently(const char* path, const char* destination, int threads, report_log* log)
+{
+    extraction ex;
+    pthread_t* tids;
+    ZPOS64_T arena_size = 0;
+    void* arena;
+    long failed = -1;
+    long i;
+    int t;
+    unzFile uf = unzOpen64(path);
+
+    TU_CHECK(uf != NULL);
+    memset(&ex, 0, sizeof(ex));
+    TU_CHECK(unzListEntries64(uf, NULL, 0, NULL, NULL, &arena_size) == UNZ_OK);
+    arena = malloc((size_t)arena_size);
+    TU_CHECK(arena != NULL);
+    TU_CHECK(unzListEntries64(uf, arena, arena_size, &ex.entries, &ex.count, NULL) == UNZ_OK);
+
+    ex.path = path;
+    ex.destination = destination;
+    ex.order = (long*)malloc(ex.count * sizeof(long));
+    ex.results = (int*)calloc(ex.count, sizeof(int));
+    ex.done = (int*)calloc(ex.count, sizeof(int));
+    tids = (pthread_t*)malloc(threads * sizeof(pthread_t));
+    TU_CHECK(ex.order != NULL && ex.results != NULL && ex.done != NULL && tids != NULL);
+    pthread_mutex_init(&ex.mutex, NULL);
+    pthread_cond_init(&ex.cond, NULL);
+
+    /* every entry is announced before any is handed to a worker */
+    for (i = 0; i < (long)ex.count; i++)
+    {
+        ex.order[i] = i;
+        if (log != NULL)
+            log->will[log->wills++] = i;
+    }
+    sort_entries = ex.entries;
+    qsort(ex.order, ex.count, sizeof(long), larger_first);
+
+    for (t = 0; t < threads; t++)
+        TU_CHECK(pthread_create(&tids[t], NULL, worker, &ex) == 0);
+
+    /* completed entries are reported in archive order */
+    for (i = 0; i < (long)ex.count; i++)
+    {
+        pthread_mutex_lock(&ex.mutex);
+        while (!ex.done[i])
+            pthread_cond_wait(&ex.cond, &ex.mutex);
+        if (ex.results[i] != UNZ_OK)
+            ex.aborted = 1;
+        pthread_mutex_unlock(&ex.mutex);
+        if (ex.aborted)
+        {
+            failed = i;
+            break;
+        }
+        if (log != NULL)
+            log->did[log->dids++] = i;
+    }
+
+    for (t = 0; t < threads; t++)
+        pthread_join(tids[t], NULL);
+    pthread_cond_destroy(&ex.cond);
+    pthread_mutex_destroy(&ex.mutex);
+    free(tids);
+    free(ex.done);
+    free(ex.results);
+    free(ex.order);
+    free(arena);
+    unzClose(uf);
+    return failed;
+}
+
+static size_t entry_size(long i, long entries, size_t max_size)
+{
+    /* a few large entries among many small ones, spread through the archive */
+    return (i % 17 == 3) ? max_size : (max_size / 64) * (size_t)(1 + (i * 7919) % entries) / (size_t)entries + 1;
+}
+
+static void make_archive(const char* path, long entries, size_t max_size, ZPOS64_T* stored_data_pos)
+{
+    unsigned char* data = (unsigned char*)malloc(max_size);
+    zipFile zf = zipOpen64(path, APPEND_STATUS_CREATE);
+    long i;
+
+    TU_CHECK(zf != NULL && data != NULL);
+    for (i = 0; i < entries; i++)
+    {
+        zip_fileinfo zi;
+        size_t size = entry_size(i, entries, max_size);
+        memset(&zi, 0, sizeof(zi));
+        tu_fill_text(data, size, (unsigned long long)i);
+        TU_CHECK(zipOpenNewFileInZip64(zf, tu_entry_name(i), &zi, NULL, 0, NULL, 0, NULL,
+                                       (i % 4 == 0) ? 0 : Z_DEFLATED, 6, 0) == ZIP_OK);
+        TU_CHECK(zipWriteInFileInZip(zf, data, (unsigned)size) == ZIP_OK);
+        TU_CHECK(zipCloseFileInZip(zf) == ZIP_OK);
+    }
+    TU_CHECK(zipClose(zf, NULL) == ZIP_OK);
+    free(data);
+
+    if (stored_data_pos != NULL)
+    {
+        /* where the data of the stored entry 100 starts */
+        unzFile uf = unzOpen64(path);
+        TU_CHECK(uf != NULL);
+        TU_CHECK(unzLocateFile(uf, tu_entry_name(100), 1) == UNZ_OK);
+        TU_CHECK(unzOpenCurrentFile(uf) == UNZ_OK);
+        *stored_data_pos = unzGetCurrentFileZStreamPos64(uf);
+        TU_CHECK(unzCloseCurrentFile(uf) == UNZ_OK);
+        TU_CHECK(unzClose(uf) == UNZ_OK);
+    }
+}
+
+static void check_files(const char* destination, long entries, size_t max_size)
+{
+    unsigned char* expected = (unsigned char*)malloc(max_size);
+    unsigned char* got = (unsigned char*)malloc(max_size + 1);
+    char out_path[1024];
+    long i;
+
+    TU_CHECK(expected != NULL && got != NULL);
+    for (i = 0; i < entries; i++)
+    {
+        size_t size = entry_size(i, entries, max_size);
+        FILE* f;
+        snprintf(out_path, sizeof(out_path), "%s/entry_%05ld", destination, i);
+        f = fopen(out_path, "rb");
+        TU_CHECK(f != NULL);
+        TU_CHECK(fread(got, 1, max_size + 1, f) == size);
+        fclose(f);
+        tu_fill_text(expected, size, (unsigned long long)i);
+        TU_CHECK(memcmp(got, expected, size) == 0);
+    }
+    free(got);
+    free(expected);
+}
+
+static void remove_files(const char* destination, long entries)
+{
+    char out_path[1024];
+    long i;
+    for (i = 0; i < entries; i++)
+    {
+        snprintf(out_path, sizeof(out_path), "%s/entry_%05ld", destination, i);
+        remove(out_path);
+    }
+    rmdir(destination);
+}
+
+static void test(void)
+{
+    const char* path = tu_path("concurrent.zip");
+    const char* destination = tu_path("concurrent_out");
+    const long entries = 400;
+    const size_t max_size = 256 * 1024;
+    static report_log log;
+    ZPOS64_T stored_data_pos;
+    unsigned char byte;
+    int threads[] = { 1, 3, 8 };
+    long i;
+    int k, fd;
+
+    make_archive(path, entries, max_size, &stored_data_pos);
+    TU_CHECK(mkdir(destination, 0755) == 0);
+
+    for (k = 0; k < (int)(sizeof(threads) / sizeof(threads[0])); k++)
+    {
+        memset(&log, 0, sizeof(log));
+        TU_CHECK(extract_concurrently(path, destination, threads[k], &log) == -1);
+        TU_CHECK(log.wills == entries);
+        TU_CHECK(log.dids == entries);
+        for (i = 0; i < entries; i++)
+            TU_CHECK(log.will[i] == i && log.did[i] == i);
+        check_files(destination, entries, max_size);
+        printf("ok: %ld entries extracted and reported in order with %d threads\n", entries, threads[k]);
+    }
+
+    /* a corrupted entry stops the reports right before it */
+    fd = open(path, O_RDWR);
+    TU_CHECK(fd >= 0);
+    TU_CHECK(pread(fd, &byte, 1, (off_t)stored_data_pos + 10) == 1);
+    byte ^= 0x55;
+    TU_CHECK(pwrite(fd, &byte, 1, (off_t)stored_data_pos + 10) == 1);
+    close(fd);
+
+    memset(&log, 0, sizeof(log));
+    TU_CHECK(extract_concurrently(path, destination, 4, &log) == 100);
+    TU_CHECK(log.wills == entries);
+    TU_CHECK(log.dids == 100);
+    for (i = 0; i < 100; i++)
+        TU_CHECK(log.did[i] == i);
+    printf("ok: a corrupted entry stops the reports before it\n");
+
+    remove_files(destination, entries);
+    remove(path);
+}
+
+static void bench(void)
+{
+    const char* path = tu_path("concurrent_bench.zip");
+    const char* destination = tu_path("concurrent_bench_out");
+    const long entries = 256;
+    const size_t max_size = 4 * 1024 * 1024;
+    double megabytes = 0, start, elapsed, single = 0;
+    int cpus = tu_cpu_count();
+    int threads;
+    long i;
+
+    make_archive(path, entries, max_size, NULL);
+    for (i = 0; i < entries; i++)
+        megabytes += (double)entry_size(i, entries, max_size) / (1 << 20);
+    TU_CHECK(mkdir(destination, 0755) == 0);
+
+    printf("%ld entries, %.0fMB, %d processors\n", entries, megabytes, cpus);
+    for (threads = 1; threads <= 2 * cpus; threads *= 2)
+    {
+        start = tu_now();
+        TU_CHECK(extract_concurrently(path, destination, threads, NULL) == -1);
+        elapsed = tu_now() - start;
+        if (threads == 1)
+            single = elapsed;
+        printf("%2d threads: %.0f ms, %.0f MB/s, %.2fx\n",
+               threads, elapsed * 1e3, megabytes / elapsed, single / elapsed);
+    }
+    check_files(destination, entries, max_size);
+    remove_files(destination, entries);
+    remove(path);
+}
+
+int main(int argc, char** argv)
+{
+    if (tu_bench_mode(argc, argv))
+        bench();
+    else
+        test();
+    return 0;
+}
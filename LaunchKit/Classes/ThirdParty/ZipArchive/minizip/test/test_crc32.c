@@ -0,0 +1,145 @@
+/* test_crc32.c -- the kernels of lk_crc32.c against zlib's crc32
+
+   lk_crc32.c is included, so its kernels can be called one by one: the
+   slice-by-8 table, PCLMULQDQ folding on x86 when the processor has it, and
+   the ARMv8 CRC32 kernel, natively on ARMv8 and on the stand-ins of
+   armv8/arm_acle.h elsewhere. Each one must give zlib's crc32 for every
+   length up to 1100 bytes at every alignment modulo 16, on larger buffers,
+   and when a buffer is split in two, chained or through crc32_combine.
+
+   With -b, prints the throughput of each native kernel and of zlib.
+
+   License: Same as ZLIB (www.gzip.org)
+*/
+
+#include "lk_crc32.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "testutil.h"
+
+typedef struct
+{
+    const char* name;
+    lk_crc32_func func;
+    int emulated;
+} kernel;
+
+static int list_kernels(kernel* kernels)
+{
+    int n = 0;
+    lk_crc32_make_table();
+    kernels[n].name = "slice8";
+    kernels[n].func = lk_crc32_slice8;
+    kernels[n++].emulated = 0;
+#ifdef LK_CRC32_PCLMUL
+    if (lk_crc32_has_pclmul())
+    {
+        kernels[n].name = "pclmul";
+        kernels[n].func = lk_crc32_pclmul;
+        kernels[n++].emulated = 0;
+    }
+#endif
+#ifdef LK_CRC32_ARMV8
+    kernels[n].name = "armv8";
+    kernels[n].func = lk_crc32_armv8;
+#if defined(__aarch64__)
+    kernels[n++].emulated = !lk_crc32_has_armv8();
+#else
+    kernels[n++].emulated = 1;
+#endif
+#endif
+    return n;
+}
+
+static uLong kernel_crc(const kernel* k, uLong crc, const unsigned char* buf, size_t len)
+{
+    return (uLong)~k->func(~(uint32_t)crc, buf, len);
+}
+
+static void check_kernel(const kernel* k, const unsigned char* data, size_t size)
+{
+    size_t len, offset, split;
+
+    for (offset = 0; offset < 16; offset++)
+        for (len = 0; len <= 1100; len++)
+            TU_CHECK(kernel_crc(k, 0, data + offset, len) == crc32(0L, data + offset, (uInt)len));
+
+    for (len = size - 15; len <= size - 8; len++)
+        TU_CHECK(kernel_crc(k, 0, data + (size - len), len) == crc32(0L, data + (size - len), (uInt)len));
+
+    for (split = 0; split < 300; split += 7)
+    {
+        const unsigned char* buf = data + 3;
+        uLong whole = crc32(0L, buf, 4099);
+        uLong first = kernel_crc(k, 0, buf, split);
+        uLong second = kernel_crc(k, 0, buf + split, 4099 - split);
+        TU_CHECK(kernel_crc(k, first, buf + split, 4099 - split) == whole);
+        TU_CHECK(crc32_combine(first, second, (z_off_t)(4099 - split)) == whole);
+    }
+    /* a running crc which is not 0 */
+    TU_CHECK(kernel_crc(k, 0x12345678UL, data + 1, 777) == crc32(0x12345678UL, data + 1, 777));
+}
+
+static void test(void)
+{
+    const size_t size = 1 << 20;
+    unsigned char* data = (unsigned char*)malloc(size);
+    kernel kernels[4];
+    int n, i;
+
+    TU_CHECK(data != NULL);
+    tu_fill_random(data, size, 7);
+    n = list_kernels(kernels);
+    for (i = 0; i < n; i++)
+    {
+        check_kernel(&kernels[i], data, size);
+        printf("ok: %s%s matches zlib crc32\n", kernels[i].name, kernels[i].emulated ? " (emulated)" : "");
+    }
+
+    TU_CHECK(lk_crc32(0L, Z_NULL, 0) == crc32(0L, Z_NULL, 0));
+    TU_CHECK(lk_crc32(0L, data + 5, 100000) == crc32(0L, data + 5, 100000));
+    printf("ok: lk_crc32 uses %s\n", lk_crc32_implementation());
+    free(data);
+}
+
+static void bench(void)
+{
+    const size_t size = 64 << 20;
+    const int passes = 8;
+    unsigned char* data = (unsigned char*)malloc(size);
+    volatile uLong sink = 0;
+    kernel kernels[4];
+    double start, elapsed;
+    int n, i, pass;
+
+    TU_CHECK(data != NULL);
+    tu_fill_random(data, size, 7);
+    start = tu_now();
+    for (pass = 0; pass < passes; pass++)
+        sink += crc32(0L, data, (uInt)size);
+    elapsed = tu_now() - start;
+    printf("%-8s %6.0f MB/s\n", "zlib", passes * (double)(size >> 20) / elapsed);
+
+    n = list_kernels(kernels);
+    for (i = 0; i < n; i++)
+    {
+        if (kernels[i].emulated)
+            continue;
+        start = tu_now();
+        for (pass = 0; pass < passes; pass++)
+            sink += kernel_crc(&kernels[i], 0, data, size);
+        elapsed = tu_now() - start;
+        printf("%-8s %6.0f MB/s\n", kernels[i].name, passes * (double)(size >> 20) / elapsed);
+    }
+    free(data);
+}
+
+int main(int argc, char** argv)
+{
+    if (tu_bench_mode(argc, argv))
+        bench();
+    else
+        test();
+    return 0;
+}
@@ -0,0 +1,125 @@
+/* test_index.c -- unzBuildIndex and unzLocateFileIndexed
+
+   Every name of the archive must be found through the index, with both case
+   sensitivities, and must become the current file. A missing name must not
+   be found and must leave the current file alone. Without an index,
+   unzLocateFileIndexed falls back to unzLocateFile.
+
+   With -b, times lookups of random names on a 50k entry archive with
+   unzLocateFile and with the index.
+
+   License: Same as ZLIB (www.gzip.org)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "lk_unzip.h"
+#include "testutil.h"
+
+static void check_current(unzFile uf, const char* name)
+{
+    char current[256];
+    TU_CHECK(unzGetCurrentFileInfo64(uf, NULL, current, sizeof(current), NULL, 0, NULL, 0) == UNZ_OK);
+    TU_CHECK(strcmp(current, name) == 0);
+}
+
+static void upper(char* dst, const char* src)
+{
+    while ((*dst++ = (char)toupper((unsigned char)*src++)) != '\0')
+        ;
+}
+
+static void test(void)
+{
+    const char* path = tu_path("index.zip");
+    const long entries = 3000;
+    char name[256];
+    unzFile uf;
+    long i;
+
+    TU_CHECK(tu_make_archive(path, entries, 16, 0, 0) == ZIP_OK);
+    uf = unzOpen64(path);
+    TU_CHECK(uf != NULL);
+
+    /* no index yet: the linear search answers */
+    TU_CHECK(unzLocateFileIndexed(uf, tu_entry_name(entries - 1), 1) == UNZ_OK);
+    check_current(uf, tu_entry_name(entries - 1));
+
+    TU_CHECK(unzBuildIndex(uf) == UNZ_OK);
+    for (i = 0; i < entries; i++)
+    {
+        long j = (i * 7919) % entries;
+        strcpy(name, tu_entry_name(j));
+        TU_CHECK(unzLocateFileIndexed(uf, name, 1) == UNZ_OK);
+        check_current(uf, name);
+
+        upper(name, tu_entry_name(j));
+        TU_CHECK(unzLocateFileIndexed(uf, name, 1) == UNZ_END_OF_LIST_OF_FILE);
+        check_current(uf, tu_entry_name(j));
+        TU_CHECK(unzLocateFileIndexed(uf, name, 2) == UNZ_OK);
+        check_current(uf, tu_entry_name(j));
+    }
+
+    /* a missing name keeps the current file */
+    TU_CHECK(unzLocateFileIndexed(uf, tu_entry_name(5), 1) == UNZ_OK);
+    TU_CHECK(unzLocateFileIndexed(uf, "assets/missing.png", 1) == UNZ_END_OF_LIST_OF_FILE);
+    TU_CHECK(unzLocateFileIndexed(uf, "assets/missing.png", 2) == UNZ_END_OF_LIST_OF_FILE);
+    check_current(uf, tu_entry_name(5));
+
+    /* the entry found can be read */
+    TU_CHECK(unzOpenCurrentFile(uf) == UNZ_OK);
+    TU_CHECK(unzReadCurrentFile(uf, name, sizeof(name)) == 16);
+    TU_CHECK(unzCloseCurrentFile(uf) == UNZ_OK);
+
+    TU_CHECK(unzClose(uf) == UNZ_OK);
+    remove(path);
+    printf("ok: %ld entries found through the index\n", entries);
+}
+
+static void bench(void)
+{
+    const char* path = tu_path("index_bench.zip");
+    const long entries = 50000;
+    const long linear_lookups = 1000;
+    const long indexed_lookups = 1000000;
+    unsigned long long state = 1;
+    double start, linear, indexed, build;
+    unzFile uf;
+    long i;
+
+    TU_CHECK(tu_make_archive(path, entries, 16, 0, 0) == ZIP_OK);
+    uf = unzOpen64(path);
+    TU_CHECK(uf != NULL);
+
+    start = tu_now();
+    for (i = 0; i < linear_lookups; i++)
+        TU_CHECK(unzLocateFile(uf, tu_entry_name((long)(tu_random(&state) % entries)), 1) == UNZ_OK);
+    linear = (tu_now() - start) / linear_lookups;
+
+    start = tu_now();
+    TU_CHECK(unzBuildIndex(uf) == UNZ_OK);
+    build = tu_now() - start;
+
+    start = tu_now();
+    for (i = 0; i < indexed_lookups; i++)
+        TU_CHECK(unzLocateFileIndexed(uf, tu_entry_name((long)(tu_random(&state) % entries)), 1) == UNZ_OK);
+    indexed = (tu_now() - start) / indexed_lookups;
+
+    printf("%ld entries: unzLocateFile %.1f us/lookup, index built in %.1f ms, "
+           "unzLocateFileIndexed %.3f us/lookup (%.0fx)\n",
+           entries, linear * 1e6, build * 1e3, indexed * 1e6, linear / indexed);
+
+    TU_CHECK(unzClose(uf) == UNZ_OK);
+    remove(path);
+}
+
+int main(int argc, char** argv)
+{
+    if (tu_bench_mode(argc, argv))
+        bench();
+    else
+        test();
+    return 0;
+}
@@ -0,0 +1,299 @@
+/* test_io.c -- the seeks and reads of unzReadCurrentFile
+
+   Reading an entry seeks the stream only when the last read did not leave
+   it at the right place, and reads with zpread64_file, without seeking at
+   all, when the file functions have it. The test extracts every entry of an
+   archive through file functions which count their calls, and checks:
+   without zpread64_file, at most two seeks per entry (the local header,
+   then its data); with it, a single seek per entry for the local header,
+   and every read of data turned into a pread; mapped, no call and no read
+   system call for the data. Two handles sharing one FILE must read
+   interleaved entries, since pread does not move it. zlib_filefunc64_def
+   keeps the layout of minizip 1.1, pread being set apart in
+   zlib_filefunc64_ex_def for unzOpen3_64: one filled field by field and
+   followed by garbage must extract every entry through unzOpen2_64.
+
+   With -b, prints the calls and read system calls of extracting a 70MB
+   archive of 8 entries each way, and the time it took.
+
+   License: Same as ZLIB (www.gzip.org)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lk_unzip.h"
+#include "lk_zip.h"
+#include "testutil.h"
+
+/* reads of a local header, one per field */
+#define MAX_HEADER_READS 32
+
+enum { IO_SEEK_READ, IO_PREAD, IO_MAPPED };
+static const char* io_names[] = { "seek and read", "pread", "mapped" };
+
+typedef struct
+{
+    tu_io_counts counts;
+    long long read_syscalls;
+    double seconds;
+} extract_stats;
+
+static void make_archive(const char* path, long entries, size_t size)
+{
+    unsigned char* data = (unsigned char*)malloc(size);
+    zipFile zf = zipOpen64(path, APPEND_STATUS_CREATE);
+    long i;
+
+    TU_CHECK(zf != NULL && data != NULL);
+    for (i = 0; i < entries; i++)
+    {
+        zip_fileinfo zi;
+        memset(&zi, 0, sizeof(zi));
+        /* text, and every other entry half random data */
+        tu_fill_text(data, size, (unsigned long long)i);
+        if (i % 2 == 1)
+            tu_fill_random(data, size / 2, (unsigned long long)i);
+        TU_CHECK(zipOpenNewFileInZip64(zf, tu_entry_name(i), &zi, NULL, 0, NULL, 0, NULL, Z_DEFLATED, 6, 0) == ZIP_OK);
+        TU_CHECK(zipWriteInFileInZip(zf, data, (unsigned)size) == ZIP_OK);
+        TU_CHECK(zipCloseFileInZip(zf) == ZIP_OK);
+    }
+    TU_CHECK(zipClose(zf, NULL) == ZIP_OK);
+    free(data);
+}
+
+static void io_filefunc(zlib_filefunc64_ex_def* functions, int io)
+{
+    if (io == IO_MAPPED)
+        fill_mmap_filefunc64(functions);
+    else
+        fill_fopen64_filefunc_ex(functions);
+    if (io == IO_SEEK_READ)
+        functions->zpread64_file = NULL;
+}
+
+/* extract every entry, and count the calls made after unzOpen */
+static void extract_all(const char* path, int io, long entries, extract_stats* stats)
+{
+    zlib_filefunc64_ex_def base, counting;
+    unsigned char* buffer = (unsigned char*)malloc(256 * 1024);
+    long i = 0;
+    int err, n;
+    unzFile uf;
+
+    TU_CHECK(buffer != NULL);
+    io_filefunc(&base, io);
+    tu_counting_filefunc_ex(&counting, &base);
+    uf = unzOpen3_64(path, &counting);
+    TU_CHECK(uf != NULL);
+
+    memset(&tu_counts, 0, sizeof(tu_counts));
+    stats->read_syscalls = tu_read_syscalls();
+    stats->seconds = tu_now();
+    for (err = unzGoToFirstFile(uf); err == UNZ_OK; err = unzGoToNextFile(uf), i++)
+    {
+        TU_CHECK(unzOpenCurrentFile(uf) == UNZ_OK);
+        while ((n = unzReadCurrentFile(uf, buffer, 256 * 1024)) > 0)
+            ;
+        TU_CHECK(n == 0);
+        /* checks the CRC */
+        TU_CHECK(unzCloseCurrentFile(uf) == UNZ_OK);
+    }
+    stats->seconds = tu_now() - stats->seconds;
+    stats->read_syscalls = tu_read_syscalls() - stats->read_syscalls;
+    stats->counts = tu_counts;
+    TU_CHECK(err == UNZ_END_OF_LIST_OF_FILE);
+    TU_CHECK(i == entries);
+    TU_CHECK(unzClose(uf) == UNZ_OK);
+    free(buffer);
+}
+
+/* stdio functions whose every open gives the same FILE */
+static FILE* shared_file;
+
+static voidpf ZCALLBACK shared_open(voidpf opaque, const void* filename, int mode)
+{
+    (void)opaque;
+    (void)filename;
+    (void)mode;
+    return shared_file;
+}
+
+static int ZCALLBACK shared_close(voidpf opaque, voidpf stream)
+{
+    (void)opaque;
+    (void)stream;
+    return 0;
+}
+
+static void check_shared_file(const char* path, long entries, size_t size)
+{
+    zlib_filefunc64_ex_def functions;
+    unsigned char* got[2];
+    unsigned char* expected = (unsigned char*)malloc(size);
+    unzFile uf[2];
+    size_t offset;
+    long i;
+    int h;
+
+    shared_file = fopen(path, "rb");
+    TU_CHECK(shared_file != NULL && expected != NULL);
+    fill_fopen64_filefunc_ex(&functions);
+    functions.zfile_func64.zopen64_file = shared_open;
+    functions.zfile_func64.zclose_file = shared_close;
+    for (h = 0; h < 2; h++)
+    {
+        uf[h] = unzOpen3_64(path, &functions);
+        got[h] = (unsigned char*)malloc(size);
+        TU_CHECK(uf[h] != NULL && got[h] != NULL);
+    }
+
+    /* handle 0 reads entry i while handle 1 reads entry i + 1, 64KB each in turn */
+    for (i = 0; i + 1 < entries; i += 2)
+    {
+        for (h = 0; h < 2; h++)
+        {
+            TU_CHECK(unzLocateFile(uf[h], tu_entry_name(i + h), 1) == UNZ_OK);
+            TU_CHECK(unzOpenCurrentFile(uf[h]) == UNZ_OK);
+        }
+        for (offset = 0; offset < size; offset += 65536)
+            for (h = 0; h < 2; h++)
+                TU_CHECK(unzReadCurrentFile(uf[h], got[h] + offset, 65536) == 65536);
+        for (h = 0; h < 2; h++)
+        {
+            TU_CHECK(unzReadCurrentFile(uf[h], got[h], 1) == 0);
+            TU_CHECK(unzCloseCurrentFile(uf[h]) == UNZ_OK);
+            tu_fill_text(expected, size, (unsigned long long)(i + h));
+            if ((i + h) % 2 == 1)
+                tu_fill_random(expected, size / 2, (unsigned long long)(i + h));
+            TU_CHECK(memcmp(got[h], expected, size) == 0);
+        }
+    }
+
+    for (h = 0; h < 2; h++)
+    {
+        TU_CHECK(unzClose(uf[h]) == UNZ_OK);
+        free(got[h]);
+    }
+    fclose(shared_file);
+    free(expected);
+}
+
+/* a zlib_filefunc64_def filled field by field, as callers written for
+   minizip 1.1 do, followed by garbage: unzOpen2_64 must use nothing else */
+static void check_filled_by_hand(const char* path, long entries)
+{
+    zlib_filefunc64_def stdio_functions;
+    zlib_filefunc64_def* functions;
+    unsigned char buffer[65536];
+    long i = 0;
+    int err, n;
+    unzFile uf;
+
+    TU_CHECK(sizeof(zlib_filefunc64_def) == 8 * sizeof(void*));
+    functions = (zlib_filefunc64_def*)malloc(sizeof(zlib_filefunc64_def) + 4 * sizeof(void*));
+    TU_CHECK(functions != NULL);
+    memset(functions, 0xa5, sizeof(zlib_filefunc64_def) + 4 * sizeof(void*));
+    fill_fopen64_filefunc(&stdio_functions);
+    functions->zopen64_file = stdio_functions.zopen64_file;
+    functions->zread_file = stdio_functions.zread_file;
+    functions->zwrite_file = stdio_functions.zwrite_file;
+    functions->ztell64_file = stdio_functions.ztell64_file;
+    functions->zseek64_file = stdio_functions.zseek64_file;
+    functions->zclose_file = stdio_functions.zclose_file;
+    functions->zerror_file = stdio_functions.zerror_file;
+    functions->opaque = NULL;
+
+    uf = unzOpen2_64(path, functions);
+    TU_CHECK(uf != NULL);
+    for (err = unzGoToFirstFile(uf); err == UNZ_OK; err = unzGoToNextFile(uf), i++)
+    {
+        TU_CHECK(unzOpenCurrentFile(uf) == UNZ_OK);
+        while ((n = unzReadCurrentFile(uf, buffer, sizeof(buffer))) > 0)
+            ;
+        TU_CHECK(n == 0);
+        TU_CHECK(unzCloseCurrentFile(uf) == UNZ_OK);
+    }
+    TU_CHECK(err == UNZ_END_OF_LIST_OF_FILE);
+    TU_CHECK(i == entries);
+    TU_CHECK(unzClose(uf) == UNZ_OK);
+    free(functions);
+}
+
+static void test(void)
+{
+    const char* path = tu_path("io.zip");
+    const long entries = 8;
+    const size_t size = 1 << 20;
+    extract_stats stats, seek_read;
+    int io;
+
+    memset(&seek_read, 0, sizeof(seek_read));
+    make_archive(path, entries, size);
+    for (io = IO_SEEK_READ; io <= IO_MAPPED; io++)
+    {
+        extract_all(path, io, entries, &stats);
+        printf("ok: %s, %lu seeks, %lu reads, %lu preads, %lld read syscalls\n", io_names[io],
+               stats.counts.seeks, stats.counts.reads, stats.counts.preads, stats.read_syscalls);
+        TU_CHECK(stats.counts.seeks <= 2 * (unsigned long)entries);
+        if (io == IO_SEEK_READ)
+        {
+            TU_CHECK(stats.counts.preads == 0);
+            seek_read = stats;
+        }
+        else
+        {
+            /* the local headers are still read with seek and read, a field
+               at a time */
+            TU_CHECK(stats.counts.seeks <= (unsigned long)entries);
+            TU_CHECK(stats.counts.reads <= MAX_HEADER_READS * (unsigned long)entries);
+        }
+        if (io == IO_PREAD)
+            TU_CHECK(stats.counts.reads + stats.counts.preads == seek_read.counts.reads);
+        /* mapped, the data is taken from the mapping without any call */
+        if (io == IO_MAPPED)
+        {
+            TU_CHECK(stats.counts.preads == 0);
+            if (stats.read_syscalls >= 0)
+                TU_CHECK(stats.read_syscalls <= entries);
+        }
+    }
+
+    check_shared_file(path, entries, size);
+    printf("ok: two handles on one FILE read interleaved entries\n");
+    check_filled_by_hand(path, entries);
+    printf("ok: file functions filled field by field, followed by garbage, extract every entry\n");
+    remove(path);
+}
+
+static void bench(void)
+{
+    const char* path = tu_path("io_bench.zip");
+    const long entries = 8;
+    const size_t size = 9 << 20;
+    extract_stats stats;
+    int io, pass;
+
+    make_archive(path, entries, size);
+    printf("%ld deflated entries of %luMB\n", entries, (unsigned long)(size >> 20));
+    /* the first pass warms the page cache */
+    for (pass = 0; pass < 2; pass++)
+        for (io = IO_SEEK_READ; io <= IO_MAPPED; io++)
+        {
+            extract_all(path, io, entries, &stats);
+            if (pass > 0)
+                printf("%-14s %5lu seeks %5lu reads %5lu preads %6lld read syscalls %6.0f ms\n",
+                       io_names[io], stats.counts.seeks, stats.counts.reads, stats.counts.preads,
+                       stats.read_syscalls, stats.seconds * 1e3);
+        }
+    remove(path);
+}
+
+int main(int argc, char** argv)
+{
+    if (tu_bench_mode(argc, argv))
+        bench();
+    else
+        test();
+    return 0;
+}
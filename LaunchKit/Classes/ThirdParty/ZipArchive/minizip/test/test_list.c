@@ -0,0 +1,266 @@
+/* test_list.c -- unzListEntries64
+
+   The entries listed by unzListEntries64 must be those of a walk with
+   unzGoToNextFile and unzGetCurrentFileInfo64, field by field, on an
+   archive with stored and deflated entries, directories, names of up to 250
+   bytes, extra fields and comments; their positions must make them the
+   current file with unzGoToFilePos64. The listing needs an arena of the
+   size it reports and refuses a smaller one, leaves the current file
+   alone, and allocates nothing (the test is built against the _counted
+   lk_unzip.c).
+
+   With -b, lists a 100k entry archive by walking it, with and without
+   keeping the entries, and with unzListEntries64, into a new arena and into
+   one already used, and prints the time each took.
+
+   License: Same as ZLIB (www.gzip.org)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lk_unzip.h"
+#include "lk_zip.h"
+#include "testutil.h"
+
+/* name of entry i: directories, and names of up to 250 bytes */
+static const char* entry_name(long i, char* name)
+{
+    size_t len = (size_t)(i * 37 % 250) + 1, k;
+    if (i % 50 == 7)
+    {
+        snprintf(name, 64, "dir_%05ld/", i);
+        return name;
+    }
+    snprintf(name, 256, "%s", tu_entry_name(i));
+    for (k = strlen(name); k < len; k++)
+        name[k] = (char)('a' + (i + (long)k) % 26);
+    name[k] = '\0';
+    return name;
+}
+
+static void make_archive(const char* path, long entries)
+{
+    char name[256], extra[64], comment[64];
+    zipFile zf = zipOpen64(path, APPEND_STATUS_CREATE);
+    long i;
+
+    TU_CHECK(zf != NULL);
+    for (i = 0; i < entries; i++)
+    {
+        zip_fileinfo zi;
+        uInt extra_size = (uInt)(i % 3) * 8;
+        int stored = (i % 4 == 1);
+        memset(&zi, 0, sizeof(zi));
+        zi.dosDate = 0x4a3c5000UL + (uLong)i;
+        zi.internal_fa = (uLong)(i & 1);
+        zi.external_fa = (uLong)i << 16;
+        /* a private extra field: id 0xcafe, then its data */
+        memset(extra, 0, sizeof(extra));
+        if (extra_size > 0)
+        {
+            extra[0] = (char)0xfe;
+            extra[1] = (char)0xca;
+            extra[2] = (char)(extra_size - 4);
+            memset(extra + 4, (int)(i & 0x7f), extra_size - 4);
+        }
+        snprintf(comment, sizeof(comment), "comment %ld", i);
+        TU_CHECK(zipOpenNewFileInZip64(zf, entry_name(i, name), &zi, NULL, 0,
+                                       extra_size ? extra : NULL, extra_size,
+                                       (i % 5 == 0) ? comment : NULL,
+                                       stored ? 0 : Z_DEFLATED, stored ? 0 : 6, 0) == ZIP_OK);
+        TU_CHECK(zipWriteInFileInZip(zf, name, (unsigned)(i % 7 * 10)) == ZIP_OK);
+        TU_CHECK(zipCloseFileInZip(zf) == ZIP_OK);
+    }
+    TU_CHECK(zipClose(zf, NULL) == ZIP_OK);
+}
+
+static void check_same_info(const unz_file_info64* a, const unz_file_info64* b)
+{
+    TU_CHECK(a->version == b->version);
+    TU_CHECK(a->version_needed == b->version_needed);
+    TU_CHECK(a->flag == b->flag);
+    TU_CHECK(a->compression_method == b->compression_method);
+    TU_CHECK(a->dosDate == b->dosDate);
+    TU_CHECK(a->crc == b->crc);
+    TU_CHECK(a->compressed_size == b->compressed_size);
+    TU_CHECK(a->uncompressed_size == b->uncompressed_size);
+    TU_CHECK(a->size_filename == b->size_filename);
+    TU_CHECK(a->size_file_extra == b->size_file_extra);
+    TU_CHECK(a->size_file_comment == b->size_file_comment);
+    TU_CHECK(a->disk_num_start == b->disk_num_start);
+    TU_CHECK(a->internal_fa == b->internal_fa);
+    TU_CHECK(a->external_fa == b->external_fa);
+}
+
+/* list the entries of uf in a malloc'd arena, checking the reported size */
+static unz_entry64* list(unzFile uf, ZPOS64_T* count, void** arena)
+{
+    ZPOS64_T needed = 0, needed_again = 0;
+    unz_entry64* entries = NULL;
+
+    TU_CHECK(unzListEntries64(uf, NULL, 0, NULL, count, &needed) == UNZ_OK);
+    *arena = malloc((size_t)needed + 1);
+    TU_CHECK(*arena != NULL);
+    TU_CHECK(unzListEntries64(uf, *arena, needed, &entries, count, &needed_again) == UNZ_OK);
+    TU_CHECK(needed_again == needed);
+    TU_CHECK(*count == 0 || entries == (unz_entry64*)*arena);
+    return entries;
+}
+
+static void check_listing(const char* path, long expected)
+{
+    char name[256], listed_name[256], current_name[256];
+    unz_file_info64 info;
+    unzFile uf = unzOpen64(path);
+    unz_entry64* entries;
+    ZPOS64_T count, needed;
+    void* arena;
+    long i = 0;
+    int err;
+
+    TU_CHECK(uf != NULL);
+    /* the current file is left where it is */
+    TU_CHECK(unzGoToFirstFile(uf) == UNZ_OK);
+    if (expected > 1)
+        TU_CHECK(unzGoToNextFile(uf) == UNZ_OK);
+    TU_CHECK(unzGetCurrentFileInfo64(uf, NULL, current_name, sizeof(current_name), NULL, 0, NULL, 0) == UNZ_OK);
+
+    memset(&tu_allocs, 0, sizeof(tu_allocs));
+    entries = list(uf, &count, &arena);
+    TU_CHECK(tu_allocs.allocs == 0);
+    TU_CHECK(count == (ZPOS64_T)expected);
+    TU_CHECK(unzGetCurrentFileInfo64(uf, NULL, name, sizeof(name), NULL, 0, NULL, 0) == UNZ_OK);
+    TU_CHECK(strcmp(name, current_name) == 0);
+
+    for (err = unzGoToFirstFile(uf); err == UNZ_OK; err = unzGoToNextFile(uf), i++)
+    {
+        TU_CHECK(unzGetCurrentFileInfo64(uf, &info, name, sizeof(name), NULL, 0, NULL, 0) == UNZ_OK);
+        TU_CHECK(strcmp(entries[i].filename, name) == 0);
+        TU_CHECK(strcmp(entries[i].filename, entry_name(i, listed_name)) == 0);
+        check_same_info(&entries[i].info, &info);
+    }
+    TU_CHECK(i == expected);
+
+    /* backwards, through the positions */
+    for (i = expected - 1; i >= 0; i -= 3)
+    {
+        TU_CHECK(unzGoToFilePos64(uf, &entries[i].pos) == UNZ_OK);
+        TU_CHECK(unzGetCurrentFileInfo64(uf, &info, name, sizeof(name), NULL, 0, NULL, 0) == UNZ_OK);
+        TU_CHECK(strcmp(name, entries[i].filename) == 0);
+        check_same_info(&entries[i].info, &info);
+    }
+
+    /* an arena one byte short is refused */
+    TU_CHECK(unzListEntries64(uf, NULL, 0, NULL, NULL, &needed) == UNZ_OK);
+    if (needed > 0)
+        TU_CHECK(unzListEntries64(uf, arena, needed - 1, &entries, &count, NULL) == UNZ_PARAMERROR);
+
+    free(arena);
+    TU_CHECK(unzClose(uf) == UNZ_OK);
+}
+
+static void test(void)
+{
+    const char* path = tu_path("list.zip");
+    long sizes[] = { 1, 2, 1000 };
+    int k;
+
+    for (k = 0; k < (int)(sizeof(sizes) / sizeof(sizes[0])); k++)
+    {
+        make_archive(path, sizes[k]);
+        check_listing(path, sizes[k]);
+        printf("ok: %ld entries listed as walked, without allocations\n", sizes[k]);
+    }
+
+    remove(path);
+}
+
+/* the walk, keeping a copy of every entry as LK_SSZipArchive did before
+   unzListEntries64: its info, and its name in an allocation of its own */
+static void walk_keeping(unzFile uf, long entries)
+{
+    unz_file_info64* infos = (unz_file_info64*)malloc((size_t)entries * sizeof(unz_file_info64));
+    char** names = (char**)malloc((size_t)entries * sizeof(char*));
+    long i = 0;
+    int err;
+
+    TU_CHECK(infos != NULL && names != NULL);
+    for (err = unzGoToFirstFile(uf); err == UNZ_OK; err = unzGoToNextFile(uf), i++)
+    {
+        TU_CHECK(unzGetCurrentFileInfo64(uf, &infos[i], NULL, 0, NULL, 0, NULL, 0) == UNZ_OK);
+        names[i] = (char*)malloc(infos[i].size_filename + 1);
+        TU_CHECK(names[i] != NULL);
+        TU_CHECK(unzGetCurrentFileInfo64(uf, NULL, names[i], infos[i].size_filename + 1, NULL, 0, NULL, 0) == UNZ_OK);
+    }
+    TU_CHECK(i == entries);
+    for (i = 0; i < entries; i++)
+        free(names[i]);
+    free(names);
+    free(infos);
+}
+
+static void bench(void)
+{
+    const char* path = tu_path("list_bench.zip");
+    const long entries = 100000;
+    const char* names[] = {
+        "walk, names to one buffer",
+        "walk, keeping every entry",
+        "unzListEntries64, new arena",
+        "unzListEntries64, arena reused"
+    };
+    char name[256];
+    unz_file_info64 info;
+    ZPOS64_T count, needed;
+    void* arena;
+    void* reused;
+    double start, best[4];
+    unzFile uf;
+    int pass, way, err;
+
+    make_archive(path, entries);
+    uf = unzOpen64(path);
+    TU_CHECK(uf != NULL);
+    TU_CHECK(unzListEntries64(uf, NULL, 0, NULL, NULL, &needed) == UNZ_OK);
+    reused = malloc((size_t)needed);
+    TU_CHECK(reused != NULL);
+    memset(reused, 0, (size_t)needed);
+    for (way = 0; way < 4; way++)
+        best[way] = 1e9;
+    for (pass = 0; pass < 5; pass++)
+        for (way = 0; way < 4; way++)
+        {
+            start = tu_now();
+            if (way == 0)
+                for (err = unzGoToFirstFile(uf); err == UNZ_OK; err = unzGoToNextFile(uf))
+                    TU_CHECK(unzGetCurrentFileInfo64(uf, &info, name, sizeof(name), NULL, 0, NULL, 0) == UNZ_OK);
+            else if (way == 1)
+                walk_keeping(uf, entries);
+            else if (way == 2)
+            {
+                list(uf, &count, &arena);
+                free(arena);
+            }
+            else
+                TU_CHECK(unzListEntries64(uf, reused, needed, NULL, &count, NULL) == UNZ_OK);
+            if (tu_now() - start < best[way])
+                best[way] = tu_now() - start;
+        }
+    TU_CHECK(unzClose(uf) == UNZ_OK);
+    free(reused);
+
+    printf("%ld entries, %.1fMB of arena, best of 5\n", entries, (double)needed / (1 << 20));
+    for (way = 0; way < 4; way++)
+        printf("%-32s %6.1f ms\n", names[way], best[way] * 1e3);
+    remove(path);
+}
+
+int main(int argc, char** argv)
+{
+    if (tu_bench_mode(argc, argv))
+        bench();
+    else
+        test();
+    return 0;
+}
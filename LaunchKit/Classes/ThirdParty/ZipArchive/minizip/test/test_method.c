@@ -0,0 +1,371 @@
+/* test_method.c -- the compression methods of lk_method.c
+
+   Entries of every method this build knows (stored, deflated, and bzip2,
+   zstd and LZ4 when built with HAVE_BZIP2, HAVE_ZSTD and HAVE_LZ4, see the
+   Makefile) must read back with their CRC: empty, tiny, text and random
+   data, written in one call and 1000 bytes at a time, read 1 byte, 777
+   bytes and 64KB at a time. A method registered with lk_method_register
+   must be used both ways, and replace a built in one of the same number;
+   a method nothing knows must be refused by the writer and the reader.
+
+   With -b, writes 47MB of files (3/4 text, 1/4 random data, like a bundle)
+   with each method and level, and prints the compressed size and the
+   compression and decompression throughput.
+
+   License: Same as ZLIB (www.gzip.org)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lk_method.h"
+#include "lk_unzip.h"
+#include "lk_zip.h"
+#include "testutil.h"
+
+#define Z_TEST_XOR 0x7878   /* the method registered by the test */
+
+typedef struct
+{
+    const char* name;
+    int method;
+    int level;
+} codec;
+
+static const codec all_codecs[] = {
+    { "stored", 0, 0 },
+    { "deflate -1", Z_DEFLATED, 1 },
+    { "deflate -6", Z_DEFLATED, 6 },
+    { "deflate -9", Z_DEFLATED, 9 },
+    { "bzip2 -9", Z_BZIP2ED, 9 },
+    { "zstd -1", Z_ZSTD, 1 },
+    { "zstd -3", Z_ZSTD, 3 },
+    { "zstd -9", Z_ZSTD, 9 },
+    { "zstd -19", Z_ZSTD, 19 },
+    { "lz4", Z_LK_LZ4, 0 },
+    { "lz4 -9 (HC)", Z_LK_LZ4, 9 }
+};
+#define CODEC_COUNT (sizeof(all_codecs) / sizeof(all_codecs[0]))
+
+static int available(const codec* c)
+{
+    return (c->method == 0) || (c->method == Z_DEFLATED) || (lk_method_find((uLong)c->method) != NULL);
+}
+
+/* ===========================================================================
+   a method of the test: the bytes xor 0x5a, 100 at most per call so that
+   the callers have to loop
+*/
+static int xor_state;
+
+static voidpf xor_init(int level)
+{
+    (void)level;
+    return &xor_state;
+}
+
+static voidpf xor_decompress_init(void)
+{
+    return &xor_state;
+}
+
+static void xor_end(voidpf state)
+{
+    TU_CHECK(state == &xor_state);
+}
+
+static int xor_run(z_streamp strm)
+{
+    uInt n = (strm->avail_in < strm->avail_out) ? strm->avail_in : strm->avail_out;
+    uInt i;
+    if (n > 100)
+        n = 100;
+    for (i = 0; i < n; i++)
+        strm->next_out[i] = strm->next_in[i] ^ 0x5a;
+    strm->next_in += n;
+    strm->avail_in -= n;
+    strm->total_in += n;
+    strm->next_out += n;
+    strm->avail_out -= n;
+    strm->total_out += n;
+    return n;
+}
+
+static int xor_compress(voidpf state, z_streamp strm, int flush)
+{
+    (void)state;
+    xor_run(strm);
+    return ((flush == Z_FINISH) && (strm->avail_in == 0)) ? Z_STREAM_END : Z_OK;
+}
+
+static int xor_decompress(voidpf state, z_streamp strm)
+{
+    (void)state;
+    return (xor_run(strm) > 0) ? Z_OK : Z_BUF_ERROR;
+}
+
+static const lk_method xor_method = {
+    Z_TEST_XOR, "xor", 63,
+    xor_init, xor_compress, xor_end,
+    xor_decompress_init, xor_decompress, xor_end
+};
+
+/* ===========================================================================
+   the test
+*/
+static const size_t sizes[] = { 0, 1, 1000, 100 * 1024 + 3, 1024 * 1024 };
+#define SIZE_COUNT (sizeof(sizes) / sizeof(sizes[0]))
+
+static void entry_data(unsigned char* data, size_t i, size_t size)
+{
+    if (i % 2 == 0)
+        tu_fill_text(data, size, i);
+    else
+        tu_fill_random(data, size, i);
+}
+
+/* two entries of each size, text and random, the second half written 1000
+   bytes at a time */
+static void write_entries(const char* path, int method, int level, unsigned char* data)
+{
+    zipFile zf = zipOpen64(path, APPEND_STATUS_CREATE);
+    size_t i;
+
+    TU_CHECK(zf != NULL);
+    for (i = 0; i < 4 * SIZE_COUNT; i++)
+    {
+        zip_fileinfo zi;
+        size_t size = sizes[(i / 2) % SIZE_COUNT], done;
+        memset(&zi, 0, sizeof(zi));
+        entry_data(data, i, size);
+        TU_CHECK(zipOpenNewFileInZip64(zf, tu_entry_name((long)i), &zi, NULL, 0, NULL, 0, NULL, method, level, 0) == ZIP_OK);
+        if (i < 2 * SIZE_COUNT)
+            TU_CHECK(zipWriteInFileInZip(zf, data, (unsigned)size) == ZIP_OK);
+        else
+            for (done = 0; done < size; done += 1000)
+                TU_CHECK(zipWriteInFileInZip(zf, data + done, (unsigned)(size - done < 1000 ? size - done : 1000)) == ZIP_OK);
+        TU_CHECK(zipCloseFileInZip(zf) == ZIP_OK);
+    }
+    TU_CHECK(zipClose(zf, NULL) == ZIP_OK);
+}
+
+static void check_entries(const char* path, int method, unsigned char* expected, unsigned char* got)
+{
+    const unsigned read_sizes[] = { 1, 777, 65536 };
+    unz_file_info64 info;
+    unzFile uf = unzOpen64(path);
+    size_t i;
+    int r;
+
+    TU_CHECK(uf != NULL);
+    for (i = 0; i < 4 * SIZE_COUNT; i++)
+    {
+        size_t size = sizes[(i / 2) % SIZE_COUNT];
+        TU_CHECK(unzLocateFile(uf, tu_entry_name((long)i), 1) == UNZ_OK);
+        TU_CHECK(unzGetCurrentFileInfo64(uf, &info, NULL, 0, NULL, 0, NULL, 0) == UNZ_OK);
+        TU_CHECK(info.compression_method == (uLong)method);
+        TU_CHECK(info.uncompressed_size == size);
+        entry_data(expected, i, size);
+        for (r = 0; r < 3; r++)
+        {
+            size_t total = 0;
+            int n;
+            /* a byte at a time only for the smaller entries */
+            if ((read_sizes[r] == 1) && (size > 2000))
+                continue;
+            TU_CHECK(unzOpenCurrentFile(uf) == UNZ_OK);
+            while ((n = unzReadCurrentFile(uf, got + total, read_sizes[r])) > 0)
+                total += (size_t)n;
+            TU_CHECK(n == 0);
+            TU_CHECK(total == size);
+            TU_CHECK(memcmp(got, expected, size) == 0);
+            /* checks the CRC */
+            TU_CHECK(unzCloseCurrentFile(uf) == UNZ_OK);
+        }
+    }
+    TU_CHECK(unzClose(uf) == UNZ_OK);
+}
+
+/* change the method of the headers of the single entry of path */
+static void set_method(const char* path, int method)
+{
+    unsigned char bytes[4096];
+    size_t len, i;
+    FILE* f = fopen(path, "r+b");
+
+    TU_CHECK(f != NULL);
+    len = fread(bytes, 1, sizeof(bytes), f);
+    TU_CHECK(len < sizeof(bytes));
+    for (i = 0; i + 4 <= len; i++)
+    {
+        size_t at = 0;
+        if (memcmp(bytes + i, "PK\003\004", 4) == 0)
+            at = i + 8;
+        else if (memcmp(bytes + i, "PK\001\002", 4) == 0)
+            at = i + 10;
+        if (at != 0)
+        {
+            bytes[at] = (unsigned char)(method & 0xff);
+            bytes[at + 1] = (unsigned char)(method >> 8);
+        }
+    }
+    rewind(f);
+    TU_CHECK(fwrite(bytes, 1, len, f) == len);
+    fclose(f);
+}
+
+static void test(void)
+{
+    const char* path = tu_path("method.zip");
+    const size_t max_size = sizes[SIZE_COUNT - 1];
+    unsigned char* data = (unsigned char*)malloc(max_size);
+    unsigned char* got = (unsigned char*)malloc(max_size + 65536);
+    zip_fileinfo zi;
+    zipFile zf;
+    size_t k;
+
+    TU_CHECK(data != NULL && got != NULL);
+    for (k = 0; k < CODEC_COUNT; k++)
+    {
+        const codec* c = &all_codecs[k];
+        if (!available(c))
+        {
+            printf("-- %s is not built in\n", c->name);
+            continue;
+        }
+        write_entries(path, c->method, c->level, data);
+        check_entries(path, c->method, data, got);
+        printf("ok: %s\n", c->name);
+    }
+
+    /* nothing knows the method yet: the writer refuses it, and so does the
+       reader, given a stored entry whose method is changed to it */
+    memset(&zi, 0, sizeof(zi));
+    zf = zipOpen64(path, APPEND_STATUS_CREATE);
+    TU_CHECK(zf != NULL);
+    TU_CHECK(zipOpenNewFileInZip64(zf, "x", &zi, NULL, 0, NULL, 0, NULL, Z_TEST_XOR, 0, 0) == ZIP_PARAMERROR);
+    TU_CHECK(zipOpenNewFileInZip64(zf, "x", &zi, NULL, 0, NULL, 0, NULL, 0, 0, 0) == ZIP_OK);
+    TU_CHECK(zipWriteInFileInZip(zf, "data", 4) == ZIP_OK);
+    TU_CHECK(zipCloseFileInZip(zf) == ZIP_OK);
+    TU_CHECK(zipClose(zf, NULL) == ZIP_OK);
+    set_method(path, Z_TEST_XOR);
+    {
+        unzFile uf = unzOpen64(path);
+        TU_CHECK(uf != NULL);
+        TU_CHECK(unzGoToFirstFile(uf) == UNZ_OK);
+        TU_CHECK(unzOpenCurrentFile(uf) == UNZ_BADZIPFILE);
+        TU_CHECK(unzClose(uf) == UNZ_OK);
+    }
+    printf("ok: an unknown method is refused\n");
+
+    TU_CHECK(lk_method_register(NULL) == -1);
+    TU_CHECK(lk_method_register(&xor_method) == 0);
+    write_entries(path, Z_TEST_XOR, 0, data);
+    check_entries(path, Z_TEST_XOR, data, got);
+    printf("ok: a registered method\n");
+
+    {
+        lk_method broken = xor_method;
+        broken.decompress = NULL;
+        TU_CHECK(lk_method_register(&broken) == -1);
+        broken = xor_method;
+        broken.method = Z_DEFLATED;
+        TU_CHECK(lk_method_register(&broken) == -1);
+    }
+
+    {
+        static lk_method as_zstd;
+        as_zstd = xor_method;
+        as_zstd.method = Z_ZSTD;
+        TU_CHECK(lk_method_register(&as_zstd) == 0);
+        TU_CHECK(lk_method_find(Z_ZSTD) == &as_zstd);
+        write_entries(path, Z_ZSTD, 0, data);
+        check_entries(path, Z_ZSTD, data, got);
+        printf("ok: a registered method replaces the built in one of its number\n");
+    }
+
+    free(got);
+    free(data);
+    remove(path);
+}
+
+/* ===========================================================================
+   the benchmark
+*/
+static void bench(void)
+{
+    const char* path = tu_path("method_bench.zip");
+    const long files = 240;
+    const size_t file_size = 200 * 1024;
+    unsigned char* data = (unsigned char*)malloc(file_size);
+    unsigned char* buffer = (unsigned char*)malloc(256 * 1024);
+    double megabytes = (double)files * file_size / (1 << 20);
+    size_t k;
+
+    TU_CHECK(data != NULL && buffer != NULL);
+    printf("%ld files of %luKB, %.0fMB, 3/4 text\n", files, (unsigned long)(file_size >> 10), megabytes);
+    printf("%-12s %7s %12s %12s\n", "", "size", "compress", "decompress");
+    for (k = 0; k < CODEC_COUNT; k++)
+    {
+        const codec* c = &all_codecs[k];
+        ZPOS64_T compressed = 0;
+        double start, write_seconds, read_seconds;
+        unz_file_info64 info;
+        zipFile zf;
+        unzFile uf;
+        long i;
+        int err, n;
+
+        if (!available(c))
+            continue;
+        start = tu_now();
+        zf = zipOpen64(path, APPEND_STATUS_CREATE);
+        TU_CHECK(zf != NULL);
+        for (i = 0; i < files; i++)
+        {
+            zip_fileinfo zi;
+            memset(&zi, 0, sizeof(zi));
+            if (i % 4 == 3)
+                tu_fill_random(data, file_size, (unsigned long long)i);
+            else
+                tu_fill_text(data, file_size, (unsigned long long)i);
+            TU_CHECK(zipOpenNewFileInZip64(zf, tu_entry_name(i), &zi, NULL, 0, NULL, 0, NULL, c->method, c->level, 0) == ZIP_OK);
+            TU_CHECK(zipWriteInFileInZip(zf, data, (unsigned)file_size) == ZIP_OK);
+            TU_CHECK(zipCloseFileInZip(zf) == ZIP_OK);
+        }
+        TU_CHECK(zipClose(zf, NULL) == ZIP_OK);
+        write_seconds = tu_now() - start;
+
+        start = tu_now();
+        uf = unzOpen64(path);
+        TU_CHECK(uf != NULL);
+        for (err = unzGoToFirstFile(uf); err == UNZ_OK; err = unzGoToNextFile(uf))
+        {
+            TU_CHECK(unzGetCurrentFileInfo64(uf, &info, NULL, 0, NULL, 0, NULL, 0) == UNZ_OK);
+            compressed += info.compressed_size;
+            TU_CHECK(unzOpenCurrentFile(uf) == UNZ_OK);
+            while ((n = unzReadCurrentFile(uf, buffer, 256 * 1024)) > 0)
+                ;
+            TU_CHECK(n == 0);
+            TU_CHECK(unzCloseCurrentFile(uf) == UNZ_OK);
+        }
+        TU_CHECK(unzClose(uf) == UNZ_OK);
+        read_seconds = tu_now() - start;
+
+        printf("%-12s %6.1f%% %7.1f MB/s %7.1f MB/s\n", c->name,
+               100.0 * (double)compressed / ((double)files * file_size),
+               megabytes / write_seconds, megabytes / read_seconds);
+    }
+    free(buffer);
+    free(data);
+    remove(path);
+}
+
+int main(int argc, char** argv)
+{
+    if (tu_bench_mode(argc, argv))
+        bench();
+    else
+        test();
+    return 0;
+}
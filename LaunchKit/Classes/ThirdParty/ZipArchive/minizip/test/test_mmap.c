@@ -0,0 +1,325 @@
+/* test_mmap.c -- the mmap file functions of lk_ioapi.c
+
+   fill_mmap_filefunc64 maps the whole zipfile, read only, and unzOpen3_64
+   reads it through the mapping. The test writes zipfiles of stored and
+   deflated entries whose sizes end one byte before, on and one byte after
+   a page boundary, and whose own size does the same (a global comment
+   pads them), and checks that each entry, its information and the comment
+   read through the mapping are those read through stdio, that stored
+   entries can be read in place only when mapped, and that the map, read,
+   pread and seek functions give the bytes of the file up to its last one.
+   The mmap functions must refuse to write, and to open a missing file; an
+   empty file opens but is no zipfile.
+
+   With -b, extracts 32 entries of 2MB of text, deflated then stored,
+   through stdio and through the mapping, and prints the MB/s of each.
+
+   License: Same as ZLIB (www.gzip.org)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "lk_unzip.h"
+#include "lk_zip.h"
+#include "testutil.h"
+
+#define COMMENT_SIZE_MAX 0xffff
+
+static size_t page_size;
+
+static size_t entry_size(long i)
+{
+    const size_t sizes[] = { 0, 1, page_size - 1, page_size, page_size + 1, 3 * page_size + 100 };
+    return sizes[(i / 2) % 6];
+}
+
+static size_t largest_entry_size(void)
+{
+    return entry_size(10);
+}
+
+/* stored and deflated in turn */
+static int entry_method(long i)
+{
+    return (i % 2 == 0) ? 0 : Z_DEFLATED;
+}
+
+static void entry_data(long i, unsigned char* data)
+{
+    tu_fill_text(data, entry_size(i), (unsigned long long)i);
+}
+
+static long file_size(const char* path)
+{
+    FILE* f = fopen(path, "rb");
+    long size;
+    TU_CHECK(f != NULL);
+    TU_CHECK(fseek(f, 0, SEEK_END) == 0);
+    size = ftell(f);
+    fclose(f);
+    return size;
+}
+
+/* entries zipfile of a size end_offset bytes away from a page boundary */
+static void make_archive(const char* path, long entries, int end_offset, char* comment)
+{
+    unsigned char* data = (unsigned char*)malloc(largest_entry_size() + 1);
+    zip_fileinfo zi;
+    zipFile zf;
+    long size, target = 0, i;
+
+    /* the size without a comment, then with the comment which pads it */
+    comment[0] = '\0';
+    for (;;)
+    {
+        zf = zipOpen64(path, APPEND_STATUS_CREATE);
+        TU_CHECK(zf != NULL && data != NULL);
+        memset(&zi, 0, sizeof(zi));
+        for (i = 0; i < entries; i++)
+        {
+            int method = entry_method(i);
+            entry_data(i, data);
+            TU_CHECK(zipOpenNewFileInZip64(zf, tu_entry_name(i), &zi, NULL, 0, NULL, 0, NULL,
+                                           method, method ? 6 : 0, 0) == ZIP_OK);
+            TU_CHECK(zipWriteInFileInZip(zf, data, (unsigned)entry_size(i)) == ZIP_OK);
+            TU_CHECK(zipCloseFileInZip(zf) == ZIP_OK);
+        }
+        TU_CHECK(zipClose(zf, comment) == ZIP_OK);
+        size = file_size(path);
+        if (comment[0] != '\0')
+            break;
+        target = (long)((size / page_size + 2) * page_size) + end_offset;
+        TU_CHECK(target - size <= COMMENT_SIZE_MAX);
+        memset(comment, 'c', (size_t)(target - size));
+        comment[target - size] = '\0';
+    }
+    TU_CHECK(size == target);
+    TU_CHECK((size + page_size - (size_t)end_offset) % page_size == 0);
+    free(data);
+}
+
+static unsigned char* read_file(const char* path, long* size)
+{
+    unsigned char* bytes;
+    FILE* f = fopen(path, "rb");
+
+    *size = file_size(path);
+    bytes = (unsigned char*)malloc((size_t)*size);
+    TU_CHECK(f != NULL && bytes != NULL);
+    TU_CHECK(fread(bytes, 1, (size_t)*size, f) == (size_t)*size);
+    fclose(f);
+    return bytes;
+}
+
+/* ---- the tests ---- */
+
+/* the file functions by themselves, on the bytes of the file */
+static void check_functions(const char* path)
+{
+    zlib_filefunc64_ex_def functions;
+    zlib_filefunc64_def* f = &functions.zfile_func64;
+    unsigned char tail[16];
+    const unsigned char* base;
+    unsigned char* bytes;
+    ZPOS64_T size = 0;
+    long expected_size;
+    voidpf stream;
+
+    bytes = read_file(path, &expected_size);
+    fill_mmap_filefunc64(&functions);
+    stream = f->zopen64_file(f->opaque, path, ZLIB_FILEFUNC_MODE_READ | ZLIB_FILEFUNC_MODE_EXISTING);
+    TU_CHECK(stream != NULL);
+
+    base = (const unsigned char*)functions.zmap64_file(f->opaque, stream, &size);
+    TU_CHECK(base != NULL && size == (ZPOS64_T)expected_size);
+    TU_CHECK(memcmp(base, bytes, (size_t)size) == 0);
+
+    /* the last bytes, by a read cut short at the end, and by pread */
+    TU_CHECK(f->zseek64_file(f->opaque, stream, 0, ZLIB_FILEFUNC_SEEK_END) == 0);
+    TU_CHECK(f->ztell64_file(f->opaque, stream) == size);
+    TU_CHECK(f->zseek64_file(f->opaque, stream, size - 5, ZLIB_FILEFUNC_SEEK_SET) == 0);
+    TU_CHECK(f->zread_file(f->opaque, stream, tail, sizeof(tail)) == 5);
+    TU_CHECK(memcmp(tail, bytes + size - 5, 5) == 0);
+    TU_CHECK(f->zread_file(f->opaque, stream, tail, sizeof(tail)) == 0);
+    TU_CHECK(functions.zpread64_file(f->opaque, stream, tail, sizeof(tail), size - 1) == 1);
+    TU_CHECK(tail[0] == bytes[size - 1]);
+    TU_CHECK(functions.zpread64_file(f->opaque, stream, tail, sizeof(tail), size) == 0);
+    /* pread leaves the position alone */
+    TU_CHECK(f->ztell64_file(f->opaque, stream) == size);
+    TU_CHECK(f->zerror_file(f->opaque, stream) == 0);
+    TU_CHECK(f->zclose_file(f->opaque, stream) == 0);
+    free(bytes);
+}
+
+/* every entry through stdio and through the mapping */
+static void check_entries(const char* path, long entries, const char* comment)
+{
+    zlib_filefunc64_ex_def functions;
+    unsigned char* data = (unsigned char*)malloc(largest_entry_size() + 1);
+    unsigned char* got[2];
+    char got_comment[COMMENT_SIZE_MAX + 1];
+    unz_file_info64 info[2];
+    unzFile uf[2];
+    long i;
+    int h;
+
+    fill_mmap_filefunc64(&functions);
+    uf[0] = unzOpen64(path);
+    uf[1] = unzOpen3_64(path, &functions);
+    TU_CHECK(uf[0] != NULL && uf[1] != NULL && data != NULL);
+    for (h = 0; h < 2; h++)
+    {
+        got[h] = (unsigned char*)malloc(largest_entry_size() + 1);
+        TU_CHECK(got[h] != NULL);
+        TU_CHECK(unzGetGlobalComment(uf[h], got_comment, sizeof(got_comment)) == (int)strlen(comment));
+        TU_CHECK(strcmp(got_comment, comment) == 0);
+        TU_CHECK(unzGoToFirstFile(uf[h]) == UNZ_OK);
+    }
+
+    for (i = 0; i < entries; i++)
+    {
+        size_t size = entry_size(i);
+        entry_data(i, data);
+        for (h = 0; h < 2; h++)
+        {
+            const void* in_place;
+            size_t total = 0;
+            int n;
+
+            TU_CHECK(unzGetCurrentFileInfo64(uf[h], &info[h], NULL, 0, NULL, 0, NULL, 0) == UNZ_OK);
+            TU_CHECK(unzOpenCurrentFile(uf[h]) == UNZ_OK);
+            /* a stored entry is read in place only from the mapping */
+            n = unzReadCurrentFileMapped(uf[h], &in_place, (unsigned)size);
+            if ((entry_method(i) == 0) && (h == 1))
+            {
+                TU_CHECK(n == (int)size);
+                TU_CHECK((size == 0) || (memcmp(in_place, data, size) == 0));
+                TU_CHECK(unzCloseCurrentFile(uf[h]) == UNZ_OK);
+                TU_CHECK(unzOpenCurrentFile(uf[h]) == UNZ_OK);
+            }
+            else
+                TU_CHECK(n == UNZ_PARAMERROR);
+            /* in reads which are not a multiple of the page */
+            while ((n = unzReadCurrentFile(uf[h], got[h] + total, 1000)) > 0)
+                total += (size_t)n;
+            TU_CHECK(n == 0);
+            TU_CHECK(total == size);
+            TU_CHECK(unzCloseCurrentFile(uf[h]) == UNZ_OK);
+        }
+        TU_CHECK(memcmp(got[0], data, size) == 0);
+        TU_CHECK(memcmp(got[1], got[0], size) == 0);
+        TU_CHECK(info[1].crc == info[0].crc);
+        TU_CHECK(info[1].compressed_size == info[0].compressed_size);
+        TU_CHECK(info[1].uncompressed_size == info[0].uncompressed_size);
+        TU_CHECK(info[1].compression_method == info[0].compression_method);
+        for (h = 0; h < 2; h++)
+            TU_CHECK(unzGoToNextFile(uf[h]) == ((i + 1 < entries) ? UNZ_OK : UNZ_END_OF_LIST_OF_FILE));
+    }
+
+    for (h = 0; h < 2; h++)
+    {
+        TU_CHECK(unzClose(uf[h]) == UNZ_OK);
+        free(got[h]);
+    }
+    free(data);
+}
+
+static void check_refusals(void)
+{
+    const char* path = tu_path("mmap_refused.zip");
+    zlib_filefunc64_ex_def functions;
+    FILE* f;
+
+    fill_mmap_filefunc64(&functions);
+    remove(path);
+    TU_CHECK(zipOpen2_64(path, APPEND_STATUS_CREATE, NULL, &functions.zfile_func64) == NULL);
+    TU_CHECK(unzOpen3_64(path, &functions) == NULL);
+    f = fopen(path, "wb");
+    TU_CHECK(f != NULL);
+    fclose(f);
+    TU_CHECK(unzOpen3_64(path, &functions) == NULL);
+    remove(path);
+    printf("ok: the mmap functions refuse to write and to open a missing file, an empty one is no zipfile\n");
+}
+
+static void test(void)
+{
+    char path[300];
+    char* comment = (char*)malloc(COMMENT_SIZE_MAX + 1);
+    const long entries = 12;
+    int end_offset;
+
+    TU_CHECK(comment != NULL);
+    snprintf(path, sizeof(path), "%s", tu_path("mmap.zip"));
+    for (end_offset = -1; end_offset <= 1; end_offset++)
+    {
+        make_archive(path, entries, end_offset, comment);
+        check_functions(path);
+        check_entries(path, entries, comment);
+        printf("ok: a zipfile of %ld bytes, %+d from a page boundary, reads the same mapped as with stdio\n",
+               file_size(path), end_offset);
+    }
+    remove(path);
+    free(comment);
+    check_refusals();
+}
+
+/* ---- the benchmark ---- */
+
+static double extract_all(const char* path, int mapped, long entries, size_t size)
+{
+    zlib_filefunc64_ex_def functions;
+    unsigned char* buffer = (unsigned char*)malloc(256 * 1024);
+    double start = tu_now();
+    size_t total = 0;
+    unzFile uf;
+    int err, n;
+
+    fill_mmap_filefunc64(&functions);
+    uf = mapped ? unzOpen3_64(path, &functions) : unzOpen64(path);
+    TU_CHECK(uf != NULL && buffer != NULL);
+    for (err = unzGoToFirstFile(uf); err == UNZ_OK; err = unzGoToNextFile(uf))
+    {
+        TU_CHECK(unzOpenCurrentFile(uf) == UNZ_OK);
+        while ((n = unzReadCurrentFile(uf, buffer, 256 * 1024)) > 0)
+            total += (size_t)n;
+        TU_CHECK(n == 0);
+        TU_CHECK(unzCloseCurrentFile(uf) == UNZ_OK);
+    }
+    TU_CHECK(err == UNZ_END_OF_LIST_OF_FILE);
+    TU_CHECK(total == (size_t)entries * size);
+    TU_CHECK(unzClose(uf) == UNZ_OK);
+    free(buffer);
+    return tu_now() - start;
+}
+
+static void bench(void)
+{
+    const char* path = tu_path("mmap_bench.zip");
+    const long entries = 32;
+    const size_t size = 2 << 20;
+    double megabytes = (double)entries * size / (1 << 20);
+    int method, mapped;
+
+    for (method = Z_DEFLATED; method >= 0; method -= Z_DEFLATED)
+    {
+        TU_CHECK(tu_make_archive(path, entries, size, method, method ? 6 : 0) == ZIP_OK);
+        /* once to have the file in the page cache */
+        extract_all(path, 0, entries, size);
+        for (mapped = 0; mapped < 2; mapped++)
+            printf("%s, %s: %.0f MB/s\n", method ? "deflated" : "stored", mapped ? "mmap" : "stdio",
+                   megabytes / extract_all(path, mapped, entries, size));
+    }
+    remove(path);
+}
+
+int main(int argc, char** argv)
+{
+    page_size = (size_t)sysconf(_SC_PAGESIZE);
+    test();
+    if (tu_bench_mode(argc, argv))
+        bench();
+    return 0;
+}
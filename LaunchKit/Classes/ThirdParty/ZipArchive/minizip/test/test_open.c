@@ -0,0 +1,186 @@
+/* test_open.c -- finding the end of central directory
+
+   unzOpen and zipOpen with APPEND_STATUS_ADDINZIP find the end of central
+   directory record, and the zip64 locator, with one read of the end of the
+   file. Archives must open with global comments of every length from 0 to
+   64 bytes (so the record lands at every position of a 16 byte block), of
+   1000 bytes and of the largest 65535 bytes, with "PK" pairs in the comment,
+   with and without a zip64 end record, and small enough for the whole file
+   to be shorter than the tail read. Appending to them with
+   APPEND_STATUS_ADDINZIP keeps their entries and comment. A file which is
+   not a zipfile must not open.
+
+   With -b, times unzOpen64 and unzClose on archives with large comments.
+
+   License: Same as ZLIB (www.gzip.org)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lk_unzip.h"
+#include "lk_zip.h"
+#include "testutil.h"
+
+#define MAX_COMMENT 65535
+
+static void make_comment(char* comment, size_t len)
+{
+    size_t i;
+    tu_fill_text((unsigned char*)comment, len, len);
+    /* "PK" pairs, which must not be taken for a signature */
+    for (i = 5; i + 2 <= len; i += 97)
+    {
+        comment[i] = 'P';
+        comment[i + 1] = 'K';
+    }
+    comment[len] = '\0';
+}
+
+static void make_archive(const char* path, long entries, const char* comment)
+{
+    zipFile zf = zipOpen64(path, APPEND_STATUS_CREATE);
+    long i;
+
+    TU_CHECK(zf != NULL);
+    for (i = 0; i < entries; i++)
+    {
+        zip_fileinfo zi;
+        memset(&zi, 0, sizeof(zi));
+        TU_CHECK(zipOpenNewFileInZip64(zf, tu_entry_name(i), &zi, NULL, 0, NULL, 0, NULL, 0, 0, 0) == ZIP_OK);
+        TU_CHECK(zipWriteInFileInZip(zf, "data", 4) == ZIP_OK);
+        TU_CHECK(zipCloseFileInZip(zf) == ZIP_OK);
+    }
+    TU_CHECK(zipClose(zf, comment) == ZIP_OK);
+}
+
+static void check_archive(const char* path, ZPOS64_T entries, const char* comment)
+{
+    static char got[MAX_COMMENT + 1];
+    unz_global_info64 gi;
+    unzFile uf = unzOpen64(path);
+
+    TU_CHECK(uf != NULL);
+    TU_CHECK(unzGetGlobalInfo64(uf, &gi) == UNZ_OK);
+    TU_CHECK(gi.number_entry == entries);
+    TU_CHECK(gi.size_comment == strlen(comment));
+    TU_CHECK(unzGetGlobalComment(uf, got, sizeof(got)) == (int)strlen(comment));
+    TU_CHECK(strcmp(got, comment) == 0);
+    TU_CHECK(unzGoToFirstFile(uf) == UNZ_OK);
+    TU_CHECK(unzLocateFile(uf, tu_entry_name((long)entries - 1), 1) == UNZ_OK);
+    TU_CHECK(unzClose(uf) == UNZ_OK);
+}
+
+static void append_entry(const char* path, long i)
+{
+    zip_fileinfo zi;
+    zipFile zf = zipOpen64(path, APPEND_STATUS_ADDINZIP);
+
+    TU_CHECK(zf != NULL);
+    memset(&zi, 0, sizeof(zi));
+    TU_CHECK(zipOpenNewFileInZip64(zf, tu_entry_name(i), &zi, NULL, 0, NULL, 0, NULL, Z_DEFLATED, 6, 0) == ZIP_OK);
+    TU_CHECK(zipWriteInFileInZip(zf, "appended", 8) == ZIP_OK);
+    TU_CHECK(zipCloseFileInZip(zf) == ZIP_OK);
+    /* a NULL comment keeps the one of the archive */
+    TU_CHECK(zipClose(zf, NULL) == ZIP_OK);
+}
+
+static void test(void)
+{
+    const char* path = tu_path("open.zip");
+    static char comment[MAX_COMMENT + 1];
+    size_t lengths[] = { 1000, 65000, MAX_COMMENT };
+    size_t len;
+    FILE* f;
+    int k;
+
+    for (len = 0; len <= 64; len++)
+    {
+        make_comment(comment, len);
+        make_archive(path, 1, comment);
+        check_archive(path, 1, comment);
+        append_entry(path, 1);
+        check_archive(path, 2, comment);
+    }
+    printf("ok: archives of one entry with comments of 0 to 64 bytes\n");
+
+    for (k = 0; k < (int)(sizeof(lengths) / sizeof(lengths[0])); k++)
+    {
+        make_comment(comment, lengths[k]);
+        make_archive(path, 20, comment);
+        check_archive(path, 20, comment);
+        append_entry(path, 20);
+        check_archive(path, 21, comment);
+    }
+    printf("ok: comments of 1000, 65000 and 65535 bytes\n");
+
+    /* 0xffff entries need the zip64 end of central directory record */
+    make_comment(comment, 60000);
+    make_archive(path, 0xffff, comment);
+    check_archive(path, 0xffff, comment);
+    append_entry(path, 0xffff);
+    check_archive(path, 0x10000, comment);
+    printf("ok: zip64 end of central directory with a 60000 byte comment\n");
+
+    /* not a zipfile, shorter and longer than the tail read */
+    f = fopen(path, "wb");
+    TU_CHECK(f != NULL);
+    fputs("PK\003\004 not a zipfile", f);
+    fclose(f);
+    TU_CHECK(unzOpen64(path) == NULL);
+    TU_CHECK(zipOpen64(path, APPEND_STATUS_ADDINZIP) == NULL);
+    f = fopen(path, "wb");
+    TU_CHECK(f != NULL);
+    for (k = 0; k < 100000; k++)
+        fputs("PK\005", f);
+    fclose(f);
+    TU_CHECK(unzOpen64(path) == NULL);
+    printf("ok: files which are not zipfiles are refused\n");
+    remove(path);
+}
+
+static void bench_open(const char* name, const char* path)
+{
+    const int opens = 2000;
+    double start = tu_now(), elapsed;
+    int i;
+
+    for (i = 0; i < opens; i++)
+    {
+        unzFile uf = unzOpen64(path);
+        TU_CHECK(uf != NULL);
+        TU_CHECK(unzClose(uf) == UNZ_OK);
+    }
+    elapsed = tu_now() - start;
+    printf("%-40s %6.1f us/open\n", name, elapsed / opens * 1e6);
+}
+
+static void bench(void)
+{
+    const char* path = tu_path("open_bench.zip");
+    const char* path64 = tu_path("open_bench64.zip");
+    static char comment[MAX_COMMENT + 1];
+
+    make_comment(comment, 0);
+    make_archive(path, 1, comment);
+    bench_open("1 entry, no comment", path);
+
+    make_comment(comment, 65000);
+    make_archive(path, 1, comment);
+    bench_open("1 entry, 65000 byte comment", path);
+
+    make_comment(comment, 60000);
+    make_archive(path64, 0xffff, comment);
+    bench_open("65535 entries (zip64), 60000 byte comment", path64);
+    remove(path);
+    remove(path64);
+}
+
+int main(int argc, char** argv)
+{
+    if (tu_bench_mode(argc, argv))
+        bench();
+    else
+        test();
+    return 0;
+}
@@ -0,0 +1,160 @@
+/* test_pdeflate.c -- deflating entries on worker threads
+
+   With zipSetParallelDeflate, entries are deflated in 128KB blocks on a
+   pool of workers and joined into one deflate stream. The test writes
+   entries of sizes around the block size and its multiples, text and random
+   data, with 0, 1, 2 and 4 workers, and checks that they read back with
+   their CRC, and that the compressed size stays within 0.5% of the serial
+   one. Built against the _counted lk_zip.c, it also checks that the writer
+   frees every buffer of the pool.
+
+   With -b, writes a 64MB entry of text serially, then with 1, 2 and 4
+   workers (up to the number of processors when there are more), and prints
+   the throughput.
+
+   License: Same as ZLIB (www.gzip.org)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lk_unzip.h"
+#include "lk_zip.h"
+#include "testutil.h"
+
+#define BLOCK (128 * 1024)
+
+static const size_t sizes[] = {
+    0, 1, BLOCK - 1, BLOCK, BLOCK + 1, 3 * BLOCK, 3 * BLOCK + 77, 5 * 1024 * 1024 + 3
+};
+#define SIZE_COUNT (sizeof(sizes) / sizeof(sizes[0]))
+
+static void entry_data(unsigned char* data, size_t i, size_t size)
+{
+    if (i % 2 == 0)
+        tu_fill_text(data, size, i);
+    else
+        tu_fill_random(data, size, i);
+}
+
+/* write two entries of each of sizes, of text and of random data */
+static void write_archive(const char* path, int threads, unsigned char* data)
+{
+    zipFile zf;
+    size_t i;
+
+    memset(&tu_allocs, 0, sizeof(tu_allocs));
+    zf = zipOpen64(path, APPEND_STATUS_CREATE);
+    TU_CHECK(zf != NULL);
+    TU_CHECK(zipSetParallelDeflate(zf, threads) == ZIP_OK);
+    for (i = 0; i < 2 * SIZE_COUNT; i++)
+    {
+        zip_fileinfo zi;
+        size_t size = sizes[i / 2];
+        memset(&zi, 0, sizeof(zi));
+        entry_data(data, i, size);
+        TU_CHECK(zipOpenNewFileInZip64(zf, tu_entry_name((long)i), &zi, NULL, 0, NULL, 0, NULL,
+                                       Z_DEFLATED, 6, size >= 0xffffffff) == ZIP_OK);
+        TU_CHECK(zipWriteInFileInZip(zf, data, (unsigned)size) == ZIP_OK);
+        TU_CHECK(zipCloseFileInZip(zf) == ZIP_OK);
+    }
+    TU_CHECK(zipClose(zf, NULL) == ZIP_OK);
+    TU_CHECK(tu_allocs.allocs == tu_allocs.frees);
+}
+
+static ZPOS64_T check_archive(const char* path, unsigned char* expected, unsigned char* got)
+{
+    unz_file_info64 info;
+    ZPOS64_T compressed = 0;
+    unzFile uf = unzOpen64(path);
+    size_t i;
+
+    TU_CHECK(uf != NULL);
+    for (i = 0; i < 2 * SIZE_COUNT; i++)
+    {
+        size_t size = sizes[i / 2];
+        TU_CHECK(unzLocateFile(uf, tu_entry_name((long)i), 1) == UNZ_OK);
+        TU_CHECK(unzGetCurrentFileInfo64(uf, &info, NULL, 0, NULL, 0, NULL, 0) == UNZ_OK);
+        TU_CHECK(info.uncompressed_size == size);
+        entry_data(expected, i, size);
+        TU_CHECK(info.crc == crc32(0L, expected, (uInt)size));
+        TU_CHECK(unzOpenCurrentFile(uf) == UNZ_OK);
+        TU_CHECK(unzReadCurrentFile(uf, got, (unsigned)size + 1) == (int)size);
+        /* unzCloseCurrentFile checks the CRC */
+        TU_CHECK(unzCloseCurrentFile(uf) == UNZ_OK);
+        TU_CHECK(memcmp(got, expected, size) == 0);
+        compressed += info.compressed_size;
+    }
+    TU_CHECK(unzClose(uf) == UNZ_OK);
+    return compressed;
+}
+
+static void test(void)
+{
+    const char* path = tu_path("pdeflate.zip");
+    const size_t max_size = sizes[SIZE_COUNT - 1];
+    unsigned char* data = (unsigned char*)malloc(max_size);
+    unsigned char* got = (unsigned char*)malloc(max_size + 1);
+    int threads[] = { 0, 1, 2, 4 };
+    ZPOS64_T serial = 0;
+    int k;
+
+    TU_CHECK(data != NULL && got != NULL);
+    for (k = 0; k < (int)(sizeof(threads) / sizeof(threads[0])); k++)
+    {
+        ZPOS64_T compressed;
+        write_archive(path, threads[k], data);
+        compressed = check_archive(path, data, got);
+        if (threads[k] == 0)
+            serial = compressed;
+        TU_CHECK(compressed <= serial + serial / 200);
+        printf("ok: %d worker(s), %llu compressed bytes (%llu serial), %lu allocations all freed\n",
+               threads[k], (unsigned long long)compressed, (unsigned long long)serial, tu_allocs.allocs);
+    }
+    free(got);
+    free(data);
+    remove(path);
+}
+
+static void bench_one(const char* path, int threads, const unsigned char* data, size_t size)
+{
+    zip_fileinfo zi;
+    double start = tu_now(), elapsed;
+    zipFile zf = zipOpen64(path, APPEND_STATUS_CREATE);
+
+    TU_CHECK(zf != NULL);
+    TU_CHECK(zipSetParallelDeflate(zf, threads) == ZIP_OK);
+    memset(&zi, 0, sizeof(zi));
+    TU_CHECK(zipOpenNewFileInZip64(zf, "large.txt", &zi, NULL, 0, NULL, 0, NULL, Z_DEFLATED, 6, 0) == ZIP_OK);
+    TU_CHECK(zipWriteInFileInZip(zf, data, (unsigned)size) == ZIP_OK);
+    TU_CHECK(zipCloseFileInZip(zf) == ZIP_OK);
+    TU_CHECK(zipClose(zf, NULL) == ZIP_OK);
+    elapsed = tu_now() - start;
+    printf("%2d worker(s) %6.0f ms %6.1f MB/s\n", threads, elapsed * 1e3, (double)(size >> 20) / elapsed);
+}
+
+static void bench(void)
+{
+    const char* path = tu_path("pdeflate_bench.zip");
+    const size_t size = 64 << 20;
+    unsigned char* data = (unsigned char*)malloc(size);
+    int max_threads = tu_cpu_count() > 4 ? tu_cpu_count() : 4;
+    int threads;
+
+    TU_CHECK(data != NULL);
+    tu_fill_text(data, size, 1);
+    printf("%d processor(s), a %luMB entry of text at level 6\n", tu_cpu_count(), (unsigned long)(size >> 20));
+    for (threads = 0; threads <= max_threads; threads = threads ? threads * 2 : 1)
+        bench_one(path, threads, data, size);
+    free(data);
+    remove(path);
+}
+
+int main(int argc, char** argv)
+{
+    if (tu_bench_mode(argc, argv))
+        bench();
+    else
+        test();
+    return 0;
+}
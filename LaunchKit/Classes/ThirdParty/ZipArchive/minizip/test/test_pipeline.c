@@ -0,0 +1,491 @@
+/* test_pipeline.c -- the zip pipeline of LK_SSZipArchive, in C
+
+   -_writeFilesAtPaths:withFileNames:placeholders: of LK_SSZipArchive deflates
+   the files on a pool of workers, each into its own buffer and at most 4
+   files per worker ahead of the commit, while the calling thread commits the
+   deflated streams in order with zipOpenNewFileInZip4_64 (raw=1) and
+   zipCloseFileInZipRaw64. The buffers waiting for their turn, of
+   deflateBound bytes, take at most 32MB: a worker waits for room before
+   deflating, unless its file is the next to commit. Files larger than 16MB,
+   and those a worker could not deflate, are written in turn like
+   writeFileAtPath: does, 16KB at a time. This is the same loop with
+   pthreads in place of GCD.
+
+   The test zips a directory of text and random files, with empty files, a
+   file larger than 16MB and a file which does not exist (skipped), with 1,
+   2 and 4 workers, and checks that every entry has the same sizes, CRC and
+   deflated bytes as when the files are written one after the other. With
+   a commit slowed down, as on slow storage, the files up to 300KB go
+   through again with a budget of 1MB: the buffers must never take more
+   than the budget plus the buffer of the largest file, which they do
+   without a budget.
+
+   With -b, zips 400 files of 300KB (3/4 text) one after the other, then
+   through the pipeline with 1, 2 and 4 workers (up to the number of
+   processors when there are more), and prints the throughput.
+
+   License: Same as ZLIB (www.gzip.org)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "lk_crc32.h"
+#include "lk_unzip.h"
+#include "lk_zip.h"
+#include "testutil.h"
+
+#define CHUNK 16384
+#define PIPELINE_MAX_ENTRY_SIZE (16 * 1024 * 1024)
+#define PIPELINE_MAX_PENDING_BYTES (32 * 1024 * 1024)
+
+typedef struct
+{
+    uLong crc;
+    ZPOS64_T uncompressed_size;
+    unsigned char* deflated;
+    size_t deflated_size;
+    size_t pending_bytes;
+    int deferred;
+    int failed;
+    int done;
+} pending_entry;
+
+typedef struct
+{
+    char** paths;
+    long count;
+    pending_entry* entries;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    long next_index;
+    long next_commit;
+    long window;
+    size_t pending_bytes;
+    size_t max_pending_bytes;
+    size_t peak_pending_bytes;
+} pipeline;
+
+/* microseconds each commit takes longer, as on slow storage */
+static useconds_t commit_delay;
+
+/* writeFileAtPath: */
+static void write_file(zipFile zf, const char* path, const char* name)
+{
+    unsigned char buffer[CHUNK];
+    zip_fileinfo zi;
+    size_t len;
+    FILE* input = fopen(path, "rb");
+
+    if (input == NULL)
+        return;
+    memset(&zi, 0, sizeof(zi));
+    TU_CHECK(zipOpenNewFileInZip(zf, name, &zi, NULL, 0, NULL, 0, NULL, Z_DEFLATED, Z_DEFAULT_COMPRESSION) == ZIP_OK);
+    while ((len = fread(buffer, 1, CHUNK, input)) > 0)
+        TU_CHECK(zipWriteInFileInZip(zf, buffer, (unsigned)len) == ZIP_OK);
+    TU_CHECK(zipCloseFileInZip(zf) == ZIP_OK);
+    fclose(input);
+}
+
+/* deflate the file of entry i in one shot, as the workers of the pipeline do */
+static void deflate_file(pipeline* p, long i, z_stream* stream, pending_entry* entry)
+{
+    struct stat st;
+    unsigned char* data = NULL;
+    int fd = open(p->paths[i], O_RDONLY);
+
+    if (fd == -1 || fstat(fd, &st) != 0)
+    {
+        /* skipped, as writeFileAtPath: does with a file it can not open */
+        entry->failed = 1;
+        if (fd != -1)
+            close(fd);
+        return;
+    }
+    if (st.st_size > PIPELINE_MAX_ENTRY_SIZE)
+    {
+        entry->deferred = 1;
+        close(fd);
+        return;
+    }
+    if (st.st_size > 0)
+    {
+        data = (unsigned char*)mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        TU_CHECK(data != MAP_FAILED);
+    }
+    close(fd);
+
+    /* wait for room in the buffers, unless the entry is the next to commit,
+       as the buffers of the later ones are only freed after it */
+    entry->deflated_size = deflateBound(stream, (uLong)st.st_size);
+    pthread_mutex_lock(&p->lock);
+    while ((p->pending_bytes > 0) && (p->pending_bytes + entry->deflated_size > p->max_pending_bytes) &&
+           (i != p->next_commit))
+        pthread_cond_wait(&p->cond, &p->lock);
+    p->pending_bytes += entry->deflated_size;
+    if (p->pending_bytes > p->peak_pending_bytes)
+        p->peak_pending_bytes = p->pending_bytes;
+    pthread_mutex_unlock(&p->lock);
+    entry->pending_bytes = entry->deflated_size;
+
+    deflateReset(stream);
+    entry->deflated = (unsigned char*)malloc(entry->deflated_size);
+    TU_CHECK(entry->deflated != NULL);
+    stream->next_in = data;
+    stream->avail_in = (uInt)st.st_size;
+    stream->next_out = entry->deflated;
+    stream->avail_out = (uInt)entry->deflated_size;
+    if (deflate(stream, Z_FINISH) == Z_STREAM_END)
+    {
+        entry->deflated_size = stream->total_out;
+        entry->crc = lk_crc32(0L, data, (uInt)st.st_size);
+        entry->uncompressed_size = (ZPOS64_T)st.st_size;
+    }
+    else
+    {
+        free(entry->deflated);
+        entry->deflated = NULL;
+        entry->deferred = 1;
+    }
+    if (data != NULL)
+        munmap(data, (size_t)st.st_size);
+}
+
+static void* worker(void* arg)
+{
+    pipeline* p = (pipeline*)arg;
+    z_stream stream;
+    int initialised;
+
+    memset(&stream, 0, sizeof(stream));
+    initialised = (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS,
+                                DEF_MEM_LEVEL, Z_DEFAULT_STRATEGY) == Z_OK);
+    for (;;)
+    {
+        pending_entry entry;
+        long i;
+
+        pthread_mutex_lock(&p->lock);
+        while (p->next_index < p->count && p->next_index >= p->next_commit + p->window)
+            pthread_cond_wait(&p->cond, &p->lock);
+        if (p->next_index >= p->count)
+        {
+            pthread_mutex_unlock(&p->lock);
+            break;
+        }
+        i = p->next_index++;
+        pthread_mutex_unlock(&p->lock);
+
+        memset(&entry, 0, sizeof(entry));
+        entry.deferred = !initialised;
+        if (!entry.deferred)
+            deflate_file(p, i, &stream, &entry);
+
+        pthread_mutex_lock(&p->lock);
+        if (entry.deflated == NULL)
+        {
+            p->pending_bytes -= entry.pending_bytes;
+            entry.pending_bytes = 0;
+        }
+        entry.done = 1;
+        p->entries[i] = entry;
+        pthread_cond_broadcast(&p->cond);
+        pthread_mutex_unlock(&p->lock);
+    }
+    if (initialised)
+        deflateEnd(&stream);
+    return NULL;
+}
+
+/* _writeFilesAtPaths:withFileNames:placeholders:, and return the most bytes
+   the buffers took at once */
+static size_t write_files(zipFile zf, char** paths, long count, int workers, size_t max_pending_bytes)
+{
+    pthread_t threads[64];
+    pipeline p;
+    long i;
+    int w;
+
+    memset(&p, 0, sizeof(p));
+    p.paths = paths;
+    p.count = count;
+    p.entries = (pending_entry*)calloc((size_t)count, sizeof(pending_entry));
+    p.window = (long)workers * 4;
+    p.max_pending_bytes = max_pending_bytes;
+    TU_CHECK(p.entries != NULL && workers <= 64);
+    pthread_mutex_init(&p.lock, NULL);
+    pthread_cond_init(&p.cond, NULL);
+    for (w = 0; w < workers; w++)
+        TU_CHECK(pthread_create(&threads[w], NULL, worker, &p) == 0);
+
+    /* commit in order */
+    for (i = 0; i < count; i++)
+    {
+        pending_entry entry;
+        pthread_mutex_lock(&p.lock);
+        while (!p.entries[i].done)
+            pthread_cond_wait(&p.cond, &p.lock);
+        entry = p.entries[i];
+        pthread_mutex_unlock(&p.lock);
+
+        if (entry.deferred)
+            write_file(zf, paths[i], tu_entry_name(i));
+        else if (!entry.failed)
+        {
+            zip_fileinfo zi;
+            memset(&zi, 0, sizeof(zi));
+            /* same header as zipOpenNewFileInZip, the deflated data is written as is */
+            TU_CHECK(zipOpenNewFileInZip4_64(zf, tu_entry_name(i), &zi, NULL, 0, NULL, 0, NULL,
+                                             Z_DEFLATED, Z_DEFAULT_COMPRESSION, 1,
+                                             -MAX_WBITS, DEF_MEM_LEVEL, Z_DEFAULT_STRATEGY,
+                                             NULL, 0, 0, 0, 0) == ZIP_OK);
+            TU_CHECK(zipWriteInFileInZip(zf, entry.deflated, (unsigned)entry.deflated_size) == ZIP_OK);
+            TU_CHECK(zipCloseFileInZipRaw64(zf, entry.uncompressed_size, entry.crc) == ZIP_OK);
+        }
+        free(entry.deflated);
+        if (commit_delay > 0)
+            usleep(commit_delay);
+
+        pthread_mutex_lock(&p.lock);
+        p.pending_bytes -= entry.pending_bytes;
+        p.next_commit = i + 1;
+        pthread_cond_broadcast(&p.cond);
+        pthread_mutex_unlock(&p.lock);
+    }
+
+    for (w = 0; w < workers; w++)
+        pthread_join(threads[w], NULL);
+    TU_CHECK(p.pending_bytes == 0);
+    pthread_cond_destroy(&p.cond);
+    pthread_mutex_destroy(&p.lock);
+    free(p.entries);
+    return p.peak_pending_bytes;
+}
+
+/* zip paths one after the other with 0 workers, else through the pipeline
+   with buffers of max_pending_bytes, the most of which *peak receives */
+static double zip_files(const char* path, char** paths, long count, int workers,
+                        size_t max_pending_bytes, size_t* peak)
+{
+    double start = tu_now();
+    zipFile zf = zipOpen64(path, APPEND_STATUS_CREATE);
+    size_t peak_pending_bytes = 0;
+    long i;
+
+    TU_CHECK(zf != NULL);
+    if (workers == 0)
+        for (i = 0; i < count; i++)
+            write_file(zf, paths[i], tu_entry_name(i));
+    else
+        peak_pending_bytes = write_files(zf, paths, count, workers, max_pending_bytes);
+    if (peak != NULL)
+        *peak = peak_pending_bytes;
+    TU_CHECK(zipClose(zf, NULL) == ZIP_OK);
+    return tu_now() - start;
+}
+
+/* the files of the directory and their sizes; file i is random data when
+   i % 4 == 3, text otherwise */
+static char** make_files(const char* directory, const size_t* sizes, long count)
+{
+    char** paths = (char**)malloc((size_t)count * sizeof(char*));
+    size_t max_size = 0;
+    unsigned char* data;
+    long i;
+
+    for (i = 0; i < count; i++)
+        if (sizes[i] != (size_t)-1 && sizes[i] > max_size)
+            max_size = sizes[i];
+    data = (unsigned char*)malloc(max_size + 1);
+    TU_CHECK(paths != NULL && data != NULL);
+    TU_CHECK(mkdir(directory, 0755) == 0);
+    for (i = 0; i < count; i++)
+    {
+        FILE* f;
+        paths[i] = (char*)malloc(strlen(directory) + 32);
+        TU_CHECK(paths[i] != NULL);
+        sprintf(paths[i], "%s/file_%05ld", directory, i);
+        /* a size of -1 is a file which does not exist */
+        if (sizes[i] == (size_t)-1)
+            continue;
+        if (i % 4 == 3)
+            tu_fill_random(data, sizes[i], (unsigned long long)i);
+        else
+            tu_fill_text(data, sizes[i], (unsigned long long)i);
+        f = fopen(paths[i], "wb");
+        TU_CHECK(f != NULL);
+        TU_CHECK(fwrite(data, 1, sizes[i], f) == sizes[i]);
+        fclose(f);
+    }
+    free(data);
+    return paths;
+}
+
+static void remove_files(const char* directory, char** paths, long count)
+{
+    long i;
+    for (i = 0; i < count; i++)
+    {
+        remove(paths[i]);
+        free(paths[i]);
+    }
+    free(paths);
+    rmdir(directory);
+}
+
+/* read the deflated bytes of the current entry */
+static unsigned char* read_raw(unzFile uf, ZPOS64_T compressed_size)
+{
+    unsigned char* raw = (unsigned char*)malloc((size_t)compressed_size + 1);
+    TU_CHECK(raw != NULL);
+    TU_CHECK(unzOpenCurrentFile2(uf, NULL, NULL, 1) == UNZ_OK);
+    TU_CHECK(unzReadCurrentFile(uf, raw, (unsigned)compressed_size + 1) == (int)compressed_size);
+    TU_CHECK(unzCloseCurrentFile(uf) == UNZ_OK);
+    return raw;
+}
+
+/* the entries of the pipeline archive must be those of the serial one */
+static void compare_archives(const char* serial_path, const char* path, long expected_entries)
+{
+    char name[256], serial_name[256];
+    unz_file_info64 info, serial_info;
+    unzFile serial = unzOpen64(serial_path);
+    unzFile uf = unzOpen64(path);
+    long entries = 0;
+    int err;
+
+    TU_CHECK(serial != NULL && uf != NULL);
+    for (err = unzGoToFirstFile(serial); err == UNZ_OK; err = unzGoToNextFile(serial), entries++)
+    {
+        unsigned char *raw, *serial_raw;
+        TU_CHECK(unzGetCurrentFileInfo64(serial, &serial_info, serial_name, sizeof(serial_name), NULL, 0, NULL, 0) == UNZ_OK);
+        TU_CHECK((entries == 0 ? unzGoToFirstFile(uf) : unzGoToNextFile(uf)) == UNZ_OK);
+        TU_CHECK(unzGetCurrentFileInfo64(uf, &info, name, sizeof(name), NULL, 0, NULL, 0) == UNZ_OK);
+        TU_CHECK(strcmp(name, serial_name) == 0);
+        TU_CHECK(info.crc == serial_info.crc);
+        TU_CHECK(info.uncompressed_size == serial_info.uncompressed_size);
+        TU_CHECK(info.compressed_size == serial_info.compressed_size);
+        TU_CHECK(info.compression_method == serial_info.compression_method);
+        TU_CHECK(info.flag == serial_info.flag);
+        raw = read_raw(uf, info.compressed_size);
+        serial_raw = read_raw(serial, serial_info.compressed_size);
+        TU_CHECK(memcmp(raw, serial_raw, (size_t)info.compressed_size) == 0);
+        free(serial_raw);
+        free(raw);
+        /* and it inflates back with its CRC */
+        TU_CHECK(unzOpenCurrentFile(uf) == UNZ_OK);
+        while ((err = unzReadCurrentFile(uf, name, sizeof(name))) > 0)
+            ;
+        TU_CHECK(err == 0);
+        TU_CHECK(unzCloseCurrentFile(uf) == UNZ_OK);
+    }
+    TU_CHECK(entries == expected_entries);
+    TU_CHECK(unzGoToNextFile(uf) == UNZ_END_OF_LIST_OF_FILE);
+    TU_CHECK(unzClose(uf) == UNZ_OK);
+    TU_CHECK(unzClose(serial) == UNZ_OK);
+}
+
+static void test(void)
+{
+    const char* directory = tu_path("pipeline_files");
+    const char* serial_path = tu_path("pipeline_serial.zip");
+    const char* path = tu_path("pipeline.zip");
+    size_t sizes[60];
+    const long count = (long)(sizeof(sizes) / sizeof(sizes[0]));
+    int workers[] = { 1, 2, 4 };
+    const long small_count = 30;
+    size_t largest_bound = 0, peak, peak_unbounded;
+    char** paths;
+    long i;
+    int k;
+
+    for (i = 0; i < count; i++)
+        sizes[i] = (size_t)(i * 7919 % 300000);
+    sizes[0] = 0;
+    sizes[5] = 0;
+    sizes[9] = 1;
+    sizes[17] = (size_t)-1;
+    sizes[30] = PIPELINE_MAX_ENTRY_SIZE;
+    sizes[42] = PIPELINE_MAX_ENTRY_SIZE + 1;
+    paths = make_files(directory, sizes, count);
+
+    zip_files(serial_path, paths, count, 0, 0, NULL);
+    for (k = 0; k < (int)(sizeof(workers) / sizeof(workers[0])); k++)
+    {
+        zip_files(path, paths, count, workers[k], PIPELINE_MAX_PENDING_BYTES, &peak);
+        compare_archives(serial_path, path, count - 1);
+        TU_CHECK(peak <= PIPELINE_MAX_PENDING_BYTES + compressBound(PIPELINE_MAX_ENTRY_SIZE));
+        printf("ok: %ld files through the pipeline with %d worker(s), as written one by one\n",
+               count, workers[k]);
+    }
+
+    /* the first files, up to 300KB, with a slow commit */
+    for (i = 0; i < small_count; i++)
+        if ((sizes[i] != (size_t)-1) && (compressBound((uLong)sizes[i]) > largest_bound))
+            largest_bound = compressBound((uLong)sizes[i]);
+    zip_files(serial_path, paths, small_count, 0, 0, NULL);
+    commit_delay = 10000;
+    zip_files(path, paths, small_count, 4, (size_t)-1, &peak_unbounded);
+    TU_CHECK(peak_unbounded > (1 << 20) + largest_bound);
+    for (k = 1; k < (int)(sizeof(workers) / sizeof(workers[0])); k++)
+    {
+        zip_files(path, paths, small_count, workers[k], 1 << 20, &peak);
+        compare_archives(serial_path, path, small_count - 1);
+        TU_CHECK(peak <= (1 << 20) + largest_bound);
+        printf("ok: with %d workers and a slow commit, at most %luKB of buffers with a budget of 1MB\n",
+               workers[k], (unsigned long)(peak >> 10));
+    }
+    printf("ok: %luKB of buffers without a budget\n", (unsigned long)(peak_unbounded >> 10));
+    commit_delay = 0;
+
+    remove_files(directory, paths, count);
+    remove(serial_path);
+    remove(path);
+}
+
+static void bench(void)
+{
+    const char* directory = tu_path("pipeline_bench_files");
+    const char* path = tu_path("pipeline_bench.zip");
+    const long count = 400;
+    const size_t size = 300 * 1024;
+    size_t* sizes = (size_t*)malloc((size_t)count * sizeof(size_t));
+    double megabytes = (double)count * size / (1 << 20);
+    int max_workers = tu_cpu_count() > 4 ? tu_cpu_count() : 4;
+    char** paths;
+    long i;
+    int workers, pass;
+
+    TU_CHECK(sizes != NULL);
+    for (i = 0; i < count; i++)
+        sizes[i] = size;
+    paths = make_files(directory, sizes, count);
+    printf("%d processor(s), %ld files of %luKB, %.0fMB\n", tu_cpu_count(), count,
+           (unsigned long)(size >> 10), megabytes);
+    /* the first pass warms the page cache */
+    for (pass = 0; pass < 2; pass++)
+        for (workers = 0; workers <= max_workers; workers = workers ? workers * 2 : 1)
+        {
+            double elapsed = zip_files(path, paths, count, workers, PIPELINE_MAX_PENDING_BYTES, NULL);
+            if (pass > 0)
+                printf("%-22s %2d %6.0f ms %6.1f MB/s\n", workers ? "pipeline, workers" : "one by one",
+                       workers, elapsed * 1e3, megabytes / elapsed);
+        }
+    remove_files(directory, paths, count);
+    free(sizes);
+    remove(path);
+}
+
+int main(int argc, char** argv)
+{
+    if (tu_bench_mode(argc, argv))
+        bench();
+    else
+        test();
+    return 0;
+}
@@ -0,0 +1,194 @@
+/* test_pool.c -- the inflate and deflate states kept between entries
+
+   Built against the _counted lk_zip.c and lk_unzip.c, whose allocations,
+   zlib's included, go through tu_alloc and tu_free. Writing tiny entries
+   must allocate the deflate state once, not once per entry, and reading
+   them back must allocate a fixed number of times, whatever the number of
+   entries: the allocations of 10000 entries must be those of 1000, apart
+   from the growth of the central directory of the writer. The states must
+   come back clean: entries at changing levels, stored entries, raw reads
+   and entries closed before their end are read back byte for byte, and
+   every allocation is freed by zipClose and unzClose.
+
+   With -b, times writing and reading 20000 entries of 100 bytes or less,
+   one in ten stored, and prints the allocations made.
+
+   License: Same as ZLIB (www.gzip.org)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lk_unzip.h"
+#include "lk_zip.h"
+#include "testutil.h"
+
+/* growths of the central directory of the writer, which doubles */
+#define MAX_EXTRA_ALLOCS 8
+
+static size_t entry_size(long i)
+{
+    return (size_t)(i * 7 % 101);
+}
+
+static int entry_level(long i, int mixed)
+{
+    if (i % 10 == 0)
+        return 0;               /* stored */
+    return mixed ? (int)(i % 9) + 1 : 6;
+}
+
+/* write entries, and return the allocations made by all but the first */
+static unsigned long write_entries(const char* path, long entries, int mixed)
+{
+    unsigned char data[101];
+    unsigned long allocs = 0;
+    zipFile zf;
+    long i;
+
+    memset(&tu_allocs, 0, sizeof(tu_allocs));
+    zf = zipOpen64(path, APPEND_STATUS_CREATE);
+    TU_CHECK(zf != NULL);
+    for (i = 0; i < entries; i++)
+    {
+        zip_fileinfo zi;
+        int level = entry_level(i, mixed);
+        if (i == 1)
+            allocs = tu_allocs.allocs;
+        memset(&zi, 0, sizeof(zi));
+        tu_fill_text(data, entry_size(i), (unsigned long long)i);
+        TU_CHECK(zipOpenNewFileInZip64(zf, tu_entry_name(i), &zi, NULL, 0, NULL, 0, NULL,
+                                       level ? Z_DEFLATED : 0, level, 0) == ZIP_OK);
+        TU_CHECK(zipWriteInFileInZip(zf, data, (unsigned)entry_size(i)) == ZIP_OK);
+        TU_CHECK(zipCloseFileInZip(zf) == ZIP_OK);
+    }
+    allocs = tu_allocs.allocs - allocs;
+    TU_CHECK(zipClose(zf, NULL) == ZIP_OK);
+    TU_CHECK(tu_allocs.allocs == tu_allocs.frees);
+    return allocs;
+}
+
+/* read every entry back, and return the allocations made after unzOpen */
+static unsigned long read_entries(const char* path, long entries)
+{
+    unsigned char got[102], expected[101];
+    unsigned long allocs;
+    unzFile uf;
+    long i = 0;
+    int err;
+
+    memset(&tu_allocs, 0, sizeof(tu_allocs));
+    uf = unzOpen64(path);
+    TU_CHECK(uf != NULL);
+    allocs = tu_allocs.allocs;
+    for (err = unzGoToFirstFile(uf); err == UNZ_OK; err = unzGoToNextFile(uf), i++)
+    {
+        TU_CHECK(unzOpenCurrentFile(uf) == UNZ_OK);
+        TU_CHECK(unzReadCurrentFile(uf, got, sizeof(got)) == (int)entry_size(i));
+        /* checks the CRC */
+        TU_CHECK(unzCloseCurrentFile(uf) == UNZ_OK);
+        tu_fill_text(expected, entry_size(i), (unsigned long long)i);
+        TU_CHECK(memcmp(got, expected, entry_size(i)) == 0);
+    }
+    TU_CHECK(i == entries);
+    allocs = tu_allocs.allocs - allocs;
+    TU_CHECK(unzClose(uf) == UNZ_OK);
+    TU_CHECK(tu_allocs.allocs == tu_allocs.frees);
+    return allocs;
+}
+
+/* raw reads and entries left before their end, between normal reads */
+static void check_mixed_reads(const char* path, long entries)
+{
+    unsigned char got[102], expected[101];
+    unz_file_info64 info;
+    unzFile uf;
+    long i = 0;
+    int err, method, level;
+
+    memset(&tu_allocs, 0, sizeof(tu_allocs));
+    uf = unzOpen64(path);
+    TU_CHECK(uf != NULL);
+    for (err = unzGoToFirstFile(uf); err == UNZ_OK; err = unzGoToNextFile(uf), i++)
+    {
+        TU_CHECK(unzGetCurrentFileInfo64(uf, &info, NULL, 0, NULL, 0, NULL, 0) == UNZ_OK);
+        tu_fill_text(expected, entry_size(i), (unsigned long long)i);
+        if (i % 3 == 0)
+        {
+            /* the compressed bytes, left as they are */
+            TU_CHECK(unzOpenCurrentFile2(uf, &method, &level, 1) == UNZ_OK);
+            TU_CHECK(unzReadCurrentFile(uf, got, sizeof(got)) == (int)info.compressed_size);
+            if (method == 0)
+                TU_CHECK(memcmp(got, expected, entry_size(i)) == 0);
+            TU_CHECK(unzCloseCurrentFile(uf) == UNZ_OK);
+        }
+        else if ((i % 3 == 1) && (entry_size(i) > 2))
+        {
+            /* two bytes only: the state is put back in the middle */
+            TU_CHECK(unzOpenCurrentFile(uf) == UNZ_OK);
+            TU_CHECK(unzReadCurrentFile(uf, got, 2) == 2);
+            TU_CHECK(memcmp(got, expected, 2) == 0);
+            unzCloseCurrentFile(uf);
+        }
+        else
+        {
+            TU_CHECK(unzOpenCurrentFile(uf) == UNZ_OK);
+            TU_CHECK(unzReadCurrentFile(uf, got, sizeof(got)) == (int)entry_size(i));
+            TU_CHECK(unzCloseCurrentFile(uf) == UNZ_OK);
+            TU_CHECK(memcmp(got, expected, entry_size(i)) == 0);
+        }
+    }
+    TU_CHECK(i == entries);
+    TU_CHECK(unzClose(uf) == UNZ_OK);
+    TU_CHECK(tu_allocs.allocs == tu_allocs.frees);
+}
+
+static void test(void)
+{
+    const char* path = tu_path("pool.zip");
+    unsigned long write_small, write_large, read_small, read_large;
+
+    write_small = write_entries(path, 1000, 0);
+    read_small = read_entries(path, 1000);
+    write_large = write_entries(path, 10000, 0);
+    read_large = read_entries(path, 10000);
+    printf("ok: 1000 entries: %lu allocations to write, %lu to read\n", write_small, read_small);
+    printf("ok: 10000 entries: %lu allocations to write, %lu to read\n", write_large, read_large);
+    TU_CHECK(write_large <= write_small + MAX_EXTRA_ALLOCS);
+    TU_CHECK(read_large == read_small);
+
+    write_entries(path, 2000, 1);
+    read_entries(path, 2000);
+    check_mixed_reads(path, 2000);
+    printf("ok: levels 0 to 9, raw reads and entries left unfinished read back\n");
+    remove(path);
+}
+
+static void bench(void)
+{
+    const char* path = tu_path("pool_bench.zip");
+    const long entries = 20000;
+    double start, write_time, read_time;
+    unsigned long write_allocs, read_allocs;
+
+    start = tu_now();
+    write_allocs = write_entries(path, entries, 0);
+    write_time = tu_now() - start;
+    start = tu_now();
+    read_allocs = read_entries(path, entries);
+    read_time = tu_now() - start;
+
+    printf("%ld entries of 100 bytes or less, one in ten stored\n", entries);
+    printf("write %6.0f ms %8lu allocations\n", write_time * 1e3, write_allocs);
+    printf("read  %6.0f ms %8lu allocations\n", read_time * 1e3, read_allocs);
+    remove(path);
+}
+
+int main(int argc, char** argv)
+{
+    if (tu_bench_mode(argc, argv))
+        bench();
+    else
+        test();
+    return 0;
+}
@@ -0,0 +1,344 @@
+/* test_repair.c -- the recovery of damaged zipfiles by lk_unzRepair64
+
+   A zipfile written with its sizes in the local headers, and one written
+   in a single pass with data descriptors (APPEND_STATUS_CREATESTREAM, zip64
+   and stored entries included), must come out of the repair with every
+   entry, each one reading back with its data and crc. Entries of 300000
+   bytes are longer than the window the repair reads through.
+
+   Cut short in the data of an entry, in its local header or in its data
+   descriptor, the zipfile must give back the entries before that one, and
+   count that one as dropped. Cut at its central directory, it must give
+   back every entry. With garbage before its first entry, including a bare
+   local header signature, the garbage must be skipped and counted.
+
+   With -b, times the repair of a 64MB zipfile of each kind, with its
+   central directory cut off, and prints the MB/s of each.
+
+   License: Same as ZLIB (www.gzip.org)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lk_unzip.h"
+#include "lk_zip.h"
+#include "lk_mztools.h"
+#include "testutil.h"
+
+#define ENTRIES 10
+#define GARBAGE_SIZE 5000
+
+static size_t entry_size(long i)
+{
+    static const size_t sizes[] = { 0, 1, 1000, 300000, 70000 };
+    return sizes[i % 5];
+}
+
+static int entry_stored(long i)
+{
+    return i % 3 == 2;
+}
+
+static void entry_data(long i, unsigned char* data)
+{
+    if (i % 2 == 0)
+        tu_fill_text(data, entry_size(i), (unsigned long long)i);
+    else
+        tu_fill_random(data, entry_size(i), (unsigned long long)i);
+}
+
+static void make_zipfile(const char* path, int streamed)
+{
+    static unsigned char data[300000];
+    zipFile zf = zipOpen64(path, streamed ? APPEND_STATUS_CREATESTREAM : APPEND_STATUS_CREATE);
+    zip_fileinfo zi;
+    long i;
+
+    TU_CHECK(zf != NULL);
+    memset(&zi, 0, sizeof(zi));
+    for (i = 0; i < ENTRIES; i++)
+    {
+        entry_data(i, data);
+        TU_CHECK(zipOpenNewFileInZip64(zf, tu_entry_name(i), &zi, NULL, 0, NULL, 0, NULL,
+                                       entry_stored(i) ? 0 : Z_DEFLATED, entry_stored(i) ? 0 : 6,
+                                       streamed && (i % 4 == 3)) == ZIP_OK);
+        TU_CHECK(zipWriteInFileInZip(zf, data, (unsigned)entry_size(i)) == ZIP_OK);
+        TU_CHECK(zipCloseFileInZip(zf) == ZIP_OK);
+    }
+    TU_CHECK(zipClose(zf, "to be repaired") == ZIP_OK);
+}
+
+static unsigned char* load_file(const char* path, size_t* size)
+{
+    FILE* f = fopen(path, "rb");
+    unsigned char* data;
+    long end;
+
+    TU_CHECK(f != NULL);
+    TU_CHECK(fseek(f, 0, SEEK_END) == 0);
+    end = ftell(f);
+    TU_CHECK(end >= 0 && fseek(f, 0, SEEK_SET) == 0);
+    data = (unsigned char*)malloc((size_t)end + 1);
+    TU_CHECK(data != NULL);
+    TU_CHECK(fread(data, 1, (size_t)end, f) == (size_t)end);
+    fclose(f);
+    *size = (size_t)end;
+    return data;
+}
+
+static void save_file(const char* path, const unsigned char* data, size_t size)
+{
+    FILE* f = fopen(path, "wb");
+    TU_CHECK(f != NULL);
+    TU_CHECK(fwrite(data, 1, size, f) == size);
+    TU_CHECK(fclose(f) == 0);
+}
+
+/* the offset of the central directory, from the end of central directory
+   record (the zipfiles here need no zip64 one) */
+static size_t central_offset(const unsigned char* zip, size_t size)
+{
+    size_t pos;
+    for (pos = size - 22; pos > 0; pos--)
+        if (memcmp(zip + pos, "PK\5\6", 4) == 0)
+            break;
+    TU_CHECK(pos > 0);
+    return (size_t)zip[pos + 16] | ((size_t)zip[pos + 17] << 8) |
+           ((size_t)zip[pos + 18] << 16) | ((size_t)zip[pos + 19] << 24);
+}
+
+/* where the data of each entry starts, and its compressed size */
+typedef struct
+{
+    ZPOS64_T data_start[ENTRIES];
+    ZPOS64_T compressed_size[ENTRIES];
+    ZPOS64_T central_offset;
+} layout;
+
+static void read_layout(const char* path, const unsigned char* zip, size_t size, layout* l)
+{
+    unz_file_info64 info;
+    unzFile uf = unzOpen64(path);
+    long i = 0;
+    int err;
+
+    TU_CHECK(uf != NULL);
+    for (err = unzGoToFirstFile(uf); err == UNZ_OK; err = unzGoToNextFile(uf), i++)
+    {
+        TU_CHECK(unzGetCurrentFileInfo64(uf, &info, NULL, 0, NULL, 0, NULL, 0) == UNZ_OK);
+        TU_CHECK(unzOpenCurrentFile(uf) == UNZ_OK);
+        l->data_start[i] = unzGetCurrentFileZStreamPos64(uf);
+        l->compressed_size[i] = info.compressed_size;
+        TU_CHECK(unzCloseCurrentFile(uf) == UNZ_OK);
+    }
+    TU_CHECK(i == ENTRIES);
+    TU_CHECK(unzClose(uf) == UNZ_OK);
+    l->central_offset = central_offset(zip, size);
+}
+
+/* repair in into out, which must hold the first entries entries of
+   make_zipfile, with their data and crc */
+static void repair(const char* in, const char* out, long entries, lk_unz_repair_info* info)
+{
+    static unsigned char got[300001], expected[300000];
+    char tmp[1024];
+    unz_file_info64 file_info;
+    unzFile uf;
+    long i = 0;
+    int err;
+
+    snprintf(tmp, sizeof(tmp), "%s", tu_path("repair_cd.tmp"));
+    TU_CHECK(lk_unzRepair64(in, out, tmp, info) == Z_OK);
+    TU_CHECK(info->entries_recovered == (ZPOS64_T)entries);
+
+    uf = unzOpen64(out);
+    TU_CHECK(uf != NULL);
+    for (err = unzGoToFirstFile(uf); err == UNZ_OK; err = unzGoToNextFile(uf), i++)
+    {
+        char name[256];
+        TU_CHECK(unzGetCurrentFileInfo64(uf, &file_info, name, sizeof(name), NULL, 0, NULL, 0) == UNZ_OK);
+        TU_CHECK(strcmp(name, tu_entry_name(i)) == 0);
+        TU_CHECK(file_info.compression_method == (entry_stored(i) ? 0 : Z_DEFLATED));
+        TU_CHECK(unzOpenCurrentFile(uf) == UNZ_OK);
+        TU_CHECK(unzReadCurrentFile(uf, got, sizeof(got)) == (int)entry_size(i));
+        /* checks the CRC */
+        TU_CHECK(unzCloseCurrentFile(uf) == UNZ_OK);
+        entry_data(i, expected);
+        TU_CHECK(memcmp(got, expected, entry_size(i)) == 0);
+    }
+    TU_CHECK(err == UNZ_END_OF_LIST_OF_FILE);
+    TU_CHECK(i == entries);
+    TU_CHECK(unzClose(uf) == UNZ_OK);
+}
+
+static void check_whole(const char* path, const char* out, const layout* l, int streamed)
+{
+    lk_unz_repair_info info;
+    ZPOS64_T bytes = 0;
+    uLong recovered = 0, recovered_bytes = 0;
+    char tmp[1024];
+    long i;
+
+    for (i = 0; i < ENTRIES; i++)
+        bytes += l->compressed_size[i];
+    repair(path, out, ENTRIES, &info);
+    TU_CHECK(info.entries_with_descriptor == (streamed ? ENTRIES : 0));
+    TU_CHECK(info.entries_dropped == 0 && info.bytes_dropped == 0 && info.bytes_skipped == 0);
+    TU_CHECK(info.bytes_recovered == bytes);
+
+    /* the same through the 32-bit lk_unzRepair */
+    snprintf(tmp, sizeof(tmp), "%s", tu_path("repair_cd.tmp"));
+    TU_CHECK(lk_unzRepair(path, out, tmp, &recovered, &recovered_bytes) == Z_OK);
+    TU_CHECK(recovered == ENTRIES && recovered_bytes == bytes);
+}
+
+/* the zipfile cut at size, which must give back entries entries */
+static void check_cut(const char* out, const unsigned char* zip, size_t size, long entries, long dropped)
+{
+    char cut[1024];
+    lk_unz_repair_info info;
+
+    snprintf(cut, sizeof(cut), "%s", tu_path("repair_cut.zip"));
+    save_file(cut, zip, size);
+    repair(cut, out, entries, &info);
+    TU_CHECK(info.entries_dropped == (ZPOS64_T)dropped);
+    TU_CHECK(info.bytes_skipped == 0);
+    TU_CHECK(info.bytes_scanned == size);
+    remove(cut);
+}
+
+static void check_truncated(const char* out, const unsigned char* zip, const layout* l, int streamed)
+{
+    /* no central directory: a download stopped before its end */
+    check_cut(out, zip, (size_t)l->central_offset, ENTRIES, 0);
+    /* in the data of entry 3 */
+    check_cut(out, zip, (size_t)(l->data_start[3] + l->compressed_size[3] / 2), 3, 1);
+    /* in the filename of entry 8 */
+    check_cut(out, zip, (size_t)(l->data_start[8] - 3), 8, 1);
+    /* in the data descriptor of entry 3 */
+    if (streamed)
+        check_cut(out, zip, (size_t)(l->data_start[3] + l->compressed_size[3] + 5), 3, 1);
+}
+
+static void check_garbage(const char* out, const unsigned char* zip, size_t size)
+{
+    char dirty[1024];
+    unsigned char* data = (unsigned char*)malloc(GARBAGE_SIZE + size);
+    lk_unz_repair_info info;
+    size_t i;
+
+    TU_CHECK(data != NULL);
+    tu_fill_random(data, GARBAGE_SIZE, 99);
+    /* stray letters of the signatures, and a local header signature
+       followed by zeros, which is no header */
+    for (i = 0; i + 2 <= GARBAGE_SIZE; i += 97)
+        memcpy(data + i, "PK", 2);
+    memset(data + 1000, 0, 40);
+    memcpy(data + 1000, "PK\3\4", 4);
+    /* none of them may be taken for a record after the entries */
+    for (i = 0; i + 4 <= GARBAGE_SIZE; i++)
+        if ((data[i] == 'P') && (data[i + 1] == 'K') && (data[i + 2] != 3))
+            data[i + 2] = 0;
+    memcpy(data + GARBAGE_SIZE, zip, size);
+
+    snprintf(dirty, sizeof(dirty), "%s", tu_path("repair_dirty.zip"));
+    save_file(dirty, data, GARBAGE_SIZE + size);
+    repair(dirty, out, ENTRIES, &info);
+    TU_CHECK(info.bytes_skipped == GARBAGE_SIZE);
+    TU_CHECK(info.entries_dropped == 0);
+    remove(dirty);
+    free(data);
+}
+
+static void test(void)
+{
+    char path[1024], out[1024];
+    int streamed;
+
+    snprintf(path, sizeof(path), "%s", tu_path("repair.zip"));
+    snprintf(out, sizeof(out), "%s", tu_path("repair_out.zip"));
+    for (streamed = 0; streamed < 2; streamed++)
+    {
+        const char* what = streamed ? "data descriptors" : "sizes in the local headers";
+        unsigned char* zip;
+        size_t size;
+        layout l;
+
+        make_zipfile(path, streamed);
+        zip = load_file(path, &size);
+        read_layout(path, zip, size, &l);
+
+        check_whole(path, out, &l, streamed);
+        printf("ok: %s, every entry recovered from the whole zipfile\n", what);
+        check_truncated(out, zip, &l, streamed);
+        printf("ok: %s, cut short, the entries before the cut recovered\n", what);
+        check_garbage(out, zip, size);
+        printf("ok: %s, garbage before the entries skipped\n", what);
+        free(zip);
+    }
+    remove(path);
+    remove(out);
+}
+
+static void bench(void)
+{
+    const size_t size = 64 << 20, chunk = 1 << 20;
+    unsigned char* data = (unsigned char*)malloc(size);
+    char path[1024], cut[1024], out[1024], tmp[1024];
+    int streamed;
+
+    TU_CHECK(data != NULL);
+    tu_fill_text(data, size / 2, 1);
+    tu_fill_random(data + size / 2, size / 2, 2);
+    snprintf(path, sizeof(path), "%s", tu_path("repair_bench.zip"));
+    snprintf(cut, sizeof(cut), "%s", tu_path("repair_bench_cut.zip"));
+    snprintf(out, sizeof(out), "%s", tu_path("repair_bench_out.zip"));
+    snprintf(tmp, sizeof(tmp), "%s", tu_path("repair_bench_cd.tmp"));
+    printf("%luMB in 64 entries, half of them stored, no central directory\n",
+           (unsigned long)(size >> 20));
+    for (streamed = 0; streamed < 2; streamed++)
+    {
+        lk_unz_repair_info info;
+        unsigned char* zip;
+        size_t zip_size, pos;
+        double start;
+        zipFile zf = zipOpen64(path, streamed ? APPEND_STATUS_CREATESTREAM : APPEND_STATUS_CREATE);
+
+        TU_CHECK(zf != NULL);
+        for (pos = 0; pos < size; pos += chunk)
+        {
+            int stored = (pos >= size / 2);
+            zip_fileinfo zi;
+            memset(&zi, 0, sizeof(zi));
+            TU_CHECK(zipOpenNewFileInZip64(zf, tu_entry_name((long)(pos / chunk)), &zi, NULL, 0, NULL, 0, NULL,
+                                           stored ? 0 : Z_DEFLATED, stored ? 0 : 6, 0) == ZIP_OK);
+            TU_CHECK(zipWriteInFileInZip(zf, data + pos, (unsigned)chunk) == ZIP_OK);
+            TU_CHECK(zipCloseFileInZip(zf) == ZIP_OK);
+        }
+        TU_CHECK(zipClose(zf, NULL) == ZIP_OK);
+
+        zip = load_file(path, &zip_size);
+        save_file(cut, zip, central_offset(zip, zip_size));
+        free(zip);
+
+        start = tu_now();
+        TU_CHECK(lk_unzRepair64(cut, out, tmp, &info) == Z_OK);
+        TU_CHECK(info.entries_recovered == size / chunk);
+        printf("%-30s %6.1f MB/s\n", streamed ? "data descriptors" : "sizes in the local headers",
+               (double)info.bytes_scanned / (1 << 20) / (tu_now() - start));
+    }
+    remove(path);
+    remove(cut);
+    remove(out);
+    free(data);
+}
+
+int main(int argc, char** argv)
+{
+    if (tu_bench_mode(argc, argv))
+        bench();
+    else
+        test();
+    return 0;
+}
@@ -0,0 +1,946 @@
+/* test_resume.c -- the resumed bundle downloads of LKBundlesManager, in C
+
+   -unzipDataFromRemoteUrl:toDirectoryUrl:completion: of LKBundlesManager
+   extracts a bundle zip into a .partial directory while it downloads, with
+   LK_SSZipStreamUnarchiver (unzStreamOpenAt and unzStreamWrite). When the
+   connection drops it saves the resume state (url, unzStreamResumeOffset,
+   ETag) to a plist next to the directory and requests the rest with
+   "Range: bytes=N-" and If-Range, giving up after
+   MAX_DOWNLOAD_RESUMES_WITHOUT_PROGRESS attempts in a row which extract
+   nothing more; a later download of the same url starts from the saved
+   state, which is also saved every 512KB in case the app is killed. A 200
+   answer to a resumed request starts over, any other answer fails. This
+   is the same logic over sockets, with a text file in place of the plist.
+
+   A stand-in HTTP server, forked from the test, serves a zipfile with
+   ranges and an ETag. The test checks that:
+   - a download dropped every size/5 bytes extracts every entry once, each
+     request asking for the resume offset of the previous one with If-Range;
+   - a server answering 200 to the resumed request gets the zip again from
+     the start, into an emptied directory;
+   - a 206 for another range fails the download and removes its state;
+   - a download which stops making progress gives up after 1 + 3 attempts
+     at the same offset, keeping its state, from which the next download
+     resumes, as it does after being killed between two saves;
+   - a zip which changed in between (another ETag) is downloaded whole.
+
+   With -b, a zipfile of about 17MB is downloaded over connections of which
+   the first three drop, resuming from the last complete entry and, as
+   before, from the start, and the bytes fetched and the time of each are
+   printed.
+
+   License: Same as ZLIB (www.gzip.org)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <dirent.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "lk_unzstream.h"
+#include "lk_zip.h"
+#include "testutil.h"
+
+#define ENTRIES 40
+
+/* as in LKBundlesManager.m */
+#define MAX_DOWNLOAD_RESUMES_WITHOUT_PROGRESS 3
+#define DOWNLOAD_RESUME_STATE_INTERVAL (512 * 1024)
+
+/* ---- the zipfiles ---- */
+
+/* the benchmark makes the entries bigger */
+static size_t size_scale = 1;
+
+static size_t entry_size(long i)
+{
+    static const size_t sizes[] = { 0, 1, 700, 100 * 1024, 1 << 20, 5000 };
+    return sizes[i % 6] * size_scale;
+}
+
+/* version changes the contents, as a new build of the bundle would */
+static void entry_data(long i, int version, unsigned char* data)
+{
+    tu_fill_text(data, entry_size(i), (unsigned long long)(i + 1000 * version));
+    /* every fourth entry half random, which deflate leaves almost as is */
+    if (i % 4 == 3)
+        tu_fill_random(data, entry_size(i) / 2, (unsigned long long)(i + 1000 * version));
+}
+
+static unsigned char* make_zip(int version, size_t* size)
+{
+    const char* path = tu_path("resume_source.zip");
+    unsigned char* data = (unsigned char*)malloc(entry_size(4) + 1);
+    unsigned char* zip;
+    zipFile zf = zipOpen64(path, APPEND_STATUS_CREATE);
+    zip_fileinfo zi;
+    FILE* f;
+    long i, end = 0;
+
+    TU_CHECK(zf != NULL && data != NULL);
+    memset(&zi, 0, sizeof(zi));
+    for (i = 0; i < ENTRIES; i++)
+    {
+        /* some stored, all smaller than the drops of the test */
+        int stored = (i % 5 == 2) && (entry_size(i) < entry_size(4));
+        entry_data(i, version, data);
+        TU_CHECK(zipOpenNewFileInZip64(zf, tu_entry_name(i), &zi, NULL, 0, NULL, 0, NULL,
+                                       stored ? 0 : Z_DEFLATED, stored ? 0 : 6, 0) == ZIP_OK);
+        TU_CHECK(zipWriteInFileInZip(zf, data, (unsigned)entry_size(i)) == ZIP_OK);
+        TU_CHECK(zipCloseFileInZip(zf) == ZIP_OK);
+    }
+    TU_CHECK(zipClose(zf, NULL) == ZIP_OK);
+    free(data);
+
+    f = fopen(path, "rb");
+    TU_CHECK(f != NULL);
+    TU_CHECK(fseek(f, 0, SEEK_END) == 0 && (end = ftell(f)) > 0);
+    zip = (unsigned char*)malloc((size_t)end);
+    TU_CHECK(zip != NULL);
+    rewind(f);
+    TU_CHECK(fread(zip, 1, (size_t)end, f) == (size_t)end);
+    fclose(f);
+    remove(path);
+    *size = (size_t)end;
+    return zip;
+}
+
+/* ---- the stand-in server ---- */
+
+typedef struct
+{
+    const unsigned char* zip;
+    size_t size;
+    const char* etag;
+    int ranges;                 /* 0 answers every request with a 200 */
+    int wrong_range;            /* answer ranges one byte early */
+    size_t drop_every;          /* close each response after that many bytes, if not 0 */
+    size_t drop_at[4];          /* close response k after drop_at[k] bytes, if not 0 */
+    size_t stall_at;            /* never send the bytes from there on, if not 0 */
+} http_config;
+
+typedef struct
+{
+    pid_t pid;
+    const char* log;
+} server;
+
+/* one listening socket for every server of a test, so that the url of the
+   zip stays the same */
+static int listener = -1;
+static int listener_port;
+
+static void listen_once(void)
+{
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+
+    if (listener >= 0)
+        return;
+    listener = socket(AF_INET, SOCK_STREAM, 0);
+    TU_CHECK(listener >= 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    TU_CHECK(bind(listener, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+    TU_CHECK(listen(listener, 4) == 0);
+    TU_CHECK(getsockname(listener, (struct sockaddr*)&addr, &len) == 0);
+    listener_port = ntohs(addr.sin_port);
+}
+
+static int write_all(int fd, const void* buf, size_t len)
+{
+    const char* p = (const char*)buf;
+    while (len > 0)
+    {
+        ssize_t n = write(fd, p, len);
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+/* the value of header name in the request or response head, or NULL */
+static const char* header_value(const char* head, const char* name, char* value, size_t size)
+{
+    const char* line = strstr(head, "\r\n");
+    size_t len = strlen(name);
+
+    while ((line != NULL) && (line[2] != '\r'))
+    {
+        const char* end;
+        line += 2;
+        end = strstr(line, "\r\n");
+        if ((end != NULL) && (strncasecmp(line, name, len) == 0) && (line[len] == ':'))
+        {
+            const char* v = line + len + 1;
+            while (*v == ' ')
+                v++;
+            snprintf(value, size, "%.*s", (int)(end - v), v);
+            return value;
+        }
+        line = end;
+    }
+    return NULL;
+}
+
+/* read a request or response head, up to the empty line, and return the
+   number of bytes read after it */
+static size_t read_head(int fd, char* head, size_t size, unsigned char* rest)
+{
+    size_t used = 0;
+    char* end = NULL;
+
+    while ((end == NULL) && (used < size - 1))
+    {
+        ssize_t n = read(fd, head + used, size - 1 - used);
+        if (n <= 0)
+            break;
+        used += (size_t)n;
+        head[used] = '\0';
+        end = strstr(head, "\r\n\r\n");
+    }
+    if (end == NULL)
+    {
+        head[0] = '\0';
+        return 0;
+    }
+    used -= (size_t)(end + 4 - head);
+    memcpy(rest, end + 4, used);
+    end[4] = '\0';
+    return used;
+}
+
+static void serve(int fd, const http_config* config, int connection, FILE* log)
+{
+    char head[2048], value[128], response[512];
+    unsigned char rest[2048];
+    unsigned long long start = 0, stop;
+    int status = 200;
+
+    read_head(fd, head, sizeof(head), rest);
+    if (head[0] == '\0')
+        return;
+    if (config->ranges && (header_value(head, "Range", value, sizeof(value)) != NULL) &&
+        (sscanf(value, "bytes=%llu-", &start) == 1) && (start < config->size))
+    {
+        const char* if_range = header_value(head, "If-Range", value, sizeof(value));
+        /* a range of the zip only if the client has the same one */
+        if ((if_range == NULL) || (strcmp(if_range, config->etag) == 0))
+        {
+            status = 206;
+            if (config->wrong_range && (start > 0))
+                start--;
+        }
+        else
+            start = 0;
+        fprintf(log, "%llu %s %d\n", (unsigned long long)(status == 206 ? start : 0),
+                if_range != NULL ? if_range : "-", status);
+    }
+    else
+    {
+        start = 0;
+        fprintf(log, "0 - 200\n");
+    }
+    fflush(log);
+
+    if (status == 206)
+        snprintf(response, sizeof(response),
+                 "HTTP/1.1 206 Partial Content\r\nContent-Length: %llu\r\n"
+                 "Content-Range: bytes %llu-%llu/%llu\r\nETag: %s\r\nConnection: close\r\n\r\n",
+                 (unsigned long long)config->size - start, start, (unsigned long long)config->size - 1,
+                 (unsigned long long)config->size, config->etag);
+    else
+        snprintf(response, sizeof(response),
+                 "HTTP/1.1 200 OK\r\nContent-Length: %llu\r\nETag: %s\r\nConnection: close\r\n\r\n",
+                 (unsigned long long)config->size, config->etag);
+    if (write_all(fd, response, strlen(response)) != 0)
+        return;
+
+    stop = config->size;
+    if (config->drop_every && (start + config->drop_every < stop))
+        stop = start + config->drop_every;
+    if ((connection < 4) && config->drop_at[connection] && (start + config->drop_at[connection] < stop))
+        stop = start + config->drop_at[connection];
+    if (config->stall_at && (config->stall_at < stop))
+        stop = (start < config->stall_at) ? config->stall_at : start;
+    write_all(fd, config->zip + start, (size_t)(stop - start));
+}
+
+/* fork a server for config on the listening socket. Each request is
+   appended to the log as "start if-range status". */
+static server start_server(const http_config* config)
+{
+    server srv;
+
+    listen_once();
+    srv.log = tu_path("resume_server.log");
+    remove(srv.log);
+    srv.pid = fork();
+    TU_CHECK(srv.pid >= 0);
+    if (srv.pid == 0)
+    {
+        FILE* log = fopen(srv.log, "a");
+        int connection;
+        signal(SIGPIPE, SIG_IGN);
+        for (connection = 0; log != NULL; connection++)
+        {
+            int fd = accept(listener, NULL, NULL);
+            if (fd < 0)
+                _exit(errno == EINTR ? 0 : 1);
+            serve(fd, config, connection, log);
+            close(fd);
+        }
+        _exit(1);
+    }
+    return srv;
+}
+
+static void stop_server(server srv)
+{
+    int status;
+    kill(srv.pid, SIGTERM);
+    TU_CHECK(waitpid(srv.pid, &status, 0) == srv.pid);
+}
+
+typedef struct
+{
+    unsigned long long start;
+    char if_range[64];
+    int status;
+} logged_request;
+
+static int read_log(server srv, logged_request* requests, int max)
+{
+    FILE* f = fopen(srv.log, "r");
+    int n = 0;
+
+    TU_CHECK(f != NULL);
+    while ((n < max) && (fscanf(f, "%llu %63s %d", &requests[n].start, requests[n].if_range,
+                                &requests[n].status) == 3))
+        n++;
+    fclose(f);
+    return n;
+}
+
+/* ---- the download, as in LKBundlesManager ---- */
+
+enum
+{
+    DOWNLOAD_DONE,
+    DOWNLOAD_FAILED,            /* the partial directory and the state are removed */
+    DOWNLOAD_GAVE_UP,           /* both are kept for the next download */
+    DOWNLOAD_KILLED             /* stopped without saving, like a killed app */
+};
+
+typedef struct
+{
+    int completed[ENTRIES];     /* entries extracted, over every download */
+    int failed[ENTRIES];
+    const char* directory;      /* where the entries of the stream go */
+} collector;
+
+typedef struct
+{
+    char url[128];
+    char directory[400], partial[420], state[440];
+    unsigned long long request_offset, saved_offset;
+    char validator[128];
+    int resumes_without_progress;
+    int unzip_error;
+    unzStream stream;
+    collector* c;
+    unsigned long long fetched;  /* bytes of body received */
+    unsigned long long kill_after;
+    int resume;                 /* 0 starts over after a drop, as before */
+} download;
+
+static long entry_index(const char* filename)
+{
+    long i;
+    for (i = 0; i < ENTRIES; i++)
+        if (strcmp(filename, tu_entry_name(i)) == 0)
+            return i;
+    return -1;
+}
+
+typedef struct
+{
+    long index;
+    FILE* file;
+} entry_out;
+
+static voidpf open_entry(voidpf opaque, const unz_stream_entry* entry)
+{
+    collector* c = (collector*)opaque;
+    entry_out* out = (entry_out*)malloc(sizeof(entry_out));
+    char path[600];
+
+    TU_CHECK(out != NULL);
+    out->index = entry_index(entry->filename);
+    TU_CHECK(out->index >= 0);
+    /* overwrite: YES */
+    snprintf(path, sizeof(path), "%s/%ld", c->directory, out->index);
+    out->file = fopen(path, "wb");
+    TU_CHECK(out->file != NULL);
+    return out;
+}
+
+static int write_entry(voidpf opaque, voidpf handle, const void* buf, uLong size)
+{
+    entry_out* out = (entry_out*)handle;
+    (void)opaque;
+    return (fwrite(buf, 1, size, out->file) == size) ? UNZ_OK : UNZ_ERRNO;
+}
+
+static void close_entry(voidpf opaque, voidpf handle, const unz_stream_entry* entry, int err)
+{
+    collector* c = (collector*)opaque;
+    entry_out* out = (entry_out*)handle;
+    (void)entry;
+
+    TU_CHECK(fclose(out->file) == 0);
+    if (err == UNZ_OK)
+        c->completed[out->index]++;
+    else
+        c->failed[out->index]++;
+    free(out);
+}
+
+static unzStream open_stream(download* d)
+{
+    unz_stream_callbacks callbacks;
+    unzStream stream;
+
+    d->c->directory = d->partial;
+    callbacks.open_entry = open_entry;
+    callbacks.write_entry = write_entry;
+    callbacks.close_entry = close_entry;
+    callbacks.opaque = d->c;
+    stream = unzStreamOpenAt(&callbacks, d->request_offset);
+    TU_CHECK(stream != NULL);
+    return stream;
+}
+
+static void remove_directory(const char* path)
+{
+    DIR* dir = opendir(path);
+    struct dirent* e;
+
+    if (dir == NULL)
+        return;
+    while ((e = readdir(dir)) != NULL)
+    {
+        char file[600];
+        if (e->d_name[0] == '.')
+            continue;
+        snprintf(file, sizeof(file), "%s/%s", path, e->d_name);
+        remove(file);
+    }
+    closedir(dir);
+    rmdir(path);
+}
+
+/* the plist of saveResumeStateOfStreamingDownload:, written atomically */
+static void save_resume_state(download* d)
+{
+    char temp[600];
+    ZPOS64_T offset = unzStreamResumeOffset(d->stream);
+    FILE* f;
+
+    snprintf(temp, sizeof(temp), "%s.tmp", d->state);
+    f = fopen(temp, "w");
+    TU_CHECK(f != NULL);
+    fprintf(f, "%s\n%llu\n%s\n", d->url, (unsigned long long)offset, d->validator[0] ? d->validator : "-");
+    TU_CHECK(fclose(f) == 0);
+    TU_CHECK(rename(temp, d->state) == 0);
+    d->saved_offset = offset;
+}
+
+/* 1 if path holds a resume state for url */
+static int load_resume_state(const char* path, const char* url, unsigned long long* offset, char* validator)
+{
+    char saved_url[128];
+    FILE* f = fopen(path, "r");
+    int ok;
+
+    if (f == NULL)
+        return 0;
+    ok = (fscanf(f, "%127s %llu %63s", saved_url, offset, validator) == 3) && (strcmp(saved_url, url) == 0);
+    fclose(f);
+    if (ok && (strcmp(validator, "-") == 0))
+        validator[0] = '\0';
+    return ok;
+}
+
+static int connect_server(void)
+{
+    struct sockaddr_in addr;
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    TU_CHECK(fd >= 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons((unsigned short)listener_port);
+    TU_CHECK(connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+    return fd;
+}
+
+/* startStreamingDownload:, didReceiveResponse: and didReceiveData:, until
+   the connection ends. Return 1 if it ended before Content-Length, like
+   an NSURLErrorDomain error, 0 otherwise. */
+static int fetch(download* d, int* killed)
+{
+    static unsigned char body[65536];
+    char head[2048], line[512], value[128];
+    unsigned long long length = 0, received = 0;
+    int fd = connect_server(), status = 0;
+    size_t n;
+
+    d->stream = open_stream(d);
+    snprintf(line, sizeof(line), "GET /bundle.zip HTTP/1.1\r\nHost: 127.0.0.1\r\n");
+    if (d->request_offset > 0)
+    {
+        snprintf(line + strlen(line), sizeof(line) - strlen(line), "Range: bytes=%llu-\r\n", d->request_offset);
+        /* if the zip changed, the server sends all of the new one */
+        if (d->validator[0] != '\0')
+            snprintf(line + strlen(line), sizeof(line) - strlen(line), "If-Range: %s\r\n", d->validator);
+    }
+    strcat(line, "\r\n");
+    TU_CHECK(write_all(fd, line, strlen(line)) == 0);
+
+    n = read_head(fd, head, sizeof(head), body);
+    if ((head[0] == '\0') || (sscanf(head, "HTTP/1.1 %d", &status) != 1))
+    {
+        close(fd);
+        return 1;
+    }
+    if (header_value(head, "Content-Length", value, sizeof(value)) != NULL)
+        length = strtoull(value, NULL, 10);
+
+    if (d->request_offset > 0)
+    {
+        char expected[64];
+        int resumed;
+        snprintf(expected, sizeof(expected), "bytes %llu-", d->request_offset);
+        resumed = (status == 206) && (header_value(head, "Content-Range", value, sizeof(value)) != NULL) &&
+                  (strncmp(value, expected, strlen(expected)) == 0);
+        if (!resumed && (status == 200))
+        {
+            /* the server sent the whole zip (it changed, or ranges are not
+               supported), so start over */
+            unzStreamClose(d->stream);
+            remove_directory(d->partial);
+            TU_CHECK(mkdir(d->partial, 0755) == 0);
+            d->request_offset = 0;
+            d->saved_offset = 0;
+            d->stream = open_stream(d);
+        }
+        else if (!resumed)
+        {
+            d->unzip_error = status;
+            close(fd);
+            return 1;
+        }
+    }
+    if ((header_value(head, "ETag", value, sizeof(value)) != NULL) ||
+        (header_value(head, "Last-Modified", value, sizeof(value)) != NULL))
+        snprintf(d->validator, sizeof(d->validator), "%s", value);
+
+    for (;;)
+    {
+        if ((d->kill_after > 0) && (d->fetched + n >= d->kill_after))
+        {
+            /* the app is gone: whatever was saved stays as it is */
+            *killed = 1;
+            close(fd);
+            return 1;
+        }
+        received += n;
+        d->fetched += n;
+        if ((n > 0) && (unzStreamWrite(d->stream, body, (uLong)n) != UNZ_OK))
+        {
+            /* no point downloading the rest of a broken zip */
+            d->unzip_error = UNZ_BADZIPFILE;
+            break;
+        }
+        if (unzStreamResumeOffset(d->stream) >= d->saved_offset + DOWNLOAD_RESUME_STATE_INTERVAL)
+            save_resume_state(d);
+        {
+            ssize_t got = read(fd, body, sizeof(body));
+            if (got <= 0)
+                break;
+            n = (size_t)got;
+        }
+    }
+    close(fd);
+    return received < length;
+}
+
+/* unzipDataFromRemoteUrl:toDirectoryUrl:completion: and the
+   didCompleteWithError: which follow each request */
+static int download_bundle(download* d, const char* name, collector* c)
+{
+    int killed = 0;
+
+    snprintf(d->url, sizeof(d->url), "http://127.0.0.1:%d/bundle.zip", listener_port);
+    snprintf(d->directory, sizeof(d->directory), "%.300s", tu_path(name));
+    snprintf(d->partial, sizeof(d->partial), "%s.partial", d->directory);
+    snprintf(d->state, sizeof(d->state), "%s.plist", d->partial);
+    d->c = c;
+    d->request_offset = 0;
+    d->saved_offset = 0;
+    d->validator[0] = '\0';
+    d->resumes_without_progress = 0;
+    d->unzip_error = 0;
+
+    /* the entries extracted by an earlier, interrupted download of the same
+       zip are kept */
+    if (load_resume_state(d->state, d->url, &d->request_offset, d->validator) &&
+        (access(d->partial, F_OK) == 0))
+        d->saved_offset = d->request_offset;
+    else
+    {
+        d->request_offset = 0;
+        d->validator[0] = '\0';
+        remove(d->state);
+        remove_directory(d->partial);
+    }
+    TU_CHECK(mkdir(d->partial, 0755) == 0 || errno == EEXIST);
+
+    for (;;)
+    {
+        int dropped = fetch(d, &killed);
+        int err = unzStreamClose(d->stream);
+        if (killed)
+            return DOWNLOAD_KILLED;
+        if ((err != UNZ_OK) && (d->unzip_error == 0) && dropped)
+        {
+            /* the entries extracted so far are kept, and the zip is
+               requested again from the first one that is missing */
+            ZPOS64_T offset = unzStreamResumeOffset(d->stream);
+            if (!d->resume)
+                offset = 0;
+            if (offset > d->request_offset)
+                d->resumes_without_progress = 0;
+            else
+                d->resumes_without_progress++;
+            if (d->resume)
+                save_resume_state(d);
+            if (d->resumes_without_progress <= MAX_DOWNLOAD_RESUMES_WITHOUT_PROGRESS)
+            {
+                /* LKBundlesManager waits 2^n/2 seconds first */
+                d->request_offset = offset;
+                continue;
+            }
+            /* give up for now, a later download resumes from the saved state */
+            return DOWNLOAD_GAVE_UP;
+        }
+        remove(d->state);
+        if ((d->unzip_error == 0) && !dropped && (err == UNZ_OK))
+        {
+            remove_directory(d->directory);
+            TU_CHECK(rename(d->partial, d->directory) == 0);
+            return DOWNLOAD_DONE;
+        }
+        remove_directory(d->partial);
+        return DOWNLOAD_FAILED;
+    }
+}
+
+/* ---- the tests ---- */
+
+static void check_directory(const char* directory, int version)
+{
+    unsigned char* expected = (unsigned char*)malloc(entry_size(4) + 1);
+    unsigned char* got = (unsigned char*)malloc(entry_size(4) + 1);
+    int files = 0;
+    DIR* dir;
+    struct dirent* e;
+    long i;
+
+    TU_CHECK(expected != NULL && got != NULL);
+    for (i = 0; i < ENTRIES; i++)
+    {
+        char path[600];
+        FILE* f;
+        snprintf(path, sizeof(path), "%s/%ld", directory, i);
+        f = fopen(path, "rb");
+        TU_CHECK(f != NULL);
+        TU_CHECK(fread(got, 1, entry_size(i) + 1, f) == entry_size(i));
+        fclose(f);
+        entry_data(i, version, expected);
+        TU_CHECK(memcmp(got, expected, entry_size(i)) == 0);
+    }
+    /* and nothing else */
+    dir = opendir(directory);
+    TU_CHECK(dir != NULL);
+    while ((e = readdir(dir)) != NULL)
+        if (e->d_name[0] != '.')
+            files++;
+    closedir(dir);
+    TU_CHECK(files == ENTRIES);
+    free(expected);
+    free(got);
+}
+
+static void check_once(const collector* c)
+{
+    long i;
+    for (i = 0; i < ENTRIES; i++)
+        TU_CHECK(c->completed[i] == 1);
+}
+
+static void check_dropped(const unsigned char* zip, size_t size)
+{
+    http_config config;
+    logged_request requests[64];
+    collector c;
+    download d;
+    server srv;
+    int n, k;
+
+    memset(&config, 0, sizeof(config));
+    config.zip = zip;
+    config.size = size;
+    config.etag = "\"bundle-1\"";
+    config.ranges = 1;
+    config.drop_every = size / 5;
+    memset(&c, 0, sizeof(c));
+    memset(&d, 0, sizeof(d));
+    d.resume = 1;
+    srv = start_server(&config);
+    TU_CHECK(download_bundle(&d, "resume_bundle", &c) == DOWNLOAD_DONE);
+    stop_server(srv);
+    check_directory(d.directory, 1);
+    check_once(&c);
+    TU_CHECK(access(d.state, F_OK) != 0 && access(d.partial, F_OK) != 0);
+
+    /* each request goes on from the last entry extracted */
+    n = read_log(srv, requests, 64);
+    TU_CHECK(n >= 5);
+    TU_CHECK(requests[0].start == 0 && strcmp(requests[0].if_range, "-") == 0);
+    for (k = 1; k < n; k++)
+    {
+        TU_CHECK(requests[k].status == 206);
+        TU_CHECK(requests[k].start > requests[k - 1].start);
+        TU_CHECK(requests[k].start <= requests[k - 1].start + config.drop_every);
+        TU_CHECK(strcmp(requests[k].if_range, config.etag) == 0);
+    }
+    TU_CHECK(d.fetched < 2 * (unsigned long long)size);
+    printf("ok: dropped every %lu bytes: %d requests, %llu bytes for a zip of %lu, every entry once\n",
+           (unsigned long)config.drop_every, n, d.fetched, (unsigned long)size);
+    remove_directory(d.directory);
+}
+
+static void check_restarted(const unsigned char* zip, size_t size)
+{
+    http_config config;
+    logged_request requests[8];
+    collector c;
+    download d;
+    server srv;
+    long i;
+    int twice = 0;
+
+    /* a server which ignores Range */
+    memset(&config, 0, sizeof(config));
+    config.zip = zip;
+    config.size = size;
+    config.etag = "\"bundle-1\"";
+    config.ranges = 0;
+    config.drop_at[0] = size / 2;
+    memset(&c, 0, sizeof(c));
+    memset(&d, 0, sizeof(d));
+    d.resume = 1;
+    srv = start_server(&config);
+    TU_CHECK(download_bundle(&d, "resume_bundle", &c) == DOWNLOAD_DONE);
+    stop_server(srv);
+    TU_CHECK(read_log(srv, requests, 8) == 2);
+    TU_CHECK(requests[1].status == 200);
+    check_directory(d.directory, 1);
+    /* the entries of the first half were extracted again */
+    for (i = 0; i < ENTRIES; i++)
+    {
+        TU_CHECK(c.completed[i] == 1 || c.completed[i] == 2);
+        twice += c.completed[i] == 2;
+    }
+    TU_CHECK(twice > 0);
+    printf("ok: a 200 to a resumed request starts over, %d entries extracted again\n", twice);
+    remove_directory(d.directory);
+
+    /* a 206 for another range */
+    config.ranges = 1;
+    config.wrong_range = 1;
+    memset(&c, 0, sizeof(c));
+    srv = start_server(&config);
+    TU_CHECK(download_bundle(&d, "resume_bundle", &c) == DOWNLOAD_FAILED);
+    stop_server(srv);
+    TU_CHECK(d.unzip_error == 206);
+    TU_CHECK(access(d.state, F_OK) != 0 && access(d.partial, F_OK) != 0 && access(d.directory, F_OK) != 0);
+    printf("ok: a 206 for another range fails, and removes the partial directory and its state\n");
+}
+
+static void check_gave_up(const unsigned char* zip, size_t size, const unsigned char* zip2, size_t size2)
+{
+    http_config config;
+    logged_request requests[64];
+    unsigned long long offset;
+    char validator[64];
+    collector c;
+    download d;
+    server srv;
+    int n, k, same = 0;
+
+    /* the server stops in the middle of entry 28 every time */
+    memset(&config, 0, sizeof(config));
+    config.zip = zip;
+    config.size = size;
+    config.etag = "\"bundle-1\"";
+    config.ranges = 1;
+    config.drop_every = size / 5;
+    config.stall_at = size * 7 / 10;
+    memset(&c, 0, sizeof(c));
+    memset(&d, 0, sizeof(d));
+    d.resume = 1;
+    srv = start_server(&config);
+    TU_CHECK(download_bundle(&d, "resume_bundle", &c) == DOWNLOAD_GAVE_UP);
+    stop_server(srv);
+    n = read_log(srv, requests, 64);
+    for (k = 0; k < n; k++)
+        same += requests[k].start == requests[n - 1].start;
+    TU_CHECK(same == 1 + MAX_DOWNLOAD_RESUMES_WITHOUT_PROGRESS);
+    TU_CHECK(load_resume_state(d.state, d.url, &offset, validator));
+    TU_CHECK(offset == requests[n - 1].start && offset < config.stall_at);
+    TU_CHECK(strcmp(validator, config.etag) == 0);
+    TU_CHECK(access(d.partial, F_OK) == 0 && access(d.directory, F_OK) != 0);
+    printf("ok: no progress: gave up after %d requests at %llu, the state kept\n", same, offset);
+
+    /* the next download goes on from the state */
+    config.stall_at = 0;
+    config.drop_every = 0;
+    srv = start_server(&config);
+    TU_CHECK(download_bundle(&d, "resume_bundle", &c) == DOWNLOAD_DONE);
+    stop_server(srv);
+    TU_CHECK(read_log(srv, requests, 64) == 1);
+    TU_CHECK(requests[0].start == offset && requests[0].status == 206);
+    check_directory(d.directory, 1);
+    check_once(&c);
+    printf("ok: the next download resumed at %llu\n", offset);
+    remove_directory(d.directory);
+
+    /* killed: the state saved every 512KB is behind, but still good */
+    memset(&c, 0, sizeof(c));
+    d.kill_after = size * 6 / 10;
+    d.fetched = 0;
+    srv = start_server(&config);
+    TU_CHECK(download_bundle(&d, "resume_bundle", &c) == DOWNLOAD_KILLED);
+    stop_server(srv);
+    d.kill_after = 0;
+    TU_CHECK(load_resume_state(d.state, d.url, &offset, validator));
+    TU_CHECK(offset > 0 && offset + DOWNLOAD_RESUME_STATE_INTERVAL + entry_size(4) > size * 6 / 10);
+    srv = start_server(&config);
+    TU_CHECK(download_bundle(&d, "resume_bundle", &c) == DOWNLOAD_DONE);
+    stop_server(srv);
+    TU_CHECK(read_log(srv, requests, 64) == 1 && requests[0].start == offset);
+    check_directory(d.directory, 1);
+    printf("ok: killed at %lu bytes, resumed at %llu\n", (unsigned long)(size * 6 / 10), offset);
+    remove_directory(d.directory);
+
+    /* given up on a zip which then changed: If-Range gets all of the new one */
+    config.stall_at = size / 2;
+    memset(&c, 0, sizeof(c));
+    srv = start_server(&config);
+    TU_CHECK(download_bundle(&d, "resume_bundle", &c) == DOWNLOAD_GAVE_UP);
+    stop_server(srv);
+    config.zip = zip2;
+    config.size = size2;
+    config.etag = "\"bundle-2\"";
+    config.stall_at = 0;
+    srv = start_server(&config);
+    TU_CHECK(download_bundle(&d, "resume_bundle", &c) == DOWNLOAD_DONE);
+    stop_server(srv);
+    TU_CHECK(read_log(srv, requests, 64) == 1);
+    TU_CHECK(requests[0].status == 200 && strcmp(requests[0].if_range, "\"bundle-1\"") == 0);
+    check_directory(d.directory, 2);
+    printf("ok: the zip changed: If-Range got all of the new one\n");
+    remove_directory(d.directory);
+}
+
+static void test(void)
+{
+    size_t size, size2;
+    unsigned char* zip = make_zip(1, &size);
+    unsigned char* zip2 = make_zip(2, &size2);
+
+    TU_CHECK(size > 4 * DOWNLOAD_RESUME_STATE_INTERVAL);
+    check_dropped(zip, size);
+    check_restarted(zip, size);
+    check_gave_up(zip, size, zip2, size2);
+    remove(tu_path("resume_server.log"));
+    free(zip);
+    free(zip2);
+}
+
+static void bench(void)
+{
+    http_config config;
+    size_t size;
+    unsigned char* zip;
+    int resume;
+
+    size_scale = 8;
+    zip = make_zip(1, &size);
+    memset(&config, 0, sizeof(config));
+    config.zip = zip;
+    config.size = size;
+    config.etag = "\"bundle-1\"";
+    config.ranges = 1;
+    config.drop_at[0] = size * 7 / 10;
+    config.drop_at[1] = size / 2;
+    config.drop_at[2] = size * 9 / 10;
+    printf("a zip of %.1fMB, the first three connections dropped at 70%%, 50%% and 90%%\n",
+           (double)size / (1 << 20));
+    for (resume = 1; resume >= 0; resume--)
+    {
+        collector c;
+        download d;
+        double start;
+        server srv;
+
+        memset(&c, 0, sizeof(c));
+        memset(&d, 0, sizeof(d));
+        d.resume = resume;
+        srv = start_server(&config);
+        start = tu_now();
+        TU_CHECK(download_bundle(&d, "resume_bench", &c) == DOWNLOAD_DONE);
+        printf("%-28s %7.1f MB fetched %7.0f ms\n", resume ? "resumed from the last entry" : "started over",
+               (double)d.fetched / (1 << 20), (tu_now() - start) * 1e3);
+        stop_server(srv);
+        remove_directory(d.directory);
+        remove_directory(d.partial);
+        remove(d.state);
+    }
+    remove(tu_path("resume_server.log"));
+    free(zip);
+}
+
+int main(int argc, char** argv)
+{
+    if (tu_bench_mode(argc, argv))
+        bench();
+    else
+        test();
+    return 0;
+}
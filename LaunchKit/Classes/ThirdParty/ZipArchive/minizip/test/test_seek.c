@@ -0,0 +1,214 @@
+/* test_seek.c -- unzSeekCurrentFile64 and the seek index
+
+   A deflated entry of 8MB of text and a stored one are read at random
+   positions after unzSeekCurrentFile64, forward and back, without
+   checkpoints and with a checkpoint every 256KB, and must give the bytes
+   of the entry. The checkpoints saved with unzSaveCurrentFileSeekIndex must
+   load into the entry reopened in another handle, and be refused by an
+   entry they were not taken on. Built against the _counted lk_unzip.c, the
+   test also checks that every checkpoint is freed.
+
+   With -b, times reads of 4KB at random positions of a 64MB deflated entry,
+   without checkpoints and with an index loaded, for spans of 1MB and 256KB.
+
+   License: Same as ZLIB (www.gzip.org)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lk_unzip.h"
+#include "lk_zip.h"
+#include "testutil.h"
+
+#define READ_SIZE 4096
+
+static void make_entries(const char* path, const unsigned char* data, size_t size)
+{
+    zip_fileinfo zi;
+    zipFile zf = zipOpen64(path, APPEND_STATUS_CREATE);
+
+    TU_CHECK(zf != NULL);
+    memset(&zi, 0, sizeof(zi));
+    TU_CHECK(zipOpenNewFileInZip64(zf, "deflated.txt", &zi, NULL, 0, NULL, 0, NULL, Z_DEFLATED, 6, 0) == ZIP_OK);
+    TU_CHECK(zipWriteInFileInZip(zf, data, (unsigned)size) == ZIP_OK);
+    TU_CHECK(zipCloseFileInZip(zf) == ZIP_OK);
+    TU_CHECK(zipOpenNewFileInZip64(zf, "stored.txt", &zi, NULL, 0, NULL, 0, NULL, 0, 0, 0) == ZIP_OK);
+    TU_CHECK(zipWriteInFileInZip(zf, data, (unsigned)size) == ZIP_OK);
+    TU_CHECK(zipCloseFileInZip(zf) == ZIP_OK);
+    TU_CHECK(zipClose(zf, NULL) == ZIP_OK);
+}
+
+static unzFile open_entry(const char* path, const char* name)
+{
+    unzFile uf = unzOpen64(path);
+    TU_CHECK(uf != NULL);
+    TU_CHECK(unzLocateFile(uf, name, 1) == UNZ_OK);
+    TU_CHECK(unzOpenCurrentFile(uf) == UNZ_OK);
+    return uf;
+}
+
+static void close_entry(unzFile uf)
+{
+    /* the CRC is not checked once data was skipped */
+    TU_CHECK(unzCloseCurrentFile(uf) == UNZ_OK);
+    TU_CHECK(unzClose(uf) == UNZ_OK);
+}
+
+/* seek to pos and read up to READ_SIZE bytes there */
+static void check_read_at(unzFile uf, const unsigned char* data, size_t size, size_t pos)
+{
+    unsigned char got[READ_SIZE];
+    size_t expected = (size - pos < READ_SIZE) ? size - pos : READ_SIZE;
+
+    TU_CHECK(unzSeekCurrentFile64(uf, (ZPOS64_T)pos) == UNZ_OK);
+    TU_CHECK(unztell64(uf) == (ZPOS64_T)pos);
+    TU_CHECK(unzReadCurrentFile(uf, got, READ_SIZE) == (int)expected);
+    TU_CHECK(memcmp(got, data + pos, expected) == 0);
+}
+
+static void check_random_reads(unzFile uf, const unsigned char* data, size_t size, int reads, unsigned long long seed)
+{
+    int i;
+    check_read_at(uf, data, size, size / 2);
+    check_read_at(uf, data, size, 0);
+    check_read_at(uf, data, size, size - 1);
+    check_read_at(uf, data, size, size);
+    for (i = 0; i < reads; i++)
+        check_read_at(uf, data, size, (size_t)(tu_random(&seed) % (size + 1)));
+    TU_CHECK(unzSeekCurrentFile64(uf, (ZPOS64_T)size + 1) == UNZ_PARAMERROR);
+}
+
+/* read the whole entry once, recording the checkpoints */
+static void read_through(unzFile uf, const unsigned char* data, size_t size)
+{
+    unsigned char* got = (unsigned char*)malloc(size + 1);
+    TU_CHECK(got != NULL);
+    TU_CHECK(unzSeekCurrentFile64(uf, 0) == UNZ_OK);
+    TU_CHECK(unzReadCurrentFile(uf, got, (unsigned)size + 1) == (int)size);
+    TU_CHECK(memcmp(got, data, size) == 0);
+    free(got);
+}
+
+static void test(void)
+{
+    const char* path = tu_path("seek.zip");
+    const char* index_path = tu_path("seek.index");
+    const size_t size = 8 << 20;
+    unsigned char* data = (unsigned char*)malloc(size);
+    unzFile uf;
+
+    TU_CHECK(data != NULL);
+    tu_fill_text(data, size, 3);
+    make_entries(path, data, size);
+
+    memset(&tu_allocs, 0, sizeof(tu_allocs));
+    uf = open_entry(path, "stored.txt");
+    check_random_reads(uf, data, size, 200, 1);
+    close_entry(uf);
+    printf("ok: random reads of a stored entry\n");
+
+    uf = open_entry(path, "deflated.txt");
+    check_random_reads(uf, data, size, 20, 2);
+    close_entry(uf);
+    printf("ok: random reads of a deflated entry without checkpoints\n");
+
+    uf = open_entry(path, "deflated.txt");
+    TU_CHECK(unzSetCurrentFileSeekSpan(uf, 256 * 1024) == UNZ_OK);
+    read_through(uf, data, size);
+    check_random_reads(uf, data, size, 200, 3);
+    TU_CHECK(unzSaveCurrentFileSeekIndex(uf, index_path) == UNZ_OK);
+    close_entry(uf);
+    printf("ok: random reads of a deflated entry with a checkpoint every 256KB\n");
+
+    uf = open_entry(path, "deflated.txt");
+    TU_CHECK(unzLoadCurrentFileSeekIndex(uf, index_path) == UNZ_OK);
+    check_random_reads(uf, data, size, 200, 4);
+    close_entry(uf);
+    uf = open_entry(path, "stored.txt");
+    TU_CHECK(unzLoadCurrentFileSeekIndex(uf, index_path) == UNZ_PARAMERROR);
+    close_entry(uf);
+    printf("ok: the saved checkpoints load into the entry, and only into it\n");
+
+    /* another deflated entry of the same sizes, but not the same data */
+    data[size / 3] ^= 1;
+    make_entries(path, data, size);
+    uf = open_entry(path, "deflated.txt");
+    TU_CHECK(unzLoadCurrentFileSeekIndex(uf, index_path) == UNZ_BADZIPFILE);
+    check_read_at(uf, data, size, size / 3 - 10);
+    close_entry(uf);
+    TU_CHECK(tu_allocs.allocs == tu_allocs.frees);
+    printf("ok: checkpoints of another entry are refused, %lu allocations all freed\n", tu_allocs.allocs);
+
+    remove(index_path);
+    remove(path);
+    free(data);
+}
+
+static void bench_reads(const char* name, unzFile uf, const unsigned char* data, size_t size)
+{
+    const int reads = 200;
+    unsigned long long seed = 5;
+    double start = tu_now(), elapsed;
+    int i;
+
+    for (i = 0; i < reads; i++)
+        check_read_at(uf, data, size, (size_t)(tu_random(&seed) % size));
+    elapsed = tu_now() - start;
+    printf("%-30s %9.1f us/read\n", name, elapsed / reads * 1e6);
+}
+
+static void bench(void)
+{
+    const char* path = tu_path("seek_bench.zip");
+    const char* index_path = tu_path("seek_bench.index");
+    const size_t size = 64 << 20;
+    const ZPOS64_T spans[] = { 1 << 20, 256 * 1024 };
+    unsigned char* data = (unsigned char*)malloc(size);
+    char name[64];
+    unzFile uf;
+    int k;
+
+    TU_CHECK(data != NULL);
+    tu_fill_text(data, size, 3);
+    make_entries(path, data, size);
+    printf("4KB reads at random positions of a %luMB deflated entry\n", (unsigned long)(size >> 20));
+
+    uf = open_entry(path, "deflated.txt");
+    bench_reads("no checkpoints", uf, data, size);
+    close_entry(uf);
+
+    for (k = 0; k < 2; k++)
+    {
+        double start;
+        uf = open_entry(path, "deflated.txt");
+        TU_CHECK(unzSetCurrentFileSeekSpan(uf, spans[k]) == UNZ_OK);
+        start = tu_now();
+        read_through(uf, data, size);
+        TU_CHECK(unzSaveCurrentFileSeekIndex(uf, index_path) == UNZ_OK);
+        printf("span %4lluKB: first pass and save %6.0f ms\n", (unsigned long long)(spans[k] >> 10),
+               (tu_now() - start) * 1e3);
+        close_entry(uf);
+
+        uf = open_entry(path, "deflated.txt");
+        start = tu_now();
+        TU_CHECK(unzLoadCurrentFileSeekIndex(uf, index_path) == UNZ_OK);
+        printf("span %4lluKB: index loaded in %6.1f ms\n", (unsigned long long)(spans[k] >> 10),
+               (tu_now() - start) * 1e3);
+        snprintf(name, sizeof(name), "index, span %lluKB", (unsigned long long)(spans[k] >> 10));
+        bench_reads(name, uf, data, size);
+        close_entry(uf);
+    }
+    remove(index_path);
+    remove(path);
+    free(data);
+}
+
+int main(int argc, char** argv)
+{
+    if (tu_bench_mode(argc, argv))
+        bench();
+    else
+        test();
+    return 0;
+}
@@ -0,0 +1,304 @@
+/* test_stored.c -- reading stored entries
+
+   Stored entries are read by unzReadCurrentFile straight into the buffer of
+   the caller, and written to a descriptor by unzCopyCurrentFileToFd from the
+   mapping of the zipfile, with copy_file_range on Linux, or through a
+   buffer. The test reads stored entries of 0 bytes to 3MB with reads of 1
+   byte to the whole entry, and copies them by the three paths, also after
+   part of the entry was read, checking the bytes and the CRC. A damaged
+   entry must fail its CRC check on the paths which read the data, and
+   deflated or encrypted entries must be refused by unzCopyCurrentFileToFd.
+
+   With -b, reads 40 stored entries of 3MB (random data, like image assets)
+   with unzReadCurrentFile and 256KB reads, then extracts them to files by
+   each path of unzCopyCurrentFileToFd, and prints the throughput.
+
+   License: Same as ZLIB (www.gzip.org)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "lk_unzip.h"
+#include "lk_zip.h"
+#include "testutil.h"
+
+#define READ_SIZE (256 * 1024)
+
+enum { COPY_MAPPED, COPY_KERNEL, COPY_BUFFERED };
+static const char* copy_names[] = { "mapped", "copy_file_range", "buffered" };
+
+static const size_t sizes[] = { 0, 1, 100, 4096, 300 * 1024 + 7, 3 * 1024 * 1024 };
+#define SIZE_COUNT (sizeof(sizes) / sizeof(sizes[0]))
+
+static void make_archive(const char* path, long entries, const size_t* entry_sizes, int extras)
+{
+    size_t max_size = 0;
+    unsigned char* data;
+    zip_fileinfo zi;
+    zipFile zf = zipOpen64(path, APPEND_STATUS_CREATE);
+    long i;
+
+    for (i = 0; i < entries; i++)
+        if (entry_sizes[i] > max_size)
+            max_size = entry_sizes[i];
+    data = (unsigned char*)malloc(max_size + 1);
+    TU_CHECK(zf != NULL && data != NULL);
+    memset(&zi, 0, sizeof(zi));
+    for (i = 0; i < entries; i++)
+    {
+        tu_fill_random(data, entry_sizes[i], (unsigned long long)i + 1);
+        TU_CHECK(zipOpenNewFileInZip64(zf, tu_entry_name(i), &zi, NULL, 0, NULL, 0, NULL, 0, 0, 0) == ZIP_OK);
+        TU_CHECK(zipWriteInFileInZip(zf, data, (unsigned)entry_sizes[i]) == ZIP_OK);
+        TU_CHECK(zipCloseFileInZip(zf) == ZIP_OK);
+    }
+    if (extras)
+    {
+        TU_CHECK(zipOpenNewFileInZip64(zf, "deflated", &zi, NULL, 0, NULL, 0, NULL, Z_DEFLATED, 6, 0) == ZIP_OK);
+        TU_CHECK(zipWriteInFileInZip(zf, data, 1000) == ZIP_OK);
+        TU_CHECK(zipCloseFileInZip(zf) == ZIP_OK);
+        TU_CHECK(zipOpenNewFileInZip3_64(zf, "encrypted", &zi, NULL, 0, NULL, 0, NULL, 0, 0, 0,
+                                         -MAX_WBITS, DEF_MEM_LEVEL, Z_DEFAULT_STRATEGY, "secret", 0, 0) == ZIP_OK);
+        TU_CHECK(zipWriteInFileInZip(zf, data, 1000) == ZIP_OK);
+        TU_CHECK(zipCloseFileInZip(zf) == ZIP_OK);
+    }
+    TU_CHECK(zipClose(zf, NULL) == ZIP_OK);
+    free(data);
+}
+
+static unzFile open_archive(const char* path, int mapped)
+{
+    zlib_filefunc64_ex_def functions;
+    if (mapped)
+        fill_mmap_filefunc64(&functions);
+    else
+        fill_fopen64_filefunc_ex(&functions);
+    return unzOpen3_64(path, &functions);
+}
+
+/* read entry i, read_size bytes at a time */
+static void check_reads(unzFile uf, long i, size_t size, size_t read_size, const unsigned char* expected)
+{
+    unsigned char* got = (unsigned char*)malloc(size + read_size);
+    size_t total = 0;
+    int n;
+
+    TU_CHECK(got != NULL);
+    TU_CHECK(unzLocateFile(uf, tu_entry_name(i), 1) == UNZ_OK);
+    TU_CHECK(unzOpenCurrentFile(uf) == UNZ_OK);
+    while ((n = unzReadCurrentFile(uf, got + total, (unsigned)read_size)) > 0)
+        total += (size_t)n;
+    TU_CHECK(n == 0);
+    TU_CHECK(total == size);
+    TU_CHECK(memcmp(got, expected, size) == 0);
+    TU_CHECK(unzCloseCurrentFile(uf) == UNZ_OK);
+    free(got);
+}
+
+/* copy the current entry to out_path, and return the error of
+   unzCopyCurrentFileToFd, or of unzCloseCurrentFile when it succeeded */
+static int copy_entry(unzFile uf, const char* path, const char* out_path, int how, ZPOS64_T* copied)
+{
+    int fd = open(out_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    int zip_fd = (how == COPY_KERNEL) ? open(path, O_RDONLY) : -1;
+    int err, close_err;
+
+    TU_CHECK(fd != -1);
+    err = unzCopyCurrentFileToFd(uf, fd, zip_fd, copied);
+    close_err = unzCloseCurrentFile(uf);
+    close(fd);
+    if (zip_fd != -1)
+        close(zip_fd);
+    return (err != UNZ_OK) ? err : close_err;
+}
+
+static void check_file(const char* out_path, const unsigned char* expected, size_t size)
+{
+    unsigned char* got = (unsigned char*)malloc(size + 1);
+    FILE* f = fopen(out_path, "rb");
+    TU_CHECK(got != NULL && f != NULL);
+    TU_CHECK(fread(got, 1, size + 1, f) == size);
+    TU_CHECK(memcmp(got, expected, size) == 0);
+    fclose(f);
+    free(got);
+}
+
+static void test(void)
+{
+    const char* path = tu_path("stored.zip");
+    const char* out_path = tu_path("stored.out");
+    const size_t read_sizes[] = { 1, 7, 4096, READ_SIZE, 4 * 1024 * 1024 };
+    unsigned char* data = (unsigned char*)malloc(sizes[SIZE_COUNT - 1]);
+    unz_file_info64 info;
+    ZPOS64_T copied;
+    unzFile uf;
+    size_t k, r;
+    int how;
+
+    TU_CHECK(data != NULL);
+    make_archive(path, SIZE_COUNT, sizes, 1);
+
+    for (how = 0; how < 2; how++)
+    {
+        uf = open_archive(path, how);
+        TU_CHECK(uf != NULL);
+        for (k = 0; k < SIZE_COUNT; k++)
+        {
+            tu_fill_random(data, sizes[k], k + 1);
+            for (r = 0; r < sizeof(read_sizes) / sizeof(read_sizes[0]); r++)
+                check_reads(uf, (long)k, sizes[k], read_sizes[r], data);
+        }
+        TU_CHECK(unzClose(uf) == UNZ_OK);
+    }
+    printf("ok: stored entries read by unzReadCurrentFile, through stdio and mapped\n");
+
+    for (how = COPY_MAPPED; how <= COPY_BUFFERED; how++)
+    {
+        uf = open_archive(path, how == COPY_MAPPED);
+        TU_CHECK(uf != NULL);
+        for (k = 0; k < SIZE_COUNT; k++)
+        {
+            size_t skip;
+            tu_fill_random(data, sizes[k], k + 1);
+            /* from the start, and after a read of part of the entry */
+            for (skip = 0; skip <= (sizes[k] > 0 ? 1 : 0); skip++)
+            {
+                unsigned char head[100];
+                size_t head_size = skip ? sizes[k] / 3 + 1 : 0;
+                if (head_size > sizeof(head))
+                    head_size = sizeof(head);
+                TU_CHECK(unzLocateFile(uf, tu_entry_name((long)k), 1) == UNZ_OK);
+                TU_CHECK(unzOpenCurrentFile(uf) == UNZ_OK);
+                TU_CHECK(unzReadCurrentFile(uf, head, (unsigned)head_size) == (int)head_size);
+                TU_CHECK(memcmp(head, data, head_size) == 0);
+                TU_CHECK(copy_entry(uf, path, out_path, how, &copied) == UNZ_OK);
+                TU_CHECK(copied == sizes[k] - head_size);
+                check_file(out_path, data + head_size, sizes[k] - head_size);
+            }
+        }
+
+        TU_CHECK(unzLocateFile(uf, "deflated", 1) == UNZ_OK);
+        TU_CHECK(unzOpenCurrentFile(uf) == UNZ_OK);
+        TU_CHECK(copy_entry(uf, path, out_path, how, &copied) == UNZ_PARAMERROR);
+        TU_CHECK(unzLocateFile(uf, "encrypted", 1) == UNZ_OK);
+        TU_CHECK(unzOpenCurrentFilePassword(uf, "secret") == UNZ_OK);
+        TU_CHECK(copy_entry(uf, path, out_path, how, &copied) == UNZ_PARAMERROR);
+        TU_CHECK(copied == 0);
+        TU_CHECK(unzClose(uf) == UNZ_OK);
+        printf("ok: stored entries copied to a descriptor, %s\n", copy_names[how]);
+    }
+
+    /* damage the largest entry: the paths which read the data catch it */
+    uf = unzOpen64(path);
+    TU_CHECK(uf != NULL);
+    TU_CHECK(unzLocateFile(uf, tu_entry_name(SIZE_COUNT - 1), 1) == UNZ_OK);
+    TU_CHECK(unzOpenCurrentFile(uf) == UNZ_OK);
+    TU_CHECK(unzGetCurrentFileInfo64(uf, &info, NULL, 0, NULL, 0, NULL, 0) == UNZ_OK);
+    {
+        FILE* f = fopen(path, "r+b");
+        ZPOS64_T offset = unzGetCurrentFileZStreamPos64(uf) + info.compressed_size / 2;
+        int c;
+        TU_CHECK(f != NULL);
+        TU_CHECK(fseeko(f, (off_t)offset, SEEK_SET) == 0);
+        c = fgetc(f);
+        TU_CHECK(fseeko(f, (off_t)offset, SEEK_SET) == 0);
+        fputc(c ^ 0x55, f);
+        fclose(f);
+    }
+    TU_CHECK(unzCloseCurrentFile(uf) == UNZ_OK);
+    TU_CHECK(unzClose(uf) == UNZ_OK);
+    for (how = COPY_MAPPED; how <= COPY_BUFFERED; how++)
+    {
+        uf = open_archive(path, how == COPY_MAPPED);
+        TU_CHECK(uf != NULL);
+        TU_CHECK(unzLocateFile(uf, tu_entry_name(SIZE_COUNT - 1), 1) == UNZ_OK);
+        TU_CHECK(unzOpenCurrentFile(uf) == UNZ_OK);
+        /* the kernel copy never sees the data, and can not check its CRC */
+        TU_CHECK(copy_entry(uf, path, out_path, how, &copied) == (how == COPY_KERNEL ? UNZ_OK : UNZ_CRCERROR));
+        TU_CHECK(copied == sizes[SIZE_COUNT - 1]);
+        TU_CHECK(unzClose(uf) == UNZ_OK);
+    }
+    printf("ok: a damaged entry fails its CRC check when mapped or buffered\n");
+
+    remove(out_path);
+    remove(path);
+    free(data);
+}
+
+static void bench(void)
+{
+    const char* path = tu_path("stored_bench.zip");
+    const char* out_path = tu_path("stored_bench.out");
+    const long entries = 40;
+    size_t entry_sizes[40];
+    unsigned char* buffer = (unsigned char*)malloc(READ_SIZE);
+    double megabytes, best[4];
+    long i;
+    int how, pass;
+
+    TU_CHECK(buffer != NULL);
+    for (i = 0; i < entries; i++)
+        entry_sizes[i] = 3 * 1024 * 1024;
+    make_archive(path, entries, entry_sizes, 0);
+    megabytes = (double)entries * entry_sizes[0] / (1 << 20);
+    printf("%ld stored entries of 3MB, %.0fMB, best of 5\n", entries, megabytes);
+
+    for (how = 0; how < 4; how++)
+        best[how] = 1e9;
+    for (pass = 0; pass < 5; pass++)
+    {
+        double start;
+        unzFile uf = unzOpen64(path);
+        TU_CHECK(uf != NULL);
+        start = tu_now();
+        for (i = 0; i < entries; i++)
+        {
+            int n;
+            TU_CHECK(unzLocateFile(uf, tu_entry_name(i), 1) == UNZ_OK);
+            TU_CHECK(unzOpenCurrentFile(uf) == UNZ_OK);
+            while ((n = unzReadCurrentFile(uf, buffer, READ_SIZE)) > 0)
+                ;
+            TU_CHECK(n == 0);
+            TU_CHECK(unzCloseCurrentFile(uf) == UNZ_OK);
+        }
+        if (tu_now() - start < best[3])
+            best[3] = tu_now() - start;
+        TU_CHECK(unzClose(uf) == UNZ_OK);
+
+        for (how = COPY_MAPPED; how <= COPY_BUFFERED; how++)
+        {
+            ZPOS64_T copied;
+            uf = open_archive(path, how == COPY_MAPPED);
+            TU_CHECK(uf != NULL);
+            start = tu_now();
+            for (i = 0; i < entries; i++)
+            {
+                TU_CHECK(unzLocateFile(uf, tu_entry_name(i), 1) == UNZ_OK);
+                TU_CHECK(unzOpenCurrentFile(uf) == UNZ_OK);
+                TU_CHECK(copy_entry(uf, path, out_path, how, &copied) == UNZ_OK);
+            }
+            if (tu_now() - start < best[how])
+                best[how] = tu_now() - start;
+            TU_CHECK(unzClose(uf) == UNZ_OK);
+        }
+    }
+    printf("%-49s %6.0f MB/s\n", "unzReadCurrentFile, 256KB reads", megabytes / best[3]);
+    for (how = COPY_MAPPED; how <= COPY_BUFFERED; how++)
+        printf("unzCopyCurrentFileToFd to a file, %-15s %6.0f MB/s\n", copy_names[how], megabytes / best[how]);
+
+    remove(out_path);
+    remove(path);
+    free(buffer);
+}
+
+int main(int argc, char** argv)
+{
+    if (tu_bench_mode(argc, argv))
+        bench();
+    else
+        test();
+    return 0;
+}
@@ -0,0 +1,418 @@
+/* test_stream.c -- zipfiles written in a single pass (APPEND_STATUS_CREATESTREAM)
+
+   The zipfile is written through file functions whose output is a pipe
+   to cat, which cannot seek: every entry must carry bit 3 of its flag and
+   a data descriptor, zip64 ones for the entries opened with zip64=1. The
+   entries, stored and deflated, some encrypted with the traditional PKWARE
+   encryption, must read back with lk_unzip. They must also pass the tests
+   of Info-ZIP unzip and of Python's zipfile, when those are installed. Both
+   check the last byte of the encryption header, which for an entry with a
+   data descriptor comes from its time instead of its crc.
+
+   The same zipfile without the encryption, and with that first zipfile
+   as a stored entry, must extract with unzStreamWrite pushed chunks of 1
+   to 65536 bytes: the data of a stored entry with a descriptor ends at
+   the first descriptor matching it, and the descriptors of the zipfile it
+   holds must not end it.
+
+   With -b, times writing 64MB of text through the pipe and to a file
+   written with seeks, and prints the MB/s of both.
+
+   License: Same as ZLIB (www.gzip.org)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lk_unzip.h"
+#include "lk_zip.h"
+#include "lk_unzstream.h"
+#include "testutil.h"
+
+#define ENTRIES 12
+#define PASSWORD "stream password"
+
+/* ---- output to a pipe ---- */
+
+static unsigned long pipe_seeks;
+
+static voidpf ZCALLBACK pipe_open(voidpf opaque, const void* filename, int mode)
+{
+    char command[512];
+    (void)opaque;
+    (void)mode;
+    snprintf(command, sizeof(command), "cat > '%s'", (const char*)filename);
+    return popen(command, "w");
+}
+
+static uLong ZCALLBACK pipe_write(voidpf opaque, voidpf stream, const void* buf, uLong size)
+{
+    (void)opaque;
+    return (uLong)fwrite(buf, 1, size, (FILE*)stream);
+}
+
+static ZPOS64_T ZCALLBACK pipe_tell(voidpf opaque, voidpf stream)
+{
+    (void)opaque;
+    (void)stream;
+    pipe_seeks++;
+    return (ZPOS64_T)-1;
+}
+
+static long ZCALLBACK pipe_seek(voidpf opaque, voidpf stream, ZPOS64_T offset, int origin)
+{
+    (void)opaque;
+    (void)stream;
+    (void)offset;
+    (void)origin;
+    pipe_seeks++;
+    return -1;
+}
+
+static int ZCALLBACK pipe_close(voidpf opaque, voidpf stream)
+{
+    (void)opaque;
+    return pclose((FILE*)stream) == 0 ? 0 : EOF;
+}
+
+static int ZCALLBACK pipe_error(voidpf opaque, voidpf stream)
+{
+    (void)opaque;
+    return ferror((FILE*)stream);
+}
+
+static void fill_pipe_filefunc(zlib_filefunc64_def* functions)
+{
+    memset(functions, 0, sizeof(*functions));
+    functions->zopen64_file = pipe_open;
+    functions->zwrite_file = pipe_write;
+    functions->ztell64_file = pipe_tell;
+    functions->zseek64_file = pipe_seek;
+    functions->zclose_file = pipe_close;
+    functions->zerror_file = pipe_error;
+}
+
+/* ---- the entries ---- */
+
+static size_t entry_size(long i)
+{
+    static const size_t sizes[] = { 0, 1, 11, 12, 13, 4096, 100000 };
+    return sizes[i % 7];
+}
+
+static int entry_encrypted(long i)
+{
+    return i % 2 == 1;
+}
+
+static int entry_stored(long i)
+{
+    return i % 3 == 2;
+}
+
+static void write_entries(zipFile zf, long entries)
+{
+    unsigned char data[100000];
+    long i;
+
+    for (i = 0; i < entries; i++)
+    {
+        zip_fileinfo zi;
+        memset(&zi, 0, sizeof(zi));
+        /* a time whose high byte is not that of the crc */
+        zi.dosDate = 0x5a21b000UL + (uLong)i * 0x1357;
+        tu_fill_text(data, entry_size(i), (unsigned long long)i);
+        /* the crc is given as if it were known: with a data descriptor the
+           encryption header must not depend on it */
+        TU_CHECK(zipOpenNewFileInZip3_64(zf, tu_entry_name(i), &zi, NULL, 0, NULL, 0, NULL,
+                                         entry_stored(i) ? 0 : Z_DEFLATED, entry_stored(i) ? 0 : 6, 0,
+                                         -MAX_WBITS, DEF_MEM_LEVEL, Z_DEFAULT_STRATEGY,
+                                         entry_encrypted(i) ? PASSWORD : NULL,
+                                         crc32(0L, data, (uInt)entry_size(i)), i % 4 == 3) == ZIP_OK);
+        TU_CHECK(zipWriteInFileInZip(zf, data, (unsigned)entry_size(i)) == ZIP_OK);
+        TU_CHECK(zipCloseFileInZip(zf) == ZIP_OK);
+    }
+}
+
+static void check_entries(const char* path, long entries)
+{
+    unsigned char got[100001], expected[100000];
+    unz_file_info64 info;
+    unzFile uf = unzOpen64(path);
+    long i = 0;
+    int err;
+
+    TU_CHECK(uf != NULL);
+    for (err = unzGoToFirstFile(uf); err == UNZ_OK; err = unzGoToNextFile(uf), i++)
+    {
+        TU_CHECK(unzGetCurrentFileInfo64(uf, &info, NULL, 0, NULL, 0, NULL, 0) == UNZ_OK);
+        TU_CHECK((info.flag & 8) != 0);
+        TU_CHECK(((info.flag & 1) != 0) == entry_encrypted(i));
+        TU_CHECK(unzOpenCurrentFilePassword(uf, entry_encrypted(i) ? PASSWORD : NULL) == UNZ_OK);
+        TU_CHECK(unzReadCurrentFile(uf, got, sizeof(got)) == (int)entry_size(i));
+        /* checks the CRC */
+        TU_CHECK(unzCloseCurrentFile(uf) == UNZ_OK);
+        tu_fill_text(expected, entry_size(i), (unsigned long long)i);
+        TU_CHECK(memcmp(got, expected, entry_size(i)) == 0);
+    }
+    TU_CHECK(i == entries);
+    TU_CHECK(unzClose(uf) == UNZ_OK);
+}
+
+/* ---- read back with unzStreamWrite ---- */
+
+typedef struct
+{
+    unsigned char* expected[ENTRIES + 1];
+    size_t expected_size[ENTRIES + 1];
+    long completed;
+} pushed;
+
+typedef struct
+{
+    long index;
+    unsigned char* data;
+    size_t size;
+} pushed_entry;
+
+/* the zipfile of the first test is stored after the entries */
+static int pushed_stored(long i)
+{
+    return (i == ENTRIES) || entry_stored(i);
+}
+
+static voidpf ZCALLBACK pushed_open(voidpf opaque, const unz_stream_entry* entry)
+{
+    pushed* p = (pushed*)opaque;
+    pushed_entry* out = (pushed_entry*)calloc(1, sizeof(pushed_entry));
+    TU_CHECK(out != NULL);
+    TU_CHECK(strcmp(entry->filename, tu_entry_name(p->completed)) == 0);
+    TU_CHECK((entry->flag & 8) != 0);
+    TU_CHECK(entry->compression_method == (pushed_stored(p->completed) ? 0 : Z_DEFLATED));
+    out->index = p->completed;
+    out->data = (unsigned char*)malloc(p->expected_size[out->index] + 1);
+    TU_CHECK(out->data != NULL);
+    return out;
+}
+
+static int ZCALLBACK pushed_write(voidpf opaque, voidpf handle, const void* buf, uLong size)
+{
+    pushed* p = (pushed*)opaque;
+    pushed_entry* out = (pushed_entry*)handle;
+    if (out->size + size > p->expected_size[out->index])
+        return UNZ_BADZIPFILE;
+    memcpy(out->data + out->size, buf, size);
+    out->size += size;
+    return UNZ_OK;
+}
+
+static void ZCALLBACK pushed_close(voidpf opaque, voidpf handle, const unz_stream_entry* entry, int err)
+{
+    pushed* p = (pushed*)opaque;
+    pushed_entry* out = (pushed_entry*)handle;
+    TU_CHECK(err == UNZ_OK);
+    TU_CHECK(out->size == p->expected_size[out->index]);
+    TU_CHECK(memcmp(out->data, p->expected[out->index], out->size) == 0);
+    TU_CHECK(entry->crc == crc32(0L, out->data, (uInt)out->size));
+    if (pushed_stored(out->index))
+        TU_CHECK(entry->compressed_size == out->size);
+    TU_CHECK(entry->uncompressed_size == out->size);
+    p->completed++;
+    free(out->data);
+    free(out);
+}
+
+static unsigned char* load_file(const char* path, size_t* size)
+{
+    FILE* f = fopen(path, "rb");
+    unsigned char* data;
+    long end;
+
+    TU_CHECK(f != NULL);
+    TU_CHECK(fseek(f, 0, SEEK_END) == 0);
+    end = ftell(f);
+    TU_CHECK(end >= 0 && fseek(f, 0, SEEK_SET) == 0);
+    data = (unsigned char*)malloc((size_t)end + 1);
+    TU_CHECK(data != NULL);
+    TU_CHECK(fread(data, 1, (size_t)end, f) == (size_t)end);
+    fclose(f);
+    *size = (size_t)end;
+    return data;
+}
+
+/* entries stored and deflated, zip64 or not, without the encryption, then
+   the zipfile of the first test as a stored entry */
+static void check_pushed(const char* inner_path)
+{
+    static const uLong chunks[] = { 1, 3, 15, 16, 17, 23, 24, 25, 4096, 65536 };
+    const char* path = tu_path("stream_pushed.zip");
+    zlib_filefunc64_def functions;
+    unsigned char* zip;
+    size_t size, pos;
+    pushed p;
+    zipFile zf;
+    long i;
+    int k;
+
+    memset(&p, 0, sizeof(p));
+    for (i = 0; i < ENTRIES; i++)
+    {
+        p.expected_size[i] = entry_size(i);
+        p.expected[i] = (unsigned char*)malloc(entry_size(i) + 1);
+        TU_CHECK(p.expected[i] != NULL);
+        tu_fill_text(p.expected[i], entry_size(i), (unsigned long long)i);
+    }
+    p.expected[ENTRIES] = load_file(inner_path, &p.expected_size[ENTRIES]);
+
+    fill_pipe_filefunc(&functions);
+    zf = zipOpen2_64(path, APPEND_STATUS_CREATESTREAM, NULL, &functions);
+    TU_CHECK(zf != NULL);
+    for (i = 0; i <= ENTRIES; i++)
+    {
+        zip_fileinfo zi;
+        memset(&zi, 0, sizeof(zi));
+        TU_CHECK(zipOpenNewFileInZip64(zf, tu_entry_name(i), &zi, NULL, 0, NULL, 0, NULL,
+                                       pushed_stored(i) ? 0 : Z_DEFLATED, pushed_stored(i) ? 0 : 6,
+                                       i % 4 == 3) == ZIP_OK);
+        TU_CHECK(zipWriteInFileInZip(zf, p.expected[i], (unsigned)p.expected_size[i]) == ZIP_OK);
+        TU_CHECK(zipCloseFileInZip(zf) == ZIP_OK);
+    }
+    TU_CHECK(zipClose(zf, NULL) == ZIP_OK);
+
+    zip = load_file(path, &size);
+    for (k = 0; k < (int)(sizeof(chunks) / sizeof(chunks[0])); k++)
+    {
+        unz_stream_callbacks callbacks;
+        unzStream stream;
+
+        memset(&callbacks, 0, sizeof(callbacks));
+        callbacks.open_entry = pushed_open;
+        callbacks.write_entry = pushed_write;
+        callbacks.close_entry = pushed_close;
+        callbacks.opaque = &p;
+        p.completed = 0;
+        stream = unzStreamOpen(&callbacks);
+        TU_CHECK(stream != NULL);
+        for (pos = 0; pos < size; pos += chunks[k])
+        {
+            uLong len = (pos + chunks[k] <= size) ? chunks[k] : (uLong)(size - pos);
+            TU_CHECK(unzStreamWrite(stream, zip + pos, len) == UNZ_OK);
+        }
+        TU_CHECK(unzStreamClose(stream) == UNZ_OK);
+        TU_CHECK(p.completed == ENTRIES + 1);
+    }
+    printf("ok: stored and deflated entries with descriptors extract with unzStreamWrite\n");
+
+    for (i = 0; i <= ENTRIES; i++)
+        free(p.expected[i]);
+    free(zip);
+    remove(path);
+}
+
+/* run command on path if tool is installed: 1 if it passed, 0 if it
+   failed, -1 if tool is missing */
+static int run_tool(const char* tool, const char* command, const char* path)
+{
+    char line[1024];
+    snprintf(line, sizeof(line), "command -v %s > /dev/null 2>&1", tool);
+    if (system(line) != 0)
+        return -1;
+    snprintf(line, sizeof(line), command, path);
+    return system(line) == 0;
+}
+
+static void check_tools(const char* path)
+{
+    int passed;
+
+    passed = run_tool("unzip", "unzip -qq -t -P '" PASSWORD "' '%s'", path);
+    TU_CHECK(passed != 0);
+    printf(passed > 0 ? "ok: unzip -t passes\n" : "-- unzip is not installed\n");
+
+    /* zipfile checks the last byte of the encryption header against the
+       time when bit 3 is set, and the crc of every entry */
+    passed = run_tool("python3",
+                      "python3 -c \"import sys, zipfile\n"
+                      "z = zipfile.ZipFile(sys.argv[1])\n"
+                      "z.setpassword(b'" PASSWORD "')\n"
+                      "for i in z.infolist(): z.read(i)\" '%s'", path);
+    TU_CHECK(passed != 0);
+    printf(passed > 0 ? "ok: python zipfile reads every entry\n" : "-- python3 is not installed\n");
+
+    passed = run_tool("bsdtar", "bsdtar --passphrase '" PASSWORD "' -xOf '%s' > /dev/null", path);
+    TU_CHECK(passed != 0);
+    printf(passed > 0 ? "ok: bsdtar extracts every entry\n" : "-- bsdtar is not installed\n");
+}
+
+static void test(void)
+{
+    const char* path = tu_path("stream.zip");
+    zlib_filefunc64_def functions;
+    zipFile zf;
+
+    fill_pipe_filefunc(&functions);
+    zf = zipOpen2_64(path, APPEND_STATUS_CREATESTREAM, NULL, &functions);
+    TU_CHECK(zf != NULL);
+    /* the traditional encryption, the one other tools read */
+    TU_CHECK(zipSetAESStrength(zf, 0) == ZIP_OK);
+    write_entries(zf, ENTRIES);
+    TU_CHECK(zipClose(zf, "written through a pipe") == ZIP_OK);
+    TU_CHECK(pipe_seeks == 0);
+    printf("ok: %d entries written through a pipe, without a seek\n", ENTRIES);
+
+    check_entries(path, ENTRIES);
+    printf("ok: every entry has a data descriptor and reads back\n");
+    check_tools(path);
+    check_pushed(path);
+    remove(path);
+}
+
+static void bench(void)
+{
+    const char* path = tu_path("stream_bench.zip");
+    const size_t size = 64 << 20, chunk = 1 << 20;
+    unsigned char* data = (unsigned char*)malloc(size);
+    zlib_filefunc64_def functions;
+    size_t pos;
+    int way;
+
+    TU_CHECK(data != NULL);
+    tu_fill_text(data, size, 1);
+    printf("%luMB of text in 64 deflated entries\n", (unsigned long)(size >> 20));
+    for (way = 0; way < 2; way++)
+    {
+        double start = tu_now();
+        zipFile zf;
+        if (way == 0)
+        {
+            fill_pipe_filefunc(&functions);
+            zf = zipOpen2_64(path, APPEND_STATUS_CREATESTREAM, NULL, &functions);
+        }
+        else
+            zf = zipOpen64(path, APPEND_STATUS_CREATE);
+        TU_CHECK(zf != NULL);
+        for (pos = 0; pos < size; pos += chunk)
+        {
+            zip_fileinfo zi;
+            memset(&zi, 0, sizeof(zi));
+            TU_CHECK(zipOpenNewFileInZip64(zf, tu_entry_name((long)(pos / chunk)), &zi, NULL, 0, NULL, 0, NULL,
+                                           Z_DEFLATED, 6, 0) == ZIP_OK);
+            TU_CHECK(zipWriteInFileInZip(zf, data + pos, (unsigned)chunk) == ZIP_OK);
+            TU_CHECK(zipCloseFileInZip(zf) == ZIP_OK);
+        }
+        TU_CHECK(zipClose(zf, NULL) == ZIP_OK);
+        printf("%-30s %6.1f MB/s\n", way == 0 ? "single pass, through a pipe" : "to a file, with seeks",
+               (double)size / (1 << 20) / (tu_now() - start));
+    }
+    remove(path);
+    free(data);
+}
+
+int main(int argc, char** argv)
+{
+    if (tu_bench_mode(argc, argv))
+        bench();
+    else
+        test();
+    return 0;
+}
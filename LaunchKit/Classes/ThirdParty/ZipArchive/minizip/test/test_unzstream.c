@@ -0,0 +1,617 @@
+/* test_unzstream.c -- the push based unzip of lk_unzstream.c
+
+   A stand-in server, forked from the test, sends a zipfile over a local TCP
+   connection in writes of 1 to 65536 bytes, and the test pushes whatever
+   each recv returns to unzStreamWrite. Every entry must reach the callbacks
+   with its data, for a zipfile with sizes in its local headers (deflated,
+   stored, empty and directory entries) and for one written in a single
+   pass with data descriptors, on stored and zip64 entries too. The same
+   must hold when the zipfile is pushed a byte at a time.
+
+   When the server drops the connection in the middle of an entry, that
+   entry must be closed with UNZ_BADZIPFILE, and fetching the rest from
+   unzStreamResumeOffset into a stream of unzStreamOpenAt must complete
+   every entry exactly once. A damaged stored entry must be closed with
+   UNZ_CRCERROR, and only that entry.
+
+   With -b, a zipfile of about 32MB is sent at 100MB/s, then extracted to
+   files while it arrives, and downloaded to a file first then extracted,
+   and the time from the connection to the last entry written is printed.
+
+   License: Same as ZLIB (www.gzip.org)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "lk_unzip.h"
+#include "lk_unzstream.h"
+#include "lk_zip.h"
+#include "testutil.h"
+
+#define ENTRIES 40
+#define DIRECTORY_NAME "assets/empty_dir/"
+
+/* ---- the zipfiles ---- */
+
+/* the benchmark makes the entries bigger */
+static size_t size_scale = 1;
+
+static size_t entry_size(long i)
+{
+    static const size_t sizes[] = { 0, 1, 700, 100 * 1024, 1 << 20, 5000 };
+    return sizes[i % 6] * size_scale;
+}
+
+static void entry_data(long i, unsigned char* data)
+{
+    tu_fill_text(data, entry_size(i), (unsigned long long)i);
+    /* every fourth entry half random, which deflate leaves almost as is */
+    if (i % 4 == 3)
+        tu_fill_random(data, entry_size(i) / 2, (unsigned long long)i);
+}
+
+/* entry i is stored when i % 5 == 2 */
+static void make_zipfile(const char* path, long entries, int descriptors)
+{
+    unsigned char* data = (unsigned char*)malloc((1 << 20) * size_scale);
+    zipFile zf = zipOpen64(path, descriptors ? APPEND_STATUS_CREATESTREAM : APPEND_STATUS_CREATE);
+    zip_fileinfo zi;
+    long i;
+
+    TU_CHECK(zf != NULL && data != NULL);
+    memset(&zi, 0, sizeof(zi));
+    for (i = 0; i < entries; i++)
+    {
+        int stored = (i % 5 == 2);
+        entry_data(i, data);
+        TU_CHECK(zipOpenNewFileInZip64(zf, tu_entry_name(i), &zi, NULL, 0, NULL, 0, NULL,
+                                       stored ? 0 : Z_DEFLATED, stored ? 0 : 6,
+                                       descriptors && (i % 3 == 1)) == ZIP_OK);
+        TU_CHECK(zipWriteInFileInZip(zf, data, (unsigned)entry_size(i)) == ZIP_OK);
+        TU_CHECK(zipCloseFileInZip(zf) == ZIP_OK);
+        if (i == entries / 2)
+        {
+            TU_CHECK(zipOpenNewFileInZip64(zf, DIRECTORY_NAME, &zi, NULL, 0, NULL, 0, NULL,
+                                           0, 0, 0) == ZIP_OK);
+            TU_CHECK(zipCloseFileInZip(zf) == ZIP_OK);
+        }
+    }
+    TU_CHECK(zipClose(zf, NULL) == ZIP_OK);
+    free(data);
+}
+
+static unsigned char* load_file(const char* path, size_t* size)
+{
+    FILE* f = fopen(path, "rb");
+    unsigned char* data;
+    long end = 0;
+
+    TU_CHECK(f != NULL);
+    TU_CHECK(fseek(f, 0, SEEK_END) == 0 && (end = ftell(f)) > 0);
+    data = (unsigned char*)malloc((size_t)end);
+    TU_CHECK(data != NULL);
+    rewind(f);
+    TU_CHECK(fread(data, 1, (size_t)end, f) == (size_t)end);
+    fclose(f);
+    *size = (size_t)end;
+    return data;
+}
+
+/* ---- the stand-in server ---- */
+
+typedef struct
+{
+    pid_t pid;
+    int port;
+} server;
+
+/* send data[start, stop) to fd in writes of 1 to 65536 bytes, at rate bytes
+   per second if rate is not 0 */
+static void serve_range(int fd, const unsigned char* data, size_t start, size_t stop,
+                        double rate, unsigned long long seed)
+{
+    double begin = tu_now();
+    size_t pos = start;
+    int one = 1;
+
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    while (pos < stop)
+    {
+        size_t chunk = (size_t)(tu_random(&seed) % 65536) + 1;
+        ssize_t n;
+        if (chunk > stop - pos)
+            chunk = stop - pos;
+        if (rate > 0)
+        {
+            double ahead = (double)(pos - start) / rate - (tu_now() - begin);
+            if (ahead > 0)
+            {
+                struct timespec ts;
+                ts.tv_sec = (time_t)ahead;
+                ts.tv_nsec = (long)((ahead - (double)ts.tv_sec) * 1e9);
+                nanosleep(&ts, NULL);
+            }
+        }
+        n = write(fd, data + pos, chunk);
+        if (n <= 0)
+            return;
+        pos += (size_t)n;
+    }
+}
+
+/* fork a server for data on 127.0.0.1. Each connection sends a request
+   line "start stop seed rate", and receives data[start, stop) then end of
+   file. A stop short of the size drops the connection in the middle. */
+static server start_server(const unsigned char* data, size_t size)
+{
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    server srv;
+
+    TU_CHECK(listener >= 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    TU_CHECK(bind(listener, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+    TU_CHECK(listen(listener, 4) == 0);
+    TU_CHECK(getsockname(listener, (struct sockaddr*)&addr, &len) == 0);
+    srv.port = ntohs(addr.sin_port);
+
+    srv.pid = fork();
+    TU_CHECK(srv.pid >= 0);
+    if (srv.pid == 0)
+    {
+        signal(SIGPIPE, SIG_IGN);
+        for (;;)
+        {
+            char request[128];
+            unsigned long long start, stop, seed;
+            double rate;
+            ssize_t n;
+            int fd = accept(listener, NULL, NULL);
+            if (fd < 0)
+                _exit(errno == EINTR ? 0 : 1);
+            n = read(fd, request, sizeof(request) - 1);
+            if (n > 0)
+            {
+                request[n] = '\0';
+                if ((sscanf(request, "%llu %llu %llu %lf", &start, &stop, &seed, &rate) == 4) &&
+                    (start <= stop) && (stop <= size))
+                    serve_range(fd, data, (size_t)start, (size_t)stop, rate, seed);
+            }
+            close(fd);
+        }
+    }
+    close(listener);
+    return srv;
+}
+
+static void stop_server(server srv)
+{
+    int status;
+    kill(srv.pid, SIGTERM);
+    TU_CHECK(waitpid(srv.pid, &status, 0) == srv.pid);
+}
+
+/* connect and ask for data[start, stop) */
+static int request(server srv, size_t start, size_t stop, unsigned long long seed, double rate)
+{
+    struct sockaddr_in addr;
+    char line[128];
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    TU_CHECK(fd >= 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons((unsigned short)srv.port);
+    TU_CHECK(connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+    snprintf(line, sizeof(line), "%lu %lu %llu %f\n", (unsigned long)start, (unsigned long)stop, seed, rate);
+    TU_CHECK(write(fd, line, strlen(line)) == (ssize_t)strlen(line));
+    return fd;
+}
+
+/* push everything received on fd to stream. Return the first error of
+   unzStreamWrite, or UNZ_OK at the end of the connection. */
+static int push_all(int fd, unzStream stream, unsigned long long* bytes)
+{
+    static unsigned char buf[65536];
+    int err = UNZ_OK;
+    ssize_t n;
+
+    while ((err == UNZ_OK) && ((n = read(fd, buf, sizeof(buf))) > 0))
+    {
+        err = unzStreamWrite(stream, buf, (uLong)n);
+        if (bytes != NULL)
+            *bytes += (unsigned long long)n;
+    }
+    close(fd);
+    return err;
+}
+
+/* ---- the callbacks ---- */
+
+typedef struct
+{
+    const char* directory;      /* write the entries there, or keep them in memory */
+    int completed[ENTRIES];     /* close_entry calls with UNZ_OK */
+    int failed[ENTRIES];        /* close_entry calls with an error */
+    int last_error[ENTRIES];
+    int directories;
+    unsigned long long written;
+} collector;
+
+typedef struct
+{
+    long index;                 /* -1 for the directory */
+    unsigned char* data;
+    size_t size;
+    FILE* file;
+} entry_out;
+
+static long entry_index(const char* filename)
+{
+    const char* underscore = strrchr(filename, '_');
+    long i = (underscore != NULL) ? strtol(underscore + 1, NULL, 10) : -1;
+    if ((i < 0) || (i >= ENTRIES) || (strcmp(filename, tu_entry_name(i)) != 0))
+        return -1;
+    return i;
+}
+
+static voidpf open_entry(voidpf opaque, const unz_stream_entry* entry)
+{
+    collector* c = (collector*)opaque;
+    entry_out* out = (entry_out*)calloc(1, sizeof(entry_out));
+
+    TU_CHECK(out != NULL);
+    out->index = entry_index(entry->filename);
+    if (out->index < 0)
+    {
+        TU_CHECK(strcmp(entry->filename, DIRECTORY_NAME) == 0);
+        return out;
+    }
+    if (c->directory != NULL)
+    {
+        char path[512];
+        snprintf(path, sizeof(path), "%s/%ld", c->directory, out->index);
+        out->file = fopen(path, "wb");
+        TU_CHECK(out->file != NULL);
+    }
+    else
+    {
+        out->data = (unsigned char*)malloc(entry_size(out->index) + 1);
+        TU_CHECK(out->data != NULL);
+    }
+    return out;
+}
+
+static int write_entry(voidpf opaque, voidpf handle, const void* buf, uLong size)
+{
+    collector* c = (collector*)opaque;
+    entry_out* out = (entry_out*)handle;
+
+    if ((out->index < 0) || (out->size + size > entry_size(out->index)))
+        return UNZ_BADZIPFILE;
+    if (out->file != NULL)
+    {
+        if (fwrite(buf, 1, size, out->file) != size)
+            return UNZ_ERRNO;
+    }
+    else
+        memcpy(out->data + out->size, buf, size);
+    out->size += size;
+    c->written += size;
+    return UNZ_OK;
+}
+
+static void close_entry(voidpf opaque, voidpf handle, const unz_stream_entry* entry, int err)
+{
+    collector* c = (collector*)opaque;
+    entry_out* out = (entry_out*)handle;
+
+    if (out->file != NULL)
+        TU_CHECK(fclose(out->file) == 0);
+    if (out->index < 0)
+    {
+        TU_CHECK(err == UNZ_OK && entry->uncompressed_size == 0);
+        c->directories++;
+    }
+    else if (err == UNZ_OK)
+    {
+        unsigned char* expected = (unsigned char*)malloc(entry_size(out->index) + 1);
+        TU_CHECK(expected != NULL);
+        TU_CHECK(out->size == entry_size(out->index));
+        TU_CHECK(entry->uncompressed_size == out->size);
+        if (out->data != NULL)
+        {
+            entry_data(out->index, expected);
+            TU_CHECK(memcmp(out->data, expected, out->size) == 0);
+        }
+        c->completed[out->index]++;
+        free(expected);
+    }
+    else
+    {
+        c->failed[out->index]++;
+        c->last_error[out->index] = err;
+    }
+    free(out->data);
+    free(out);
+}
+
+static unzStream open_stream(collector* c, ZPOS64_T offset)
+{
+    unz_stream_callbacks callbacks;
+    unzStream stream;
+
+    callbacks.open_entry = open_entry;
+    callbacks.write_entry = write_entry;
+    callbacks.close_entry = close_entry;
+    callbacks.opaque = c;
+    stream = unzStreamOpenAt(&callbacks, offset);
+    TU_CHECK(stream != NULL);
+    return stream;
+}
+
+static void check_all_completed(const collector* c)
+{
+    long i;
+    for (i = 0; i < ENTRIES; i++)
+        TU_CHECK(c->completed[i] == 1);
+    TU_CHECK(c->directories == 1);
+}
+
+/* ---- the tests ---- */
+
+static void check_served(const unsigned char* zip, size_t size, const char* what)
+{
+    server srv = start_server(zip, size);
+    collector c;
+    unzStream stream;
+    size_t pos;
+    int seed;
+
+    for (seed = 1; seed <= 3; seed++)
+    {
+        memset(&c, 0, sizeof(c));
+        stream = open_stream(&c, 0);
+        TU_CHECK(push_all(request(srv, 0, size, (unsigned long long)seed, 0), stream, NULL) == UNZ_OK);
+        TU_CHECK(unzStreamClose(stream) == UNZ_OK);
+        check_all_completed(&c);
+    }
+    stop_server(srv);
+    printf("ok: %s, served in chunks of 1 to 65536 bytes\n", what);
+
+    memset(&c, 0, sizeof(c));
+    stream = open_stream(&c, 0);
+    for (pos = 0; pos < size; pos++)
+        TU_CHECK(unzStreamWrite(stream, zip + pos, 1) == UNZ_OK);
+    TU_CHECK(unzStreamClose(stream) == UNZ_OK);
+    check_all_completed(&c);
+    printf("ok: %s, pushed a byte at a time\n", what);
+}
+
+static void check_resumed(const unsigned char* zip, size_t size, const char* what)
+{
+    server srv = start_server(zip, size);
+    const size_t drops[] = { size / 5, size / 2, size - 30 };
+    ZPOS64_T resume;
+    collector c;
+    unzStream stream;
+    long i, dropped;
+    int k;
+
+    for (k = 0; k < 3; k++)
+    {
+        memset(&c, 0, sizeof(c));
+        stream = open_stream(&c, 0);
+        TU_CHECK(push_all(request(srv, 0, drops[k], 7, 0), stream, NULL) == UNZ_OK);
+        resume = unzStreamResumeOffset(stream);
+        TU_CHECK(resume <= drops[k]);
+        TU_CHECK(unzStreamClose(stream) == UNZ_BADZIPFILE);
+
+        /* at most the entry cut short failed, with UNZ_BADZIPFILE */
+        dropped = -1;
+        for (i = 0; i < ENTRIES; i++)
+            if (c.failed[i] > 0)
+            {
+                TU_CHECK(dropped < 0 && c.failed[i] == 1 && c.last_error[i] == UNZ_BADZIPFILE);
+                dropped = i;
+                c.failed[i] = 0;
+            }
+
+        stream = open_stream(&c, resume);
+        TU_CHECK(push_all(request(srv, (size_t)resume, size, 8, 0), stream, NULL) == UNZ_OK);
+        TU_CHECK(unzStreamClose(stream) == UNZ_OK);
+        check_all_completed(&c);
+        for (i = 0; i < ENTRIES; i++)
+            TU_CHECK(c.failed[i] == 0);
+    }
+    stop_server(srv);
+    printf("ok: %s, dropped and resumed, every entry extracted once\n", what);
+}
+
+static void check_damaged(unsigned char* zip, size_t size)
+{
+    unsigned char expected[5000];
+    unsigned char* found = NULL;
+    collector c;
+    unzStream stream;
+    size_t pos;
+    long i, damaged = 2 + 5 * 3;
+
+    /* entry 17 is stored: find its data and change a byte of it */
+    TU_CHECK(damaged % 5 == 2 && entry_size(damaged) == 5000);
+    entry_data(damaged, expected);
+    for (pos = 0; (found == NULL) && (pos + sizeof(expected) <= size); pos++)
+        if (memcmp(zip + pos, expected, sizeof(expected)) == 0)
+            found = zip + pos;
+    TU_CHECK(found != NULL);
+    found[1234] ^= 0x20;
+
+    memset(&c, 0, sizeof(c));
+    stream = open_stream(&c, 0);
+    unzStreamWrite(stream, zip, (uLong)size);
+    unzStreamClose(stream);
+    TU_CHECK(c.failed[damaged] == 1 && c.last_error[damaged] == UNZ_CRCERROR);
+    TU_CHECK(c.completed[damaged] == 0);
+    for (i = 0; i < damaged; i++)
+        TU_CHECK(c.completed[i] == 1 && c.failed[i] == 0);
+    found[1234] ^= 0x20;
+    printf("ok: a damaged stored entry is closed with UNZ_CRCERROR\n");
+}
+
+static void test(void)
+{
+    const char* path = tu_path("unzstream.zip");
+    unsigned char* zip;
+    size_t size;
+
+    signal(SIGPIPE, SIG_IGN);
+    make_zipfile(path, ENTRIES, 0);
+    zip = load_file(path, &size);
+    check_served(zip, size, "sizes in the local headers");
+    check_resumed(zip, size, "sizes in the local headers");
+    check_damaged(zip, size);
+    free(zip);
+
+    make_zipfile(path, ENTRIES, 1);
+    zip = load_file(path, &size);
+    check_served(zip, size, "data descriptors");
+    check_resumed(zip, size, "data descriptors");
+    free(zip);
+
+    remove(path);
+}
+
+/* ---- the benchmark ---- */
+
+/* extract every entry of the zipfile at path to files of directory */
+static void extract_file(const char* path, const char* directory)
+{
+    unsigned char* buf = (unsigned char*)malloc(65536);
+    unzFile uf = unzOpen64(path);
+    char name[256], out_path[512];
+    long i = 0;
+    int err, n;
+
+    TU_CHECK(uf != NULL && buf != NULL);
+    for (err = unzGoToFirstFile(uf); err == UNZ_OK; err = unzGoToNextFile(uf))
+    {
+        FILE* f;
+        TU_CHECK(unzGetCurrentFileInfo64(uf, NULL, name, sizeof(name), NULL, 0, NULL, 0) == UNZ_OK);
+        if (entry_index(name) < 0)
+            continue;
+        snprintf(out_path, sizeof(out_path), "%s/%ld", directory, entry_index(name));
+        f = fopen(out_path, "wb");
+        TU_CHECK(f != NULL);
+        TU_CHECK(unzOpenCurrentFile(uf) == UNZ_OK);
+        while ((n = unzReadCurrentFile(uf, buf, 65536)) > 0)
+            TU_CHECK(fwrite(buf, 1, (size_t)n, f) == (size_t)n);
+        TU_CHECK(n == 0 && unzCloseCurrentFile(uf) == UNZ_OK);
+        TU_CHECK(fclose(f) == 0);
+        i++;
+    }
+    TU_CHECK(i == ENTRIES);
+    TU_CHECK(unzClose(uf) == UNZ_OK);
+    free(buf);
+}
+
+static void remove_outputs(const char* directory)
+{
+    char path[512];
+    long i;
+    for (i = 0; i < ENTRIES; i++)
+    {
+        snprintf(path, sizeof(path), "%s/%ld", directory, i);
+        remove(path);
+    }
+}
+
+static void bench(void)
+{
+    const char* path = tu_path("unzstream_bench.zip");
+    const char* download = tu_path("unzstream_download.zip");
+    char directory[256];
+    const double rate = 100e6;
+    unsigned char* zip;
+    unsigned char buf[65536];
+    double start, streamed = 1e9, first = 1e9;
+    size_t size;
+    server srv;
+    collector c;
+    int pass;
+
+    snprintf(directory, sizeof(directory), "%s", tu_path("unzstream_out"));
+    TU_CHECK(mkdir(directory, 0700) == 0 || errno == EEXIST);
+
+    /* 40 entries, of 12MB every sixth */
+    size_scale = 12;
+    make_zipfile(path, ENTRIES, 0);
+    zip = load_file(path, &size);
+    srv = start_server(zip, size);
+    printf("%.1fMB zipfile sent at %.0fMB/s, best of 3 (%d CPU)\n",
+           (double)size / (1 << 20), rate / 1e6, tu_cpu_count());
+
+    for (pass = 0; pass < 3; pass++)
+    {
+        unzStream stream;
+        FILE* f;
+        ssize_t n;
+        int fd;
+
+        memset(&c, 0, sizeof(c));
+        c.directory = directory;
+        start = tu_now();
+        stream = open_stream(&c, 0);
+        TU_CHECK(push_all(request(srv, 0, size, 1, rate), stream, NULL) == UNZ_OK);
+        TU_CHECK(unzStreamClose(stream) == UNZ_OK);
+        if (tu_now() - start < streamed)
+            streamed = tu_now() - start;
+        check_all_completed(&c);
+        remove_outputs(directory);
+
+        start = tu_now();
+        fd = request(srv, 0, size, 1, rate);
+        f = fopen(download, "wb");
+        TU_CHECK(f != NULL);
+        while ((n = read(fd, buf, sizeof(buf))) > 0)
+            TU_CHECK(fwrite(buf, 1, (size_t)n, f) == (size_t)n);
+        close(fd);
+        TU_CHECK(fclose(f) == 0);
+        extract_file(download, directory);
+        if (tu_now() - start < first)
+            first = tu_now() - start;
+        remove_outputs(directory);
+    }
+    stop_server(srv);
+    printf("the transfer alone                   %6.0f ms\n", (double)size / rate * 1e3);
+    printf("extracted while it arrives           %6.0f ms\n", streamed * 1e3);
+    printf("downloaded to a file, then extracted %6.0f ms\n", first * 1e3);
+
+    rmdir(directory);
+    remove(download);
+    remove(path);
+    free(zip);
+}
+
+int main(int argc, char** argv)
+{
+    if (tu_bench_mode(argc, argv))
+        bench();
+    else
+        test();
+    return 0;
+}
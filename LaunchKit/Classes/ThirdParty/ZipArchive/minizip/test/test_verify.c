@@ -0,0 +1,342 @@
+/* test_verify.c -- unzVerifyArchive, the check of a zipfile without extracting
+
+   Two zipfiles of the same entries (deflated, stored, empty, zip64,
+   traditional and AES encrypted), one with sizes in its local headers and
+   one written in a single pass with data descriptors, must verify with 1
+   to 8 threads, with a report per entry in the order of the central
+   directory giving the crc and sizes of the data. Without the password
+   only the encrypted entries are reported, with UNZ_PARAMERROR.
+
+   Each damage, on a copy, must be reported for that entry only, with 1 and
+   4 threads: a byte of deflated, stored and AES data, the crc and size of a
+   local header, the crc of a central record, and the crc of a data
+   descriptor, zip64 ones included.
+
+   With -b, times verifying 64 entries of about 2MB of text, deflated then
+   stored, mapped with mmap, with 1 thread up to twice as many threads as
+   processors (8 at least), and prints the MB/s of each.
+
+   License: Same as ZLIB (www.gzip.org)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lk_aes.h"
+#include "lk_unzip.h"
+#include "lk_zip.h"
+#include "testutil.h"
+
+#define ENTRIES 24
+#define PASSWORD "verify password"
+
+/* ---- the zipfiles ---- */
+
+enum
+{
+    KIND_DEFLATED,
+    KIND_STORED,
+    KIND_EMPTY,
+    KIND_ZIP64,
+    KIND_CRYPTED,               /* the traditional encryption */
+    KIND_AES,
+    KIND_BYTE,                  /* stored, 1 byte */
+    KIND_LARGE                  /* deflated, 1MB */
+};
+
+static int entry_kind(long i)
+{
+    return (int)(i % 8);
+}
+
+static size_t entry_size(long i)
+{
+    static const size_t sizes[] = { 100000, 5000, 0, 300000, 20000, 20000, 1, 1 << 20 };
+    return sizes[entry_kind(i)];
+}
+
+static int entry_encrypted(long i)
+{
+    return (entry_kind(i) == KIND_CRYPTED) || (entry_kind(i) == KIND_AES);
+}
+
+static void entry_data(long i, unsigned char* data)
+{
+    tu_fill_text(data, entry_size(i), (unsigned long long)i);
+    if (entry_kind(i) == KIND_ZIP64)
+        tu_fill_random(data, entry_size(i) / 2, (unsigned long long)i);
+}
+
+static void make_zipfile(const char* path, int descriptors)
+{
+    unsigned char* data = (unsigned char*)malloc(1 << 20);
+    zipFile zf = zipOpen64(path, descriptors ? APPEND_STATUS_CREATESTREAM : APPEND_STATUS_CREATE);
+    long i;
+
+    TU_CHECK(zf != NULL && data != NULL);
+    for (i = 0; i < ENTRIES; i++)
+    {
+        int kind = entry_kind(i);
+        int stored = (kind == KIND_STORED) || (kind == KIND_BYTE);
+        zip_fileinfo zi;
+        memset(&zi, 0, sizeof(zi));
+        entry_data(i, data);
+        TU_CHECK(zipSetAESStrength(zf, (kind == KIND_AES) ? LK_AES_STRENGTH_256 : 0) == ZIP_OK);
+        TU_CHECK(zipOpenNewFileInZip3_64(zf, tu_entry_name(i), &zi, NULL, 0, NULL, 0, NULL,
+                                         stored ? 0 : Z_DEFLATED, stored ? 0 : 6, 0,
+                                         -MAX_WBITS, DEF_MEM_LEVEL, Z_DEFAULT_STRATEGY,
+                                         entry_encrypted(i) ? PASSWORD : NULL,
+                                         crc32(0L, data, (uInt)entry_size(i)), kind == KIND_ZIP64) == ZIP_OK);
+        TU_CHECK(zipWriteInFileInZip(zf, data, (unsigned)entry_size(i)) == ZIP_OK);
+        TU_CHECK(zipCloseFileInZip(zf) == ZIP_OK);
+    }
+    TU_CHECK(zipClose(zf, NULL) == ZIP_OK);
+    free(data);
+}
+
+static int verify(const char* path, const char* password, int threads, unz_verify_entry* report,
+                  ZPOS64_T* bad)
+{
+    return unzVerifyArchive(path, NULL, password, threads, report, ENTRIES, bad);
+}
+
+/* ---- the offsets to damage ---- */
+
+static unsigned long read_le(FILE* f, long offset, int bytes)
+{
+    unsigned char b[4];
+    unsigned long v = 0;
+    int k;
+
+    TU_CHECK(fseek(f, offset, SEEK_SET) == 0);
+    TU_CHECK(fread(b, 1, (size_t)bytes, f) == (size_t)bytes);
+    for (k = bytes - 1; k >= 0; k--)
+        v = (v << 8) | b[k];
+    return v;
+}
+
+typedef struct
+{
+    long central;               /* central record */
+    long local;                 /* local header */
+    long data;                  /* data, after the salt or encryption header */
+    long descriptor;            /* data descriptor, if the entry has one */
+    ZPOS64_T compressed_size;
+} entry_offsets;
+
+static void find_entry(const char* path, long i, entry_offsets* o)
+{
+    unz_file_info64 info;
+    unzFile uf = unzOpen64(path);
+    FILE* f = fopen(path, "rb");
+    long k;
+
+    TU_CHECK(uf != NULL && f != NULL);
+    TU_CHECK(unzGoToFirstFile(uf) == UNZ_OK);
+    for (k = 0; k < i; k++)
+        TU_CHECK(unzGoToNextFile(uf) == UNZ_OK);
+    TU_CHECK(unzGetCurrentFileInfo64(uf, &info, NULL, 0, NULL, 0, NULL, 0) == UNZ_OK);
+    o->central = (long)unzGetOffset64(uf);
+    TU_CHECK(read_le(f, o->central, 4) == 0x02014b50);
+    o->local = (long)read_le(f, o->central + 42, 4);
+    TU_CHECK(read_le(f, o->local, 4) == 0x04034b50);
+    o->compressed_size = info.compressed_size;
+    o->descriptor = o->local + 30 + (long)read_le(f, o->local + 26, 2) + (long)read_le(f, o->local + 28, 2) +
+                    (long)info.compressed_size;
+    TU_CHECK(unzOpenCurrentFilePassword(uf, entry_encrypted(i) ? PASSWORD : NULL) == UNZ_OK);
+    o->data = (long)unzGetCurrentFileZStreamPos64(uf);
+    TU_CHECK(unzCloseCurrentFile(uf) == UNZ_OK);
+    TU_CHECK(unzClose(uf) == UNZ_OK);
+    fclose(f);
+}
+
+static void copy_file(const char* from, const char* to)
+{
+    unsigned char buf[65536];
+    FILE* in = fopen(from, "rb");
+    FILE* out = fopen(to, "wb");
+    size_t n;
+
+    TU_CHECK(in != NULL && out != NULL);
+    while ((n = fread(buf, 1, sizeof(buf), in)) > 0)
+        TU_CHECK(fwrite(buf, 1, n, out) == n);
+    fclose(in);
+    TU_CHECK(fclose(out) == 0);
+}
+
+static void flip_byte(const char* path, long offset)
+{
+    FILE* f = fopen(path, "r+b");
+    int c;
+
+    TU_CHECK(f != NULL);
+    TU_CHECK(fseek(f, offset, SEEK_SET) == 0);
+    c = fgetc(f);
+    TU_CHECK(c != EOF);
+    TU_CHECK(fseek(f, offset, SEEK_SET) == 0);
+    fputc(c ^ 0x20, f);
+    TU_CHECK(fclose(f) == 0);
+}
+
+/* ---- the tests ---- */
+
+static void check_sound(const char* path, const char* what)
+{
+    unz_verify_entry report[ENTRIES];
+    unsigned char* data = (unsigned char*)malloc(1 << 20);
+    ZPOS64_T bad = 1;
+    int threads;
+    long i;
+
+    TU_CHECK(data != NULL);
+    for (threads = 1; threads <= 8; threads *= 2)
+    {
+        memset(report, 0xff, sizeof(report));
+        TU_CHECK(verify(path, PASSWORD, threads, report, &bad) == UNZ_OK);
+        TU_CHECK(bad == 0);
+        for (i = 0; i < ENTRIES; i++)
+        {
+            entry_data(i, data);
+            TU_CHECK(report[i].err == UNZ_OK && report[i].mismatch == 0);
+            TU_CHECK(report[i].uncompressed_size == entry_size(i));
+            /* AE-2 entries store no crc */
+            if (entry_kind(i) != KIND_AES)
+                TU_CHECK(report[i].crc == crc32(0L, data, (uInt)entry_size(i)));
+        }
+    }
+    printf("ok: %s verify with 1 to 8 threads, a report per entry in order\n", what);
+
+    TU_CHECK(verify(path, NULL, 2, report, &bad) == UNZ_CRCERROR);
+    TU_CHECK(bad == 6);
+    for (i = 0; i < ENTRIES; i++)
+        TU_CHECK(report[i].err == (entry_encrypted(i) ? UNZ_PARAMERROR : UNZ_OK));
+    TU_CHECK(unzVerifyArchive(path, NULL, PASSWORD, 2, report, ENTRIES - 1, NULL) == UNZ_PARAMERROR);
+    printf("ok: %s without the password: the encrypted entries only\n", what);
+    free(data);
+}
+
+/* damage a copy of path at offset, and check that entry i only is bad,
+   with mismatch bits when there are some */
+static void check_damage(const char* path, long offset, long i, int err, uLong mismatch, const char* what)
+{
+    char copy[1024];
+    unz_verify_entry report[ENTRIES];
+    ZPOS64_T bad = 0;
+    int threads;
+    long k;
+
+    snprintf(copy, sizeof(copy), "%s.damaged", path);
+    copy_file(path, copy);
+    flip_byte(copy, offset);
+    for (threads = 1; threads <= 4; threads *= 4)
+    {
+        TU_CHECK(verify(copy, PASSWORD, threads, report, &bad) == UNZ_CRCERROR);
+        TU_CHECK(bad == 1);
+        for (k = 0; k < ENTRIES; k++)
+            if (k != i)
+                TU_CHECK(report[k].err == UNZ_OK);
+        if (err != UNZ_OK)
+            TU_CHECK(report[i].err == err);
+        else
+            TU_CHECK(report[i].err != UNZ_OK);
+        TU_CHECK((report[i].mismatch & mismatch) == mismatch);
+    }
+    printf("ok: %s: entry %ld reported, %s\n", what, i,
+           report[i].err == UNZ_CRCERROR ? "UNZ_CRCERROR" : "a zlib error");
+    remove(copy);
+}
+
+static void test(void)
+{
+    char path[1024], streamed[1024];
+    entry_offsets o;
+
+    /* tu_path reuses its buffers */
+    snprintf(path, sizeof(path), "%s", tu_path("verify.zip"));
+    snprintf(streamed, sizeof(streamed), "%s", tu_path("verify_stream.zip"));
+    make_zipfile(path, 0);
+    make_zipfile(streamed, 1);
+    check_sound(path, "sizes in the local headers:");
+    check_sound(streamed, "data descriptors:");
+
+    find_entry(path, 7, &o);
+    check_damage(path, o.data + (long)o.compressed_size / 2, 7, UNZ_OK, 0, "deflated data");
+    find_entry(path, 1, &o);
+    check_damage(path, o.data + 1234, 1, UNZ_CRCERROR, UNZ_VERIFY_CRC_CENTRAL | UNZ_VERIFY_CRC_LOCAL,
+                 "stored data");
+    find_entry(path, 13, &o);
+    check_damage(path, o.data + 5000, 13, UNZ_CRCERROR, 0, "AES data, its HMAC");
+    find_entry(path, 8, &o);
+    check_damage(path, o.local + 14, 8, UNZ_CRCERROR, UNZ_VERIFY_CRC_LOCAL, "crc of a local header");
+    check_damage(path, o.local + 22, 8, UNZ_CRCERROR, UNZ_VERIFY_UNCOMPRESSED_LOCAL,
+                 "size of a local header");
+    check_damage(path, o.central + 16, 8, UNZ_CRCERROR, 0, "crc of a central record");
+
+    find_entry(streamed, 16, &o);
+    TU_CHECK(o.descriptor + 4 < o.central);
+    check_damage(streamed, o.descriptor + 4, 16, UNZ_CRCERROR, UNZ_VERIFY_CRC_LOCAL, "crc of a data descriptor");
+    find_entry(streamed, 11, &o);
+    check_damage(streamed, o.descriptor + 4, 11, UNZ_CRCERROR, UNZ_VERIFY_CRC_LOCAL,
+                 "crc of a zip64 data descriptor");
+
+    remove(path);
+    remove(streamed);
+}
+
+static void bench(void)
+{
+    const char* path = tu_path("verify_bench.zip");
+    const long entries = 64;
+    unsigned char* data = (unsigned char*)malloc(3 << 20);
+    zlib_filefunc64_ex_def mmap_functions;
+    unz_verify_entry report[64];
+    int cpus = tu_cpu_count();
+    int max_threads = (2 * cpus > 8) ? 2 * cpus : 8;
+    int level, threads;
+    long i;
+
+    TU_CHECK(data != NULL);
+    fill_mmap_filefunc64(&mmap_functions);
+    for (level = 6; level >= 0; level -= 6)
+    {
+        double megabytes = 0, single = 0;
+        zipFile zf = zipOpen64(path, APPEND_STATUS_CREATE);
+        TU_CHECK(zf != NULL);
+        for (i = 0; i < entries; i++)
+        {
+            size_t size = (size_t)(1 << 20) + (size_t)(i * 32768);
+            zip_fileinfo zi;
+            memset(&zi, 0, sizeof(zi));
+            tu_fill_text(data, size, (unsigned long long)i);
+            TU_CHECK(zipOpenNewFileInZip64(zf, tu_entry_name(i), &zi, NULL, 0, NULL, 0, NULL,
+                                           level ? Z_DEFLATED : 0, level, 0) == ZIP_OK);
+            TU_CHECK(zipWriteInFileInZip(zf, data, (unsigned)size) == ZIP_OK);
+            TU_CHECK(zipCloseFileInZip(zf) == ZIP_OK);
+            megabytes += (double)size / (1 << 20);
+        }
+        TU_CHECK(zipClose(zf, NULL) == ZIP_OK);
+
+        printf("%ld entries %s, %.0fMB, %d processors\n", entries, level ? "deflated" : "stored", megabytes, cpus);
+        for (threads = 1; threads <= max_threads; threads *= 2)
+        {
+            double start = tu_now(), elapsed;
+            TU_CHECK(unzVerifyArchive(path, &mmap_functions, NULL, threads, report, entries, NULL) == UNZ_OK);
+            elapsed = tu_now() - start;
+            if (threads == 1)
+                single = elapsed;
+            printf("%2d threads: %6.0f ms, %6.0f MB/s, %.2fx\n",
+                   threads, elapsed * 1e3, megabytes / elapsed, single / elapsed);
+        }
+    }
+    remove(path);
+    free(data);
+}
+
+int main(int argc, char** argv)
+{
+    if (tu_bench_mode(argc, argv))
+        bench();
+    else
+        test();
+    return 0;
+}
@@ -0,0 +1,170 @@
+/* test_zip64.c -- archives beyond 4GB through the 64-bit file functions
+
+   The archive is written with APPEND_STATUS_CREATEAFTER after a sparse 5GB
+   prefix, so every local header, the central directory and the end records
+   are past 4GB and need zip64 records. One of its entries is larger than
+   4GB once inflated. The data is generated and checked a megabyte at a
+   time, nothing is held in memory, and the file takes a few megabytes of
+   disk. It is read back with the stdio and the mmap file functions: names,
+   sizes, offsets and crc must match what was written.
+
+   With -b, prints the time to write and to read back the large entry.
+
+   License: Same as ZLIB (www.gzip.org)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "lk_unzip.h"
+#include "lk_zip.h"
+#include "testutil.h"
+
+#define PREFIX_SIZE     ((ZPOS64_T)5 << 30)
+#define CHUNK_SIZE      (1 << 20)
+#define LARGE_CHUNKS    4200            /* 4200MB, past 4GB */
+#define SMALL_SIZE      (100 * 1000)
+
+/* chunk i of the large entry: zeros, stamped with its index so that a
+   chunk out of place changes the crc */
+static void fill_chunk(unsigned char* buf, long i)
+{
+    memset(buf, 0, CHUNK_SIZE);
+    memcpy(buf + (i % 1000) * 1000, &i, sizeof(i));
+}
+
+static double write_archive(const char* path, uLong* large_crc, uLong* small_crc)
+{
+    unsigned char* buf = (unsigned char*)malloc(CHUNK_SIZE);
+    zip_fileinfo zi;
+    double start, elapsed;
+    zipFile zf;
+    long i;
+    int fd;
+
+    TU_CHECK(buf != NULL);
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    TU_CHECK(fd >= 0);
+    TU_CHECK(ftruncate(fd, (off_t)PREFIX_SIZE) == 0);
+    close(fd);
+
+    zf = zipOpen64(path, APPEND_STATUS_CREATEAFTER);
+    TU_CHECK(zf != NULL);
+    memset(&zi, 0, sizeof(zi));
+
+    tu_fill_text(buf, SMALL_SIZE, 1);
+    *small_crc = crc32(0L, buf, SMALL_SIZE);
+    TU_CHECK(zipOpenNewFileInZip64(zf, "before.txt", &zi, NULL, 0, NULL, 0, NULL, Z_DEFLATED, 6, 0) == ZIP_OK);
+    TU_CHECK(zipWriteInFileInZip(zf, buf, SMALL_SIZE) == ZIP_OK);
+    TU_CHECK(zipCloseFileInZip(zf) == ZIP_OK);
+
+    start = tu_now();
+    *large_crc = crc32(0L, Z_NULL, 0);
+    TU_CHECK(zipOpenNewFileInZip64(zf, "large.bin", &zi, NULL, 0, NULL, 0, NULL, Z_DEFLATED, 1, 1) == ZIP_OK);
+    for (i = 0; i < LARGE_CHUNKS; i++)
+    {
+        fill_chunk(buf, i);
+        *large_crc = crc32(*large_crc, buf, CHUNK_SIZE);
+        TU_CHECK(zipWriteInFileInZip(zf, buf, CHUNK_SIZE) == ZIP_OK);
+    }
+    TU_CHECK(zipCloseFileInZip(zf) == ZIP_OK);
+    elapsed = tu_now() - start;
+
+    tu_fill_text(buf, SMALL_SIZE, 1);
+    TU_CHECK(zipOpenNewFileInZip64(zf, "after.txt", &zi, NULL, 0, NULL, 0, NULL, 0, 0, 0) == ZIP_OK);
+    TU_CHECK(zipWriteInFileInZip(zf, buf, SMALL_SIZE) == ZIP_OK);
+    TU_CHECK(zipCloseFileInZip(zf) == ZIP_OK);
+    TU_CHECK(zipClose(zf, "past 4GB") == ZIP_OK);
+    free(buf);
+    return elapsed;
+}
+
+static double read_entry(unzFile uf, const char* name, ZPOS64_T size, uLong crc)
+{
+    unsigned char* buf = (unsigned char*)malloc(CHUNK_SIZE);
+    unsigned char* expected = (unsigned char*)malloc(CHUNK_SIZE);
+    unz_file_info64 info;
+    unz64_file_pos pos;
+    ZPOS64_T total = 0;
+    uLong got_crc = crc32(0L, Z_NULL, 0);
+    double start;
+    long chunk = 0;
+    int n;
+
+    TU_CHECK(buf != NULL && expected != NULL);
+    TU_CHECK(unzLocateFile(uf, name, 1) == UNZ_OK);
+    TU_CHECK(unzGetCurrentFileInfo64(uf, &info, NULL, 0, NULL, 0, NULL, 0) == UNZ_OK);
+    TU_CHECK(info.uncompressed_size == size);
+    TU_CHECK(info.crc == crc);
+    TU_CHECK(unzGetFilePos64(uf, &pos) == UNZ_OK);
+    TU_CHECK(pos.pos_in_zip_directory > PREFIX_SIZE);
+    TU_CHECK(unzGetCurrentFileZStreamPos64(uf) == 0);
+
+    start = tu_now();
+    TU_CHECK(unzOpenCurrentFile(uf) == UNZ_OK);
+    TU_CHECK(unzGetCurrentFileZStreamPos64(uf) > PREFIX_SIZE);
+    while ((n = unzReadCurrentFile(uf, buf, CHUNK_SIZE)) > 0)
+    {
+        /* the large entry is checked chunk by chunk, not only by its crc */
+        if (size > 0xffffffff)
+        {
+            TU_CHECK(n == CHUNK_SIZE);
+            fill_chunk(expected, chunk++);
+            TU_CHECK(memcmp(buf, expected, CHUNK_SIZE) == 0);
+        }
+        got_crc = crc32(got_crc, buf, (uInt)n);
+        total += (ZPOS64_T)n;
+    }
+    TU_CHECK(n == 0);
+    TU_CHECK(unzCloseCurrentFile(uf) == UNZ_OK);
+    TU_CHECK(total == size);
+    TU_CHECK(got_crc == crc);
+    free(expected);
+    free(buf);
+    return tu_now() - start;
+}
+
+static double read_archive(const char* path, zlib_filefunc64_ex_def* functions, uLong large_crc, uLong small_crc)
+{
+    unz_global_info64 gi;
+    char comment[64];
+    double elapsed;
+    unzFile uf = unzOpen3_64(path, functions);
+
+    TU_CHECK(uf != NULL);
+    TU_CHECK(unzGetGlobalInfo64(uf, &gi) == UNZ_OK);
+    TU_CHECK(gi.number_entry == 3);
+    TU_CHECK(unzGetGlobalComment(uf, comment, sizeof(comment)) == (int)strlen("past 4GB"));
+    TU_CHECK(strcmp(comment, "past 4GB") == 0);
+
+    read_entry(uf, "before.txt", SMALL_SIZE, small_crc);
+    elapsed = read_entry(uf, "large.bin", (ZPOS64_T)LARGE_CHUNKS * CHUNK_SIZE, large_crc);
+    read_entry(uf, "after.txt", SMALL_SIZE, small_crc);
+    TU_CHECK(unzClose(uf) == UNZ_OK);
+    return elapsed;
+}
+
+int main(int argc, char** argv)
+{
+    const char* path = tu_path("zip64.zip");
+    zlib_filefunc64_ex_def stdio_functions, mmap_functions;
+    double written, read_stdio, read_mmap;
+    double megabytes = (double)LARGE_CHUNKS * CHUNK_SIZE / (1 << 20);
+    uLong large_crc, small_crc;
+
+    written = write_archive(path, &large_crc, &small_crc);
+
+    fill_fopen64_filefunc_ex(&stdio_functions);
+    read_stdio = read_archive(path, &stdio_functions, large_crc, small_crc);
+    fill_mmap_filefunc64(&mmap_functions);
+    read_mmap = read_archive(path, &mmap_functions, large_crc, small_crc);
+    remove(path);
+
+    printf("ok: %.0fMB entry after a 5GB prefix written and read back with stdio and mmap\n", megabytes);
+    if (tu_bench_mode(argc, argv))
+        printf("%.0fMB entry: written at %.0f MB/s, read at %.0f MB/s (stdio), %.0f MB/s (mmap)\n",
+               megabytes, megabytes / written, megabytes / read_stdio, megabytes / read_mmap);
+    return 0;
+}
@@ -0,0 +1,274 @@
+/* testutil.c -- helpers shared by the standalone tests of the Minizip code
+
+   License: Same as ZLIB (www.gzip.org)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "testutil.h"
+
+#ifndef local
+#  define local static
+#endif
+
+void tu_fail(const char* file, int line, const char* what)
+{
+    fprintf(stderr, "%s:%d: check failed: %s\n", file, line, what);
+    exit(1);
+}
+
+int tu_bench_mode(int argc, char** argv)
+{
+    int i;
+    for (i = 1; i < argc; i++)
+        if (strcmp(argv[i], "-b") == 0)
+            return 1;
+    return 0;
+}
+
+double tu_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+const char* tu_path(const char* name)
+{
+    static char paths[8][1024];
+    static int next = 0;
+    char* path = paths[next];
+    const char* dir = getenv("TMPDIR");
+    next = (next + 1) % 8;
+    snprintf(path, sizeof(paths[0]), "%s/lk_minizip_%ld_%s",
+             (dir != NULL && dir[0] != '\0') ? dir : "/tmp", (long)getpid(), name);
+    return path;
+}
+
+unsigned long long tu_random(unsigned long long* state)
+{
+    unsigned long long x = *state;
+    if (x == 0)
+        x = 0x9e3779b97f4a7c15ULL;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return x;
+}
+
+void tu_fill_text(unsigned char* buf, size_t len, unsigned long long seed)
+{
+    static char words[256][12];
+    static int made = 0;
+    unsigned long long state = seed + 1;
+    size_t pos = 0;
+    int i, j;
+
+    if (!made)
+    {
+        unsigned long long word_state = 42;
+        for (i = 0; i < 256; i++)
+        {
+            int word_len = 2 + (int)(tu_random(&word_state) % 9);
+            for (j = 0; j < word_len; j++)
+                words[i][j] = (char)('a' + tu_random(&word_state) % 26);
+            words[i][word_len] = '\0';
+        }
+        made = 1;
+    }
+
+    while (pos < len)
+    {
+        unsigned long long r = tu_random(&state);
+        const char* word = words[r & 0xff];
+        size_t word_len = strlen(word);
+        if (word_len > len - pos)
+            word_len = len - pos;
+        memcpy(buf + pos, word, word_len);
+        pos += word_len;
+        if (pos < len)
+            buf[pos++] = ((r >> 8) % 12 == 0) ? '\n' : ' ';
+    }
+}
+
+void tu_fill_random(unsigned char* buf, size_t len, unsigned long long seed)
+{
+    unsigned long long state = seed + 1;
+    size_t pos = 0;
+    while (pos < len)
+    {
+        unsigned long long r = tu_random(&state);
+        size_t n = (len - pos < 8) ? len - pos : 8;
+        memcpy(buf + pos, &r, n);
+        pos += n;
+    }
+}
+
+int tu_cpu_count(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return (n > 0) ? (int)n : 1;
+}
+
+local long long tu_proc_io(const char* field)
+{
+    char line[128];
+    long long value = -1;
+    size_t field_len = strlen(field);
+    FILE* f = fopen("/proc/self/io", "r");
+    if (f == NULL)
+        return -1;
+    while (fgets(line, sizeof(line), f) != NULL)
+        if ((strncmp(line, field, field_len) == 0) && (line[field_len] == ':'))
+            value = atoll(line + field_len + 1);
+    fclose(f);
+    return value;
+}
+
+long long tu_read_syscalls(void)
+{
+    return tu_proc_io("syscr");
+}
+
+long long tu_write_syscalls(void)
+{
+    return tu_proc_io("syscw");
+}
+
+const char* tu_entry_name(long i)
+{
+    static char name[64];
+    snprintf(name, sizeof(name), "assets/Dir%03ld/Image_%06ld.png", i % 97, i);
+    return name;
+}
+
+int tu_make_archive(const char* path, long entries, size_t size, int method, int level)
+{
+    unsigned char* data = (unsigned char*)malloc(size > 0 ? size : 1);
+    zipFile zf = zipOpen64(path, APPEND_STATUS_CREATE);
+    int err = (zf != NULL && data != NULL) ? ZIP_OK : ZIP_ERRNO;
+    long i;
+
+    for (i = 0; (i < entries) && (err == ZIP_OK); i++)
+    {
+        zip_fileinfo zi;
+        memset(&zi, 0, sizeof(zi));
+        tu_fill_text(data, size, (unsigned long long)i);
+        err = zipOpenNewFileInZip64(zf, tu_entry_name(i), &zi, NULL, 0, NULL, 0, NULL,
+                                    method, level, size >= 0xffffffff);
+        if (err == ZIP_OK)
+            err = zipWriteInFileInZip(zf, data, (unsigned)size);
+        if (err == ZIP_OK)
+            err = zipCloseFileInZip(zf);
+    }
+    if (zf != NULL && zipClose(zf, NULL) != ZIP_OK && err == ZIP_OK)
+        err = ZIP_ERRNO;
+    free(data);
+    return err;
+}
+
+tu_io_counts tu_counts;
+local zlib_filefunc64_def tu_base;
+
+local voidpf ZCALLBACK tu_open (voidpf opaque, const void* filename, int mode)
+{
+    tu_counts.opens++;
+    return tu_base.zopen64_file(tu_base.opaque, filename, mode);
+}
+
+local uLong ZCALLBACK tu_read (voidpf opaque, voidpf stream, void* buf, uLong size)
+{
+    uLong got = tu_base.zread_file(tu_base.opaque, stream, buf, size);
+    tu_counts.reads++;
+    tu_counts.bytes_read += got;
+    return got;
+}
+
+local uLong ZCALLBACK tu_write (voidpf opaque, voidpf stream, const void* buf, uLong size)
+{
+    tu_counts.writes++;
+    return tu_base.zwrite_file(tu_base.opaque, stream, buf, size);
+}
+
+local ZPOS64_T ZCALLBACK tu_tell (voidpf opaque, voidpf stream)
+{
+    tu_counts.tells++;
+    return tu_base.ztell64_file(tu_base.opaque, stream);
+}
+
+local long ZCALLBACK tu_seek (voidpf opaque, voidpf stream, ZPOS64_T offset, int origin)
+{
+    tu_counts.seeks++;
+    return tu_base.zseek64_file(tu_base.opaque, stream, offset, origin);
+}
+
+local int ZCALLBACK tu_close (voidpf opaque, voidpf stream)
+{
+    return tu_base.zclose_file(tu_base.opaque, stream);
+}
+
+local int ZCALLBACK tu_error (voidpf opaque, voidpf stream)
+{
+    return tu_base.zerror_file(tu_base.opaque, stream);
+}
+
+local map64_file_func tu_base_map;
+local pread64_file_func tu_base_pread;
+
+local const void* ZCALLBACK tu_map (voidpf opaque, voidpf stream, ZPOS64_T* psize)
+{
+    return tu_base_map(tu_base.opaque, stream, psize);
+}
+
+local uLong ZCALLBACK tu_pread (voidpf opaque, voidpf stream, void* buf, uLong size, ZPOS64_T offset)
+{
+    uLong got = tu_base_pread(tu_base.opaque, stream, buf, size, offset);
+    tu_counts.preads++;
+    tu_counts.bytes_read += got;
+    return got;
+}
+
+void tu_counting_filefunc(zlib_filefunc64_def* counting, const zlib_filefunc64_def* base)
+{
+    tu_base = *base;
+    memset(&tu_counts, 0, sizeof(tu_counts));
+    counting->zopen64_file = tu_open;
+    counting->zread_file = tu_read;
+    counting->zwrite_file = tu_write;
+    counting->ztell64_file = tu_tell;
+    counting->zseek64_file = tu_seek;
+    counting->zclose_file = tu_close;
+    counting->zerror_file = tu_error;
+    counting->opaque = NULL;
+}
+
+void tu_counting_filefunc_ex(zlib_filefunc64_ex_def* counting, const zlib_filefunc64_ex_def* base)
+{
+    tu_counting_filefunc(&counting->zfile_func64, &base->zfile_func64);
+    tu_base_map = base->zmap64_file;
+    tu_base_pread = base->zpread64_file;
+    counting->zmap64_file = (base->zmap64_file != NULL) ? tu_map : NULL;
+    counting->zpread64_file = (base->zpread64_file != NULL) ? tu_pread : NULL;
+}
+
+tu_alloc_counts tu_allocs;
+
+void* tu_alloc(size_t size)
+{
+    __sync_fetch_and_add(&tu_allocs.allocs, 1);
+    __sync_fetch_and_add(&tu_allocs.bytes, (unsigned long long)size);
+    return malloc(size);
+}
+
+void tu_free(void* p)
+{
+    if (p != NULL)
+    {
+        __sync_fetch_and_add(&tu_allocs.frees, 1);
+        free(p);
+    }
+}
@@ -0,0 +1,95 @@
+/* testutil.h -- helpers shared by the standalone tests of the Minizip code
+
+   Each test is a small program which checks one feature and exits with 0
+   when it works. Run with -b, it runs the benchmark of that feature
+   instead and prints its measurements.
+
+   License: Same as ZLIB (www.gzip.org)
+*/
+
+#ifndef _LK_TESTUTIL_H
+#define _LK_TESTUTIL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "zlib.h"
+#include "lk_ioapi.h"
+#include "lk_zip.h"
+
+#define TU_CHECK(cond) \
+    do { if (!(cond)) tu_fail(__FILE__, __LINE__, #cond); } while (0)
+
+/* report a failed check and exit with 1 */
+void tu_fail(const char* file, int line, const char* what);
+
+/* 1 if the program was run with -b, to benchmark */
+int tu_bench_mode(int argc, char** argv);
+
+/* a monotonic clock, in seconds */
+double tu_now(void);
+
+/* a path in $TMPDIR (/tmp by default) unique to this process */
+const char* tu_path(const char* name);
+
+/* xorshift64 generator: a seed always gives the same sequence */
+unsigned long long tu_random(unsigned long long* state);
+
+/* fill buf with text made of words, which deflates about 3:1 */
+void tu_fill_text(unsigned char* buf, size_t len, unsigned long long seed);
+
+/* fill buf with random bytes, which do not compress (like images) */
+void tu_fill_random(unsigned char* buf, size_t len, unsigned long long seed);
+
+/* number of processors online */
+int tu_cpu_count(void);
+
+/* read and write system calls made by the process so far (syscr and syscw
+   of /proc/self/io), or -1 where they are not available */
+long long tu_read_syscalls(void);
+long long tu_write_syscalls(void);
+
+/* the name of entry i of the archives of tu_make_archive */
+const char* tu_entry_name(long i);
+
+/* write a zipfile of entries named by tu_entry_name, each of size bytes of
+   text seeded by its index, compressed with method (0 or Z_DEFLATED) at
+   level. Return ZIP_OK or the first error. */
+int tu_make_archive(const char* path, long entries, size_t size, int method, int level);
+
+/* I/O calls made through file functions wrapped with tu_counting_filefunc */
+typedef struct tu_io_counts_s
+{
+    unsigned long opens;
+    unsigned long reads;
+    unsigned long writes;
+    unsigned long seeks;
+    unsigned long tells;
+    unsigned long preads;
+    unsigned long long bytes_read;
+} tu_io_counts;
+
+extern tu_io_counts tu_counts;
+
+/* file functions which count the calls made to base in tu_counts, then
+   forward them to it. Only one base can be wrapped at a time. */
+void tu_counting_filefunc(zlib_filefunc64_def* counting, const zlib_filefunc64_def* base);
+
+/* the same for the file functions of unzOpen3_64, zmap64_file and
+   zpread64_file included */
+void tu_counting_filefunc_ex(zlib_filefunc64_ex_def* counting, const zlib_filefunc64_ex_def* base);
+
+/* allocations made through tu_alloc and tu_free, which the _counted builds
+   of lk_zip.c and lk_unzip.c use as their ALLOC and TRYFREE */
+typedef struct tu_alloc_counts_s
+{
+    unsigned long allocs;
+    unsigned long frees;
+    unsigned long long bytes;   /* allocated in all */
+} tu_alloc_counts;
+
+extern tu_alloc_counts tu_allocs;
+
+void* tu_alloc(size_t size);
+void tu_free(void* p);
+
+#endif /* _LK_TESTUTIL_H */